@@ -0,0 +1,500 @@
+// Throughput of the asset pipeline: mesh conversion and packing, the model file parsers, texture decode and
+// model and texture loading on a headless renderer. Every benchmark is warmed up and then sampled, the
+// median and the median absolute deviation (MAD) of the samples are reported and written to a CSV file.
+// With --baseline the medians are compared with an earlier CSV, the exit code is 1 if one got slower.
+// usage: xjar_asset_bench [--filter TEXT] [--warmup N] [--samples N] [--triangles N] [--obj FILE]
+//                         [--model PREFIX] [--texture FILE]... [--no-gpu] [--out FILE] [--baseline FILE]
+#include "pch.h"
+
+#include "renderer/render_system.h"
+#include "tools/mesh_converter.h"
+#include "texture_manager.h"
+#include "job_system.h"
+#include "window.h"
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+
+using namespace xjar;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr const char *ASSET_DIR = "bench_assets";
+// cheap operations are repeated until a sample takes this long, so the clock resolution does not matter
+static constexpr f64 MIN_SAMPLE_MS = 5.0;
+static constexpr u32 MAX_BATCH = 100000;
+// a median has to move by this many MADs and by REGRESSION_MIN_DELTA to count as a change
+static constexpr f64 REGRESSION_MADS = 3.0;
+static constexpr f64 REGRESSION_MIN_DELTA = 0.03;
+
+struct BenchOptions {
+    const char              *filter = nullptr;
+    u32                      warmup = 3;
+    u32                      samples = 15;
+    u32                      triangles = 200000;
+    const char              *objFilename = nullptr; // generated when not given
+    const char              *modelPrefix = "assets/test";
+    std::vector<std::string> textures;
+    b32                      gpu = true;
+    const char              *outFilename = "asset_bench.csv";
+    const char              *baselineFilename = nullptr;
+};
+
+struct BenchResult {
+    std::string name;
+    f64         medianMs;
+    f64         madMs;
+    f64         minMs;
+    u32         samples;
+    u32         batch;
+    f64         mbPerSec;
+    f64         itemsPerSec;
+    const char *itemName;
+};
+
+static f64 ElapsedMs(Clock::time_point start) {
+    return std::chrono::duration<f64, std::milli>(Clock::now() - start).count();
+}
+
+static f64 Median(std::vector<f64> values) {
+    std::sort(values.begin(), values.end());
+
+    const size_t mid = values.size() / 2;
+    return values.size() % 2 ? values[mid] : 0.5 * (values[mid - 1] + values[mid]);
+}
+
+static u64 FileSize(const std::string &filename) {
+    std::error_code error;
+    const u64       size = std::filesystem::file_size(filename, error);
+    if (error) {
+        fprintf(stderr, "Failed to stat %s\n", filename.c_str());
+        exit(1);
+    }
+
+    return size;
+}
+
+// repeats op until a run takes MIN_SAMPLE_MS, the returned sampler times one batch and gives ms per op
+template <typename F>
+static auto Batched(F op, u32 *batch) {
+    Clock::time_point start = Clock::now();
+    op();
+    const f64 once = ElapsedMs(start);
+
+    *batch = once > 0.0 ? (u32)std::clamp(MIN_SAMPLE_MS / once, 1.0, (f64)MAX_BATCH) : MAX_BATCH;
+
+    return [op, count = *batch]() {
+        Clock::time_point start = Clock::now();
+        for (u32 i = 0; i < count; i++)
+            op();
+
+        return ElapsedMs(start) / count;
+    };
+}
+
+class AssetBench {
+public:
+    explicit AssetBench(const BenchOptions &options):
+        m_options(options) {
+    }
+
+    bool Enabled(const std::string &name) const {
+        return !m_options.filter || name.find(m_options.filter) != std::string::npos;
+    }
+
+    // sample() runs the operation once and returns its time in ms, bytes and items are per operation
+    template <typename F>
+    void Run(const std::string &name, f64 bytes, f64 items, const char *itemName, u32 batch, F &&sample) {
+        for (u32 i = 0; i < m_options.warmup; i++)
+            sample();
+
+        std::vector<f64> times(m_options.samples);
+        for (f64 &time : times)
+            time = sample();
+
+        const f64 median = Median(times);
+
+        std::vector<f64> deviations(times.size());
+        for (size_t i = 0; i < times.size(); i++)
+            deviations[i] = std::abs(times[i] - median);
+
+        BenchResult result {
+            .name = name,
+            .medianMs = median,
+            .madMs = Median(deviations),
+            .minMs = *std::min_element(times.begin(), times.end()),
+            .samples = m_options.samples,
+            .batch = batch,
+            .mbPerSec = median > 0.0 ? bytes / (1024.0 * 1024.0) / (median * 1e-3) : 0.0,
+            .itemsPerSec = median > 0.0 ? items / (median * 1e-3) : 0.0,
+            .itemName = itemName};
+
+        printf("%-36s %12.4f %10.4f %12.4f %7u %10.1f %14.0f %s/s\n",
+               result.name.c_str(), result.medianMs, result.madMs, result.minMs, result.batch,
+               result.mbPerSec, result.itemsPerSec, result.itemName);
+
+        m_results.push_back(result);
+    }
+
+    void WriteCsv(const char *filename) const {
+        FILE *file = fopen(filename, "w");
+        if (!file) {
+            fprintf(stderr, "Failed to open %s\n", filename);
+            exit(1);
+        }
+
+        fprintf(file, "name,median_ms,mad_ms,min_ms,samples,batch,mb_per_s,items_per_s,item\n");
+        for (const BenchResult &result : m_results) {
+            fprintf(file, "%s,%.6f,%.6f,%.6f,%u,%u,%.3f,%.3f,%s\n",
+                    result.name.c_str(), result.medianMs, result.madMs, result.minMs,
+                    result.samples, result.batch, result.mbPerSec, result.itemsPerSec, result.itemName);
+        }
+
+        fclose(file);
+        printf("Wrote %s\n", filename);
+    }
+
+    // returns the number of benchmarks that got slower than the baseline
+    u32 CompareBaseline(const char *filename) const {
+        FILE *file = fopen(filename, "r");
+        if (!file) {
+            fprintf(stderr, "Failed to open baseline %s\n", filename);
+            exit(1);
+        }
+
+        struct Baseline {
+            std::string name;
+            f64         medianMs;
+            f64         madMs;
+        };
+
+        std::vector<Baseline> baselines;
+
+        char line[512];
+        while (fgets(line, sizeof(line), file)) {
+            char name[256];
+            f64  medianMs = 0.0;
+            f64  madMs = 0.0;
+            if (sscanf(line, "%255[^,],%lf,%lf", name, &medianMs, &madMs) == 3)
+                baselines.push_back({name, medianMs, madMs});
+        }
+        fclose(file);
+
+        printf("\nagainst %s\n", filename);
+        printf("%-36s %12s %12s %9s\n", "benchmark", "base ms", "now ms", "change");
+
+        u32 regressions = 0;
+        for (const BenchResult &result : m_results) {
+            auto baseline = std::find_if(baselines.begin(), baselines.end(), [&](const Baseline &b) { return b.name == result.name; });
+            if (baseline == baselines.end() || baseline->medianMs <= 0.0) {
+                printf("%-36s %12s %12.4f %9s\n", result.name.c_str(), "-", result.medianMs, "new");
+                continue;
+            }
+
+            const f64 diff = result.medianMs - baseline->medianMs;
+            const f64 delta = diff / baseline->medianMs;
+            const f64 noise = REGRESSION_MADS * std::max(result.madMs, baseline->madMs);
+
+            const char *verdict = "";
+            if (std::abs(diff) > noise && std::abs(delta) > REGRESSION_MIN_DELTA) {
+                verdict = diff > 0.0 ? "slower" : "faster";
+                regressions += diff > 0.0;
+            }
+
+            printf("%-36s %12.4f %12.4f %+8.1f%% %s\n", result.name.c_str(), baseline->medianMs, result.medianMs, delta * 100.0, verdict);
+        }
+
+        return regressions;
+    }
+
+private:
+    const BenchOptions      &m_options;
+    std::vector<BenchResult> m_results;
+};
+
+// a bumpy UV sphere of about `triangles` triangles as Wavefront OBJ, what the converter reads most often
+static void WriteObj(const std::string &filename, u32 triangles) {
+    const u32 n = std::max(3u, (u32)std::sqrt(triangles / 2.0));
+
+    FILE *file = fopen(filename.c_str(), "w");
+    if (!file) {
+        fprintf(stderr, "Failed to write %s\n", filename.c_str());
+        exit(1);
+    }
+
+    for (u32 ring = 0; ring <= n; ring++) {
+        const f32 theta = glm::pi<f32>() * ring / n;
+        for (u32 segment = 0; segment <= n; segment++) {
+            const f32       phi = glm::two_pi<f32>() * segment / n;
+            const glm::vec3 normal(glm::sin(theta) * glm::cos(phi), glm::cos(theta), glm::sin(theta) * glm::sin(phi));
+            const glm::vec3 pos = normal * (1.0f + 0.1f * glm::sin(5.0f * phi) * glm::sin(5.0f * theta));
+
+            fprintf(file, "v %f %f %f\nvn %f %f %f\nvt %f %f\n",
+                    pos.x, pos.y, pos.z, normal.x, normal.y, normal.z, (f32)segment / n, (f32)ring / n);
+        }
+    }
+
+    // OBJ indices start at 1
+    for (u32 ring = 0; ring < n; ring++) {
+        for (u32 segment = 0; segment < n; segment++) {
+            const u32 a = ring * (n + 1) + segment + 1;
+            const u32 b = a + n + 1;
+
+            fprintf(file, "f %u/%u/%u %u/%u/%u %u/%u/%u\n", a, a, a, b, b, b, a + 1, a + 1, a + 1);
+            fprintf(file, "f %u/%u/%u %u/%u/%u %u/%u/%u\n", a + 1, a + 1, a + 1, b, b, b, b + 1, b + 1, b + 1);
+        }
+    }
+
+    fclose(file);
+}
+
+static void BuildPackInput(u32 triangles, std::vector<Vertex> &vertices, std::vector<u32> &indices) {
+    const u32 n = std::max(3u, (u32)std::sqrt(triangles / 2.0));
+
+    for (u32 y = 0; y <= n; y++) {
+        for (u32 x = 0; x <= n; x++)
+            vertices.emplace_back((f32)x, 0.0f, (f32)y, 0.0f, 1.0f, 0.0f, (f32)x / n, (f32)y / n);
+    }
+
+    for (u32 y = 0; y < n; y++) {
+        for (u32 x = 0; x < n; x++) {
+            const u32 a = y * (n + 1) + x;
+            const u32 b = a + n + 1;
+
+            indices.insert(indices.end(), {a, b, a + 1, a + 1, b, b + 1});
+        }
+    }
+}
+
+static std::string BaseName(const std::string &filename) {
+    return std::filesystem::path(filename).filename().string();
+}
+
+static void BenchConverter(AssetBench &bench, const BenchOptions &options) {
+    std::filesystem::create_directories(ASSET_DIR);
+
+    const std::string outMesh = std::string(ASSET_DIR) + "/asset_bench.mesh";
+    const std::string outInstance = std::string(ASSET_DIR) + "/asset_bench.mesh.instance";
+    const std::string outMaterials = std::string(ASSET_DIR) + "/asset_bench.materials";
+
+    if (bench.Enabled("mesh_convert")) {
+        std::string objFilename = options.objFilename ? options.objFilename : "";
+        if (objFilename.empty()) {
+            objFilename = std::string(ASSET_DIR) + "/asset_bench.obj";
+            WriteObj(objFilename, options.triangles);
+        }
+
+        auto convert = [&]() {
+            MeshConvert(objFilename.c_str(), outMesh.c_str(), outInstance.c_str(), outMaterials.c_str(), ASSET_DIR, true, true);
+        };
+
+        // the triangle count comes from the converted meshes, the OBJ may be any file
+        convert();
+        std::vector<Mesh> meshes;
+        {
+            FILE   *file = fopen(outMesh.c_str(), "rb");
+            MeshHdr hdr {};
+            if (!file || fread(&hdr, sizeof(hdr), 1, file) != 1) {
+                fprintf(stderr, "Failed to read %s\n", outMesh.c_str());
+                exit(1);
+            }
+            meshes.resize(hdr.meshNum);
+            fread(meshes.data(), sizeof(Mesh), hdr.meshNum, file);
+            fclose(file);
+        }
+
+        f64 triangles = 0.0;
+        for (const Mesh &mesh : meshes)
+            triangles += mesh.LodIndexCount(0) / 3.0;
+
+        u32  batch;
+        auto sample = Batched(convert, &batch);
+        bench.Run("mesh_convert:" + BaseName(objFilename), (f64)FileSize(objFilename), triangles, "tri", batch, sample);
+    }
+
+    if (bench.Enabled("mesh_pack")) {
+        std::vector<Vertex> vertices;
+        std::vector<u32>    indices;
+        BuildPackInput(options.triangles, vertices, indices);
+
+        auto pack = [&]() {
+            MeshPack(vertices.data(), (int)vertices.size(), indices.data(), (int)indices.size(), (int)indices.size() / 3,
+                     outMesh.c_str(), outInstance.c_str(), outMaterials.c_str(), "");
+        };
+
+        u32       batch;
+        auto      sample = Batched(pack, &batch);
+        const f64 bytes = (f64)(vertices.size() * sizeof(Vertex) + indices.size() * sizeof(u32));
+        bench.Run("mesh_pack", bytes, indices.size() / 3.0, "tri", batch, sample);
+    }
+}
+
+static void BenchParsers(AssetBench &bench, const BenchOptions &options) {
+    const std::string instanceFilename = std::string(options.modelPrefix) + ".mesh.instance";
+    const std::string materialFilename = std::string(options.modelPrefix) + ".materials";
+
+    if (bench.Enabled("load_instance_data")) {
+        std::vector<InstanceData> instances;
+        u32  batch;
+        auto sample = Batched([&]() { RenderSystem::LoadInstanceData(instanceFilename.c_str(), instances); }, &batch);
+        bench.Run("load_instance_data:" + BaseName(instanceFilename), (f64)FileSize(instanceFilename), (f64)instances.size(), "instance", batch, sample);
+    }
+
+    if (bench.Enabled("load_materials")) {
+        std::vector<MaterialDescr> materials;
+        std::vector<std::string>   files;
+        u32  batch;
+        auto sample = Batched([&]() { RenderSystem::LoadMaterials(materialFilename.c_str(), materials, files); }, &batch);
+        bench.Run("load_materials:" + BaseName(materialFilename), (f64)FileSize(materialFilename), (f64)materials.size(), "material", batch, sample);
+    }
+
+    for (const std::string &texture : options.textures) {
+        const std::string name = "texture_decode:" + BaseName(texture);
+        if (!bench.Enabled(name))
+            continue;
+
+        f64  pixels = 0.0;
+        auto decode = [&]() {
+            std::optional<DecodedTexture> decoded = TextureManager::DecodeTexture(texture);
+            if (!decoded.has_value())
+                exit(1);
+
+            pixels = (f64)decoded->width * decoded->height;
+            TextureManager::FreeDecodedTexture(*decoded);
+        };
+
+        u32  batch;
+        auto sample = Batched(decode, &batch);
+        bench.Run(name, (f64)FileSize(texture), pixels, "pixel", batch, sample);
+    }
+}
+
+// needs the Vulkan device, every model load starts from a fresh renderer so nothing is cached between samples
+static void BenchLoaders(AssetBench &bench, const BenchOptions &options) {
+    auto &renderSystem = RenderSystem::Instance();
+    auto &textureManager = TextureManager::Instance();
+
+    for (const std::string &texture : options.textures) {
+        const std::string name = "texture_load:" + BaseName(texture);
+        if (!bench.Enabled(name))
+            continue;
+
+        renderSystem.Startup();
+
+        f64  pixels = 0.0;
+        auto load = [&]() {
+            Clock::time_point      start = Clock::now();
+            std::optional<Texture> loaded = TextureManager::LoadTexture(texture);
+            const f64              ms = ElapsedMs(start);
+            if (!loaded.has_value())
+                exit(1);
+
+            pixels = (f64)loaded->width * loaded->height;
+            renderSystem.DestroyTexture(&*loaded);
+
+            return ms;
+        };
+
+        load();
+        bench.Run(name, (f64)FileSize(texture), pixels, "pixel", 1, load);
+
+        renderSystem.Shutdown();
+    }
+
+    const std::string meshFilename = std::string(options.modelPrefix) + ".mesh";
+    const std::string instanceFilename = std::string(options.modelPrefix) + ".mesh.instance";
+    const std::string materialFilename = std::string(options.modelPrefix) + ".materials";
+
+    const std::string name = "load_model:" + BaseName(options.modelPrefix);
+    if (bench.Enabled(name)) {
+        f64  triangles = 0.0;
+        auto load = [&]() {
+            renderSystem.Startup();
+
+            Model             model {};
+            Clock::time_point start = Clock::now();
+            renderSystem.LoadModel(meshFilename.c_str(), instanceFilename.c_str(), materialFilename.c_str(), model);
+            const f64 ms = ElapsedMs(start);
+
+            triangles = 0.0;
+            for (const Mesh &mesh : model.mesh.meshes)
+                triangles += mesh.LodIndexCount(0) / 3.0;
+
+            textureManager.Shutdown();
+            renderSystem.Shutdown();
+
+            return ms;
+        };
+
+        load();
+        bench.Run(name, (f64)FileSize(meshFilename), triangles, "tri", 1, load);
+    }
+}
+
+static void ParseOptions(int argc, char **argv, BenchOptions &options) {
+    for (int i = 1; i < argc; i++) {
+        const bool hasValue = i + 1 < argc;
+
+        if (strcmp(argv[i], "--filter") == 0 && hasValue) {
+            options.filter = argv[++i];
+        } else if (strcmp(argv[i], "--warmup") == 0 && hasValue) {
+            options.warmup = (u32)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--samples") == 0 && hasValue) {
+            options.samples = (u32)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--triangles") == 0 && hasValue) {
+            options.triangles = (u32)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--obj") == 0 && hasValue) {
+            options.objFilename = argv[++i];
+        } else if (strcmp(argv[i], "--model") == 0 && hasValue) {
+            options.modelPrefix = argv[++i];
+        } else if (strcmp(argv[i], "--texture") == 0 && hasValue) {
+            options.textures.push_back(argv[++i]);
+        } else if (strcmp(argv[i], "--no-gpu") == 0) {
+            options.gpu = false;
+        } else if (strcmp(argv[i], "--out") == 0 && hasValue) {
+            options.outFilename = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && hasValue) {
+            options.baselineFilename = argv[++i];
+        } else {
+            fprintf(stderr, "Unknown argument %s, see the top of bench/asset_bench.cpp\n", argv[i]);
+            exit(1);
+        }
+    }
+
+    if (options.samples == 0) {
+        fprintf(stderr, "--samples has to be at least 1\n");
+        exit(1);
+    }
+
+    if (options.textures.empty())
+        options.textures = {"assets/statue.jpg", "assets/metal.png"};
+}
+
+int main(int argc, char **argv) {
+    BenchOptions options;
+    ParseOptions(argc, argv, options);
+
+    JobSystem::Instance().StartUp();
+
+    printf("%u warm-up runs, %u samples, times are per operation\n", options.warmup, options.samples);
+    printf("%-36s %12s %10s %12s %7s %10s %14s\n", "benchmark", "median ms", "MAD ms", "min ms", "batch", "MB/s", "items/s");
+
+    AssetBench bench(options);
+    BenchConverter(bench, options);
+    BenchParsers(bench, options);
+
+    if (options.gpu) {
+        InitWindow(256, 256, "xjar_asset_bench");
+        BenchLoaders(bench, options);
+    }
+
+    JobSystem::Instance().Shutdown();
+
+    bench.WriteCsv(options.outFilename);
+
+    if (options.baselineFilename && bench.CompareBaseline(options.baselineFilename) > 0)
+        return 1;
+
+    return 0;
+}
@@ -0,0 +1,119 @@
+// CPU frustum culling throughput over random boxes, with about a quarter of them in view.
+// usage: xjar_cull_bench [object count] [max threads]
+#include "frustum_culling.h"
+#include "job_system.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+using namespace xjar;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr u32 DEFAULT_OBJECT_COUNT = 1 << 20;
+static constexpr int REPEAT_COUNT = 20;
+
+static f64 ElapsedNs(Clock::time_point start) {
+    return std::chrono::duration<f64, std::nano>(Clock::now() - start).count();
+}
+
+// best of REPEAT_COUNT runs, the minimum is the least noisy estimate of the cost
+template <typename F>
+static f64 Measure(F &&f) {
+    f64 best = 1e30;
+    for (int i = 0; i < REPEAT_COUNT; i++) {
+        auto start = Clock::now();
+        f();
+        best = std::min(best, ElapsedNs(start));
+    }
+
+    return best;
+}
+
+static u32 CullReference(const Frustum &frustum, const CullBounds &bounds) {
+    u32 visible = 0;
+    for (u32 i = 0; i < bounds.Count(); i++) {
+        const glm::vec3 center(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]);
+        const glm::vec3 extent(bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]);
+
+        visible += TestFrustumAABB(frustum, AABB {.min = center - extent, .max = center + extent}) != Containment::Outside;
+    }
+
+    return visible;
+}
+
+int main(int argc, char **argv) {
+    const u32 objectCount = argc > 1 ? static_cast<u32>(std::max(1, atoi(argv[1]))) : DEFAULT_OBJECT_COUNT;
+
+    u32 maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    if (argc > 2)
+        maxThreads = static_cast<u32>(std::max(1, atoi(argv[2])));
+
+    // boxes in a 1000 unit cube around a camera with a 90 degree view, which sees roughly a quarter of it
+    std::mt19937                          rng(42);
+    std::uniform_real_distribution<f32> position(-500.0f, 500.0f);
+    std::uniform_real_distribution<f32> size(0.1f, 4.0f);
+
+    CullBounds bounds;
+    bounds.ForEachArray([=](std::vector<f32> &values) { values.reserve(objectCount); });
+    for (u32 i = 0; i < objectCount; i++) {
+        const glm::vec3 center(position(rng), position(rng), position(rng));
+        const glm::vec3 extent(size(rng), size(rng), size(rng));
+        bounds.Push(AABB {.min = center - extent, .max = center + extent});
+    }
+
+    GPU_SceneData sceneData {};
+    sceneData.viewMat = glm::lookAt(glm::vec3(0.0f), glm::vec3(1.0f, 0.2f, 0.3f), glm::vec3(0.0f, 1.0f, 0.0f));
+    sceneData.projMat = glm::perspective(glm::radians(90.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+
+    const Frustum frustum = FrustumFromSceneData(sceneData);
+    const u32     expected = CullReference(frustum, bounds);
+
+    std::vector<u32> visible(objectCount);
+    u32              visibleCount = 0;
+
+    // the checksum keeps the compiler from hoisting the reference out of the timing loop
+    u64 checksum = 0;
+
+    const f64 referenceNs = Measure([&]() { checksum += CullReference(frustum, bounds); });
+    const f64 singleNs = Measure([&]() { visibleCount = CullFrustum(frustum, bounds, 0, objectCount, visible.data()); });
+    if (visibleCount != expected || checksum != static_cast<u64>(expected) * REPEAT_COUNT) {
+        fprintf(stderr, "CullFrustum kept %u objects, the reference kept %u\n", visibleCount, expected);
+        return 1;
+    }
+
+    printf("objects: %u, visible: %u (%.1f%%)\n", objectCount, expected, 100.0 * expected / objectCount);
+    printf("%-20s %8s %12s %14s\n", "variant", "threads", "ms", "objects/ns");
+    printf("%-20s %8u %12.3f %14.3f\n", "scalar reference", 1u, referenceNs * 1e-6, objectCount / referenceNs);
+    printf("%-20s %8u %12.3f %14.3f\n", "simd", 1u, singleNs * 1e-6, objectCount / singleNs);
+
+    std::vector<u32> threadCounts;
+    for (u32 n = 1; n < maxThreads; n *= 2)
+        threadCounts.push_back(n);
+    threadCounts.push_back(maxThreads);
+
+    auto &jobs = JobSystem::Instance();
+    for (u32 threads : threadCounts) {
+        jobs.StartUp(threads);
+
+        const f64 parallelNs = Measure([&]() { CullFrustumParallel(frustum, bounds, visible); });
+
+        jobs.Shutdown();
+
+        if (visible.size() != expected) {
+            fprintf(stderr, "CullFrustumParallel kept %zu objects, the reference kept %u\n", visible.size(), expected);
+            return 1;
+        }
+
+        printf("%-20s %8u %12.3f %14.3f\n", "simd parallel", threads, parallelNs * 1e-6, objectCount / parallelNs);
+    }
+
+    return 0;
+}
@@ -0,0 +1,125 @@
+// Scheduling overhead and scaling of the job system.
+// usage: xjar_job_bench [max threads]
+#include "job_system.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace xjar;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr u32 EMPTY_JOB_COUNT = 200000;
+static constexpr u32 CHAIN_LENGTH = 20000;
+static constexpr u32 WORK_ITEMS = 1 << 22;
+static constexpr u32 WORK_GRAIN = 4096;
+static constexpr int REPEAT_COUNT = 5;
+
+static f64 ElapsedMs(Clock::time_point start) {
+    return std::chrono::duration<f64, std::milli>(Clock::now() - start).count();
+}
+
+// best of REPEAT_COUNT runs, the minimum is the least noisy estimate of the cost
+template <typename F>
+static f64 Measure(F &&f) {
+    f64 best = 1e30;
+    for (int i = 0; i < REPEAT_COUNT; i++) {
+        auto start = Clock::now();
+        f();
+        best = std::min(best, ElapsedMs(start));
+    }
+
+    return best;
+}
+
+// submit and drain jobs that do nothing
+static f64 BenchEmptyJobs(JobSystem &jobs) {
+    return Measure([&]() {
+        JobCounter counter;
+        for (u32 i = 0; i < EMPTY_JOB_COUNT; i++)
+            jobs.Run([]() {}, &counter);
+
+        jobs.Wait(counter);
+    });
+}
+
+// every job waits for the previous one, measures the latency of releasing a dependency
+static f64 BenchChain(JobSystem &jobs) {
+    return Measure([&]() {
+        std::vector<JobCounter> counters(CHAIN_LENGTH);
+
+        jobs.Run([]() {}, &counters[0]);
+        for (u32 i = 1; i < CHAIN_LENGTH; i++)
+            jobs.RunAfter(counters[i - 1], []() {}, &counters[i]);
+
+        // continuations keep a pointer to their counter, so drain the whole chain
+        for (JobCounter &counter : counters)
+            jobs.Wait(counter);
+    });
+}
+
+// compute bound parallel for, the speedup column comes from this one
+static f64 BenchParallelFor(JobSystem &jobs, std::vector<f32> &data, f64 *checksum) {
+    return Measure([&]() {
+        jobs.ParallelFor(WORK_ITEMS, WORK_GRAIN, [&](u32 first, u32 count) {
+            for (u32 i = first; i < first + count; i++) {
+                f32 x = static_cast<f32>(i) * 0.001f;
+                for (int k = 0; k < 16; k++)
+                    x = std::sqrt(x * x + 1.0f) * 0.5f;
+                data[i] = x;
+            }
+        });
+
+        f64 sum = 0.0;
+        for (u32 i = 0; i < WORK_ITEMS; i += 1024)
+            sum += data[i];
+        *checksum = sum;
+    });
+}
+
+int main(int argc, char **argv) {
+    u32 maxThreads = std::max(32u, std::thread::hardware_concurrency());
+    if (argc > 1)
+        maxThreads = static_cast<u32>(std::max(1, atoi(argv[1])));
+
+    std::vector<u32> threadCounts;
+    for (u32 n = 1; n < maxThreads; n *= 2)
+        threadCounts.push_back(n);
+    threadCounts.push_back(maxThreads);
+
+    printf("hardware threads: %u\n", std::thread::hardware_concurrency());
+    printf("%8s %16s %16s %14s %9s\n", "threads", "empty ns/job", "chain ns/link", "parfor ms", "speedup");
+
+    std::vector<f32> data(WORK_ITEMS);
+    f64 baseline = 0.0;
+    f64 checksum = 0.0;
+
+    auto &jobs = JobSystem::Instance();
+    for (u32 threads : threadCounts) {
+        jobs.StartUp(threads);
+
+        const f64 emptyMs = BenchEmptyJobs(jobs);
+        const f64 chainMs = BenchChain(jobs);
+        const f64 parforMs = BenchParallelFor(jobs, data, &checksum);
+
+        jobs.Shutdown();
+
+        if (threads == 1)
+            baseline = parforMs;
+
+        printf("%8u %16.1f %16.1f %14.3f %8.2fx\n",
+               threads,
+               emptyMs * 1e6 / EMPTY_JOB_COUNT,
+               chainMs * 1e6 / CHAIN_LENGTH,
+               parforMs,
+               baseline / parforMs);
+    }
+
+    printf("checksum %f\n", checksum);
+
+    return 0;
+}
@@ -0,0 +1,112 @@
+// cost of building and sorting the draw keys of a pass, the radix sort against std::stable_sort.
+// usage: xjar_queue_bench [draw count] [model count]
+#include "renderer/render_queue.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace xjar;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr u32 DEFAULT_DRAW_COUNT = 100000;
+static constexpr u32 DEFAULT_MODEL_COUNT = 1000;
+static constexpr u32 VARIANT_COUNT = 32; // every combination of the ShaderVariantFlags
+static constexpr int REPEAT_COUNT = 20;
+
+static f64 ElapsedNs(Clock::time_point start) {
+    return std::chrono::duration<f64, std::nano>(Clock::now() - start).count();
+}
+
+// best of REPEAT_COUNT runs, the minimum is the least noisy estimate of the cost
+template <typename F>
+static f64 Measure(F &&f) {
+    f64 best = 1e30;
+    for (int i = 0; i < REPEAT_COUNT; i++) {
+        auto start = Clock::now();
+        f();
+        best = std::min(best, ElapsedNs(start));
+    }
+
+    return best;
+}
+
+struct Draw {
+    u32 variant;
+    u32 material;
+    f32 depth;
+};
+
+int main(int argc, char **argv) {
+    const u32 drawCount = argc > 1 ? static_cast<u32>(std::max(1, atoi(argv[1]))) : DEFAULT_DRAW_COUNT;
+    const u32 modelCount = argc > 2 ? static_cast<u32>(std::max(1, atoi(argv[2]))) : DEFAULT_MODEL_COUNT;
+
+    // each model uses a few variants, the draws are spread over a 1000 unit deep view
+    std::mt19937                        rng(42);
+    std::uniform_int_distribution<u32>  model(0, modelCount - 1);
+    std::uniform_real_distribution<f32> depth(-1.0f, 1000.0f);
+
+    std::vector<Draw> draws(drawCount);
+    for (Draw &draw : draws) {
+        draw.material = model(rng);
+        draw.variant = (draw.material * 7 + rng() % 3) % VARIANT_COUNT;
+        draw.depth = depth(rng);
+    }
+
+    RenderQueue queue;
+    auto        build = [&]() {
+        queue.Clear();
+        for (u32 i = 0; i < drawCount; i++)
+            queue.Push(MakeSortKey(0, draws[i].variant, draws[i].material, draws[i].depth), i);
+    };
+
+    // warms up the buffers of the queue like the frames before would
+    build();
+    queue.Sort();
+
+    const f64 buildNs = Measure(build);
+    const f64 sortNs = Measure([&]() {
+        build();
+        queue.Sort();
+    }) - buildNs;
+
+    std::vector<u32> order;
+    const std::span<const u32> sorted = queue.Sort();
+
+    std::vector<u64> keys(drawCount);
+    for (u32 i = 0; i < drawCount; i++)
+        keys[i] = MakeSortKey(0, draws[i].variant, draws[i].material, draws[i].depth);
+
+    const f64 referenceNs = Measure([&]() {
+        order.resize(drawCount);
+        for (u32 i = 0; i < drawCount; i++)
+            order[i] = i;
+
+        std::stable_sort(order.begin(), order.end(), [&](u32 a, u32 b) { return keys[a] < keys[b]; });
+    });
+
+    if (!std::equal(sorted.begin(), sorted.end(), order.begin(), order.end())) {
+        fprintf(stderr, "RenderQueue::Sort and std::stable_sort disagree\n");
+        return 1;
+    }
+
+    // what the sort saves the recording, compared to the submission order of the list
+    u32 unsortedSwitches = 0, sortedSwitches = 0;
+    for (u32 i = 1; i < drawCount; i++) {
+        unsortedSwitches += draws[i].variant != draws[i - 1].variant;
+        sortedSwitches += draws[sorted[i]].variant != draws[sorted[i - 1]].variant;
+    }
+
+    printf("draws: %u, models: %u, variants: %u\n", drawCount, modelCount, VARIANT_COUNT);
+    printf("%-20s %12s %14s\n", "step", "ms", "draws/us");
+    printf("%-20s %12.3f %14.3f\n", "build keys", buildNs * 1e-6, drawCount / (buildNs * 1e-3));
+    printf("%-20s %12.3f %14.3f\n", "radix sort", sortNs * 1e-6, drawCount / (sortNs * 1e-3));
+    printf("%-20s %12.3f %14.3f\n", "std::stable_sort", referenceNs * 1e-6, drawCount / (referenceNs * 1e-3));
+    printf("pipeline switches: %u unsorted, %u sorted\n", unsortedSwitches, sortedSwitches);
+
+    return 0;
+}
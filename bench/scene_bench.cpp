@@ -0,0 +1,416 @@
+// Scaling of load time, CPU submission cost, memory and GPU time with the size of a generated scene.
+// Every configuration is written to bench_assets/ and drawn headless on a freshly started renderer.
+// usage: xjar_bench [--sweep all|meshes|instances|materials|textures|triangles] [--meshes N] [--instances N]
+//                   [--materials N] [--textures N] [--triangles N] [--max-instances N] [--frames N]
+//                   [--size WxH] [--csv FILE]
+#include "pch.h"
+
+#include "renderer/render_system.h"
+#include "renderer/gpu_profiler.h"
+#include "tools/mesh_converter.h"
+#include "texture_manager.h"
+#include "job_system.h"
+#include "world.h"
+#include "window.h"
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+
+#if defined(_WIN32)
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace xjar;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr const char *ASSET_DIR = "bench_assets";
+static constexpr u32         TEXTURE_SIZE = 256;
+static constexpr u32         WARMUP_FRAMES = 5;
+static constexpr f32         INSTANCE_SPACING = 3.0f;
+
+struct SceneConfig {
+    u32 meshes = 16;
+    u32 instances = 1000;
+    u32 materials = 16; // stored per mesh file, so at most one per unique mesh
+    u32 textures = 16;  // assigned round robin to the materials
+    u32 triangles = 2000;
+};
+
+struct SceneResult {
+    f64 loadMs;
+    f64 recordMs; // DrawEntities and EndFrame, the CPU side of the submission
+    f64 frameMs;  // BeginFrame to EndFrame, includes waiting for a free frame in flight
+    f64 gpuFrameMs;
+    f64 gpuMeshMs;
+    f64 residentMb;
+    f64 deviceMb;
+};
+
+struct BenchOptions {
+    SceneConfig base;
+    const char *sweep = "all";
+    u32         maxInstances = 1000000;
+    u32         frames = 60;
+    u32         width = 1280;
+    u32         height = 720;
+    const char *csvFilename = "bench_scene.csv";
+};
+
+static f64 ElapsedMs(Clock::time_point start) {
+    return std::chrono::duration<f64, std::milli>(Clock::now() - start).count();
+}
+
+static f64 ResidentMb() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters {};
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.WorkingSetSize / (1024.0 * 1024.0);
+#else
+    long  pages = 0;
+    long  resident = 0;
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (file) {
+        if (fscanf(file, "%ld %ld", &pages, &resident) != 2)
+            resident = 0;
+        fclose(file);
+    }
+    return (f64)resident * sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+#endif
+}
+
+static std::string AssetPath(const char *name, u32 index, const char *extension) {
+    return std::string(ASSET_DIR) + "/" + name + "_" + std::to_string(index) + extension;
+}
+
+// checker with a colour per texture, binary PPM is read by stb_image
+static void WriteTexture(const std::string &filename, u32 index) {
+    const u8 r = (u8)(64 + (index * 97) % 192);
+    const u8 g = (u8)(64 + (index * 57) % 192);
+    const u8 b = (u8)(64 + (index * 31) % 192);
+
+    std::vector<u8> pixels(TEXTURE_SIZE * TEXTURE_SIZE * 3);
+    for (u32 y = 0; y < TEXTURE_SIZE; y++) {
+        for (u32 x = 0; x < TEXTURE_SIZE; x++) {
+            const bool dark = ((x / 32) + (y / 32)) % 2 != 0;
+            u8        *pixel = &pixels[(y * TEXTURE_SIZE + x) * 3];
+            pixel[0] = dark ? r / 2 : r;
+            pixel[1] = dark ? g / 2 : g;
+            pixel[2] = dark ? b / 2 : b;
+        }
+    }
+
+    FILE *file = fopen(filename.c_str(), "wb");
+    if (!file) {
+        fprintf(stderr, "Failed to write %s\n", filename.c_str());
+        exit(1);
+    }
+
+    fprintf(file, "P6\n%u %u\n255\n", TEXTURE_SIZE, TEXTURE_SIZE);
+    fwrite(pixels.data(), 1, pixels.size(), file);
+    fclose(file);
+}
+
+// UV sphere of about `triangles` triangles, the radius is modulated per mesh so no two meshes are alike
+static void BuildMesh(u32 index, u32 triangles, std::vector<Vertex> &vertices, std::vector<u32> &indices) {
+    const u32 n = std::max(3u, (u32)std::sqrt(triangles / 2.0));
+    const f32 lobes = 2.0f + index % 7;
+    const f32 bump = 0.1f + 0.05f * (index % 5);
+
+    vertices.clear();
+    indices.clear();
+
+    for (u32 ring = 0; ring <= n; ring++) {
+        const f32 theta = glm::pi<f32>() * ring / n;
+        for (u32 segment = 0; segment <= n; segment++) {
+            const f32       phi = glm::two_pi<f32>() * segment / n;
+            const glm::vec3 normal(glm::sin(theta) * glm::cos(phi), glm::cos(theta), glm::sin(theta) * glm::sin(phi));
+            const f32       radius = 1.0f + bump * glm::sin(lobes * phi) * glm::sin(lobes * theta);
+            const glm::vec3 pos = normal * radius;
+
+            vertices.emplace_back(pos.x, pos.y, pos.z, normal.x, normal.y, normal.z, (f32)segment / n, (f32)ring / n);
+        }
+    }
+
+    for (u32 ring = 0; ring < n; ring++) {
+        for (u32 segment = 0; segment < n; segment++) {
+            const u32 a = ring * (n + 1) + segment;
+            const u32 b = a + n + 1;
+
+            indices.insert(indices.end(), {a, b, a + 1, a + 1, b, b + 1});
+        }
+    }
+}
+
+// MeshPack writes a white material with a diffuse map, the bench replaces it with its own
+static void WriteMaterial(const std::string &filename, u32 materialIndex, const SceneConfig &config) {
+    MaterialDescr material {};
+    material.albedoColor = gpuvec4(0.5f + 0.5f * ((materialIndex * 37) % 11) / 10.0f,
+                                   0.5f + 0.5f * ((materialIndex * 53) % 11) / 10.0f,
+                                   0.5f + 0.5f * ((materialIndex * 71) % 11) / 10.0f,
+                                   1.0f);
+    material.diffuseMap = 0;
+
+    const std::vector<std::string> textureFiles = {AssetPath("texture", materialIndex % config.textures, ".ppm")};
+
+    FILE *file = fopen(filename.c_str(), "wb");
+    if (!file) {
+        fprintf(stderr, "Failed to write %s\n", filename.c_str());
+        exit(1);
+    }
+
+    u32 materialCount = 1;
+    fwrite(&materialCount, sizeof(u32), 1, file);
+    fwrite(&material, sizeof(MaterialDescr), 1, file);
+    SaveStringList(file, textureFiles);
+    fclose(file);
+}
+
+static void GenerateScene(const SceneConfig &config) {
+    std::filesystem::create_directories(ASSET_DIR);
+
+    for (u32 i = 0; i < config.textures; i++)
+        WriteTexture(AssetPath("texture", i, ".ppm"), i);
+
+    std::vector<Vertex> vertices;
+    std::vector<u32>    indices;
+    for (u32 i = 0; i < config.meshes; i++) {
+        BuildMesh(i, config.triangles, vertices, indices);
+
+        const std::string materialFile = AssetPath("mesh", i, ".materials");
+        MeshPack(vertices.data(), (int)vertices.size(),
+                 indices.data(), (int)indices.size(),
+                 (int)indices.size() / 3,
+                 AssetPath("mesh", i, ".mesh").c_str(),
+                 AssetPath("mesh", i, ".mesh.instance").c_str(),
+                 materialFile.c_str(),
+                 "");
+
+        WriteMaterial(materialFile, i % config.materials, config);
+    }
+}
+
+static SceneResult RunScene(const SceneConfig &config, const BenchOptions &options) {
+    GenerateScene(config);
+
+    auto &renderSystem = RenderSystem::Instance();
+    renderSystem.Startup();
+
+    std::vector<std::string> filenames;
+    std::vector<ModelFiles>  files(config.meshes);
+    for (u32 i = 0; i < config.meshes; i++) {
+        filenames.push_back(AssetPath("mesh", i, ".mesh"));
+        filenames.push_back(AssetPath("mesh", i, ".mesh.instance"));
+        filenames.push_back(AssetPath("mesh", i, ".materials"));
+    }
+    for (u32 i = 0; i < config.meshes; i++)
+        files[i] = {filenames[i * 3].c_str(), filenames[i * 3 + 1].c_str(), filenames[i * 3 + 2].c_str()};
+
+    std::vector<Model>   models(config.meshes);
+    std::vector<Model *> modelPtrs;
+    for (Model &model : models)
+        modelPtrs.push_back(&model);
+
+    SceneResult result {};
+
+    Clock::time_point loadStart = Clock::now();
+    renderSystem.LoadModels(files, modelPtrs);
+    result.loadMs = ElapsedMs(loadStart);
+
+    const u32 side = std::max(1u, (u32)std::ceil(std::sqrt((f64)config.instances)));
+
+    auto &world = World::Instance();
+    world.Reserve(config.instances);
+    for (u32 i = 0; i < config.instances; i++) {
+        const EntityHandle entity = world.CreateEntity();
+        world.SetModel(entity, &models[i % config.meshes]);
+        world.SetLocalTransform(entity, glm::translate(glm::mat4(1.0f), glm::vec3((i % side) * INSTANCE_SPACING, 0.0f, (i / side) * INSTANCE_SPACING)));
+    }
+    world.UpdateTransforms();
+
+    const f32       extent = side * INSTANCE_SPACING;
+    const glm::vec3 center(extent * 0.5f, 0.0f, extent * 0.5f);
+    const glm::vec3 eye = center + glm::vec3(0.0f, extent * 0.6f + 5.0f, -(extent * 0.6f + 5.0f));
+
+    f64 recordMs = 0.0;
+    f64 frameMs = 0.0;
+    u32 measured = 0;
+
+    for (u32 i = 0; i < WARMUP_FRAMES + options.frames; i++) {
+        Clock::time_point frameStart = Clock::now();
+
+        GPU_SceneData sceneData {};
+        sceneData.viewMat = glm::lookAt(eye, center, glm::vec3(0.0f, 1.0f, 0.0f));
+        sceneData.projMat = glm::perspective(glm::radians(45.0f), (f32)options.width / (f32)options.height, 0.1f, extent * 4.0f + 100.0f);
+        sceneData.viewPos = eye;
+        sceneData.lightPos = center + glm::vec3(-2.0f, 40.0f, 1.0f);
+
+        auto frame = renderSystem.BeginFrame();
+        if (!frame.success)
+            continue;
+
+        renderSystem.ClearColor(frame, 0.05f, 0.05f, 0.05f, 1.0f);
+
+        Clock::time_point recordStart = Clock::now();
+        renderSystem.DrawEntities(frame, &sceneData, world.GetRenderList());
+        // the vulkan passes are only added by the draw calls and recorded when the frame ends
+        renderSystem.EndFrame();
+        const f64 frameRecordMs = ElapsedMs(recordStart);
+
+        if (i >= WARMUP_FRAMES) {
+            recordMs += frameRecordMs;
+            frameMs += ElapsedMs(frameStart);
+            measured++;
+        }
+    }
+
+    result.recordMs = measured > 0 ? recordMs / measured : 0.0;
+    result.frameMs = measured > 0 ? frameMs / measured : 0.0;
+
+    if (const GpuProfileHistory *gpuProfile = renderSystem.GetGpuProfile()) {
+        result.gpuFrameMs = gpuProfile->GetFrameStats().avgMs;
+        result.gpuMeshMs = gpuProfile->GetStats(GPU_PASS_MESH).avgMs;
+    }
+
+    result.residentMb = ResidentMb();
+    result.deviceMb = renderSystem.GetDeviceMemoryUsage() / (1024.0 * 1024.0);
+
+    world.Clear();
+    TextureManager::Instance().Shutdown();
+    renderSystem.Shutdown();
+
+    return result;
+}
+
+static void ParseOptions(int argc, char **argv, BenchOptions &options) {
+    for (int i = 1; i < argc; i++) {
+        const bool hasValue = i + 1 < argc;
+
+        if (strcmp(argv[i], "--sweep") == 0 && hasValue) {
+            options.sweep = argv[++i];
+        } else if (strcmp(argv[i], "--meshes") == 0 && hasValue) {
+            options.base.meshes = (u32)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--instances") == 0 && hasValue) {
+            options.base.instances = (u32)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--materials") == 0 && hasValue) {
+            options.base.materials = (u32)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--textures") == 0 && hasValue) {
+            options.base.textures = (u32)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--triangles") == 0 && hasValue) {
+            options.base.triangles = (u32)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-instances") == 0 && hasValue) {
+            options.maxInstances = (u32)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--frames") == 0 && hasValue) {
+            options.frames = (u32)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--size") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%ux%u", &options.width, &options.height) != 2) {
+                fprintf(stderr, "--size expects WIDTHxHEIGHT\n");
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--csv") == 0 && hasValue) {
+            options.csvFilename = argv[++i];
+        } else {
+            fprintf(stderr, "Unknown argument %s, see the top of bench/scene_bench.cpp\n", argv[i]);
+            exit(1);
+        }
+    }
+
+    if (options.base.meshes == 0 || options.base.instances == 0 || options.base.materials == 0 ||
+        options.base.textures == 0 || options.frames == 0) {
+        fprintf(stderr, "Meshes, instances, materials, textures and frames have to be at least 1\n");
+        exit(1);
+    }
+}
+
+struct SweepPoint {
+    const char *axis;
+    SceneConfig config;
+};
+
+static std::vector<SweepPoint> BuildSweep(const BenchOptions &options) {
+    std::vector<SweepPoint> points;
+    const bool              all = strcmp(options.sweep, "all") == 0;
+
+    auto add = [&](const char *axis, const std::vector<u32> &values, u32 SceneConfig::*field) {
+        if (!all && strcmp(options.sweep, axis) != 0)
+            return;
+
+        for (u32 value : values) {
+            SceneConfig config = options.base;
+            config.*field = value;
+
+            // a material lives in a mesh file, so the material sweep adds meshes and the others drop materials
+            if (field == &SceneConfig::materials) {
+                config.meshes = std::max(config.meshes, config.materials);
+            } else {
+                config.materials = std::min(config.materials, config.meshes);
+            }
+
+            points.push_back({axis, config});
+        }
+    };
+
+    std::vector<u32> instanceCounts;
+    for (u64 count = 1; count <= options.maxInstances; count *= 10)
+        instanceCounts.push_back((u32)count);
+
+    add("instances", instanceCounts, &SceneConfig::instances);
+    // every unique mesh is one draw in the indirect buffers, which hold 2048
+    add("meshes", {1, 4, 16, 64, 256, 1024}, &SceneConfig::meshes);
+    add("materials", {1, 2, 4, 8, 16, 64}, &SceneConfig::materials);
+    add("textures", {1, 4, 16, 64, 256}, &SceneConfig::textures);
+    add("triangles", {128, 1000, 10000, 100000}, &SceneConfig::triangles);
+
+    if (points.empty()) {
+        fprintf(stderr, "Unknown sweep %s\n", options.sweep);
+        exit(1);
+    }
+
+    return points;
+}
+
+int main(int argc, char **argv) {
+    BenchOptions options;
+    ParseOptions(argc, argv, options);
+
+    const std::vector<SweepPoint> points = BuildSweep(options);
+
+    InitWindow(options.width, options.height, "xjar_bench");
+    JobSystem::Instance().StartUp();
+
+    FILE *csv = fopen(options.csvFilename, "w");
+    if (!csv) {
+        fprintf(stderr, "Failed to open %s\n", options.csvFilename);
+        return 1;
+    }
+
+    fprintf(csv, "axis,meshes,instances,materials,textures,triangles,load_ms,record_ms,frame_ms,gpu_frame_ms,gpu_mesh_ms,resident_mb,device_mb\n");
+
+    printf("%ux%u, %u frames per configuration\n", options.width, options.height, options.frames);
+    printf("%-10s %7s %9s %6s %6s %8s %10s %10s %10s %10s %10s %9s %9s\n",
+           "axis", "meshes", "instances", "mats", "texs", "tris", "load ms", "record ms", "frame ms", "gpu ms", "gpu mesh", "rss MB", "dev MB");
+
+    for (const SweepPoint &point : points) {
+        const SceneConfig &config = point.config;
+        const SceneResult  result = RunScene(config, options);
+
+        printf("%-10s %7u %9u %6u %6u %8u %10.2f %10.3f %10.3f %10.3f %10.3f %9.1f %9.1f\n",
+               point.axis, config.meshes, config.instances, config.materials, config.textures, config.triangles,
+               result.loadMs, result.recordMs, result.frameMs, result.gpuFrameMs, result.gpuMeshMs, result.residentMb, result.deviceMb);
+
+        fprintf(csv, "%s,%u,%u,%u,%u,%u,%.3f,%.4f,%.4f,%.4f,%.4f,%.2f,%.2f\n",
+                point.axis, config.meshes, config.instances, config.materials, config.textures, config.triangles,
+                result.loadMs, result.recordMs, result.frameMs, result.gpuFrameMs, result.gpuMeshMs, result.residentMb, result.deviceMb);
+        fflush(csv);
+    }
+
+    fclose(csv);
+    JobSystem::Instance().Shutdown();
+
+    printf("Wrote %s\n", options.csvFilename);
+
+    return 0;
+}
@@ -12,19 +12,38 @@ struct MaterialData {
     uint64_t padding;
 };
 
+struct PointLight {
+    vec3  position;
+    float radius;
+    vec3  color;
+    float intensity;
+};
+
+const uint MAX_LIGHTS_PER_CLUSTER = 64; // see vulkan_clustered_lighting.h
+
 layout(location = 0) in vec3 inUVW;
 layout(location = 1) in flat uint inMatIndex;
 layout(location = 2) in vec3 inNormal;
 layout(location = 3) in vec3 inFragPos;
-layout(location = 4) in vec4 inFragLightSpacePos;
 
 layout(location = 0) out vec4 FragColor;
 
+// set per pipeline variant, see ShaderVariantFlags, the disabled paths are compiled out
+layout(constant_id = 0) const bool SHADOWS = true;
+layout(constant_id = 1) const bool BLINN_PHONG = true;
+layout(constant_id = 2) const bool DIFFUSE_MAP = true;
+layout(constant_id = 3) const bool SPECULAR_MAP = true;
+
 layout(binding = 0) uniform UniformBuffer {
     mat4 view;
     mat4 projection;
-    mat4 lightSpaceMat;
+    mat4 viewProj;
+    mat4 cascadeMats[4]; // MAX_SHADOW_CASCADES, world to shadow map uv and depth
+    vec4 cascadeSplits;  // view depth where each cascade ends
     vec3 viewPos;
+    vec3 lightPos;       // the shadowed light
+    uvec4 clusterCount;  // clusters along x, y and depth, w is the light count
+    vec4 clusterScale;   // clusters per pixel along x and y, log depth scale and bias of the slices
 } ubo;
 
 layout(binding = 4) readonly buffer MatBO {
@@ -32,23 +51,79 @@ layout(binding = 4) readonly buffer MatBO {
 } mat_bo;
 
 layout(binding = 5) uniform sampler2D textures[];
-layout(binding = 6) uniform sampler2D shadowMap;
+layout(binding = 6) uniform sampler2DArray shadowMap; // a layer per cascade
+
+layout(binding = 7) readonly buffer LightBO {
+    PointLight data[];
+} lights;
+
+// per cluster the light count followed by MAX_LIGHTS_PER_CLUSTER light indices, see cluster_lights.comp
+layout(binding = 8) readonly buffer ClusterGrid {
+    uint data[];
+} grid;
+
+float CalculateShadows(vec3 fragPos, vec3 normal, vec3 lightDir, float viewDepth) {
+    // the first cascade that reaches the fragment, the unused splits repeat the last one
+    int   cascade = int(dot(vec4(greaterThan(vec4(viewDepth), ubo.cascadeSplits)), vec4(1.0)));
+    if (cascade >= 4) {
+        return 0.0;
+    }
 
-float CalculateShadows(vec4 fragLightSpacePos) {
-    // for ortho is meaningless, but for perspective is required, leave it to ensure it works for both projections
-    vec3 projectedCoords = fragLightSpacePos.xyz / fragLightSpacePos.w;
-    projectedCoords = projectedCoords * 0.5 + 0.5;
-    float closestDepth = texture(shadowMap, projectedCoords.xy).r;
-    float depth = projectedCoords.z;
-    float shadow = depth > closestDepth ? 1.0 : 0.0;
+    vec4 projectedCoords = ubo.cascadeMats[cascade] * vec4(fragPos, 1.0);
+    projectedCoords.xyz /= projectedCoords.w;
+    float closestDepth = texture(shadowMap, vec3(projectedCoords.xy, cascade)).r;
+    // slope scaled, surfaces at a grazing angle to the light span more depth per texel
+    float bias = max(0.002 * (1.0 - dot(normal, lightDir)), 0.0005);
+    float shadow = projectedCoords.z - bias > closestDepth ? 1.0 : 0.0;
 
     return shadow;
 }
 
-void main() {
-    //TODO: move it to uniform
-    const vec3 lightPos = vec3(-2.0f, 4.0f, 1.0f);
+float SpecularIntensity(vec3 norm, vec3 lightDir, vec3 viewDir) {
+    if (BLINN_PHONG) {
+        vec3 halfwayDir = normalize(viewDir + lightDir);
+        return pow(max(dot(norm, halfwayDir), 0.0), 16.0);
+    }
+
+    vec3 reflectDir = reflect(-lightDir, norm);
+    return pow(max(dot(viewDir, reflectDir), 0.0), 8.0);
+}
+
+uint ClusterIndex(float viewDepth) {
+    uvec3 count = ubo.clusterCount.xyz;
+    uvec2 tile = min(uvec2(gl_FragCoord.xy * ubo.clusterScale.xy), count.xy - 1);
+    uint  slice = uint(clamp(log(viewDepth) * ubo.clusterScale.z + ubo.clusterScale.w, 0.0, float(count.z - 1)));
+
+    return (slice * count.y + tile.y) * count.x + tile.x;
+}
+
+// the unshadowed point lights of the fragment's cluster
+vec3 ClusterLighting(vec3 norm, vec3 viewDir, float viewDepth, vec3 diffuseColor, vec3 specularColor) {
+    uint first = ClusterIndex(viewDepth) * (MAX_LIGHTS_PER_CLUSTER + 1);
+    uint count = grid.data[first];
 
+    vec3 lighting = vec3(0.0);
+    for (uint i = 0; i < count; i++) {
+        PointLight light = lights.data[grid.data[first + 1 + i]];
+
+        vec3  toLight = light.position - inFragPos;
+        float distance = length(toLight);
+        vec3  lightDir = toLight / max(distance, 0.0001);
+
+        // inverse square, windowed to reach 0 at the radius the light was binned with
+        float window = clamp(1.0 - pow(distance / light.radius, 4.0), 0.0, 1.0);
+        float attenuation = window * window / (1.0 + distance * distance);
+
+        vec3 diffuse = max(dot(lightDir, norm), 0.0) * diffuseColor;
+        vec3 specular = SpecularIntensity(norm, lightDir, viewDir) * specularColor;
+
+        lighting += light.color * light.intensity * attenuation * (diffuse + specular);
+    }
+
+    return lighting;
+}
+
+void main() {
     const vec3 ambientColor = vec3(0.05f);
     const vec3 specularColor = vec3(0.3f);
 
@@ -56,14 +131,12 @@ void main() {
     vec4         diffuseMap = matData.albedoColor;
     vec4         specularMap = matData.albedoColor;
 
-    const int INVALID_HANDLE = 2000;
-
-    if (matData.diffuseMap < INVALID_HANDLE) {
+    if (DIFFUSE_MAP) {
         uint texIndex = uint(matData.diffuseMap);
         diffuseMap = texture(textures[nonuniformEXT(texIndex)], inUVW.xy);
     }
 
-    if (matData.specularMap < INVALID_HANDLE) {
+    if (SPECULAR_MAP) {
         uint texIndex = uint(matData.specularMap);
         specularMap = texture(textures[nonuniformEXT(texIndex)], inUVW.xy);
     }
@@ -73,26 +146,22 @@ void main() {
 
     // diffuse
     vec3  norm = normalize(inNormal);
-    vec3  lightDir = normalize(lightPos - inFragPos);
+    vec3  lightDir = normalize(ubo.lightPos - inFragPos);
     float diffuseStrength = max(dot(lightDir, norm), 0.0f);
     vec3  diffuse = diffuseStrength * diffuseMap.rgb;
 
     // specular
-    const bool blin = true;
-    vec3       viewDir = normalize(ubo.viewPos - inFragPos);
-    float      specularIntensity = 0.0f;
-    if (blin) {
-        vec3 halfwayDir = normalize(viewDir + lightDir);
-        specularIntensity = pow(max(dot(inNormal, halfwayDir), 0.0), 16.0);
-    } else {
-        vec3 reflectDir = reflect(-lightDir, norm);
-        specularIntensity = pow(max(dot(viewDir, reflectDir), 0.0), 8.0);
-    }
+    vec3  viewDir = normalize(ubo.viewPos - inFragPos);
+    float specularIntensity = SpecularIntensity(norm, lightDir, viewDir);
 
-    float shadow = CalculateShadows(inFragLightSpacePos);
+    float viewDepth = -(ubo.view * vec4(inFragPos, 1.0)).z;
+    float shadow = SHADOWS ? CalculateShadows(inFragPos, norm, lightDir, viewDepth) : 0.0;
     vec3  specular = specularColor * specularIntensity * specularMap.rgb;
 
     vec3 finalLighting = (ambient + (1.0 - shadow) * (diffuse + specular));
+    if (ubo.clusterCount.w > 0) {
+        finalLighting += ClusterLighting(norm, viewDir, viewDepth, diffuseMap.rgb, specularColor * specularMap.rgb);
+    }
 
     FragColor = vec4(finalLighting, 1.0);
 }
@@ -6,7 +6,8 @@ layout(location = 0) out vec3 outUVW;
 layout(location = 1) out flat uint outMatIndex;
 layout(location = 2) out vec3 outNormal;
 layout(location = 3) out vec3 outFragPos;
-layout(location = 4) out vec4 outFragLightSpacePos;
+
+invariant gl_Position;
 
 struct ImDrawVert {
     float x, y, z;
@@ -21,45 +22,73 @@ struct InstanceData {
     uint indexOffset;
     uint vertexOffset;
     uint transformIndex;
+    uint indexFormat;
+    uint padding;
 };
 
+const uint INDEX_FORMAT_U16 = 1;
+
 layout(push_constant) uniform PushConstantData {
     mat4 model;
+    mat4 normal; // computed on the CPU once per changed transform
 } push;
 
 layout(binding = 0) uniform UniformBuffer {
     mat4 view;
     mat4 projection;
-    mat4 lightSpaceMat;
+    mat4 viewProj;
+    mat4 cascadeMats[4];
+    vec4 cascadeSplits;
     vec3 viewPos;
+    vec3 lightPos;
+    uvec4 clusterCount;
+    vec4 clusterScale;
 } ubo;
 
 layout(binding = 1) readonly buffer SBO {
     ImDrawVert data[];
 } sbo;
 
+#ifndef INDEXED_DRAW
 layout(binding = 2) readonly buffer IBO {
     uint data[];
 } ibo;
+#endif
 
 layout(binding = 3) readonly buffer InstanceBO {
     InstanceData data[];
 } instanceDataBuffer;
 
+#ifndef INDEXED_DRAW
+// indexOffset is counted in elements of the mesh index format, u16 indices are packed two per word
+uint FetchIndex(InstanceData instance, uint i) {
+    uint element = instance.indexOffset + i;
+    if (instance.indexFormat == INDEX_FORMAT_U16) {
+        return (ibo.data[element >> 1] >> ((element & 1u) * 16u)) & 0xffffu;
+    }
+
+    return ibo.data[element];
+}
+#endif
+
 void main() {
     InstanceData instance = instanceDataBuffer.data[gl_BaseInstance];
 
-    uint       refIdx = instance.indexOffset + gl_VertexIndex;
-    ImDrawVert v = sbo.data[ibo.data[refIdx] + instance.vertexOffset];
+#ifdef INDEXED_DRAW
+    // fetched by the input assembler, gl_VertexIndex already includes gl_BaseVertex (instance.vertexOffset)
+    ImDrawVert v = sbo.data[gl_VertexIndex];
+#else
+    ImDrawVert v = sbo.data[FetchIndex(instance, gl_VertexIndex) + instance.vertexOffset];
+#endif
     vec3 pos = vec3(v.x, v.y, v.z);
 
     outFragPos = vec3(push.model * vec4(pos, 1.0));
-    outFragLightSpacePos = ubo.lightSpaceMat * vec4(outFragPos, 1.0);
 
     outMatIndex = instance.material;
     outUVW = vec3(v.u, v.v, 1.0);
-    outNormal = mat3(transpose(inverse(push.model))) * vec3(v.nx, v.ny, v.nz); // TODO: Normal matrix. don't compute it here
+    outNormal = mat3(push.normal) * vec3(v.nx, v.ny, v.nz);
     
-    gl_Position = ubo.projection * ubo.view * push.model * vec4(pos, 1.0);
+    // the same expression over the same matrices as shadow_depth.vert, the depth pre-pass is tested EQUAL
+    gl_Position = ubo.viewProj * push.model * vec4(pos, 1.0);
 }
 
@@ -1,10 +1,13 @@
 C:\VulkanSDK\1.3.283.0\Bin\glslc.exe -fshader-stage=vert .\basic.vert -o basic.vert.spv
+C:\VulkanSDK\1.3.283.0\Bin\glslc.exe -fshader-stage=vert -DINDEXED_DRAW .\basic.vert -o basic_indexed.vert.spv
 C:\VulkanSDK\1.3.283.0\Bin\glslc.exe -fshader-stage=frag .\basic.frag -o basic.frag.spv
+C:\VulkanSDK\1.3.283.0\Bin\glslc.exe -fshader-stage=comp .\cluster_lights.comp -o cluster_lights.comp.spv
 
 C:\VulkanSDK\1.3.283.0\Bin\glslc.exe -fshader-stage=vert .\grid.vert -o grid.vert.spv
 C:\VulkanSDK\1.3.283.0\Bin\glslc.exe -fshader-stage=frag .\grid.frag -o grid.frag.spv
 
 C:\VulkanSDK\1.3.283.0\Bin\glslc.exe -fshader-stage=vert .\shadow_depth.vert -o shadow_depth.vert.spv
+C:\VulkanSDK\1.3.283.0\Bin\glslc.exe -fshader-stage=vert -DINDEXED_DRAW .\shadow_depth.vert -o shadow_depth_indexed.vert.spv
 C:\VulkanSDK\1.3.283.0\Bin\glslc.exe -fshader-stage=frag .\shadow_depth.frag -o shadow_depth.frag.spv
 
 pause
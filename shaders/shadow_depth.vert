@@ -2,12 +2,6 @@
 
 #extension GL_EXT_shader_explicit_arithmetic_types_int64 : enable
 
-struct ImDrawVert {
-    float x, y, z;
-    float u, v;
-    float nx, ny, nz;
-};
-
 struct InstanceData {
     uint mesh;
     uint material;
@@ -15,32 +9,63 @@ struct InstanceData {
     uint indexOffset;
     uint vertexOffset;
     uint transformIndex;
+    uint indexFormat;
+    uint padding;
 };
 
+const uint INDEX_FORMAT_U16 = 1;
+
+// also the depth pre-pass of basic.vert
+invariant gl_Position;
+
+layout(push_constant) uniform PushConstantData {
+    mat4 model;
+} push;
+
+// light view projection of the cascade being rendered, or the camera's for the depth pre-pass
 layout(binding = 0) uniform UniformBuffer {
     mat4 depthMVP;
 } ubo;
 
-layout(binding = 1) readonly buffer SBO {
-    ImDrawVert data[];
-} sbo;
+// position stream only, 12 bytes per vertex
+layout(binding = 1) readonly buffer PositionBO {
+    float data[];
+} positions;
 
+#ifndef INDEXED_DRAW
 layout(binding = 2) readonly buffer IBO {
     uint data[];
 } ibo;
+#endif
 
 layout(binding = 3) readonly buffer InstanceBO {
     InstanceData data[];
 } instanceDataBuffer;
 
+#ifndef INDEXED_DRAW
+// indexOffset is counted in elements of the mesh index format, u16 indices are packed two per word
+uint FetchIndex(InstanceData instance, uint i) {
+    uint element = instance.indexOffset + i;
+    if (instance.indexFormat == INDEX_FORMAT_U16) {
+        return (ibo.data[element >> 1] >> ((element & 1u) * 16u)) & 0xffffu;
+    }
+
+    return ibo.data[element];
+}
+#endif
+
 
 void main() {
+#ifdef INDEXED_DRAW
+    // fetched by the input assembler, gl_VertexIndex already includes gl_BaseVertex (instance.vertexOffset)
+    uint vertex = gl_VertexIndex;
+#else
     InstanceData instance = instanceDataBuffer.data[gl_BaseInstance];
 
-    uint       refIdx = instance.indexOffset + gl_VertexIndex;
-    ImDrawVert v = sbo.data[ibo.data[refIdx] + instance.vertexOffset];
+    uint vertex = FetchIndex(instance, gl_VertexIndex) + instance.vertexOffset;
+#endif
 
-    vec3 pos = vec3(v.x, v.y, v.z);
+    vec3 pos = vec3(positions.data[vertex * 3 + 0], positions.data[vertex * 3 + 1], positions.data[vertex * 3 + 2]);
     
-    gl_Position = ubo.depthMVP * vec4(pos, 1.0);
+    gl_Position = ubo.depthMVP * push.model * vec4(pos, 1.0);
 }
@@ -0,0 +1,188 @@
+// no pch here, the culling is also linked into the benchmark target
+#include "frustum_culling.h"
+#include "math_simd.h"
+#include "job_system.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace xjar {
+
+// objects per job, small enough to spread a few thousand objects over the workers
+static constexpr u32 CULL_GRAIN = 4096;
+
+Frustum FrustumFromSceneData(const GPU_SceneData &sceneData) {
+    return FrustumFromMatrix(sceneData.projMat * sceneData.viewMat);
+}
+
+// A box is outside a plane when its center is further behind it than the box reaches along the normal,
+// dot(n, c) + d + dot(|n|, e) < 0. The index of every lane is stored and the output only advances past
+// the visible ones, which keeps the compaction free of branches.
+static u32 CullScalar(const Frustum &frustum, const CullBounds &bounds, u32 first, u32 end, u32 *visible, u32 written) {
+    for (u32 i = first; i < end; i++) {
+        bool inside = true;
+        for (const Plane &plane : frustum.planes) {
+            const f32 distance = plane.normal.x * bounds.centerX[i] + plane.normal.y * bounds.centerY[i] +
+                                 plane.normal.z * bounds.centerZ[i] + plane.d;
+            const f32 reach = std::abs(plane.normal.x) * bounds.extentX[i] + std::abs(plane.normal.y) * bounds.extentY[i] +
+                              std::abs(plane.normal.z) * bounds.extentZ[i];
+            inside &= distance + reach >= 0.0f;
+        }
+
+        visible[written] = i;
+        written += inside;
+    }
+
+    return written;
+}
+
+#if defined(__AVX2__)
+
+static constexpr u32 CULL_LANES = 8;
+
+u32 CullFrustum(const Frustum &frustum, const CullBounds &bounds, u32 first, u32 count, u32 *visible) {
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256 zero = _mm256_setzero_ps();
+
+    __m256 nx[6], ny[6], nz[6], ax[6], ay[6], az[6], d[6];
+    for (u32 p = 0; p < 6; p++) {
+        const Plane &plane = frustum.planes[p];
+        nx[p] = _mm256_set1_ps(plane.normal.x);
+        ny[p] = _mm256_set1_ps(plane.normal.y);
+        nz[p] = _mm256_set1_ps(plane.normal.z);
+        ax[p] = _mm256_andnot_ps(signMask, nx[p]);
+        ay[p] = _mm256_andnot_ps(signMask, ny[p]);
+        az[p] = _mm256_andnot_ps(signMask, nz[p]);
+        d[p] = _mm256_set1_ps(plane.d);
+    }
+
+    const u32 end = first + count;
+    const u32 simdEnd = first + count / CULL_LANES * CULL_LANES;
+    u32       written = 0;
+
+    for (u32 i = first; i < simdEnd; i += CULL_LANES) {
+        const __m256 cx = _mm256_loadu_ps(&bounds.centerX[i]);
+        const __m256 cy = _mm256_loadu_ps(&bounds.centerY[i]);
+        const __m256 cz = _mm256_loadu_ps(&bounds.centerZ[i]);
+        const __m256 ex = _mm256_loadu_ps(&bounds.extentX[i]);
+        const __m256 ey = _mm256_loadu_ps(&bounds.extentY[i]);
+        const __m256 ez = _mm256_loadu_ps(&bounds.extentZ[i]);
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (u32 p = 0; p < 6; p++) {
+            __m256 distance = _mm256_add_ps(_mm256_mul_ps(nx[p], cx), d[p]);
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(ny[p], cy));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(nz[p], cz));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(ax[p], ex));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(ay[p], ey));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(az[p], ez));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, zero, _CMP_GE_OQ));
+        }
+
+        const u32 mask = static_cast<u32>(_mm256_movemask_ps(inside));
+        for (u32 lane = 0; lane < CULL_LANES; lane++) {
+            visible[written] = i + lane;
+            written += (mask >> lane) & 1;
+        }
+    }
+
+    return CullScalar(frustum, bounds, simdEnd, end, visible, written);
+}
+
+#elif XJAR_SSE
+
+// two SSE vectors per iteration, 8 objects like the AVX2 path
+static constexpr u32 CULL_LANES = 8;
+
+u32 CullFrustum(const Frustum &frustum, const CullBounds &bounds, u32 first, u32 count, u32 *visible) {
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 zero = _mm_setzero_ps();
+
+    __m128 nx[6], ny[6], nz[6], ax[6], ay[6], az[6], d[6];
+    for (u32 p = 0; p < 6; p++) {
+        const Plane &plane = frustum.planes[p];
+        nx[p] = _mm_set1_ps(plane.normal.x);
+        ny[p] = _mm_set1_ps(plane.normal.y);
+        nz[p] = _mm_set1_ps(plane.normal.z);
+        ax[p] = _mm_andnot_ps(signMask, nx[p]);
+        ay[p] = _mm_andnot_ps(signMask, ny[p]);
+        az[p] = _mm_andnot_ps(signMask, nz[p]);
+        d[p] = _mm_set1_ps(plane.d);
+    }
+
+    auto test = [&](u32 i) {
+        const __m128 cx = _mm_loadu_ps(&bounds.centerX[i]);
+        const __m128 cy = _mm_loadu_ps(&bounds.centerY[i]);
+        const __m128 cz = _mm_loadu_ps(&bounds.centerZ[i]);
+        const __m128 ex = _mm_loadu_ps(&bounds.extentX[i]);
+        const __m128 ey = _mm_loadu_ps(&bounds.extentY[i]);
+        const __m128 ez = _mm_loadu_ps(&bounds.extentZ[i]);
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (u32 p = 0; p < 6; p++) {
+            __m128 distance = _mm_add_ps(_mm_mul_ps(nx[p], cx), d[p]);
+            distance = _mm_add_ps(distance, _mm_mul_ps(ny[p], cy));
+            distance = _mm_add_ps(distance, _mm_mul_ps(nz[p], cz));
+            distance = _mm_add_ps(distance, _mm_mul_ps(ax[p], ex));
+            distance = _mm_add_ps(distance, _mm_mul_ps(ay[p], ey));
+            distance = _mm_add_ps(distance, _mm_mul_ps(az[p], ez));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, zero));
+        }
+
+        return static_cast<u32>(_mm_movemask_ps(inside));
+    };
+
+    const u32 end = first + count;
+    const u32 simdEnd = first + count / CULL_LANES * CULL_LANES;
+    u32       written = 0;
+
+    for (u32 i = first; i < simdEnd; i += CULL_LANES) {
+        const u32 mask = test(i) | (test(i + 4) << 4);
+        for (u32 lane = 0; lane < CULL_LANES; lane++) {
+            visible[written] = i + lane;
+            written += (mask >> lane) & 1;
+        }
+    }
+
+    return CullScalar(frustum, bounds, simdEnd, end, visible, written);
+}
+
+#else
+
+u32 CullFrustum(const Frustum &frustum, const CullBounds &bounds, u32 first, u32 count, u32 *visible) {
+    return CullScalar(frustum, bounds, first, first + count, visible, 0);
+}
+
+#endif
+
+// every job compacts into its own range of visible, the ranges are then closed up in order
+void CullFrustumParallel(const Frustum &frustum, const CullBounds &bounds, std::vector<u32> &visible) {
+    XJAR_ZONE("CullFrustumParallel");
+
+    const u32 count = bounds.Count();
+    visible.resize(count);
+    if (count == 0)
+        return;
+
+    const u32        chunkCount = (count + CULL_GRAIN - 1) / CULL_GRAIN;
+    std::vector<u32> written(chunkCount);
+
+    JobSystem::Instance().ParallelFor(count, CULL_GRAIN, [&](u32 first, u32 rangeCount) {
+        // ranges smaller than the grain only come at the end or when everything runs inline
+        for (u32 chunk = first; chunk < first + rangeCount; chunk += CULL_GRAIN) {
+            const u32 chunkSize = std::min(CULL_GRAIN, first + rangeCount - chunk);
+            written[chunk / CULL_GRAIN] = CullFrustum(frustum, bounds, chunk, chunkSize, visible.data() + chunk);
+        }
+    });
+
+    u32 total = written[0];
+    for (u32 chunk = 1; chunk < chunkCount; chunk++) {
+        std::copy_n(visible.begin() + chunk * CULL_GRAIN, written[chunk], visible.begin() + total);
+        total += written[chunk];
+    }
+
+    visible.resize(total);
+}
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "types.h"
+#include "geometry.h"
+#include "renderer/renderer_types.h"
+
+#include <vector>
+
+namespace xjar {
+
+// boxes as center and half extent, one array per component so the culling loop loads a lane per object
+struct CullBounds {
+    std::vector<f32> centerX, centerY, centerZ;
+    std::vector<f32> extentX, extentY, extentZ;
+
+    u32 Count() const {
+        return static_cast<u32>(centerX.size());
+    }
+
+    // calls f on every component array, for the operations that treat them all alike
+    template <typename F>
+    void ForEachArray(F &&f) {
+        f(centerX);
+        f(centerY);
+        f(centerZ);
+        f(extentX);
+        f(extentY);
+        f(extentZ);
+    }
+
+    void Set(u32 i, const AABB &box) {
+        const glm::vec3 center = 0.5f * (box.min + box.max);
+        const glm::vec3 extent = 0.5f * (box.max - box.min);
+
+        centerX[i] = center.x;
+        centerY[i] = center.y;
+        centerZ[i] = center.z;
+        extentX[i] = extent.x;
+        extentY[i] = extent.y;
+        extentZ[i] = extent.z;
+    }
+
+    void Push(const AABB &box) {
+        ForEachArray([](std::vector<f32> &values) { values.push_back(0.0f); });
+        Set(Count() - 1, box);
+    }
+
+    void Move(u32 from, u32 to) {
+        ForEachArray([=](std::vector<f32> &values) { values[to] = values[from]; });
+    }
+};
+
+// the planes of the camera in sceneData, before the backend adjusts the projection
+Frustum FrustumFromSceneData(const GPU_SceneData &sceneData);
+
+// writes the indices in [first, first + count) of the boxes that are not fully outside, in order, and
+// returns how many. visible needs room for count indices.
+u32 CullFrustum(const Frustum &frustum, const CullBounds &bounds, u32 first, u32 count, u32 *visible);
+
+// CullFrustum over all bounds, split across the job system
+void CullFrustumParallel(const Frustum &frustum, const CullBounds &bounds, std::vector<u32> &visible);
+
+}
@@ -9,7 +9,7 @@ struct ButtonState {
     u32 transitions;
 };
 
-constexpr int BUTTON_COUNT = 12;
+constexpr int BUTTON_COUNT = 15;
 
 enum GameMouseInput {
     GameMouseInput_Left = 0,
@@ -36,6 +36,9 @@ struct GameInput {
             ButtonState button1;
             ButtonState button2;
             ButtonState button3;
+            ButtonState button4;
+            ButtonState button5;
+            ButtonState button6;
         };
     };
 
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "types.h"
+#include "renderer/renderer_types.h"
+
+#include <glm/glm.hpp>
+#include <limits>
+
+namespace xjar {
+
+// points with dot(normal, p) + d >= 0 are on the inner side
+struct Plane {
+    glm::vec3 normal;
+    f32       d;
+};
+
+// left, right, bottom, top, near, far
+struct Frustum {
+    Plane planes[6];
+};
+
+struct Sphere {
+    glm::vec3 center;
+    f32       radius;
+};
+
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 direction;
+};
+
+enum class Containment {
+    Outside = 0,
+    Intersects,
+    Inside
+};
+
+inline AABB EmptyAABB() {
+    return AABB {.min = glm::vec3(std::numeric_limits<f32>::max()), .max = glm::vec3(-std::numeric_limits<f32>::max())};
+}
+
+inline AABB Union(const AABB &a, const AABB &b) {
+    return AABB {.min = glm::min(a.min, b.min), .max = glm::max(a.max, b.max)};
+}
+
+inline f32 SurfaceArea(const AABB &box) {
+    const glm::vec3 d = glm::max(box.max - box.min, glm::vec3(0.0f));
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+// the near and far planes of a glm::perspective projection
+inline void GetClipPlanes(const glm::mat4 &proj, f32 &nearPlane, f32 &farPlane) {
+    nearPlane = proj[3][2] / (proj[2][2] - 1.0f);
+    farPlane = proj[3][2] / (proj[2][2] + 1.0f);
+}
+
+// Gribb/Hartmann plane extraction, the planes are normalized so distances are in world units.
+// Works for the -1..1 depth range glm uses and conservatively for 0..1.
+inline Frustum FrustumFromMatrix(const glm::mat4 &viewProj) {
+    const glm::mat4 m = glm::transpose(viewProj); // rows of viewProj
+    const glm::vec4 planes[6] = {m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1], m[3] + m[2], m[3] - m[2]};
+
+    Frustum frustum;
+    for (u32 i = 0; i < 6; i++) {
+        const f32 length = glm::length(glm::vec3(planes[i]));
+        frustum.planes[i] = Plane {.normal = glm::vec3(planes[i]) / length, .d = planes[i].w / length};
+    }
+
+    return frustum;
+}
+
+// the box corner furthest along the plane normal decides outside, the nearest one inside
+inline Containment TestFrustumAABB(const Frustum &frustum, const AABB &box) {
+    Containment result = Containment::Inside;
+
+    for (const Plane &plane : frustum.planes) {
+        const glm::vec3 positive = glm::mix(box.min, box.max, glm::greaterThanEqual(plane.normal, glm::vec3(0.0f)));
+        const glm::vec3 negative = glm::mix(box.max, box.min, glm::greaterThanEqual(plane.normal, glm::vec3(0.0f)));
+
+        if (glm::dot(plane.normal, positive) + plane.d < 0.0f)
+            return Containment::Outside;
+        if (glm::dot(plane.normal, negative) + plane.d < 0.0f)
+            result = Containment::Intersects;
+    }
+
+    return result;
+}
+
+inline bool Overlaps(const AABB &a, const AABB &b) {
+    return glm::all(glm::lessThanEqual(a.min, b.max)) && glm::all(glm::lessThanEqual(b.min, a.max));
+}
+
+inline bool Overlaps(const Sphere &sphere, const AABB &box) {
+    const glm::vec3 closest = glm::clamp(sphere.center, box.min, box.max);
+    const glm::vec3 d = closest - sphere.center;
+
+    return glm::dot(d, d) <= sphere.radius * sphere.radius;
+}
+
+inline bool Contains(const AABB &outer, const AABB &inner) {
+    return glm::all(glm::lessThanEqual(outer.min, inner.min)) && glm::all(glm::lessThanEqual(inner.max, outer.max));
+}
+
+// slab test, invDirection is 1 / ray.direction. Returns the entry distance, negative if the origin is inside.
+inline bool IntersectRayAABB(const Ray &ray, const glm::vec3 &invDirection, const AABB &box, f32 maxDistance, f32 &distance) {
+    const glm::vec3 t0 = (box.min - ray.origin) * invDirection;
+    const glm::vec3 t1 = (box.max - ray.origin) * invDirection;
+    const glm::vec3 tmin = glm::min(t0, t1);
+    const glm::vec3 tmax = glm::max(t0, t1);
+
+    const f32 enter = glm::max(glm::max(tmin.x, tmin.y), tmin.z);
+    const f32 exit = glm::min(glm::min(tmax.x, tmax.y), tmax.z);
+
+    distance = enter;
+    return enter <= exit && exit >= 0.0f && enter <= maxDistance;
+}
+
+}
@@ -7,13 +7,19 @@
 
 #include "renderer/render_system.h"
 #include "world.h"
+#include "scene_bvh.h"
 #include "game_input.h"
 #include "renderer/camera.h"
 #include "tools/mesh_converter.h"
 #include "renderer/mesh_feature.h"
+#include "renderer/gpu_profiler.h"
 #include "texture_manager.h"
+#include "job_system.h"
+#include "profiler.h"
 #include "window.h"
 
+#include <chrono>
+
 #define ArrayCount(a) (sizeof(a) / sizeof((a)[0]))
 
 static xjar::GameInput  g_gameInput[2];
@@ -31,7 +37,329 @@ static void ProcessButton(xjar::ButtonState &button, b32 pressed) {
 
 glm::vec2 g_lastMousePos = glm::vec2(0.0f);
 
-int main() {
+// average frame time for the active draw mode, printed every FRAME_STATS_WINDOW frames
+struct FrameStats {
+    f64 accumulated = 0.0;
+    u32 frames = 0;
+};
+
+static constexpr u32 FRAME_STATS_WINDOW = 1000;
+
+static const char *DrawModeName(xjar::DrawMode mode) {
+    return mode == xjar::DrawMode::Indexed ? "indexed" : "vertex pulling";
+}
+
+// the scene both the window and the headless run draw
+static constexpr u32 DEMO_ENTITY_COUNT = 4;
+
+static constexpr u32 DEMO_MODEL_COUNT = 2;
+
+enum class CullMode {
+    Off,
+    BVH,  // frustum query against the scene BVH
+    SIMD  // linear SoA pass over all world bounds, spread over the job system
+};
+
+struct DemoScene {
+    xjar::Model        models[DEMO_MODEL_COUNT]; // the first three entities share the statue
+    xjar::EntityHandle entities[DEMO_ENTITY_COUNT];
+
+    CullMode                        cullMode = CullMode::BVH;
+    u32                             lightCount = 0;
+    std::vector<xjar::GPU_PointLight> lights;
+    xjar::SceneBVH                  bvh;
+    std::vector<xjar::EntityHandle> visibleEntities;
+    std::vector<u32>                visible;
+};
+
+static void CreateDemoScene(DemoScene &scene) {
+    const xjar::ModelFiles modelFiles[DEMO_MODEL_COUNT] = {
+        {"assets/test.mesh", "assets/test.mesh.instance", "assets/test.materials"},
+        {"assets/plane.mesh", "assets/plane.mesh.instance", "assets/plane.materials"}};
+    xjar::Model *models[DEMO_MODEL_COUNT] = {&scene.models[0], &scene.models[1]};
+
+    xjar::RenderSystem::Instance().LoadModels(modelFiles, models);
+
+    const glm::mat4 transforms[DEMO_ENTITY_COUNT] = {
+        glm::translate(glm::mat4(1.0f), glm::vec3(2.0f, 5.0f, 20.0f)),
+        glm::translate(glm::mat4(1.0f), glm::vec3(-15.0f, 5.0f, 0.0f)),
+        glm::translate(glm::mat4(1.0f), glm::vec3(5.0f, 4.0f, 0.0f)),
+        glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(10.0f, 0.0f, 0.0f)), glm::vec3(2.0f, 5.0f, 1.0f))};
+
+    auto &world = xjar::World::Instance();
+    for (u32 i = 0; i < DEMO_ENTITY_COUNT; i++) {
+        scene.entities[i] = world.CreateEntity();
+        world.SetModel(scene.entities[i], &scene.models[i < 3 ? 0 : 1]);
+        world.SetLocalTransform(scene.entities[i], transforms[i]);
+        world.SetStatic(scene.entities[i], true); // nothing in the demo moves, the shadows stay cached
+    }
+}
+
+// point lights on a sunflower spiral over the plane, besides the shadowed light of the scene data
+static void CreateDemoLights(DemoScene &scene) {
+    const glm::vec3 colors[] = {
+        {1.0f, 0.3f, 0.2f}, {0.2f, 1.0f, 0.3f}, {0.3f, 0.4f, 1.0f},
+        {1.0f, 0.8f, 0.3f}, {0.9f, 0.3f, 1.0f}, {0.3f, 1.0f, 1.0f}};
+
+    scene.lights.resize(std::min(scene.lightCount, xjar::MAX_POINT_LIGHTS));
+    for (u32 i = 0; i < scene.lights.size(); i++) {
+        const f32 angle = i * 2.39996f; // golden angle
+        const f32 distance = 25.0f * std::sqrt((i + 0.5f) / scene.lights.size());
+
+        scene.lights[i] = {
+            .position = glm::vec3(distance * std::cos(angle), 1.5f, distance * std::sin(angle)),
+            .radius = 6.0f,
+            .color = colors[i % ArrayCount(colors)],
+            .intensity = 4.0f};
+    }
+}
+
+static void DestroyDemoScene(DemoScene &scene) {
+    scene.bvh.Clear();
+    xjar::World::Instance().Clear();
+}
+
+static void DrawDemoScene(DemoScene &scene, xjar::GPU_SceneData *sceneData) {
+    auto &renderSystem = xjar::RenderSystem::Instance();
+    auto &world = xjar::World::Instance();
+
+    world.UpdateTransforms();
+    scene.bvh.Update(world);
+
+    // culled before the backend flips the projection for Vulkan
+    const xjar::Frustum frustum = xjar::FrustumFromSceneData(*sceneData);
+
+    if (scene.cullMode == CullMode::BVH) {
+        scene.visibleEntities.clear();
+        scene.bvh.QueryFrustum(frustum, scene.visibleEntities);
+
+        scene.visible.clear();
+        for (xjar::EntityHandle entity : scene.visibleEntities)
+            scene.visible.push_back(world.GetDenseIndex(entity));
+    } else if (scene.cullMode == CullMode::SIMD) {
+        xjar::CullFrustumParallel(frustum, world.GetCullBounds(), scene.visible);
+    }
+
+    xjar::RenderList list = world.GetRenderList();
+    list.visible = scene.visible;
+    list.lights = scene.lights;
+    list.culled = scene.cullMode != CullMode::Off;
+
+    auto frame = renderSystem.BeginFrame();
+    if (frame.success) {
+        renderSystem.ClearColor(frame, 0.05f, 0.05f, 0.05f, 1.0f);
+
+        renderSystem.DrawGrid(frame, sceneData);
+        renderSystem.DrawEntities(frame, sceneData, list);
+        renderSystem.EndFrame();
+    }
+}
+
+struct HeadlessOptions {
+    u32         width = 1920;
+    u32         height = 1080;
+    u32         frames = 1000;
+    u32         warmupFrames = 20;      // left out of the CPU numbers, they pay for the first uploads and pipeline use
+    const char *cameraPath = nullptr;   // orbits the scene if not set
+    const char *reportBasename = nullptr; // GPU profile export, see RenderSystem::ExportGpuProfile
+    CullMode    cullMode = CullMode::BVH; // also applies to the window
+    u32         cascadeCount = xjar::MAX_SHADOW_CASCADES; // likewise
+    b32         shadowCache = true;                        // likewise
+    u32         lightCount = 64;                           // likewise
+    b32         depthPrepass = false;                      // likewise
+    b32         dynamicRendering = false;                  // likewise
+};
+
+static bool ParseHeadlessOptions(int argc, char **argv, HeadlessOptions &options) {
+    bool headless = false;
+
+    for (int i = 1; i < argc; i++) {
+        const bool hasValue = i + 1 < argc;
+
+        if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        } else if (strcmp(argv[i], "--frames") == 0 && hasValue) {
+            options.frames = static_cast<u32>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--warmup") == 0 && hasValue) {
+            options.warmupFrames = static_cast<u32>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--size") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%ux%u", &options.width, &options.height) != 2) {
+                fprintf(stderr, "--size expects WIDTHxHEIGHT\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--camera-path") == 0 && hasValue) {
+            options.cameraPath = argv[++i];
+        } else if (strcmp(argv[i], "--report") == 0 && hasValue) {
+            options.reportBasename = argv[++i];
+        } else if (strcmp(argv[i], "--cull") == 0 && hasValue) {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "off") == 0) {
+                options.cullMode = CullMode::Off;
+            } else if (strcmp(mode, "bvh") == 0) {
+                options.cullMode = CullMode::BVH;
+            } else if (strcmp(mode, "simd") == 0) {
+                options.cullMode = CullMode::SIMD;
+            } else {
+                fprintf(stderr, "--cull expects off, bvh or simd\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--shadow-cache") == 0 && hasValue) {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "on") == 0 || strcmp(mode, "off") == 0) {
+                options.shadowCache = strcmp(mode, "on") == 0;
+            } else {
+                fprintf(stderr, "--shadow-cache expects on or off\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--depth-prepass") == 0 && hasValue) {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "on") == 0 || strcmp(mode, "off") == 0) {
+                options.depthPrepass = strcmp(mode, "on") == 0;
+            } else {
+                fprintf(stderr, "--depth-prepass expects on or off\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--dynamic-rendering") == 0 && hasValue) {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "on") == 0 || strcmp(mode, "off") == 0) {
+                options.dynamicRendering = strcmp(mode, "on") == 0;
+            } else {
+                fprintf(stderr, "--dynamic-rendering expects on or off\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--lights") == 0 && hasValue) {
+            options.lightCount = static_cast<u32>(atoi(argv[++i]));
+            if (options.lightCount > xjar::MAX_POINT_LIGHTS) {
+                fprintf(stderr, "--lights expects 0 to %u\n", xjar::MAX_POINT_LIGHTS);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--cascades") == 0 && hasValue) {
+            options.cascadeCount = static_cast<u32>(atoi(argv[++i]));
+            if (options.cascadeCount == 0 || options.cascadeCount > xjar::MAX_SHADOW_CASCADES) {
+                fprintf(stderr, "--cascades expects 1 to %u\n", xjar::MAX_SHADOW_CASCADES);
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            fprintf(stderr, "Unknown argument %s\n", argv[i]);
+            fprintf(stderr, "Usage: xjar [--headless [--frames N] [--warmup N] [--size WxH] [--camera-path FILE] [--report BASENAME]] [--cull off|bvh|simd] [--cascades N] [--shadow-cache on|off] [--lights N] [--depth-prepass on|off] [--dynamic-rendering on|off]\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (headless && (options.frames == 0 || options.width == 0 || options.height == 0)) {
+        fprintf(stderr, "Headless runs need at least one frame and a non empty size\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return headless;
+}
+
+// Renders the demo scene offscreen along a camera path and reports the timings. It needs no window
+// or display, so it runs on build machines with a software ICD, e.g. VK_DRIVER_FILES=<lvp_icd.json>.
+static int RunHeadless(const HeadlessOptions &options) {
+#if RENDERER_BACKEND == OpenGL
+    fprintf(stderr, "Headless runs need the Vulkan backend\n");
+    return EXIT_FAILURE;
+#else
+    xjar::InitWindow(options.width, options.height, "VkDemo headless");
+
+    xjar::CameraPath cameraPath;
+    if (options.cameraPath) {
+        if (!cameraPath.Load(options.cameraPath))
+            return EXIT_FAILURE;
+    } else {
+        cameraPath.Orbit(glm::vec3(0.0f, 2.0f, 5.0f), 30.0f, 8.0f, 8);
+    }
+
+    auto &renderSystem = xjar::RenderSystem::Instance();
+    auto &textureManager = xjar::TextureManager::Instance();
+    auto &jobSystem = xjar::JobSystem::Instance();
+    jobSystem.StartUp();
+    renderSystem.SetDynamicRendering(options.dynamicRendering);
+    renderSystem.Startup();
+
+    xjar::ShadowSettings shadows;
+    shadows.cascadeCount = options.cascadeCount;
+    shadows.cacheStatic = options.shadowCache;
+    renderSystem.SetShadowSettings(shadows);
+    renderSystem.SetDepthPrepass(options.depthPrepass);
+
+    DemoScene scene;
+    scene.cullMode = options.cullMode;
+    scene.lightCount = options.lightCount;
+    CreateDemoScene(scene);
+    CreateDemoLights(scene);
+
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<f64> frameMs;
+    frameMs.reserve(options.frames);
+
+    const Clock::time_point runStart = Clock::now();
+    Clock::time_point       measureStart = runStart;
+
+    for (u32 i = 0; i < options.warmupFrames + options.frames; i++) {
+        XJAR_ZONE("Frame");
+
+        if (i == options.warmupFrames)
+            measureStart = Clock::now();
+
+        const Clock::time_point frameStart = Clock::now();
+
+        // the path is tied to the frame number, not to the time, so every run draws the same frames
+        const f32 t = options.frames > 1 && i >= options.warmupFrames ? (f32)(i - options.warmupFrames) / (options.frames - 1) : 0.0f;
+
+        xjar::GPU_SceneData sceneData {};
+        sceneData.viewMat = cameraPath.GetViewMatrix(t, &sceneData.viewPos);
+        sceneData.projMat = glm::perspective(glm::radians(45.0f), (f32)options.width / (f32)options.height, 0.1f, 1000.0f);
+        sceneData.lightPos = glm::vec3(-2.0f, 4.0f, 1.0f);
+
+        DrawDemoScene(scene, &sceneData);
+
+        if (i >= options.warmupFrames)
+            frameMs.push_back(std::chrono::duration<f64, std::milli>(Clock::now() - frameStart).count());
+    }
+
+    const f64 measuredSec = std::chrono::duration<f64>(Clock::now() - measureStart).count();
+
+    std::vector<f64> sorted = frameMs;
+    std::sort(sorted.begin(), sorted.end());
+
+    f64 sum = 0.0;
+    for (f64 ms : frameMs)
+        sum += ms;
+
+    const size_t p99 = std::min(sorted.size() - 1, (size_t)(sorted.size() * 0.99));
+
+    printf("Headless %ux%u, %u frames after %u warm-up frames, draw mode %s, depth pre-pass %s, dynamic rendering %s\n",
+           options.width, options.height, options.frames, options.warmupFrames, DrawModeName(renderSystem.GetDrawMode()),
+           renderSystem.IsDepthPrepass() ? "on" : "off", renderSystem.IsDynamicRendering() ? "on" : "off");
+    printf("CPU frame time: avg %.3f ms, min %.3f ms, p99 %.3f ms, max %.3f ms\n",
+           sum / frameMs.size(), sorted.front(), sorted[p99], sorted.back());
+    printf("Throughput: %.1f frames/s, %.1f Mpixel/s\n",
+           options.frames / measuredSec, (f64)options.frames * options.width * options.height / measuredSec * 1e-6);
+
+    if (const xjar::GpuProfileHistory *gpuProfile = renderSystem.GetGpuProfile())
+        gpuProfile->Print();
+
+    if (options.reportBasename)
+        renderSystem.ExportGpuProfile(options.reportBasename);
+
+    DestroyDemoScene(scene);
+    textureManager.Shutdown();
+    renderSystem.Shutdown();
+    jobSystem.Shutdown();
+
+    return 0;
+#endif
+}
+
+int main(int argc, char **argv) {
+    XJAR_PROFILE_THREAD("main");
+
+    HeadlessOptions headlessOptions;
+    const bool      headless = ParseHeadlessOptions(argc, argv, headlessOptions);
+
     glfwSetErrorCallback([](int error, const char *description) { fprintf(stderr, "Error: %s\n", description); });
 
 #if 0
@@ -77,6 +405,9 @@ int main() {
              "assets/plane.materials",
              "assets/plane/wood.png");
 
+    if (headless)
+        return RunHeadless(headlessOptions);
+
     const u32   window_width = 1920;
     const u32   window_height = 1080;
     const char *window_title = "VkDemo";
@@ -148,6 +479,18 @@ int main() {
                 ProcessButton(g_currInput->button3, isPressed);
             }
 
+            if (key == GLFW_KEY_4) {
+                ProcessButton(g_currInput->button4, isPressed);
+            }
+
+            if (key == GLFW_KEY_5) {
+                ProcessButton(g_currInput->button5, isPressed);
+            }
+
+            if (key == GLFW_KEY_6) {
+                ProcessButton(g_currInput->button6, isPressed);
+            }
+
             if (mods & GLFW_MOD_SHIFT) {
                 ProcessButton(g_currInput->actionAccelerate, isPressed);
             }
@@ -176,29 +519,37 @@ int main() {
 
     auto &renderSystem = xjar::RenderSystem::Instance();
     auto &textureManager = xjar::TextureManager::Instance();
+    auto &jobSystem = xjar::JobSystem::Instance();
+    jobSystem.StartUp();
+    renderSystem.SetDynamicRendering(headlessOptions.dynamicRendering);
     renderSystem.Startup();
 
+    xjar::ShadowSettings shadows;
+    shadows.cascadeCount = headlessOptions.cascadeCount;
+    shadows.cacheStatic = headlessOptions.shadowCache;
+    renderSystem.SetShadowSettings(shadows);
+    renderSystem.SetDepthPrepass(headlessOptions.depthPrepass);
+
     f32 frameTime = static_cast<f32>(glfwGetTime());
 
     auto windowObj = xjar::GetWindow();
 
-    auto         &world = xjar::World::Instance();
-    xjar::Entity *ent = world.CreateEntity();
-    xjar::Entity *ent2 = world.CreateEntity();
-    xjar::Entity *ent3 = world.CreateEntity();
-    xjar::Entity *ent4 = world.CreateEntity();
-
-    renderSystem.LoadModel("assets/test.mesh", "assets/test.mesh.instance", "assets/test.materials", ent->model);
-    renderSystem.LoadModel("assets/test.mesh", "assets/test.mesh.instance", "assets/test.materials", ent2->model);
-    renderSystem.LoadModel("assets/test.mesh", "assets/test.mesh.instance", "assets/test.materials", ent3->model);
-    renderSystem.LoadModel("assets/plane.mesh", "assets/plane.mesh.instance", "assets/plane.materials", ent4->model);
+    DemoScene scene;
+    scene.cullMode = headlessOptions.cullMode;
+    scene.lightCount = headlessOptions.lightCount;
+    CreateDemoScene(scene);
+    CreateDemoLights(scene);
 
     memset(g_gameInput, 0, sizeof(xjar::GameInput));
 
     g_currInput = &g_gameInput[0];
     g_prevInput = &g_gameInput[1];
 
+    FrameStats frameStats;
+
     while (!glfwWindowShouldClose(window)) {
+        XJAR_ZONE("Frame");
+
         f32 currentTime = glfwGetTime();
         f32 dtForFrame = currentTime - static_cast<f32>(frameTime);
 
@@ -217,40 +568,60 @@ int main() {
 
         g_FpsCamera.Update(dtForFrame, g_currInput, g_lastMousePos);
 
-        glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(2.0f, 5.0f, 20.0f)); // make sure to initialize matrix to identity matrix first
-        ent->model.localTransform = model;
+        if (g_currInput->button3.pressed && g_currInput->button3.transitions > 0) {
+            xjar::DrawMode mode = renderSystem.GetDrawMode() == xjar::DrawMode::Indexed ? xjar::DrawMode::VertexPulling : xjar::DrawMode::Indexed;
+            renderSystem.SetDrawMode(mode);
+            frameStats = {};
 
-        glm::mat4 model2 = glm::translate(glm::mat4(1.0f), glm::vec3(-15.0f, 5.0f, 0.0f));
-        ent2->model.localTransform = model2;
+            printf("Draw mode: %s\n", DrawModeName(mode));
+        }
 
-        glm::mat4 model3 = glm::translate(glm::mat4(1.0f), glm::vec3(5.0f, 4.0f, 0.0f));
-        ent3->model.localTransform = model3;
+        if (g_currInput->button4.pressed && g_currInput->button4.transitions > 0) {
+            b32 parallel = !renderSystem.IsParallelRecording();
+            renderSystem.SetParallelRecording(parallel);
+            frameStats = {};
 
-        glm::mat4 model4 = glm::translate(glm::mat4(1.0f), glm::vec3(10.0f, 0.0f, 0.0f));
-        model4 = glm::scale(model4, glm::vec3(2.0f, 5.0f, 1.0f));
-        ent4->model.localTransform = model4;
+            printf("Command recording: %s\n", parallel ? "parallel" : "single thread");
+        }
+
+        if (g_currInput->button5.pressed && g_currInput->button5.transitions > 0) {
+            renderSystem.ExportGpuProfile("gpu_profile");
+        }
+
+        if (g_currInput->button6.pressed && g_currInput->button6.transitions > 0) {
+#if XJAR_PROFILE
+            xjar::Profiler::Instance().WriteChromeTrace("cpu_trace.json");
+#else
+            printf("Built without XJAR_PROFILE, there are no CPU zones to write\n");
+#endif
+        }
+
+        frameStats.accumulated += dtForFrame;
+        if (++frameStats.frames == FRAME_STATS_WINDOW) {
+            printf("[%s] avg frame time %.3f ms\n", DrawModeName(renderSystem.GetDrawMode()), frameStats.accumulated * 1000.0 / frameStats.frames);
+            frameStats = {};
+
+            if (const xjar::GpuProfileHistory *gpuProfile = renderSystem.GetGpuProfile())
+                gpuProfile->Print();
+        }
 
         xjar::GPU_SceneData sceneData {};
         sceneData.viewMat = g_FpsCamera.GetViewMatrix();
         sceneData.projMat = glm::perspective(glm::radians(45.0f), (f32)windowObj.width / (f32)windowObj.height, 0.1f, 1000.0f);
         sceneData.viewPos = g_FpsCamera.m_cameraPosition;
+        sceneData.lightPos = glm::vec3(-2.0f, 4.0f, 1.0f);
 
-        auto frame = renderSystem.BeginFrame();
-        if (frame.success) {
-            renderSystem.ClearColor(frame, 0.05f, 0.05f, 0.05f, 1.0f);
-
-            renderSystem.DrawGrid(frame, &sceneData);
-            renderSystem.DrawEntities(frame, &sceneData, {ent, ent2, ent3, ent4});
-            renderSystem.EndFrame();
-        }
+        DrawDemoScene(scene, &sceneData);
 
         xjar::GameInput *tempInput = g_currInput;
         g_currInput = g_prevInput;
         g_prevInput = tempInput;
     }
 
+    DestroyDemoScene(scene);
     textureManager.Shutdown();
     renderSystem.Shutdown();
+    jobSystem.Shutdown();
 
     glfwDestroyWindow(window);
     glfwTerminate();
@@ -0,0 +1,242 @@
+// no pch here, the scheduler is also linked into the benchmark target
+#include "job_system.h"
+#include "profiler.h"
+
+#include <assert.h>
+#include <algorithm>
+
+namespace xjar {
+
+static constexpr u32 CONTINUATION_BIT = 0x80000000u;
+static constexpr u32 COUNT_MASK = ~CONTINUATION_BIT;
+
+// spins before a worker goes to sleep
+static constexpr u32 IDLE_SPIN_COUNT = 64;
+
+static thread_local u32 t_threadIndex = 0;
+static thread_local u32 t_stealSeed = 0x9e3779b9u;
+
+JobSystem &JobSystem::Instance() {
+    static JobSystem jobSystem;
+
+    return jobSystem;
+}
+
+u32 JobSystem::GetThreadIndex() {
+    return t_threadIndex;
+}
+
+void JobSystem::StartUp(u32 workerCount) {
+    assert(m_queues.empty());
+
+    if (workerCount == 0)
+        workerCount = std::max(1u, std::thread::hardware_concurrency());
+
+    m_quit = false;
+    m_queues.reserve(workerCount);
+    for (u32 i = 0; i < workerCount; i++)
+        m_queues.push_back(std::make_unique<Queue>());
+
+    t_threadIndex = 0;
+    for (u32 i = 1; i < workerCount; i++)
+        m_threads.emplace_back(&JobSystem::WorkerLoop, this, i);
+}
+
+void JobSystem::Shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_quit = true;
+    }
+    m_sleepCv.notify_all();
+
+    for (std::thread &t : m_threads)
+        t.join();
+
+    m_threads.clear();
+    m_queues.clear();
+    m_queued = 0;
+}
+
+void JobSystem::Push(Job &&job) {
+    // before StartUp everything runs inline
+    if (m_queues.empty()) {
+        Execute(job);
+        return;
+    }
+
+    m_queued.fetch_add(1);
+
+    Queue &queue = *m_queues[t_threadIndex];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back(std::move(job));
+    }
+
+    // a worker bumps m_sleeping before it checks m_queued, so one of the two sides sees the other
+    if (m_sleeping.load() > 0) {
+        { std::lock_guard<std::mutex> lock(m_sleepMutex); }
+        m_sleepCv.notify_one();
+    }
+}
+
+void JobSystem::Run(JobFunc func, JobCounter *counter) {
+    if (counter)
+        counter->value.fetch_add(1);
+
+    Push(Job {.func = std::move(func), .counter = counter});
+}
+
+void JobSystem::RunAfter(JobCounter &dependency, JobFunc func, JobCounter *counter) {
+    if (counter)
+        counter->value.fetch_add(1);
+
+    Job job {.func = std::move(func), .counter = counter};
+    {
+        std::lock_guard<std::mutex> lock(dependency.mutex);
+
+        u32 value = dependency.value.load();
+        while ((value & COUNT_MASK) != 0) {
+            if (dependency.value.compare_exchange_weak(value, value | CONTINUATION_BIT)) {
+                dependency.continuations.push_back(std::move(job));
+                return;
+            }
+        }
+    }
+
+    Push(std::move(job));
+}
+
+bool JobSystem::TryPop(u32 threadIndex, Job &job) {
+    const u32 queueCount = static_cast<u32>(m_queues.size());
+    if (m_queued.load(std::memory_order_relaxed) == 0)
+        return false;
+
+    {
+        Queue &own = *m_queues[threadIndex];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty()) {
+            job = std::move(own.jobs.back());
+            own.jobs.pop_back();
+            m_queued.fetch_sub(1);
+            return true;
+        }
+    }
+
+    // xorshift picks where the scan starts so thieves spread over the victims
+    t_stealSeed ^= t_stealSeed << 13;
+    t_stealSeed ^= t_stealSeed >> 17;
+    t_stealSeed ^= t_stealSeed << 5;
+
+    const u32 start = t_stealSeed % queueCount;
+    for (u32 i = 0; i < queueCount; i++) {
+        const u32 victimIndex = (start + i) % queueCount;
+        if (victimIndex == threadIndex)
+            continue;
+
+        Queue &victim = *m_queues[victimIndex];
+        std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+        if (!lock.owns_lock() || victim.jobs.empty())
+            continue;
+
+        job = std::move(victim.jobs.front());
+        victim.jobs.pop_front();
+        m_queued.fetch_sub(1);
+        return true;
+    }
+
+    return false;
+}
+
+void JobSystem::Execute(Job &job) {
+    job.func();
+    // drop the captures now rather than when the slot is reused
+    job.func = nullptr;
+
+    if (job.counter)
+        Finish(job.counter);
+}
+
+void JobSystem::Finish(JobCounter *counter) {
+    const u32 previous = counter->value.fetch_sub(1);
+    if (previous != (CONTINUATION_BIT | 1))
+        return;
+
+    std::vector<Job> continuations;
+    {
+        std::lock_guard<std::mutex> lock(counter->mutex);
+        continuations.swap(counter->continuations);
+    }
+
+    for (Job &job : continuations)
+        Push(std::move(job));
+
+    // last access, Wait returns once the bit is gone
+    counter->value.fetch_and(COUNT_MASK);
+}
+
+void JobSystem::Wait(JobCounter &counter) {
+    const u32 threadIndex = t_threadIndex;
+
+    Job job;
+    while (counter.value.load() != 0) {
+        if (!m_queues.empty() && TryPop(threadIndex, job))
+            Execute(job);
+        else
+            std::this_thread::yield();
+    }
+}
+
+bool JobSystem::IsDone(const JobCounter &counter) const {
+    return counter.value.load() == 0;
+}
+
+void JobSystem::ParallelFor(u32 count, u32 grain, const JobRangeFunc &func) {
+    if (count == 0)
+        return;
+
+    grain = std::max(1u, grain);
+    if (count <= grain || m_queues.size() < 2) {
+        func(0, count);
+        return;
+    }
+
+    JobCounter counter;
+    for (u32 first = grain; first < count; first += grain) {
+        const u32 rangeCount = std::min(grain, count - first);
+        Run([&func, first, rangeCount]() { func(first, rangeCount); }, &counter);
+    }
+
+    // the first range runs here while the others get stolen
+    func(0, grain);
+
+    Wait(counter);
+}
+
+void JobSystem::WorkerLoop(u32 threadIndex) {
+    t_threadIndex = threadIndex;
+    t_stealSeed ^= threadIndex * 0x85ebca6bu;
+    XJAR_PROFILE_THREAD("job worker");
+
+    Job job;
+    u32 idle = 0;
+    while (!m_quit.load()) {
+        if (TryPop(threadIndex, job)) {
+            Execute(job);
+            idle = 0;
+            continue;
+        }
+
+        if (++idle < IDLE_SPIN_COUNT) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_sleeping.fetch_add(1);
+        m_sleepCv.wait(lock, [&]() { return m_quit.load() || m_queued.load() > 0; });
+        m_sleeping.fetch_sub(1);
+        idle = 0;
+    }
+}
+
+}
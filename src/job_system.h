@@ -0,0 +1,90 @@
+#pragma once
+
+#include "types.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace xjar {
+
+struct JobCounter;
+
+using JobFunc = std::function<void()>;
+using JobRangeFunc = std::function<void(u32 first, u32 count)>;
+
+struct Job {
+    JobFunc     func;
+    JobCounter *counter; // decremented once func returns, may be null
+};
+
+// counts unfinished jobs, jobs queued with RunAfter are released when it drops to zero.
+// A counter has to outlive its jobs: Wait on it before it goes out of scope.
+struct JobCounter {
+    // low bits count jobs, the top bit marks pending continuations
+    std::atomic<u32> value {0};
+    std::mutex       mutex;
+    std::vector<Job> continuations;
+};
+
+// work-stealing scheduler: every thread owns a deque, pops its own jobs LIFO and steals FIFO from the others.
+// The thread that calls StartUp is thread 0 and runs jobs while it waits.
+class JobSystem {
+public:
+    static JobSystem &Instance();
+
+    // workerCount includes the calling thread, 0 picks one thread per core
+    void StartUp(u32 workerCount = 0);
+    void Shutdown();
+
+    void Run(JobFunc func, JobCounter *counter = nullptr);
+    // func is queued once dependency reaches zero
+    void RunAfter(JobCounter &dependency, JobFunc func, JobCounter *counter = nullptr);
+    // runs jobs until counter reaches zero
+    void Wait(JobCounter &counter);
+    // polls instead of helping, for work that is picked up in a later frame
+    bool IsDone(const JobCounter &counter) const;
+    // splits [0, count) into ranges of at most grain items and waits for all of them
+    void ParallelFor(u32 count, u32 grain, const JobRangeFunc &func);
+
+    u32 GetWorkerCount() const {
+        return static_cast<u32>(m_queues.size());
+    }
+
+    // index of the calling thread, threads not owned by the system share 0 with the main thread
+    static u32 GetThreadIndex();
+
+    JobSystem(const JobSystem &) = delete;
+    JobSystem &operator=(const JobSystem &) = delete;
+
+private:
+    struct alignas(64) Queue {
+        std::mutex      mutex;
+        std::deque<Job> jobs;
+    };
+
+    JobSystem() = default;
+
+    void Push(Job &&job);
+    bool TryPop(u32 threadIndex, Job &job);
+    void Execute(Job &job);
+    void Finish(JobCounter *counter);
+    void WorkerLoop(u32 threadIndex);
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread>            m_threads;
+
+    // idle workers sleep until something is queued
+    std::atomic<u32>        m_queued {0};
+    std::atomic<u32>        m_sleeping {0};
+    std::atomic<bool>       m_quit {false};
+    std::mutex              m_sleepMutex;
+    std::condition_variable m_sleepCv;
+};
+
+}
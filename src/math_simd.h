@@ -0,0 +1,73 @@
+#pragma once
+
+#include "types.h"
+#include "renderer/renderer_types.h"
+
+#include <glm/glm.hpp>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <immintrin.h>
+#define XJAR_SSE 1
+#else
+#define XJAR_SSE 0
+#endif
+
+namespace xjar {
+
+// out = a * b for column major matrices, out may alias a or b
+inline void MulMat4(const glm::mat4 &a, const glm::mat4 &b, glm::mat4 &out) {
+#if XJAR_SSE
+    const __m128 a0 = _mm_loadu_ps(&a[0][0]);
+    const __m128 a1 = _mm_loadu_ps(&a[1][0]);
+    const __m128 a2 = _mm_loadu_ps(&a[2][0]);
+    const __m128 a3 = _mm_loadu_ps(&a[3][0]);
+
+    // every column of the result is a combination of the columns of a weighted by a column of b
+    for (int column = 0; column < 4; column++) {
+        const __m128 w = _mm_loadu_ps(&b[column][0]);
+
+        __m128 r = _mm_mul_ps(a0, _mm_shuffle_ps(w, w, _MM_SHUFFLE(0, 0, 0, 0)));
+        r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_shuffle_ps(w, w, _MM_SHUFFLE(1, 1, 1, 1))));
+        r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_shuffle_ps(w, w, _MM_SHUFFLE(2, 2, 2, 2))));
+        r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_shuffle_ps(w, w, _MM_SHUFFLE(3, 3, 3, 3))));
+
+        _mm_storeu_ps(&out[column][0], r);
+    }
+#else
+    out = a * b;
+#endif
+}
+
+// inverse transpose of the upper 3x3, the columns are the cross products of the other two columns
+// over the determinant. Kept in a mat4 so it can be pushed and read as one in the shaders.
+inline glm::mat4 NormalMatrix(const glm::mat4 &m) {
+    const glm::vec3 c0(m[0]);
+    const glm::vec3 c1(m[1]);
+    const glm::vec3 c2(m[2]);
+
+    const glm::vec3 r0 = glm::cross(c1, c2);
+    const f32       det = glm::dot(c0, r0);
+    const f32       invDet = det != 0.0f ? 1.0f / det : 0.0f;
+
+    glm::mat4 result(1.0f);
+    result[0] = glm::vec4(r0 * invDet, 0.0f);
+    result[1] = glm::vec4(glm::cross(c2, c0) * invDet, 0.0f);
+    result[2] = glm::vec4(glm::cross(c0, c1) * invDet, 0.0f);
+
+    return result;
+}
+
+// Arvo's method, the extent along each world axis is the sum of the absolute transformed local extents
+inline AABB TransformBounds(const AABB &bounds, const glm::mat4 &m) {
+    const glm::vec3 center = 0.5f * (bounds.min + bounds.max);
+    const glm::vec3 extent = 0.5f * (bounds.max - bounds.min);
+
+    const glm::vec3 worldCenter = glm::vec3(m * glm::vec4(center, 1.0f));
+    const glm::vec3 worldExtent = glm::abs(glm::vec3(m[0])) * extent.x +
+                                  glm::abs(glm::vec3(m[1])) * extent.y +
+                                  glm::abs(glm::vec3(m[2])) * extent.z;
+
+    return AABB {.min = worldCenter - worldExtent, .max = worldCenter + worldExtent};
+}
+
+}
@@ -0,0 +1,571 @@
+#include "pch.h"
+#include "mesh_bvh.h"
+#include "math_simd.h"
+#include "profiler.h"
+
+#include <cmath>
+
+namespace xjar {
+
+static constexpr u32 INVALID_NODE = 0xffffffff;
+
+static constexpr u32 BIN_COUNT = 16;
+static constexpr u32 MAX_LEAF_TRIANGLES = 3; // fits the 2 bit count of MeshBVHNode::meta
+// below this depth nodes are split at the median, so no tree is deeper than it plus log2 of the triangles
+static constexpr u32 MAX_SAH_DEPTH = 64;
+static constexpr u32 MAX_TREE_DEPTH = MAX_SAH_DEPTH + 32;
+// every level pushes at most one child fewer than the width on top of the node it popped
+static constexpr u32 TRAVERSAL_STACK_SIZE = (MESH_BVH_WIDTH - 1) * MAX_TREE_DEPTH + 1;
+
+static constexpr u8 META_INNER = 0x80;
+static constexpr u8 META_OFFSET_MASK = 0x1f;
+static constexpr u8 META_COUNT_SHIFT = 5;
+
+// quantized boxes are rounded outwards, this covers the rounding of the decode in the slab test
+static constexpr f32 SLAB_EPSILON = 1e-5f;
+
+struct BuildTriangle {
+    AABB      bounds;
+    glm::vec3 centroid;
+    u32       index;
+};
+
+// binary node, a leaf has no children and covers [first, first + count) of the triangles
+struct BuildNode {
+    AABB bounds;
+    u32  first;
+    u32  count;
+    u32  left; // the right child follows it
+};
+
+static AABB TriangleBounds(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c) {
+    return AABB {.min = glm::min(a, glm::min(b, c)), .max = glm::max(a, glm::max(b, c))};
+}
+
+static std::vector<BuildNode> BuildBinaryTree(std::vector<BuildTriangle> &triangles) {
+    const u32 triangleCount = static_cast<u32>(triangles.size());
+
+    auto rangeBounds = [&](u32 first, u32 count) {
+        AABB bounds = EmptyAABB();
+        for (u32 i = first; i < first + count; i++)
+            bounds = Union(bounds, triangles[i].bounds);
+        return bounds;
+    };
+
+    std::vector<BuildNode> nodes;
+    nodes.reserve(2 * triangleCount);
+    nodes.push_back(BuildNode {.bounds = rangeBounds(0, triangleCount), .first = 0, .count = triangleCount, .left = INVALID_NODE});
+
+    struct Task {
+        u32 node;
+        u32 depth;
+    };
+
+    struct Bin {
+        AABB bounds;
+        u32  count;
+    };
+
+    std::vector<Task> stack {Task {.node = 0, .depth = 0}};
+    while (!stack.empty()) {
+        const Task      task = stack.back();
+        const BuildNode node = nodes[task.node];
+        stack.pop_back();
+
+        if (node.count <= MAX_LEAF_TRIANGLES)
+            continue;
+
+        BuildTriangle *begin = triangles.data() + node.first;
+        BuildTriangle *end = begin + node.count;
+
+        AABB centroidBounds = EmptyAABB();
+        for (const BuildTriangle *t = begin; t != end; t++)
+            centroidBounds = Union(centroidBounds, AABB {.min = t->centroid, .max = t->centroid});
+
+        const glm::vec3 centroidExtent = centroidBounds.max - centroidBounds.min;
+
+        f32 bestCost = std::numeric_limits<f32>::max();
+        u32 bestAxis = 3;
+        u32 bestSplit = 0; // bins up to and including it go left
+
+        for (u32 axis = 0; axis < 3 && task.depth < MAX_SAH_DEPTH; axis++) {
+            if (centroidExtent[axis] <= 0.0f)
+                continue;
+
+            Bin bins[BIN_COUNT];
+            for (Bin &bin : bins)
+                bin = Bin {.bounds = EmptyAABB(), .count = 0};
+
+            const f32 scale = BIN_COUNT / centroidExtent[axis];
+            for (const BuildTriangle *t = begin; t != end; t++) {
+                const u32 b = std::min(BIN_COUNT - 1, static_cast<u32>((t->centroid[axis] - centroidBounds.min[axis]) * scale));
+                bins[b].bounds = Union(bins[b].bounds, t->bounds);
+                bins[b].count++;
+            }
+
+            f32  rightAreas[BIN_COUNT];
+            u32  rightCounts[BIN_COUNT];
+            AABB right = EmptyAABB();
+            u32  rightCount = 0;
+            for (u32 i = BIN_COUNT - 1; i > 0; i--) {
+                right = Union(right, bins[i].bounds);
+                rightCount += bins[i].count;
+                rightAreas[i - 1] = SurfaceArea(right);
+                rightCounts[i - 1] = rightCount;
+            }
+
+            AABB left = EmptyAABB();
+            u32  leftCount = 0;
+            for (u32 i = 0; i < BIN_COUNT - 1; i++) {
+                left = Union(left, bins[i].bounds);
+                leftCount += bins[i].count;
+                if (leftCount == 0 || rightCounts[i] == 0)
+                    continue;
+
+                const f32 cost = SurfaceArea(left) * leftCount + rightAreas[i] * rightCounts[i];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = i;
+                }
+            }
+        }
+
+        BuildTriangle *middle;
+        if (bestAxis < 3) {
+            const f32 min = centroidBounds.min[bestAxis];
+            const f32 scale = BIN_COUNT / centroidExtent[bestAxis];
+            middle = std::partition(begin, end, [&](const BuildTriangle &t) {
+                return std::min(BIN_COUNT - 1, static_cast<u32>((t.centroid[bestAxis] - min) * scale)) <= bestSplit;
+            });
+        } else {
+            // too deep or all centroids in one point, split the count along the longest axis
+            const u32 axis = centroidExtent.x >= centroidExtent.y && centroidExtent.x >= centroidExtent.z ? 0 : (centroidExtent.y >= centroidExtent.z ? 1 : 2);
+            middle = begin + node.count / 2;
+            std::nth_element(begin, middle, end, [=](const BuildTriangle &a, const BuildTriangle &b) {
+                return a.centroid[axis] < b.centroid[axis];
+            });
+        }
+
+        const u32 leftCount = static_cast<u32>(middle - begin);
+        const u32 leftIndex = static_cast<u32>(nodes.size());
+
+        nodes.push_back(BuildNode {.bounds = rangeBounds(node.first, leftCount), .first = node.first, .count = leftCount, .left = INVALID_NODE});
+        nodes.push_back(BuildNode {.bounds = rangeBounds(node.first + leftCount, node.count - leftCount),
+                                   .first = node.first + leftCount,
+                                   .count = node.count - leftCount,
+                                   .left = INVALID_NODE});
+        nodes[task.node].left = leftIndex;
+
+        stack.push_back(Task {.node = leftIndex + 1, .depth = task.depth + 1});
+        stack.push_back(Task {.node = leftIndex, .depth = task.depth + 1});
+    }
+
+    return nodes;
+}
+
+// smallest power of two step that reaches from origin to max in 255 steps
+static i8 GridExponent(f32 origin, f32 max) {
+    const f32 extent = max - origin;
+    if (extent <= 0.0f)
+        return -100;
+
+    int exponent = static_cast<int>(std::ceil(std::log2(extent / 255.0f)));
+    while (origin + std::ldexp(255.0f, exponent) < max)
+        exponent++;
+
+    return static_cast<i8>(std::clamp(exponent, -100, 127));
+}
+
+static void QuantizeChild(MeshBVHNode &node, u32 slot, const AABB &bounds) {
+    for (u32 axis = 0; axis < 3; axis++) {
+        const f32 origin = node.origin[axis];
+        const f32 step = std::ldexp(1.0f, node.exponent[axis]);
+
+        i32 qmin = std::clamp(static_cast<i32>(std::floor((bounds.min[axis] - origin) / step)), 0, 255);
+        i32 qmax = std::clamp(static_cast<i32>(std::ceil((bounds.max[axis] - origin) / step)), 0, 255);
+
+        // the division can round the box a hair inside the child, widen it by a step where it did
+        while (qmin > 0 && origin + qmin * step > bounds.min[axis])
+            qmin--;
+        while (qmax < 255 && origin + qmax * step < bounds.max[axis])
+            qmax++;
+
+        node.qmin[axis][slot] = static_cast<u8>(qmin);
+        node.qmax[axis][slot] = static_cast<u8>(qmax);
+    }
+}
+
+MeshBVH BuildMeshBVH(std::span<const glm::vec3> positions, std::span<const u32> indices) {
+    XJAR_ZONE("BuildMeshBVH");
+
+    MeshBVH bvh {};
+
+    const u32 triangleCount = static_cast<u32>(indices.size() / 3);
+    if (triangleCount == 0)
+        return bvh;
+
+    std::vector<BuildTriangle> triangles(triangleCount);
+    for (u32 i = 0; i < triangleCount; i++) {
+        const AABB bounds = TriangleBounds(positions[indices[3 * i]], positions[indices[3 * i + 1]], positions[indices[3 * i + 2]]);
+        triangles[i] = BuildTriangle {.bounds = bounds, .centroid = 0.5f * (bounds.min + bounds.max), .index = i};
+    }
+
+    const std::vector<BuildNode> binary = BuildBinaryTree(triangles);
+    bvh.bounds = binary[0].bounds;
+
+    // Every wide node takes a binary node and opens its inner descendant with the largest area until there
+    // are 8 children. Inner children become the next wide nodes, allocated as one block.
+    struct Pending {
+        u32 wide;
+        u32 binary;
+    };
+
+    std::vector<Pending> queue {Pending {.wide = 0, .binary = 0}};
+    bvh.nodes.emplace_back();
+    bvh.triangles.reserve(triangleCount);
+
+    for (size_t q = 0; q < queue.size(); q++) {
+        const Pending    pending = queue[q];
+        const BuildNode &root = binary[pending.binary];
+
+        u32 children[MESH_BVH_WIDTH];
+        u32 childCount = 0;
+
+        if (root.left == INVALID_NODE) {
+            children[childCount++] = pending.binary;
+        } else {
+            children[childCount++] = root.left;
+            children[childCount++] = root.left + 1;
+
+            while (childCount < MESH_BVH_WIDTH) {
+                u32 largest = MESH_BVH_WIDTH;
+                f32 largestArea = -1.0f;
+                for (u32 i = 0; i < childCount; i++) {
+                    const BuildNode &child = binary[children[i]];
+                    if (child.left != INVALID_NODE && SurfaceArea(child.bounds) > largestArea) {
+                        largest = i;
+                        largestArea = SurfaceArea(child.bounds);
+                    }
+                }
+
+                if (largest == MESH_BVH_WIDTH)
+                    break;
+
+                const u32 opened = binary[children[largest]].left;
+                children[largest] = opened;
+                children[childCount++] = opened + 1;
+            }
+        }
+
+        MeshBVHNode node {};
+        node.origin = root.bounds.min;
+        for (u32 axis = 0; axis < 3; axis++)
+            node.exponent[axis] = GridExponent(root.bounds.min[axis], root.bounds.max[axis]);
+        node.firstChild = static_cast<u32>(bvh.nodes.size());
+        node.firstTriangle = static_cast<u32>(bvh.triangles.size());
+
+        u32 innerCount = 0;
+        u32 triangleOffset = 0;
+        for (u32 slot = 0; slot < childCount; slot++) {
+            const BuildNode &child = binary[children[slot]];
+
+            QuantizeChild(node, slot, child.bounds);
+            node.childMask |= 1 << slot;
+
+            if (child.left != INVALID_NODE) {
+                node.meta[slot] = static_cast<u8>(META_INNER | innerCount);
+                queue.push_back(Pending {.wide = node.firstChild + innerCount, .binary = children[slot]});
+                innerCount++;
+                continue;
+            }
+
+            node.meta[slot] = static_cast<u8>(child.count << META_COUNT_SHIFT | triangleOffset);
+            triangleOffset += child.count;
+
+            for (u32 i = child.first; i < child.first + child.count; i++) {
+                const u32        index = triangles[i].index;
+                const glm::vec3 &v0 = positions[indices[3 * index]];
+                bvh.triangles.push_back(MeshBVHTriangle {
+                    .v0 = v0,
+                    .edge1 = positions[indices[3 * index + 1]] - v0,
+                    .edge2 = positions[indices[3 * index + 2]] - v0,
+                    .index = index});
+            }
+        }
+
+        bvh.nodes.resize(bvh.nodes.size() + innerCount);
+        bvh.nodes[pending.wide] = node;
+    }
+
+    return bvh;
+}
+
+struct RayData {
+    glm::vec3 origin;
+    glm::vec3 invDirection;
+};
+
+// a zero component would turn the slab test into 0 * inf
+static glm::vec3 SafeInverse(const glm::vec3 &direction) {
+    glm::vec3 result;
+    for (u32 axis = 0; axis < 3; axis++) {
+        const f32 d = std::abs(direction[axis]) < 1e-20f ? std::copysign(1e-20f, direction[axis]) : direction[axis];
+        result[axis] = 1.0f / d;
+    }
+
+    return result;
+}
+
+// slab test of all children at once, returns the mask of the children hit and their entry distances.
+// The quantized bounds decode as origin + q * step, so t = q * (step * invDirection) + (origin - rayOrigin) * invDirection.
+static u32 IntersectChildren(const MeshBVHNode &node, const RayData &ray, f32 maxDistance, f32 *distances) {
+    f32 scale[3], offset[3];
+    for (u32 axis = 0; axis < 3; axis++) {
+        scale[axis] = std::ldexp(1.0f, node.exponent[axis]) * ray.invDirection[axis];
+        offset[axis] = (node.origin[axis] - ray.origin[axis]) * ray.invDirection[axis];
+    }
+
+#if XJAR_SSE
+    const __m128i zero = _mm_setzero_si128();
+    const __m128  limit = _mm_set1_ps(maxDistance);
+    const __m128  slack = _mm_set1_ps(1.0f + SLAB_EPSILON);
+
+    // 4 bytes of quantized coordinates to 4 floats
+    auto load = [&](const u8 *q) {
+        i32 packed;
+        memcpy(&packed, q, sizeof(packed));
+        const __m128i bytes = _mm_cvtsi32_si128(packed);
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero));
+    };
+
+    u32 mask = 0;
+    for (u32 half = 0; half < MESH_BVH_WIDTH; half += 4) {
+        __m128 enter = _mm_setzero_ps();
+        __m128 exit = limit;
+
+        for (u32 axis = 0; axis < 3; axis++) {
+            const __m128 s = _mm_set1_ps(scale[axis]);
+            const __m128 o = _mm_set1_ps(offset[axis]);
+            const __m128 t0 = _mm_add_ps(_mm_mul_ps(load(&node.qmin[axis][half]), s), o);
+            const __m128 t1 = _mm_add_ps(_mm_mul_ps(load(&node.qmax[axis][half]), s), o);
+
+            enter = _mm_max_ps(enter, _mm_min_ps(t0, t1));
+            exit = _mm_min_ps(exit, _mm_max_ps(t0, t1));
+        }
+
+        _mm_storeu_ps(distances + half, enter);
+        mask |= static_cast<u32>(_mm_movemask_ps(_mm_cmple_ps(enter, _mm_mul_ps(exit, slack)))) << half;
+    }
+
+    return mask & node.childMask;
+#else
+    u32 mask = 0;
+    for (u32 slot = 0; slot < MESH_BVH_WIDTH; slot++) {
+        f32 enter = 0.0f;
+        f32 exit = maxDistance;
+
+        for (u32 axis = 0; axis < 3; axis++) {
+            const f32 t0 = node.qmin[axis][slot] * scale[axis] + offset[axis];
+            const f32 t1 = node.qmax[axis][slot] * scale[axis] + offset[axis];
+            enter = std::max(enter, std::min(t0, t1));
+            exit = std::min(exit, std::max(t0, t1));
+        }
+
+        distances[slot] = enter;
+        mask |= (enter <= exit * (1.0f + SLAB_EPSILON)) << slot;
+    }
+
+    return mask & node.childMask;
+#endif
+}
+
+// Moller-Trumbore, both sides of the triangle count
+static bool IntersectTriangle(const MeshBVHTriangle &triangle, const Ray &ray, f32 maxDistance, f32 &distance, f32 &u, f32 &v) {
+    const glm::vec3 p = glm::cross(ray.direction, triangle.edge2);
+    const f32       det = glm::dot(triangle.edge1, p);
+    if (std::abs(det) < 1e-20f)
+        return false;
+
+    const f32       invDet = 1.0f / det;
+    const glm::vec3 s = ray.origin - triangle.v0;
+
+    u = glm::dot(s, p) * invDet;
+    if (u < 0.0f || u > 1.0f)
+        return false;
+
+    const glm::vec3 q = glm::cross(s, triangle.edge1);
+
+    v = glm::dot(ray.direction, q) * invDet;
+    if (v < 0.0f || u + v > 1.0f)
+        return false;
+
+    distance = glm::dot(triangle.edge2, q) * invDet;
+
+    return distance >= 0.0f && distance <= maxDistance;
+}
+
+// nearest inner child first, subtrees starting beyond the closest hit so far are skipped
+template <bool ANY_HIT>
+static bool Traverse(const MeshBVH &bvh, const Ray &ray, f32 maxDistance, MeshRayHit *hit) {
+    if (bvh.nodes.empty())
+        return false;
+
+    const RayData rayData {.origin = ray.origin, .invDirection = SafeInverse(ray.direction)};
+
+    f32 rootDistance;
+    if (!IntersectRayAABB(ray, rayData.invDirection, bvh.bounds, maxDistance, rootDistance))
+        return false;
+
+    struct Entry {
+        u32 node;
+        f32 distance;
+    };
+
+    Entry stack[TRAVERSAL_STACK_SIZE];
+    u32   stackSize = 0;
+    stack[stackSize++] = Entry {.node = 0, .distance = rootDistance};
+
+    f32  closest = maxDistance;
+    bool found = false;
+
+    while (stackSize > 0) {
+        const Entry entry = stack[--stackSize];
+        if (entry.distance > closest)
+            continue;
+
+        const MeshBVHNode &node = bvh.nodes[entry.node];
+
+        f32       distances[MESH_BVH_WIDTH];
+        const u32 mask = IntersectChildren(node, rayData, closest, distances);
+
+        Entry inner[MESH_BVH_WIDTH];
+        u32   innerCount = 0;
+
+        for (u32 slot = 0; slot < MESH_BVH_WIDTH; slot++) {
+            if (!(mask & (1 << slot)))
+                continue;
+
+            const u8 meta = node.meta[slot];
+            if (meta & META_INNER) {
+                inner[innerCount++] = Entry {.node = node.firstChild + (meta & ~META_INNER), .distance = distances[slot]};
+                continue;
+            }
+
+            const u32 first = node.firstTriangle + (meta & META_OFFSET_MASK);
+            const u32 count = meta >> META_COUNT_SHIFT;
+            for (u32 i = first; i < first + count; i++) {
+                f32 distance, u, v;
+                if (!IntersectTriangle(bvh.triangles[i], ray, closest, distance, u, v))
+                    continue;
+
+                if constexpr (ANY_HIT)
+                    return true;
+
+                closest = distance;
+                found = true;
+                *hit = MeshRayHit {.distance = distance, .mesh = 0, .triangle = bvh.triangles[i].index, .u = u, .v = v};
+            }
+        }
+
+        // sorted far to near, so the nearest child is popped next
+        for (u32 i = 1; i < innerCount; i++) {
+            const Entry e = inner[i];
+            u32         j = i;
+            for (; j > 0 && inner[j - 1].distance < e.distance; j--)
+                inner[j] = inner[j - 1];
+            inner[j] = e;
+        }
+
+        for (u32 i = 0; i < innerCount; i++)
+            stack[stackSize++] = inner[i];
+    }
+
+    return found;
+}
+
+bool RaycastMeshBVH(const MeshBVH &bvh, const Ray &ray, f32 maxDistance, MeshRayHit &hit) {
+    return Traverse<false>(bvh, ray, maxDistance, &hit);
+}
+
+bool IntersectsMeshBVH(const MeshBVH &bvh, const Ray &ray, f32 maxDistance) {
+    return Traverse<true>(bvh, ray, maxDistance, nullptr);
+}
+
+bool RaycastTriangleMesh(const TriangleMesh &mesh, const Ray &ray, f32 maxDistance, MeshRayHit &hit) {
+    bool found = false;
+
+    for (u32 i = 0; i < mesh.bvhs.size(); i++) {
+        MeshRayHit meshHit;
+        if (RaycastMeshBVH(mesh.bvhs[i], ray, maxDistance, meshHit)) {
+            meshHit.mesh = i;
+            hit = meshHit;
+            maxDistance = meshHit.distance;
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+bool IntersectsSegment(const TriangleMesh &mesh, const glm::vec3 &from, const glm::vec3 &to) {
+    const Ray ray {.origin = from, .direction = to - from};
+
+    for (const MeshBVH &bvh : mesh.bvhs) {
+        if (IntersectsMeshBVH(bvh, ray, 1.0f))
+            return true;
+    }
+
+    return false;
+}
+
+void WriteMeshBVHs(FILE *file, std::span<const MeshBVH> bvhs) {
+    const MeshBVHHdr hdr {.magicValue = MESH_BVH_MAGIC, .meshNum = static_cast<u32>(bvhs.size())};
+    fwrite(&hdr, 1, sizeof(hdr), file);
+
+    for (const MeshBVH &bvh : bvhs) {
+        const MeshBVHInfo info {.bounds = bvh.bounds,
+                                .nodeCount = static_cast<u32>(bvh.nodes.size()),
+                                .triangleCount = static_cast<u32>(bvh.triangles.size())};
+
+        fwrite(&info, 1, sizeof(info), file);
+        fwrite(bvh.nodes.data(), sizeof(MeshBVHNode), bvh.nodes.size(), file);
+        fwrite(bvh.triangles.data(), sizeof(MeshBVHTriangle), bvh.triangles.size(), file);
+    }
+}
+
+bool ReadMeshBVHs(FILE *file, u32 meshNum, std::vector<MeshBVH> &bvhs) {
+    bvhs.clear();
+
+    MeshBVHHdr hdr;
+    if (fread(&hdr, 1, sizeof(hdr), file) != sizeof(hdr))
+        return false;
+
+    if (hdr.magicValue != MESH_BVH_MAGIC || hdr.meshNum != meshNum) {
+        fprintf(stderr, "Unknown section after the mesh geometry\n");
+        exit(1);
+    }
+
+    bvhs.resize(meshNum);
+    for (MeshBVH &bvh : bvhs) {
+        MeshBVHInfo info;
+        if (fread(&info, 1, sizeof(info), file) != sizeof(info)) {
+            fprintf(stderr, "Unable to read mesh BVH\n");
+            exit(1);
+        }
+
+        bvh.bounds = info.bounds;
+        bvh.nodes.resize(info.nodeCount);
+        bvh.triangles.resize(info.triangleCount);
+
+        if (fread(bvh.nodes.data(), sizeof(MeshBVHNode), info.nodeCount, file) != info.nodeCount ||
+            fread(bvh.triangles.data(), sizeof(MeshBVHTriangle), info.triangleCount, file) != info.triangleCount) {
+            fprintf(stderr, "Unable to read mesh BVH\n");
+            exit(1);
+        }
+    }
+
+    return true;
+}
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "types.h"
+#include "geometry.h"
+#include "renderer/renderer_types.h"
+
+#include <span>
+#include <stdio.h>
+#include <vector>
+
+namespace xjar {
+
+struct MeshRayHit {
+    f32 distance; // in units of the ray direction
+    u32 mesh;     // index into TriangleMesh::meshes
+    u32 triangle; // within the mesh
+    f32 u, v;     // barycentrics of v1 and v2
+};
+
+// binned SAH binary tree over the triangles, collapsed into 8-wide nodes with at most 3 triangles per leaf
+MeshBVH BuildMeshBVH(std::span<const glm::vec3> positions, std::span<const u32> indices);
+
+// closest hit along the ray within maxDistance, the ray is in the space of the mesh. The direction does not
+// have to be normalized, transforming a world ray by the inverse model matrix keeps its distances.
+bool RaycastMeshBVH(const MeshBVH &bvh, const Ray &ray, f32 maxDistance, MeshRayHit &hit);
+// any hit within maxDistance, for visibility tests
+bool IntersectsMeshBVH(const MeshBVH &bvh, const Ray &ray, f32 maxDistance);
+
+// the same over every mesh of a model, false if the model has no BVHs
+bool RaycastTriangleMesh(const TriangleMesh &mesh, const Ray &ray, f32 maxDistance, MeshRayHit &hit);
+bool IntersectsSegment(const TriangleMesh &mesh, const glm::vec3 &from, const glm::vec3 &to);
+
+// the optional .mesh section, see MeshBVHHdr. Reading returns false and leaves bvhs empty if the file
+// ends before it.
+void WriteMeshBVHs(FILE *file, std::span<const MeshBVH> bvhs);
+bool ReadMeshBVHs(FILE *file, u32 meshNum, std::vector<MeshBVH> &bvhs);
+
+}
@@ -0,0 +1,134 @@
+// no pch here, like the job system the profiler is linked into the tools as well
+#include "profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define XJAR_HAS_RDTSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define XJAR_HAS_RDTSC 1
+#else
+#define XJAR_HAS_RDTSC 0
+#endif
+
+namespace xjar {
+
+thread_local ProfileThread *Profiler::t_thread = nullptr;
+
+static u64 SteadyNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+u64 Profiler::Now() {
+#if XJAR_HAS_RDTSC
+    return __rdtsc();
+#else
+    return SteadyNs();
+#endif
+}
+
+Profiler &Profiler::Instance() {
+    static Profiler profiler;
+
+    return profiler;
+}
+
+Profiler::Profiler():
+    m_startTicks(Now()), m_startNs(SteadyNs()) {
+}
+
+ProfileThread *Profiler::RegisterThread() {
+    std::lock_guard<std::mutex> lock(m_threadsMutex);
+
+    m_threads.push_back(std::make_unique<ProfileThread>());
+    t_thread = m_threads.back().get();
+    t_thread->threadId = static_cast<u32>(m_threads.size() - 1);
+
+    return t_thread;
+}
+
+void Profiler::SetThreadName(const char *name) {
+    ProfileThread *thread = t_thread ? t_thread : RegisterThread();
+    thread->name = name;
+}
+
+static void WriteJsonString(FILE *file, const char *s) {
+    fputc('"', file);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', file);
+        fputc(*s, file);
+    }
+    fputc('"', file);
+}
+
+bool Profiler::WriteChromeTrace(const char *filename) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", filename);
+        return false;
+    }
+
+    // the tick rate is measured over the whole run, so rdtsc needs no calibration up front
+    const u64 ticks = Now() - m_startTicks;
+    const u64 ns = SteadyNs() - m_startNs;
+    const f64 usPerTick = ticks > 0 ? (f64)ns / (f64)ticks * 1e-3 : 1e-3;
+
+    std::lock_guard<std::mutex> lock(m_threadsMutex);
+
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+    bool                      firstEvent = true;
+    std::vector<ProfileEvent> events;
+    u64                       eventCount = 0;
+
+    for (const std::unique_ptr<ProfileThread> &thread : m_threads) {
+        // copy the newest events, then drop those the owner overwrote while they were copied
+        const u64 head = thread->head.load(std::memory_order_acquire);
+        const u64 first = head > PROFILE_RING_SIZE ? head - PROFILE_RING_SIZE : 0;
+
+        events.clear();
+        for (u64 i = first; i < head; i++)
+            events.push_back(thread->events[i % PROFILE_RING_SIZE]);
+
+        const u64 newHead = thread->head.load(std::memory_order_acquire);
+        const u64 overwritten = newHead > PROFILE_RING_SIZE ? std::min(newHead - PROFILE_RING_SIZE, head) : 0;
+        const u64 skip = overwritten > first ? overwritten - first : 0;
+
+        fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %u, \"args\": {\"name\": ",
+                firstEvent ? "" : ",\n", thread->threadId);
+        if (thread->name) {
+            WriteJsonString(file, thread->name);
+        } else {
+            fprintf(file, "\"thread %u\"", thread->threadId);
+        }
+        fprintf(file, "}}");
+        firstEvent = false;
+
+        for (size_t i = skip; i < events.size(); i++) {
+            const ProfileEvent &event = events[i];
+
+            fprintf(file, ",\n{\"name\": ");
+            WriteJsonString(file, event.name);
+            fprintf(file, ", \"ph\": \"X\", \"pid\": 0, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+                    thread->threadId,
+                    (f64)(int64_t)(event.start - m_startTicks) * usPerTick, // a zone may open before the profiler exists
+                    (f64)(event.end - event.start) * usPerTick);
+        }
+
+        eventCount += events.size() - skip;
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    printf("Wrote %llu zones of %zu threads to %s\n", (unsigned long long)eventCount, m_threads.size(), filename);
+
+    return true;
+}
+
+}
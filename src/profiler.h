@@ -0,0 +1,92 @@
+#pragma once
+
+#include "types.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// XJAR_ZONE("name") times the rest of the enclosing scope on the calling thread.
+// Zones are compiled in when XJAR_PROFILE is 1, which the build does for debug builds or with -DXJAR_PROFILE=ON.
+#if XJAR_PROFILE
+#define XJAR_ZONE_CONCAT_(a, b) a##b
+#define XJAR_ZONE_CONCAT(a, b) XJAR_ZONE_CONCAT_(a, b)
+#define XJAR_ZONE(name) ::xjar::ProfileZone XJAR_ZONE_CONCAT(xjarZone, __LINE__)(name)
+#define XJAR_PROFILE_THREAD(name) ::xjar::Profiler::Instance().SetThreadName(name)
+#else
+#define XJAR_ZONE(name) ((void)0)
+#define XJAR_PROFILE_THREAD(name) ((void)0)
+#endif
+
+namespace xjar {
+
+// zones a thread keeps, older ones are overwritten
+static constexpr u32 PROFILE_RING_SIZE = 1 << 16;
+
+struct ProfileEvent {
+    const char *name; // has to be a string literal, only the pointer is stored
+    u64         start;
+    u64         end;
+};
+
+// one per thread, only the owner thread writes to it
+struct alignas(64) ProfileThread {
+    std::atomic<u64> head {0}; // events written so far, published after the event
+    u32              threadId;
+    const char      *name = nullptr;
+    ProfileEvent     events[PROFILE_RING_SIZE];
+};
+
+// collects zones into per thread rings without locks, the trace is assembled on demand
+class Profiler {
+public:
+    static Profiler &Instance();
+
+    void SetThreadName(const char *name);
+
+    void Record(const char *name, u64 start, u64 end) {
+        ProfileThread *thread = t_thread ? t_thread : RegisterThread();
+
+        const u64 head = thread->head.load(std::memory_order_relaxed);
+        thread->events[head % PROFILE_RING_SIZE] = ProfileEvent {.name = name, .start = start, .end = end};
+        thread->head.store(head + 1, std::memory_order_release);
+    }
+
+    // Chrome trace event format, opens in chrome://tracing and ui.perfetto.dev
+    bool WriteChromeTrace(const char *filename);
+
+    static u64 Now();
+
+    Profiler(const Profiler &) = delete;
+    Profiler &operator=(const Profiler &) = delete;
+
+private:
+    Profiler();
+
+    ProfileThread *RegisterThread();
+
+    static thread_local ProfileThread *t_thread;
+
+    std::mutex                                  m_threadsMutex; // only taken when a thread records its first zone
+    std::vector<std::unique_ptr<ProfileThread>> m_threads;
+
+    // Now() ticks and steady_clock nanoseconds at startup, the trace converts with the rate since then
+    u64 m_startTicks;
+    u64 m_startNs;
+};
+
+struct ProfileZone {
+    explicit ProfileZone(const char *name):
+        name(name), start(Profiler::Now()) {
+    }
+
+    ~ProfileZone() {
+        Profiler::Instance().Record(name, start, Profiler::Now());
+    }
+
+    const char *name;
+    u64         start;
+};
+
+}
@@ -4,6 +4,9 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/constants.hpp>
+#include <stdio.h>
+#include <vector>
 #include "game_input.h"
 namespace xjar {
 
@@ -85,4 +88,67 @@ struct FirstPerson_Camera {
     }
 };
 
+// scripted camera for benchmark runs, the keys are spread evenly over the run and interpolated linearly
+struct CameraPath {
+    struct Key {
+        glm::vec3 position;
+        glm::vec3 target;
+    };
+
+    std::vector<Key> keys;
+
+    // one key per line: px py pz tx ty tz, lines starting with # are skipped
+    bool Load(const char *filename) {
+        FILE *file = fopen(filename, "r");
+        if (!file) {
+            fprintf(stderr, "Failed to open camera path %s\n", filename);
+            return false;
+        }
+
+        char line[256];
+        while (fgets(line, sizeof(line), file)) {
+            Key key;
+            if (line[0] == '#')
+                continue;
+
+            if (sscanf(line, "%f %f %f %f %f %f",
+                       &key.position.x, &key.position.y, &key.position.z,
+                       &key.target.x, &key.target.y, &key.target.z) == 6) {
+                keys.push_back(key);
+            }
+        }
+
+        fclose(file);
+
+        if (keys.empty()) {
+            fprintf(stderr, "Camera path %s has no keys\n", filename);
+            return false;
+        }
+
+        return true;
+    }
+
+    void Orbit(const glm::vec3 &center, f32 radius, f32 height, u32 keyCount) {
+        keys.clear();
+        for (u32 i = 0; i <= keyCount; i++) {
+            const f32 angle = glm::two_pi<f32>() * i / keyCount;
+            keys.push_back(Key {
+                .position = center + glm::vec3(radius * glm::cos(angle), height, radius * glm::sin(angle)),
+                .target = center});
+        }
+    }
+
+    // t goes from 0 at the first key to 1 at the last one
+    glm::mat4 GetViewMatrix(f32 t, glm::vec3 *position) const {
+        const f32 along = glm::clamp(t, 0.0f, 1.0f) * (keys.size() - 1);
+        const u32 index = std::min(static_cast<u32>(along), static_cast<u32>(keys.size() - 1));
+        const Key &a = keys[index];
+        const Key &b = keys[std::min<size_t>(index + 1, keys.size() - 1)];
+        const f32 blend = along - index;
+
+        *position = glm::mix(a.position, b.position, blend);
+        return glm::lookAt(*position, glm::mix(a.target, b.target, blend), glm::vec3(0.0f, 1.0f, 0.0f));
+    }
+};
+
 }
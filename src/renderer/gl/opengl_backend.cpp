@@ -36,8 +36,10 @@ void OpenGL_Backend::OnInit() {
 
     g_window = static_cast<GLFWwindow *>(xjar::GetWindow().handle);
 
+    m_gpuProfiler.Init();
 }
 void OpenGL_Backend::OnDestroy() {
+    m_gpuProfiler.Destroy();
 }
 
 void OpenGL_Backend::OnResized(u32 width, u32 height) {
@@ -65,12 +67,8 @@ void OpenGL_Backend::CreateTexture(const void *pixels, Texture *texture) {
 }
 
 void OpenGL_Backend::CreateMesh(Model &model) {
-    size_t vertexDataSize = model.mesh.vertexData.size() * sizeof(model.mesh.vertexData[0]);
-    size_t indexDataSize = model.mesh.indexData.size() * sizeof(model.mesh.indexData[0]);
-
     OpenGL_Mesh *glmesh = new OpenGL_Mesh();
-    glmesh->Init(model.mesh.indexData.data(), indexDataSize, 
-            model.mesh.vertexData.data(), vertexDataSize);
+    glmesh->Init(model.mesh);
 
     model.handle = glmesh;
 }
@@ -79,6 +77,7 @@ void OpenGL_Backend::DestroyTexture(Texture *texture) {
 }
 
 void OpenGL_Backend::BeginDefaultPass() {
+    m_gpuProfiler.BeginPass(GPU_PASS_MESH);
     glEnable(GL_DEPTH_TEST);
 
     glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
@@ -88,6 +87,7 @@ void OpenGL_Backend::BeginDefaultPass() {
 
 void OpenGL_Backend::EndDefaultPass() {
     glDisable(GL_DEPTH_TEST);
+    m_gpuProfiler.EndPass(GPU_PASS_MESH);
 }
 
 FrameStatus OpenGL_Backend::BeginFrame() {
@@ -96,6 +96,8 @@ FrameStatus OpenGL_Backend::BeginFrame() {
     glfwGetFramebufferSize(g_window, &w, &h);
     glViewport(0, 0, w, h);
 
+    m_gpuProfiler.BeginFrame();
+
     FrameStatus frame{.success = true, .data = nullptr};
     return frame;
 }
@@ -104,4 +106,8 @@ void OpenGL_Backend::EndFrame() {
     glfwSwapBuffers(g_window);
 }
 
+GpuProfileHistory *OpenGL_Backend::GetGpuProfile() {
+    return m_gpuProfiler.GetHistory();
+}
+
 }
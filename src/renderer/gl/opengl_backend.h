@@ -1,5 +1,6 @@
 #include <glad/glad.h>
 #include "renderer/renderer_backend.h"
+#include "opengl_gpu_profiler.h"
 
 namespace xjar {
 
@@ -18,6 +19,10 @@ public:
     void        BeginDefaultPass() override;
     void        EndDefaultPass() override;
     void        EndFrame() override;
+    GpuProfileHistory *GetGpuProfile() override;
+
+private:
+    OpenGL_GpuProfiler m_gpuProfiler;
 };
 
 }
@@ -0,0 +1,76 @@
+#include "opengl_gpu_profiler.h"
+
+#include <algorithm>
+
+namespace xjar {
+
+void OpenGL_GpuProfiler::Init() {
+    glGenQueries(GL_PROFILE_LATENCY * GPU_PASS_COUNT * 2, &m_queries[0][0][0]);
+}
+
+void OpenGL_GpuProfiler::Destroy() {
+    glDeleteQueries(GL_PROFILE_LATENCY * GPU_PASS_COUNT * 2, &m_queries[0][0][0]);
+}
+
+void OpenGL_GpuProfiler::ReadBack(u32 slot) {
+    f64 passMs[GPU_PASS_COUNT];
+    u64 first = ~0ull;
+    u64 last = 0;
+
+    for (u32 pass = 0; pass < GPU_PASS_COUNT; pass++) {
+        passMs[pass] = -1.0;
+        if (!(m_endedPasses[slot] & (1u << pass)))
+            continue;
+
+        // the end query completes last, a frame that is still in flight is dropped instead of waited for
+        GLint available = 0;
+        glGetQueryObjectiv(m_queries[slot][pass][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+
+        GLuint64 begin = 0;
+        GLuint64 end = 0;
+        glGetQueryObjectui64v(m_queries[slot][pass][0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(m_queries[slot][pass][1], GL_QUERY_RESULT, &end);
+
+        passMs[pass] = (end - begin) * 1e-6;
+        first = std::min<u64>(first, begin);
+        last = std::max<u64>(last, end);
+    }
+
+    if (first > last)
+        return;
+
+    m_history.AddFrame(m_frameNumbers[slot], passMs, (last - first) * 1e-6);
+}
+
+void OpenGL_GpuProfiler::BeginFrame() {
+    m_currentSlot = m_frameNumber % GL_PROFILE_LATENCY;
+
+    if (m_endedPasses[m_currentSlot] != 0)
+        ReadBack(m_currentSlot);
+
+    m_beganPasses[m_currentSlot] = 0;
+    m_endedPasses[m_currentSlot] = 0;
+    m_frameNumbers[m_currentSlot] = m_frameNumber++;
+}
+
+void OpenGL_GpuProfiler::BeginPass(u32 pass) {
+    const u32 bit = 1u << pass;
+    if (m_beganPasses[m_currentSlot] & bit)
+        return;
+
+    m_beganPasses[m_currentSlot] |= bit;
+    glQueryCounter(m_queries[m_currentSlot][pass][0], GL_TIMESTAMP);
+}
+
+void OpenGL_GpuProfiler::EndPass(u32 pass) {
+    const u32 bit = 1u << pass;
+    if (!(m_beganPasses[m_currentSlot] & bit) || (m_endedPasses[m_currentSlot] & bit))
+        return;
+
+    m_endedPasses[m_currentSlot] |= bit;
+    glQueryCounter(m_queries[m_currentSlot][pass][1], GL_TIMESTAMP);
+}
+
+}
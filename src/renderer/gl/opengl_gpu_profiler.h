@@ -0,0 +1,39 @@
+#pragma once
+
+#include <glad/glad.h>
+#include "renderer/gpu_profiler.h"
+
+namespace xjar {
+
+// frames a query result is given to arrive before the frame is dropped from the history
+static constexpr u32 GL_PROFILE_LATENCY = 4;
+
+// GL_TIMESTAMP queries around the passes. The queries of a frame are checked GL_PROFILE_LATENCY
+// frames later and only read if they are available, so the CPU never waits for the GPU.
+class OpenGL_GpuProfiler final {
+public:
+    void Init();
+    void Destroy();
+
+    void BeginFrame();
+    void BeginPass(u32 pass);
+    void EndPass(u32 pass);
+
+    GpuProfileHistory *GetHistory() {
+        return &m_history;
+    }
+
+private:
+    void ReadBack(u32 slot);
+
+    GLuint m_queries[GL_PROFILE_LATENCY][GPU_PASS_COUNT][2];
+    u32    m_beganPasses[GL_PROFILE_LATENCY] = {};
+    u32    m_endedPasses[GL_PROFILE_LATENCY] = {};
+    u64    m_frameNumbers[GL_PROFILE_LATENCY] = {};
+    u32    m_currentSlot = 0;
+    u64    m_frameNumber = 0;
+
+    GpuProfileHistory m_history;
+};
+
+}
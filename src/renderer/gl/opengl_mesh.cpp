@@ -3,8 +3,21 @@
 
 namespace xjar {
 
-void OpenGL_Mesh::Init(const u32 *indices, u32 indicesSizeInBytes, const f32 *vertices, u32 verticesSizeInBytes) {
-    m_numIndices = indicesSizeInBytes / sizeof(u32);
+void OpenGL_Mesh::Init(const TriangleMesh &mesh) {
+    const u32 indicesSizeInBytes = static_cast<u32>(mesh.indexData.size());
+    const u32 verticesSizeInBytes = static_cast<u32>(mesh.vertexData.size() * sizeof(f32));
+    const u8 *indices = mesh.indexData.data();
+    const f32 *vertices = mesh.vertexData.data();
+
+    // one range per mesh since every mesh has its own index format
+    m_ranges.reserve(mesh.meshes.size());
+    for (const Mesh &m : mesh.meshes) {
+        m_ranges.push_back(DrawRange {
+            .numIndices = m.LodIndexCount(0),
+            .indexType = m.indexFormat == INDEX_FORMAT_U16 ? (GLenum)GL_UNSIGNED_SHORT : (GLenum)GL_UNSIGNED_INT,
+            .indexByteOffset = m.lodOffset[0],
+            .baseVertex = static_cast<i32>(m.vertexOffset)});
+    }
 
     glCreateVertexArrays(1, &m_vertexArray); 
     glCreateBuffers(1, &m_vertexBuffer);
@@ -34,7 +47,10 @@ void OpenGL_Mesh::Init(const u32 *indices, u32 indicesSizeInBytes, const f32 *ve
 
 void OpenGL_Mesh::Draw() {
     glBindVertexArray(m_vertexArray);
-    glDrawElements(GL_TRIANGLES, m_numIndices, GL_UNSIGNED_INT, nullptr);
+    for (const DrawRange &range : m_ranges) {
+        glDrawElementsBaseVertex(GL_TRIANGLES, range.numIndices, range.indexType,
+                                 (void *)(uintptr_t)range.indexByteOffset, range.baseVertex);
+    }
 }
 
 OpenGL_Mesh::~OpenGL_Mesh() {
@@ -10,13 +10,20 @@ public:
     OpenGL_Mesh() = default;
     ~OpenGL_Mesh();
 
-    void Init(const u32 *indices, u32 indicesSizeInBytes, const f32 *vertices, u32 verticesSizeInBytes);
+    void Init(const TriangleMesh &mesh);
     void Draw();
 private:
-    GLuint m_vertexBuffer;
-    GLuint m_indexBuffer;
-    GLuint m_vertexArray;
-    u32    m_numIndices;
+    struct DrawRange {
+        u32    numIndices;
+        GLenum indexType;
+        u32    indexByteOffset;
+        i32    baseVertex;
+    };
+
+    GLuint                 m_vertexBuffer;
+    GLuint                 m_indexBuffer;
+    GLuint                 m_vertexArray;
+    std::vector<DrawRange> m_ranges;
 };
 
 }
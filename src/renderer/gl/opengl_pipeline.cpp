@@ -1,9 +1,113 @@
 #include <glad/glad.h>
 #include "opengl_pipeline.h"
 
+#include <filesystem>
+
 namespace xjar {
 
+static constexpr char PROGRAM_CACHE_DIR[] = "shader_cache";
+static constexpr u32  PROGRAM_CACHE_MAGIC = 0x5047584a; // "JXGP"
+
+struct ProgramBinaryHdr {
+    u32    magicValue;
+    GLenum binaryFormat;
+    u32    binarySize;
+};
+
+static u64 HashString(u64 hash, const char *str) {
+    // FNV-1a
+    for (; str && *str; str++) {
+        hash ^= (u8)*str;
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+static bool IsProgramBinarySupported() {
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+
+    return formats > 0;
+}
+
+bool OpenGL_Shader::LoadProgramBinary(const char *filename) {
+    FILE *f = fopen(filename, "rb");
+    if (!f)
+        return false;
+
+    ProgramBinaryHdr  hdr;
+    std::vector<char> binary;
+    bool              ok = fread(&hdr, 1, sizeof(hdr), f) == sizeof(hdr) && hdr.magicValue == PROGRAM_CACHE_MAGIC;
+    if (ok) {
+        binary.resize(hdr.binarySize);
+        ok = fread(binary.data(), 1, hdr.binarySize, f) == hdr.binarySize;
+    }
+    fclose(f);
+
+    if (!ok)
+        return false;
+
+    program = glCreateProgram();
+    glProgramBinary(program, hdr.binaryFormat, binary.data(), static_cast<GLsizei>(binary.size()));
+
+    // the driver is free to reject a binary, e.g. after an update
+    GLint success = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glDeleteProgram(program);
+        program = 0;
+        return false;
+    }
+
+    return true;
+}
+
+void OpenGL_Shader::SaveProgramBinary(const char *filename) {
+    GLint size = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+    if (size <= 0)
+        return;
+
+    std::vector<char> binary(size);
+    ProgramBinaryHdr  hdr {};
+    hdr.magicValue = PROGRAM_CACHE_MAGIC;
+    glGetProgramBinary(program, size, nullptr, &hdr.binaryFormat, binary.data());
+    hdr.binarySize = static_cast<u32>(size);
+
+    std::error_code ec;
+    std::filesystem::create_directories(PROGRAM_CACHE_DIR, ec);
+
+    FILE *f = fopen(filename, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to write program binary %s\n", filename);
+        return;
+    }
+
+    fwrite(&hdr, 1, sizeof(hdr), f);
+    fwrite(binary.data(), 1, binary.size(), f);
+    fclose(f);
+}
+
 void OpenGL_Shader::CreateShader(const char *vs, const char *fs) {
+    const bool useCache = IsProgramBinarySupported();
+
+    char cacheFile[256] = {};
+    if (useCache) {
+        u64 hash = 0xcbf29ce484222325ull;
+        hash = HashString(hash, vs);
+        hash = HashString(hash, fs);
+        hash = HashString(hash, (const char *)glGetString(GL_VENDOR));
+        hash = HashString(hash, (const char *)glGetString(GL_RENDERER));
+        hash = HashString(hash, (const char *)glGetString(GL_VERSION));
+        snprintf(cacheFile, sizeof(cacheFile), "%s/%016llx.bin", PROGRAM_CACHE_DIR, (unsigned long long)hash);
+
+        if (LoadProgramBinary(cacheFile)) {
+            glUseProgram(program);
+            return;
+        }
+    }
+
     const GLuint shaderVertex = glCreateShader(GL_VERTEX_SHADER);
 
     glShaderSource(shaderVertex, 1, &vs, nullptr);
@@ -19,9 +123,14 @@ void OpenGL_Shader::CreateShader(const char *vs, const char *fs) {
 
     glAttachShader(program, shaderVertex);
     glAttachShader(program, shaderFragment);
+    if (useCache)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(program);
     CheckErrors(program, "PROGRAM");
 
+    if (useCache)
+        SaveProgramBinary(cacheFile);
+
     glDeleteShader(shaderFragment);
     glDeleteShader(shaderVertex);
     glUseProgram(program);
@@ -6,8 +6,11 @@
 namespace xjar {
 
 struct OpenGL_Shader {
+    // the linked program is cached with glProgramBinary, keyed by the sources and the driver strings
     void CreateShader(const char *vs, const char *fs);
     void CheckErrors(GLuint shader, std::string type);
+    bool LoadProgramBinary(const char *filename);
+    void SaveProgramBinary(const char *filename);
     void Bind();
     void Unbind();
 
@@ -0,0 +1,146 @@
+#include "pch.h"
+#include "gpu_profiler.h"
+
+namespace xjar {
+
+const char *GpuPassName(u32 pass) {
+    static const char *names[GPU_PASS_COUNT] = {"shadow", "lights", "prepass", "mesh", "grid", "final"};
+
+    return pass < GPU_PASS_COUNT ? names[pass] : "unknown";
+}
+
+void GpuProfileHistory::AddFrame(u64 frameNumber, const f64 (&passMs)[GPU_PASS_COUNT], f64 frameMs) {
+    FrameSample &frame = m_frames[m_head];
+    frame.frameNumber = frameNumber;
+    frame.frameMs = frameMs;
+    for (u32 pass = 0; pass < GPU_PASS_COUNT; pass++)
+        frame.passMs[pass] = passMs[pass];
+
+    m_head = (m_head + 1) % GPU_PROFILE_HISTORY;
+    m_count = std::min(m_count + 1, GPU_PROFILE_HISTORY);
+}
+
+template <typename F>
+GpuPassStats GpuProfileHistory::ComputeStats(F &&sampleOf) const {
+    f64 samples[GPU_PROFILE_HISTORY];
+    u32 sampleCount = 0;
+    f64 sum = 0.0;
+
+    for (u32 i = 0; i < m_count; i++) {
+        const f64 ms = sampleOf(GetFrame(i));
+        if (ms < 0.0)
+            continue;
+
+        samples[sampleCount++] = ms;
+        sum += ms;
+    }
+
+    if (sampleCount == 0)
+        return GpuPassStats {};
+
+    std::sort(samples, samples + sampleCount);
+
+    // nearest rank
+    const u32 p99Rank = (sampleCount * 99 + 99) / 100;
+
+    return GpuPassStats {
+        .minMs = samples[0],
+        .avgMs = sum / sampleCount,
+        .p99Ms = samples[p99Rank - 1],
+        .samples = sampleCount};
+}
+
+GpuPassStats GpuProfileHistory::GetStats(u32 pass) const {
+    return ComputeStats([pass](const FrameSample &frame) { return frame.passMs[pass]; });
+}
+
+GpuPassStats GpuProfileHistory::GetFrameStats() const {
+    return ComputeStats([](const FrameSample &frame) { return frame.frameMs; });
+}
+
+bool GpuProfileHistory::ExportCsv(const char *filename) const {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", filename);
+        return false;
+    }
+
+    fprintf(file, "frame");
+    for (u32 pass = 0; pass < GPU_PASS_COUNT; pass++)
+        fprintf(file, ",%s_ms", GpuPassName(pass));
+    fprintf(file, ",frame_ms\n");
+
+    // passes that were not recorded are left empty
+    for (u32 i = 0; i < m_count; i++) {
+        const FrameSample &frame = GetFrame(i);
+
+        fprintf(file, "%llu", (unsigned long long)frame.frameNumber);
+        for (u32 pass = 0; pass < GPU_PASS_COUNT; pass++) {
+            if (frame.passMs[pass] < 0.0)
+                fprintf(file, ",");
+            else
+                fprintf(file, ",%.4f", frame.passMs[pass]);
+        }
+        fprintf(file, ",%.4f\n", frame.frameMs);
+    }
+
+    fclose(file);
+
+    return true;
+}
+
+static void WriteJsonStats(FILE *file, const char *name, const GpuPassStats &stats) {
+    fprintf(file, "    \"%s\": {\"min_ms\": %.4f, \"avg_ms\": %.4f, \"p99_ms\": %.4f, \"samples\": %u}",
+            name, stats.minMs, stats.avgMs, stats.p99Ms, stats.samples);
+}
+
+bool GpuProfileHistory::ExportJson(const char *filename) const {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", filename);
+        return false;
+    }
+
+    fprintf(file, "{\n  \"summary\": {\n");
+    for (u32 pass = 0; pass < GPU_PASS_COUNT; pass++) {
+        WriteJsonStats(file, GpuPassName(pass), GetStats(pass));
+        fprintf(file, ",\n");
+    }
+    WriteJsonStats(file, "frame", GetFrameStats());
+    fprintf(file, "\n  },\n  \"frames\": [\n");
+
+    // null marks a pass that was not recorded in the frame
+    for (u32 i = 0; i < m_count; i++) {
+        const FrameSample &frame = GetFrame(i);
+
+        fprintf(file, "    {\"frame\": %llu", (unsigned long long)frame.frameNumber);
+        for (u32 pass = 0; pass < GPU_PASS_COUNT; pass++) {
+            if (frame.passMs[pass] < 0.0)
+                fprintf(file, ", \"%s_ms\": null", GpuPassName(pass));
+            else
+                fprintf(file, ", \"%s_ms\": %.4f", GpuPassName(pass), frame.passMs[pass]);
+        }
+        fprintf(file, ", \"frame_ms\": %.4f}%s\n", frame.frameMs, i + 1 < m_count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+
+    fclose(file);
+
+    return true;
+}
+
+void GpuProfileHistory::Print() const {
+    printf("GPU over the last %u frames:\n", m_count);
+    for (u32 pass = 0; pass < GPU_PASS_COUNT; pass++) {
+        const GpuPassStats stats = GetStats(pass);
+        if (stats.samples == 0)
+            continue;
+
+        printf("  %-8s min %.3f ms, avg %.3f ms, p99 %.3f ms\n", GpuPassName(pass), stats.minMs, stats.avgMs, stats.p99Ms);
+    }
+
+    const GpuPassStats frame = GetFrameStats();
+    printf("  %-8s min %.3f ms, avg %.3f ms, p99 %.3f ms\n", "frame", frame.minMs, frame.avgMs, frame.p99Ms);
+}
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "types.h"
+
+namespace xjar {
+
+// passes the backends put timestamps around
+enum GpuPass : u32 {
+    GPU_PASS_SHADOW = 0,
+    GPU_PASS_LIGHTS,  // clustered light binning
+    GPU_PASS_PREPASS, // depth only, before the mesh pass
+    GPU_PASS_MESH,
+    GPU_PASS_GRID,
+    GPU_PASS_FINAL,
+    GPU_PASS_COUNT
+};
+
+const char *GpuPassName(u32 pass);
+
+// frames kept for the statistics and the exports
+static constexpr u32 GPU_PROFILE_HISTORY = 512;
+
+struct GpuPassStats {
+    f64 minMs;
+    f64 avgMs;
+    f64 p99Ms;
+    u32 samples;
+};
+
+// rolling per pass GPU times fed by the backend once the queries of a frame are read back.
+// A pass that was not recorded in a frame has a negative time and is skipped by the stats.
+class GpuProfileHistory {
+public:
+    void AddFrame(u64 frameNumber, const f64 (&passMs)[GPU_PASS_COUNT], f64 frameMs);
+
+    GpuPassStats GetStats(u32 pass) const;
+    // the whole frame, from the first to the last timestamp of it
+    GpuPassStats GetFrameStats() const;
+
+    u32 GetFrameCount() const {
+        return m_count;
+    }
+
+    // one row per frame, oldest first
+    bool ExportCsv(const char *filename) const;
+    // the summary of every pass and the raw history
+    bool ExportJson(const char *filename) const;
+    void Print() const;
+
+private:
+    struct FrameSample {
+        u64 frameNumber;
+        f64 passMs[GPU_PASS_COUNT];
+        f64 frameMs;
+    };
+
+    template <typename F>
+    GpuPassStats ComputeStats(F &&sampleOf) const;
+
+    const FrameSample &GetFrame(u32 i) const {
+        return m_frames[(m_head + GPU_PROFILE_HISTORY - m_count + i) % GPU_PROFILE_HISTORY];
+    }
+
+    FrameSample m_frames[GPU_PROFILE_HISTORY];
+    u32         m_head = 0;  // slot of the next frame
+    u32         m_count = 0; // valid frames, at most GPU_PROFILE_HISTORY
+};
+
+}
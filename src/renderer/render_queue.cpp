@@ -0,0 +1,76 @@
+// no pch here, the queue is also linked into the benchmark target
+#include "render_queue.h"
+#include "profiler.h"
+
+#include <string.h>
+#include <utility>
+
+namespace xjar {
+
+// flips the float so that its bits compare as unsigned integers in the order of the values
+static u32 SortableDepth(f32 depth) {
+    u32 bits;
+    memcpy(&bits, &depth, sizeof(bits));
+
+    return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+}
+
+u64 MakeSortKey(u32 pass, u32 variant, u32 material, f32 depth) {
+    const u64 variantMask = (1ull << SORT_KEY_VARIANT_BITS) - 1;
+    const u64 materialMask = (1ull << SORT_KEY_MATERIAL_BITS) - 1;
+
+    return (static_cast<u64>(pass & 0x3) << 62) |
+           ((variant & variantMask) << 56) |
+           ((material & materialMask) << 32) |
+           SortableDepth(depth);
+}
+
+std::span<const u32> RenderQueue::Sort() {
+    XJAR_ZONE("RenderQueue::Sort");
+
+    constexpr u32 DIGIT_COUNT = sizeof(u64);
+    constexpr u32 BUCKET_COUNT = 256;
+
+    const size_t count = m_items.size();
+    m_scratch.resize(count);
+    m_order.resize(count);
+
+    // the histograms of all digits in one sweep over the keys
+    u32 histograms[DIGIT_COUNT][BUCKET_COUNT] = {};
+    for (const Item &item : m_items) {
+        for (u32 digit = 0; digit < DIGIT_COUNT; digit++) {
+            histograms[digit][(item.key >> (digit * 8)) & 0xff]++;
+        }
+    }
+
+    Item *src = m_items.data();
+    Item *dst = m_scratch.data();
+    for (u32 digit = 0; digit < DIGIT_COUNT; digit++) {
+        u32 *histogram = histograms[digit];
+
+        // the pass, the variant and often the material are the same for the whole pass
+        if (count == 0 || histogram[(src[0].key >> (digit * 8)) & 0xff] == count)
+            continue;
+
+        u32 offset = 0;
+        for (u32 bucket = 0; bucket < BUCKET_COUNT; bucket++) {
+            const u32 bucketCount = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += bucketCount;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            dst[histogram[(src[i].key >> (digit * 8)) & 0xff]++] = src[i];
+        }
+
+        std::swap(src, dst);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        m_order[i] = src[i].index;
+    }
+
+    return m_order;
+}
+
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "types.h"
+
+#include <span>
+#include <vector>
+
+namespace xjar {
+
+// 64 bit draw sort key, the most significant field first:
+//   63..62 pass, 61..56 pipeline variant, 55..32 material, 31..0 depth
+// so a pass switches pipelines and sets as rarely as possible and draws the opaque geometry front to back
+static constexpr u32 SORT_KEY_VARIANT_BITS  = 6;
+static constexpr u32 SORT_KEY_MATERIAL_BITS = 24;
+
+// depth is any value growing away from the viewer, e.g. the clip space z of the draw's origin
+u64 MakeSortKey(u32 pass, u32 variant, u32 material, f32 depth);
+
+// the draws of one pass, pushed unordered and submitted in key order
+class RenderQueue final {
+public:
+    void Clear() {
+        m_items.clear();
+    }
+
+    void Push(u64 key, u32 index) {
+        m_items.push_back({key, index});
+    }
+
+    u32 Count() const {
+        return static_cast<u32>(m_items.size());
+    }
+
+    // the pushed indices in ascending key order, valid until the next Clear or Sort.
+    // A stable least significant digit radix sort, digits every key shares are skipped
+    std::span<const u32> Sort();
+
+private:
+    struct Item {
+        u64 key;
+        u32 index;
+    };
+
+    // the buffers are kept between frames, so a sort doesn't allocate once they have grown
+    std::vector<Item> m_items;
+    std::vector<Item> m_scratch;
+    std::vector<u32>  m_order;
+};
+
+}
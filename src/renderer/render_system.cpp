@@ -3,6 +3,7 @@
 #include "resource_types.h"
 
 #include "renderer_backend.h"
+#include "gpu_profiler.h"
 
 #if RENDERER_BACKEND == OpenGL
 #include "gl/opengl_backend.h"
@@ -13,6 +14,9 @@
 #endif
 
 #include "texture_manager.h"
+#include "mesh_bvh.h"
+#include "job_system.h"
+#include "profiler.h"
 #include "window.h"
 
 namespace xjar {
@@ -34,6 +38,7 @@ void RenderSystem::Startup() {
     
 #endif
 
+    g_backend->SetDynamicRendering(m_dynamicRendering);
     g_backend->OnInit();
 }
 
@@ -65,7 +70,95 @@ void RenderSystem::LoadInstanceData(const char *filename, std::vector<InstanceDa
     fclose(file);
 }
 
+// meshes converted before the position stream existed get it built from the attribute stream
+static void AddPositionStream(TriangleMesh &mesh) {
+    const u32 positionStreamOffset = static_cast<u32>(mesh.vertexData.size() * sizeof(f32));
+    const u32 positionSize = sizeof(f32) * 3;
+
+    size_t vertexCount = 0;
+    for (const Mesh &m : mesh.meshes)
+        vertexCount += m.vertexCount;
+    mesh.vertexData.reserve(mesh.vertexData.size() + vertexCount * 3);
+
+    for (Mesh &m : mesh.meshes) {
+        const u32 stride = m.streamElementSize[ATTRIBUTE_STREAM] / sizeof(f32);
+        const u64 first = m.streamOffset[ATTRIBUTE_STREAM] / sizeof(f32);
+
+        for (u32 v = 0; v < m.vertexCount; v++) {
+            const f32 x = mesh.vertexData[first + v * stride + 0];
+            const f32 y = mesh.vertexData[first + v * stride + 1];
+            const f32 z = mesh.vertexData[first + v * stride + 2];
+            mesh.vertexData.push_back(x);
+            mesh.vertexData.push_back(y);
+            mesh.vertexData.push_back(z);
+        }
+
+        m.streamNum = 2;
+        m.streamOffset[POSITION_STREAM] = positionStreamOffset + m.vertexOffset * positionSize;
+        m.streamElementSize[POSITION_STREAM] = positionSize;
+    }
+
+    mesh.positionStreamOffset = positionStreamOffset;
+}
+
+static AABB ComputeBounds(const TriangleMesh &mesh) {
+    AABB bounds {.min = glm::vec3(std::numeric_limits<f32>::max()), .max = glm::vec3(-std::numeric_limits<f32>::max())};
+
+    for (const Mesh &m : mesh.meshes) {
+        if (m.vertexCount == 0)
+            continue;
+
+        const f32 *positions = &mesh.vertexData[m.streamOffset[POSITION_STREAM] / sizeof(f32)];
+        for (u32 v = 0; v < m.vertexCount; v++) {
+            const glm::vec3 pos(positions[v * 3 + 0], positions[v * 3 + 1], positions[v * 3 + 2]);
+            bounds.min = glm::min(bounds.min, pos);
+            bounds.max = glm::max(bounds.max, pos);
+        }
+    }
+
+    if (bounds.min.x > bounds.max.x)
+        bounds.min = bounds.max = glm::vec3(0.0f);
+
+    return bounds;
+}
+
 void RenderSystem::LoadModel(const char *meshFilename, const char *instanceFilename, const char *materialFilename, Model &model) {
+    XJAR_ZONE("RenderSystem::LoadModel");
+
+    ModelFiles files {meshFilename, instanceFilename, materialFilename};
+    Model *models[] = {&model};
+
+    LoadModels({&files, 1}, models);
+}
+
+void RenderSystem::LoadModels(std::span<const ModelFiles> files, std::span<Model *const> models) {
+    XJAR_ZONE("RenderSystem::LoadModels");
+
+    assert(files.size() == models.size());
+
+    const u32 modelCount = static_cast<u32>(files.size());
+    std::vector<ModelSource> sources(modelCount);
+
+    JobSystem::Instance().ParallelFor(modelCount, 1, [&](u32 first, u32 count) {
+        for (u32 i = first; i < first + count; i++)
+            ReadModel(files[i], *models[i], sources[i]);
+    });
+
+    std::vector<std::string> textureFilenames;
+    for (const ModelSource &source : sources)
+        textureFilenames.insert(textureFilenames.end(), source.textureFilenames.begin(), source.textureFilenames.end());
+
+    TextureManager::Instance().Preload(textureFilenames);
+
+    XJAR_ZONE("RenderSystem::CreateModels");
+    for (u32 i = 0; i < modelCount; i++)
+        g_backend->CreateModel(sources[i].instances, sources[i].materials, sources[i].textureFilenames, *models[i]);
+}
+
+void RenderSystem::ReadModel(const ModelFiles &files, Model &model, ModelSource &source) {
+    XJAR_ZONE("RenderSystem::ReadModel");
+
+    const char *meshFilename = files.meshFilename;
 
     FILE *file = fopen(meshFilename, "rb");
     if (!file) {
@@ -80,6 +173,10 @@ void RenderSystem::LoadModel(const char *meshFilename, const char *instanceFilen
     }
 
     const u32 meshNum = hdr.meshNum;
+    if (meshNum == 0) {
+        fprintf(stderr, "No meshes in %s file\n", meshFilename);
+        exit(1);
+    }
     model.mesh.meshes.resize(meshNum);
 
     if (fread(model.mesh.meshes.data(), sizeof(Mesh), meshNum, file) != meshNum) {
@@ -89,7 +186,7 @@ void RenderSystem::LoadModel(const char *meshFilename, const char *instanceFilen
 
     const u32 indexDataSize = hdr.indexDataSize;
     const u32 vertexDataSize = hdr.vertexDataSize;
-    model.mesh.indexData.resize(indexDataSize / sizeof(u32));
+    model.mesh.indexData.resize(indexDataSize);
     model.mesh.vertexData.resize(vertexDataSize / sizeof(f32));
 
     if (fread(model.mesh.indexData.data(), 1, indexDataSize, file) != indexDataSize ||
@@ -98,14 +195,21 @@ void RenderSystem::LoadModel(const char *meshFilename, const char *instanceFilen
         exit(1);
     }
 
-    std::vector<InstanceData> instances;
-    LoadInstanceData(instanceFilename, instances);
+    ReadMeshBVHs(file, meshNum, model.mesh.bvhs);
 
-    std::vector<std::string> textureFilenames;
-    std::vector<MaterialDescr> materials;
-    LoadMaterials(materialFilename, materials, textureFilenames);
+    fclose(file);
+
+    const Mesh &first = model.mesh.meshes[0];
+    if (first.streamNum > POSITION_STREAM) {
+        model.mesh.positionStreamOffset = static_cast<u32>(first.streamOffset[POSITION_STREAM] - first.vertexOffset * first.streamElementSize[POSITION_STREAM]);
+    } else {
+        AddPositionStream(model.mesh);
+    }
 
-    g_backend->CreateModel(instances, materials, textureFilenames, model);
+    model.bounds = ComputeBounds(model.mesh);
+
+    LoadInstanceData(files.instanceFilename, source.instances);
+    LoadMaterials(files.materialFilename, source.materials, source.textureFilenames);
 }
 
 void RenderSystem::LoadMaterials(const char *fileName, std::vector<MaterialDescr> &materials, std::vector<std::string> &files) {
@@ -137,8 +241,11 @@ void RenderSystem::LoadMaterials(const char *fileName, std::vector<MaterialDescr
 
     fclose(f);
 }
-void RenderSystem::DrawEntities(FrameStatus frame, GPU_SceneData *sceneData, std::initializer_list<Entity *> entities) {
-    g_backend->DrawEntities(frame, sceneData, entities);
+
+void RenderSystem::DrawEntities(FrameStatus frame, GPU_SceneData *sceneData, const RenderList &list) {
+    assert(list.renderables.size() == list.transforms.size() && list.renderables.size() == list.normalMatrices.size());
+
+    g_backend->DrawEntities(frame, sceneData, list);
 }
 
 void RenderSystem::DrawGrid(FrameStatus frame, GPU_SceneData *sceneData) {
@@ -147,6 +254,70 @@ void RenderSystem::DrawGrid(FrameStatus frame, GPU_SceneData *sceneData) {
     g_backend->EndGridPass(frame);
 }
 
+void RenderSystem::SetDrawMode(DrawMode mode) {
+    m_drawMode = mode;
+    g_backend->SetDrawMode(mode);
+}
+
+DrawMode RenderSystem::GetDrawMode() const {
+    return m_drawMode;
+}
+
+void RenderSystem::SetParallelRecording(b32 enabled) {
+    m_parallelRecording = enabled;
+    g_backend->SetParallelRecording(enabled);
+}
+
+b32 RenderSystem::IsParallelRecording() const {
+    return m_parallelRecording;
+}
+
+void RenderSystem::SetShadowSettings(const ShadowSettings &settings) {
+    m_shadowSettings = settings;
+    g_backend->SetShadowSettings(settings);
+}
+
+const ShadowSettings &RenderSystem::GetShadowSettings() const {
+    return m_shadowSettings;
+}
+
+void RenderSystem::SetDepthPrepass(b32 enabled) {
+    m_depthPrepass = enabled;
+    g_backend->SetDepthPrepass(enabled);
+}
+
+b32 RenderSystem::IsDepthPrepass() const {
+    return m_depthPrepass;
+}
+
+void RenderSystem::SetDynamicRendering(b32 enabled) {
+    m_dynamicRendering = enabled;
+}
+
+b32 RenderSystem::IsDynamicRendering() const {
+    return g_backend && g_backend->IsDynamicRendering();
+}
+
+const GpuProfileHistory *RenderSystem::GetGpuProfile() const {
+    return g_backend->GetGpuProfile();
+}
+
+void RenderSystem::ExportGpuProfile(const char *basename) const {
+    const GpuProfileHistory *profile = g_backend->GetGpuProfile();
+    if (!profile) {
+        fprintf(stderr, "GPU profiling is not available\n");
+        return;
+    }
+
+    std::string filename = basename;
+    if (profile->ExportCsv((filename + ".csv").c_str()) && profile->ExportJson((filename + ".json").c_str()))
+        printf("GPU profile of %u frames written to %s.csv and %s.json\n", profile->GetFrameCount(), basename, basename);
+}
+
+u64 RenderSystem::GetDeviceMemoryUsage() const {
+    return g_backend->GetDeviceMemoryUsage();
+}
+
 void RenderSystem::CreateTexture(const void *pixels, Texture *texture) {
     g_backend->CreateTexture(pixels, texture);
 }
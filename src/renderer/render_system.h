@@ -6,7 +6,13 @@
 
 namespace xjar {
 
-struct Entity;
+class GpuProfileHistory;
+
+struct ModelFiles {
+    const char *meshFilename;
+    const char *instanceFilename;
+    const char *materialFilename;
+};
 
 class RenderSystem final {
 public:
@@ -22,16 +28,51 @@ public:
     void        ClearColor(FrameStatus frame, f32 r, f32 g, f32 b, f32 a);
     void        Shutdown();
     void        LoadModel(const char *meshFilename, const char *instanceFilename, const char *materialFilename, Model &model);
+    // reads and decodes on the job system, the GPU resources are created on the calling thread
+    void        LoadModels(std::span<const ModelFiles> files, std::span<Model *const> models);
     void        CreateTexture(const void *pixels, Texture *texture);
     void        DestroyTexture(Texture *texture);
-    void        DrawEntities(FrameStatus frame, GPU_SceneData *sceneData, std::initializer_list<Entity *> entities);
+    void        DrawEntities(FrameStatus frame, GPU_SceneData *sceneData, const RenderList &list);
     void        DrawGrid(FrameStatus frame, GPU_SceneData *sceneData);
+    void        SetDrawMode(DrawMode mode);
+    DrawMode    GetDrawMode() const;
+    void        SetParallelRecording(b32 enabled);
+    b32         IsParallelRecording() const;
+    void        SetShadowSettings(const ShadowSettings &settings);
+    const ShadowSettings &GetShadowSettings() const;
+    // depth only pass before the lit one, worth it when overdraw dominates the fragment cost of a scene
+    void        SetDepthPrepass(b32 enabled);
+    b32         IsDepthPrepass() const;
+    // passes begun without render pass objects, the grid and the meshes then share one rendering scope.
+    // Has to be set before Startup, it is off when the device doesn't support it
+    void        SetDynamicRendering(b32 enabled);
+    b32         IsDynamicRendering() const;
+    // per pass GPU times of the recent frames, null if the backend has no timestamps
+    const GpuProfileHistory *GetGpuProfile() const;
+    // writes <basename>.csv and <basename>.json
+    void        ExportGpuProfile(const char *basename) const;
+    u64         GetDeviceMemoryUsage() const;
+
+    // parsing only, no backend is needed
+    static void LoadInstanceData(const char *filename, std::vector<InstanceData> &instances);
+    static void LoadMaterials(const char *fileName, std::vector<MaterialDescr> &materials, std::vector<std::string> &files);
 
 private:
-    void LoadInstanceData(const char *filename, std::vector<InstanceData> &instances);
-    void LoadMaterials(const char *fileName, std::vector<MaterialDescr> &materials, std::vector<std::string> &files);
+    struct ModelSource {
+        std::vector<InstanceData>  instances;
+        std::vector<MaterialDescr> materials;
+        std::vector<std::string>   textureFilenames;
+    };
+
+    void ReadModel(const ModelFiles &files, Model &model, ModelSource &source);
 
     RenderSystem() = default;
+
+    DrawMode       m_drawMode = DrawMode::VertexPulling;
+    b32            m_parallelRecording = false;
+    ShadowSettings m_shadowSettings;
+    b32            m_depthPrepass = false;
+    b32            m_dynamicRendering = false;
 };
 
 }
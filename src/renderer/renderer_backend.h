@@ -3,9 +3,11 @@
 #include "renderer_types.h"
 #include "material_descr.h"
 
+#include <span>
+
 namespace xjar {
 
-struct Entity;
+class GpuProfileHistory;
 
 class RendererBackend {
 public:
@@ -16,10 +18,33 @@ public:
     virtual void        EndFrame() = 0;
     virtual void        ClearColor(FrameStatus frame, f32 r, f32 g, f32 b, f32 a) = 0;
 
-    virtual void DrawEntities(FrameStatus frame, GPU_SceneData *sceneData, std::initializer_list<Entity *> entities) = 0;
+    virtual void DrawEntities(FrameStatus frame, GPU_SceneData *sceneData, const RenderList &list) = 0;
 
     virtual void DrawGrid(FrameStatus frame, GPU_SceneData *sceneData) {
     }
+    virtual void SetDrawMode(DrawMode mode) {
+    }
+    virtual void SetParallelRecording(b32 enabled) {
+    }
+    virtual void SetShadowSettings(const ShadowSettings &settings) {
+    }
+    virtual void SetDepthPrepass(b32 enabled) {
+    }
+    // before OnInit, the device and the pipelines are created for it
+    virtual void SetDynamicRendering(b32 enabled) {
+    }
+    // whether the device could, after OnInit
+    virtual b32 IsDynamicRendering() {
+        return false;
+    }
+    // null when the device can't time passes
+    virtual GpuProfileHistory *GetGpuProfile() {
+        return nullptr;
+    }
+    // bytes of device memory allocated so far, 0 if the backend doesn't track it
+    virtual u64 GetDeviceMemoryUsage() {
+        return 0;
+    }
     virtual void CreateModel(std::vector<InstanceData> &instances,
         std::vector<MaterialDescr> &materials,
         const std::vector<std::string> &textureFilenames,
@@ -2,8 +2,10 @@
 
 #include <glm/vec3.hpp>
 #include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
 #include <glm/mat4x4.hpp>
 
+#include <span>
 #include <vector>   
 #include "types.h"
 
@@ -11,8 +13,24 @@
 
 namespace xjar {
 
+struct CullBounds;
+
 static constexpr u32 MAX_LODS = 8;
 static constexpr u32 MAX_STREAMS = 8;
+static constexpr u32 MAX_SHADOW_CASCADES = 4;
+static constexpr u32 MAX_POINT_LIGHTS = 1024; // per frame, the rest of a RenderList's lights are dropped
+
+// vertex streams of a Mesh
+enum {
+    ATTRIBUTE_STREAM = 0, // interleaved position, uv, normal
+    POSITION_STREAM       // tightly packed positions for the depth only passes
+};
+
+// how the geometry is fed to the vertex stage
+enum class DrawMode {
+    VertexPulling = 0, // indices are fetched manually from a storage buffer
+    Indexed            // indices are bound as an index buffer, post-transform vertex cache is used
+};
 
 // universal structure to keep the relevant data for frame
 struct FrameStatus {
@@ -21,13 +39,28 @@ struct FrameStatus {
     // Vulkan stuff
     void *commandBuffer;
     u32   currentImage;
+    u32   currentFrame; // frame in flight, selects the per-frame command pools
+};
+
+// the directional light's cascaded shadow maps, see ComputeShadowCascades
+struct ShadowSettings {
+    u32 cascadeCount = MAX_SHADOW_CASCADES;
+    f32 splitLambda = 0.8f;      // 0 splits the shadowed range uniformly, 1 logarithmically
+    f32 shadowDistance = 60.0f;  // of the view frustum covered by the cascades
+    f32 casterDistance = 50.0f;  // how far towards the light casters outside the view still shadow it
+    b32 cacheStatic = true;      // keep the static casters of each cascade until the cascade or they change
 };
 
 struct GPU_SceneData {
     alignas(16) glm::mat4 viewMat;
     alignas(16)  glm::mat4 projMat;
-    alignas(16) glm::mat4 lightSpaceMat;
+    alignas(16) glm::mat4 viewProjMat; // written by the backend, what the vertices are projected with
+    alignas(16) glm::mat4 cascadeMats[MAX_SHADOW_CASCADES]; // world to shadow map uv and depth
+    alignas(16) glm::vec4 cascadeSplits;                    // view depth where each cascade ends
     alignas(16)  glm::vec3 viewPos;
+    alignas(16)  glm::vec3 lightPos;   // the shadowed light
+    alignas(16) glm::uvec4 clusterCount; // light clusters along x, y and depth, w is the light count
+    alignas(16) glm::vec4  clusterScale; // clusters per pixel along x and y, log depth scale and bias of the slices
 };
 
 static_assert(sizeof(GPU_SceneData) % 16 == 0, "GPU_SceneData should be padded to 16 bytes");
@@ -46,23 +79,45 @@ struct Vertex {
         texcoord{uvx, uvy} {}
 };
 
+struct AABB {
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+// element type of a mesh index stream, 0 keeps the files written before u16 support readable
+enum IndexFormat : u32 {
+    INDEX_FORMAT_U32 = 0,
+    INDEX_FORMAT_U16 = 1
+};
+
 struct Mesh {
     u32 lodNum;
     u32 streamNum;
     u32 materialID;
     u32 meshSize;
     u32 vertexCount;
-    u32 indexOffset;
+    u32 indexOffset; // in elements of indexFormat from the start of the index data
     u32 vertexOffset;
-    u32 lodOffset[MAX_LODS];
+    u32 lodOffset[MAX_LODS]; // in bytes from the start of the index data
+    u32 indexFormat;         // occupies the former alignment padding before streamOffset
     u64 streamOffset[MAX_STREAMS];
     u32 streamElementSize[MAX_STREAMS];
 
     inline u64 LodSize(u32 lod) const {
         return lodOffset[lod + 1] - lodOffset[lod];
     }
+
+    inline u32 IndexSize() const {
+        return indexFormat == INDEX_FORMAT_U16 ? sizeof(u16) : sizeof(u32);
+    }
+
+    inline u32 LodIndexCount(u32 lod) const {
+        return static_cast<u32>(LodSize(lod) / IndexSize());
+    }
 };
 
+static_assert(sizeof(Mesh) == 160, "Mesh is stored as is in .mesh files");
+
 struct MeshHdr {
     u32 magicValue;
     u32 meshNum;
@@ -71,14 +126,67 @@ struct MeshHdr {
     u32 vertexDataSize;
 };
 
+static constexpr u32 MESH_BVH_MAGIC = 0x38485642; // "BVH8"
+static constexpr u32 MESH_BVH_WIDTH = 8;
+
+// optional section after the vertex data of a .mesh file, followed by a MeshBVHInfo, the nodes and the
+// triangles of every mesh
+struct MeshBVHHdr {
+    u32 magicValue;
+    u32 meshNum;
+};
+
+struct MeshBVHInfo {
+    AABB bounds; // of the root node
+    u32  nodeCount;
+    u32  triangleCount;
+};
+
+// 8-wide node, the child boxes are quantized to 8 bits on a grid of 2^exponent steps from origin.
+// Inner children are stored next to each other from firstChild, the triangles of the leaf children
+// from firstTriangle.
+struct MeshBVHNode {
+    glm::vec3 origin;
+    i8        exponent[3];
+    u8        childMask;     // bit i is set if child i exists
+    u32       firstChild;
+    u32       firstTriangle;
+    u8        meta[MESH_BVH_WIDTH];  // inner: 0x80 | index from firstChild, leaf: count << 5 | index from firstTriangle
+    u8        qmin[3][MESH_BVH_WIDTH]; // axis major, one load fetches an axis of every child
+    u8        qmax[3][MESH_BVH_WIDTH];
+};
+
+static_assert(sizeof(MeshBVHNode) == 80, "MeshBVHNode is stored as is in .mesh files");
+
+// the vertices are copied out of the vertex streams so a leaf is tested without touching them
+struct MeshBVHTriangle {
+    glm::vec3 v0;
+    glm::vec3 edge1; // v1 - v0
+    glm::vec3 edge2; // v2 - v0
+    u32       index; // triangle within the mesh, the indices are 3 * index + 0, 1, 2
+};
+
+static_assert(sizeof(MeshBVHTriangle) == 40, "MeshBVHTriangle is stored as is in .mesh files");
+
+struct MeshBVH {
+    AABB                         bounds;
+    std::vector<MeshBVHNode>     nodes; // nodes[0] is the root
+    std::vector<MeshBVHTriangle> triangles;
+};
+
 struct Material {
     Texture *diffuseTexture;
 };
 
 struct TriangleMesh {
-    std::vector<u32> indexData;
+    std::vector<u8>  indexData; // raw index streams, see Mesh::indexFormat
     std::vector<f32> vertexData;
     std::vector<Mesh> meshes;
+
+    // the position streams of all meshes follow the attribute streams in vertexData
+    u32 positionStreamOffset; // in bytes
+
+    std::vector<MeshBVH> bvhs; // one per mesh, empty if the .mesh file was written without them
 };
 
 struct InstanceData {
@@ -90,19 +198,74 @@ struct InstanceData {
     u32 transformIndex;
 };
 
+// InstanceData as seen by the shaders, extended with what the vertex pulling needs from the Mesh
+struct GPU_InstanceData {
+    u32 meshIndex;
+    u32 materialIndex;
+    u32 LOD;
+    u32 indexOffset;
+    u32 vertexOffset;
+    u32 transformIndex;
+    u32 indexFormat;
+    u32 padding;
+};
+
+static_assert(sizeof(GPU_InstanceData) % 16 == 0, "GPU_InstanceData should be padded to 16 bytes");
+
 struct ModelID {
     int modelIndex;
     int instanceCount;
 };
+
 struct Model {
     Texture      texture;
-    glm::mat4    localTransform;
     TriangleMesh mesh;
+    AABB         bounds; // object space, over all meshes
     void        *handle; // the actual handle to the mesh with vao, vbo, ebo
 };
 
+// std430 layout, see basic.frag
+struct GPU_PointLight {
+    glm::vec3 position; // world space
+    f32       radius;   // no light reaches further
+    glm::vec3 color;
+    f32       intensity;
+};
+
+static_assert(sizeof(GPU_PointLight) == 32, "GPU_PointLight should match the shader layout");
+
+// what the renderer needs of a drawn entity besides its transform, models are shared between entities
+struct Renderable {
+    const Model *model;            // null is not drawn
+    b32          isStatic = false; // see World::SetStatic
+};
+
+// parallel arrays of the entities to draw, e.g. the World's renderables and transforms
+struct RenderList {
+    std::span<const Renderable> renderables;
+    const CullBounds           *bounds = nullptr; // world bounds for the passes that cull on their own
+    std::span<const glm::mat4>  transforms;
+    std::span<const glm::mat4>  normalMatrices; // inverse transpose of the transforms, see NormalMatrix
+    // indices into the spans above to draw when culled, e.g. what a frustum query returned
+    std::span<const u32>        visible;
+    std::span<const GPU_PointLight> lights; // besides the shadowed lightPos of the scene data, binned per cluster
+    b32                         culled = false;
+    u32                         staticVersion = 0; // see World::GetStaticVersion
+
+    u32 Count() const {
+        return static_cast<u32>(culled ? visible.size() : renderables.size());
+    }
+
+    // the i-th entity to draw
+    u32 Index(u32 i) const {
+        return culled ? visible[i] : i;
+    }
+};
+
+// 128 bytes, the push constant size every device supports
 struct PushConstantData {
     glm::mat4 model;
+    glm::mat4 normal;
 };
 
 }
@@ -0,0 +1,97 @@
+#include "pch.h"
+#include "shadow_cascades.h"
+
+namespace xjar {
+
+void ComputeShadowCascades(const GPU_SceneData &sceneData, const glm::vec3 &lightDir, const ShadowSettings &settings,
+                           u32 resolution, ShadowCascades &cascades) {
+    f32 nearPlane, farPlane;
+    GetClipPlanes(sceneData.projMat, nearPlane, farPlane);
+    farPlane = std::min(farPlane, nearPlane + settings.shadowDistance);
+
+    cascades.count = std::clamp(settings.cascadeCount, 1u, MAX_SHADOW_CASCADES);
+
+    // practical split scheme, a blend of the logarithmic split that spreads the texels evenly in view
+    // and the uniform one that doesn't squeeze the first cascades into the near plane
+    const f32 ratio = farPlane / nearPlane;
+    for (u32 i = 0; i < cascades.count; i++) {
+        const f32 p = static_cast<f32>(i + 1) / cascades.count;
+        const f32 logSplit = nearPlane * std::pow(ratio, p);
+        const f32 uniformSplit = nearPlane + (farPlane - nearPlane) * p;
+
+        cascades.splitDepths[i] = glm::mix(uniformSplit, logSplit, settings.splitLambda);
+    }
+
+    // the slices are fitted in view space, so their spheres only depend on the projection
+    const glm::vec2 tanHalfFov(1.0f / sceneData.projMat[0][0], 1.0f / sceneData.projMat[1][1]);
+    const glm::mat4 invView = glm::inverse(sceneData.viewMat);
+
+    const glm::vec3 direction = glm::normalize(lightDir);
+    const glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+
+    // the rotation of every cascade, light space looks down -z towards the light's direction
+    const glm::mat4 lightRotation = glm::lookAt(glm::vec3(0.0f), direction, up);
+
+    f32 sliceNear = nearPlane;
+    for (u32 c = 0; c < cascades.count; c++) {
+        const f32 sliceFar = cascades.splitDepths[c];
+
+        // the sphere is centered on the view axis, where it is the smallest around both ends of the slice
+        const glm::vec2 nearCorner = tanHalfFov * sliceNear;
+        const glm::vec2 farCorner = tanHalfFov * sliceFar;
+        const f32       nearReach = glm::dot(nearCorner, nearCorner);
+        const f32       farReach = glm::dot(farCorner, farCorner);
+        const f32       centerDepth = std::min(sliceFar, 0.5f * (sliceNear + sliceFar) + 0.5f * (farReach - nearReach) / (sliceFar - sliceNear));
+
+        const f32       radius = std::sqrt(std::max(nearReach + (centerDepth - sliceNear) * (centerDepth - sliceNear),
+                                                    farReach + (sliceFar - centerDepth) * (sliceFar - centerDepth)));
+
+        const glm::vec3 center = glm::vec3(lightRotation * invView * glm::vec4(0.0f, 0.0f, -centerDepth, 1.0f));
+
+        // the box only moves in whole texels along all three axes and the matrix is built from the snapped
+        // center alone, so it stays bit for bit the same until the camera moved a texel, see IsCacheValid.
+        // The world origin then lands on a texel corner and the shadow edges don't shimmer
+        const f32       texel = 2.0f * radius / resolution;
+        const glm::vec3 snapped = glm::round(center / texel) * texel;
+
+        // the snapping moves the box up to half a texel along z, a texel more on both ends keeps the slice inside
+        const f32 eyeDistance = settings.casterDistance + radius + texel;
+        const f32 depth = settings.casterDistance + 2.0f * radius + 2.0f * texel;
+
+        glm::mat4 lightView = lightRotation;
+        lightView[3] = glm::vec4(-snapped.x, -snapped.y, -(snapped.z + eyeDistance), 1.0f);
+        const glm::mat4 lightProj = glm::ortho(-radius, radius, -radius, radius, 0.0f, depth);
+
+        cascades.viewProj[c] = lightProj * lightView;
+        cascades.casters[c] = FrustumFromMatrix(cascades.viewProj[c]);
+
+        sliceNear = sliceFar;
+    }
+}
+
+glm::mat4 ShadowDepthMatrix(const ShadowCascades &cascades, u32 cascade) {
+    // z' = 0.5 * z + 0.5 * w
+    glm::mat4 depthRange(1.0f);
+    depthRange[2][2] = 0.5f;
+    depthRange[3][2] = 0.5f;
+
+    return depthRange * cascades.viewProj[cascade];
+}
+
+void WriteShadowCascades(const ShadowCascades &cascades, GPU_SceneData &sceneData) {
+    // Vulkan clip space to shadow map uv, y points down in both
+    glm::mat4 toTexture(1.0f);
+    toTexture[0][0] = 0.5f;
+    toTexture[1][1] = 0.5f;
+    toTexture[3][0] = 0.5f;
+    toTexture[3][1] = 0.5f;
+
+    for (u32 c = 0; c < MAX_SHADOW_CASCADES; c++) {
+        const u32 used = std::min(c, cascades.count - 1);
+
+        sceneData.cascadeMats[c] = toTexture * ShadowDepthMatrix(cascades, used);
+        sceneData.cascadeSplits[c] = cascades.splitDepths[used];
+    }
+}
+
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "types.h"
+#include "geometry.h"
+#include "renderer_types.h"
+
+namespace xjar {
+
+struct ShadowCascades {
+    u32       count;
+    f32       splitDepths[MAX_SHADOW_CASCADES]; // view space distance where each cascade ends
+    glm::mat4 viewProj[MAX_SHADOW_CASCADES];    // light space, with glm's -1..1 depth like the camera
+    Frustum   casters[MAX_SHADOW_CASCADES];     // boxes outside of these cast no shadow into the cascade
+};
+
+// Splits the camera frustum of sceneData up to settings.shadowDistance and fits an orthographic light box
+// around each slice. The box is the bounding sphere of the slice, which keeps its size while the camera
+// turns, and it only moves in whole texels of a resolution sized map along all three light space axes, so the
+// shadow edges don't shimmer and the matrix stays the same while the camera moves less than a texel.
+// The boxes reach settings.casterDistance further towards the light for the casters in front of the slice.
+void ComputeShadowCascades(const GPU_SceneData &sceneData, const glm::vec3 &lightDir, const ShadowSettings &settings,
+                           u32 resolution, ShadowCascades &cascades);
+
+// the matrix of a cascade for the depth pass, Vulkan clip space with 0..1 depth
+glm::mat4 ShadowDepthMatrix(const ShadowCascades &cascades, u32 cascade);
+
+// writes the cascades the lit pass samples into sceneData, the unused splits repeat the last one
+void WriteShadowCascades(const ShadowCascades &cascades, GPU_SceneData &sceneData);
+
+}
@@ -3,7 +3,12 @@
 #include "vulkan_swapchain.h"
 #include "vulkan_ds.h"
 #include "vulkan_texture.h"
+#include "vulkan_pipeline_cache.h"
 #include "window.h"
+#include "profiler.h"
+#include "frustum_culling.h"
+
+#include <numeric>
 
 
 namespace xjar {
@@ -13,53 +18,49 @@ namespace xjar {
 VkDescriptorSetLayout g_dsSceneLayout;
 
 void Vulkan_Backend::OnInit() {
-    m_renderDevice = CreateRenderDevice("xjar", "xjarEngine");
+    m_renderDevice = CreateRenderDevice("xjar", "xjarEngine", GetWindow().headless, m_dynamicRendering);
+    m_depthFormat = FindDepthFormat(m_renderDevice.physicalDevice);
+    m_graph.Init(&m_renderDevice);
     RecreateSwapchain(); 
-    CreateLastRenderPass();
-    CreateBuffers();
+    CreateFrameContexts(&m_renderDevice, m_frames, m_ringBuffer);
+    m_gpuProfiler.Init(&m_renderDevice);
+
+    m_renderDevice.pipelineCache = LoadPipelineCache(&m_renderDevice, PIPELINE_CACHE_FILE);
+
+    // the features only queue their pipelines, they are built all at once below
+    Vulkan_PipelineBatch pipelines;
 
     m_multiMeshFeature = new Vulkan_MultiMeshFeature();
-    m_multiMeshFeature->Init(&m_renderDevice, m_swapchain.get());
+    m_multiMeshFeature->Init(&m_renderDevice, m_swapchain.get(), m_frames, pipelines);
    
     m_gridFeature = new Vulkan_GridFeature();
-    m_gridFeature->Init(&m_renderDevice, m_swapchain.get());
-}
-
-void Vulkan_Backend::CreateBuffers() {
-    m_commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    m_gridFeature->Init(&m_renderDevice, m_swapchain.get(), m_frames, pipelines);
 
-    VkCommandBufferAllocateInfo allocInfo {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = m_renderDevice.commandPool;
-    allocInfo.commandBufferCount = static_cast<u32>(m_commandBuffers.size());
-
-    if (vkAllocateCommandBuffers(m_renderDevice.device, &allocInfo, m_commandBuffers.data()) !=
-        VK_SUCCESS) {
-        fprintf(stderr, "Failed to allocate buffers\n");
-        exit(1);
-    }
+    pipelines.Build();
 }
 
 void Vulkan_Backend::OnDestroy() {
     vkDeviceWaitIdle(m_renderDevice.device);
 
+    // the imported resources the graph kept states for between frames
+    Vulkan_ShadowTechnique &shadows = m_multiMeshFeature->GetShadowTechnique();
+    m_graph.ForgetImage(shadows.m_depthImage);
+    if (shadows.m_cacheImage != VK_NULL_HANDLE)
+        m_graph.ForgetImage(shadows.m_cacheImage);
+    m_graph.ForgetBuffer(m_multiMeshFeature->GetLightGrid());
+
     m_multiMeshFeature->Destroy();
     m_gridFeature->Destroy();
-#if 0
-    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        m_frameDescriptors[i].DestroyPools(m_renderDevice.device);
-    }
-#endif
-    vkFreeCommandBuffers(
-        m_renderDevice.device,
-        m_renderDevice.commandPool,
-        static_cast<u32>(m_commandBuffers.size()),
-        m_commandBuffers.data());
-    m_commandBuffers.clear();
+    m_graph.Destroy();
+
+    DestroyFrameContexts(&m_renderDevice, m_frames, m_ringBuffer);
+    m_gpuProfiler.Destroy();
 
     DestroySwapchain(m_swapchain.get(), &m_renderDevice);
-    vkDestroyRenderPass(m_renderDevice.device, m_lastRenderPass, nullptr);
+
+    SavePipelineCache(&m_renderDevice, m_renderDevice.pipelineCache, PIPELINE_CACHE_FILE);
+    vkDestroyPipelineCache(m_renderDevice.device, m_renderDevice.pipelineCache, nullptr);
+
     DestroyRenderDevice(&m_renderDevice);
 
 }
@@ -223,14 +224,22 @@ void Vulkan_Backend::DestroyTexture(Texture *texture) {
 void Vulkan_Backend::RecreateSwapchain() {
     auto       window = GetWindow();
     VkExtent2D extent = {window.width, window.height};
-    while (extent.width == 0 || extent.height == 0) {
+    while (!window.headless && (extent.width == 0 || extent.height == 0)) {
         extent = {window.width, window.height};
         glfwWaitEvents();
     }
 
     vkDeviceWaitIdle(m_renderDevice.device);
 
-    if (m_swapchain == nullptr) {
+    // the framebuffers of the graph hold the views of the old images
+    m_graph.OnResize();
+
+    if (m_renderDevice.headless) {
+        if (m_swapchain != nullptr)
+            DestroySwapchain(m_swapchain.get(), &m_renderDevice);
+
+        m_swapchain = CreateOffscreenSwapchain(&m_renderDevice, extent);
+    } else if (m_swapchain == nullptr) {
         m_swapchain = CreateSwapchain(&m_renderDevice, extent, nullptr);
     } else {
         std::shared_ptr<Vulkan_Swapchain> oldSwapchain = std::move(m_swapchain);
@@ -240,21 +249,16 @@ void Vulkan_Backend::RecreateSwapchain() {
 }
 
 VkResult Vulkan_Backend::AcquireNextImage(u32 *imageIndex) {
-    vkWaitForFences(
-        m_renderDevice.device,
-        1,
-        &m_swapchain->inFlightFences[m_swapchain->currentFrame],
-        VK_TRUE,
-        UINT64_MAX);
-
-
-    //m_frameDescriptors[m_currentFrameIndex].ClearPools();
+    if (m_renderDevice.headless) {
+        *imageIndex = m_currentFrameIndex;
+        return VK_SUCCESS;
+    }
 
     VkResult result = vkAcquireNextImageKHR(
         m_renderDevice.device,
         m_swapchain->swapchain,
         UINT64_MAX,
-        m_swapchain->imageAvailableSems[m_swapchain->currentFrame],
+        m_frames[m_currentFrameIndex].imageAvailableSem,
         VK_NULL_HANDLE,
         imageIndex);
 
@@ -262,6 +266,11 @@ VkResult Vulkan_Backend::AcquireNextImage(u32 *imageIndex) {
 }
 
 FrameStatus Vulkan_Backend::BeginFrame() {
+    XJAR_ZONE("Vulkan_Backend::BeginFrame");
+
+    // the fence is only reset on submit, so a failed acquire below leaves the frame waitable
+    ResetFrameContext(&m_renderDevice, m_frames[m_currentFrameIndex]);
+
     VkResult result = AcquireNextImage(&m_currentImageIndex);
     if (result == VK_ERROR_OUT_OF_DATE_KHR) {
         RecreateSwapchain();
@@ -284,39 +293,56 @@ FrameStatus Vulkan_Backend::BeginFrame() {
         exit(1);
     }
 
+    m_gpuProfiler.BeginFrame(*cmdbuf, m_currentFrameIndex);
+
     FrameStatus status {
         .success = true,
         .commandBuffer = cmdbuf,
-        .currentImage = m_currentImageIndex};
+        .currentImage = m_currentImageIndex,
+        .currentFrame = m_currentFrameIndex};
+
+    // the fence of this frame was waited in ResetFrameContext, so its secondaries can be reset
+    m_multiMeshFeature->BeginFrame(status);
+
+    m_graph.Reset();
+    m_gridPending = false;
+
+    const VkExtent2D extent = m_swapchain->swapchainExtent;
+
+    // what the image held before is cleared or drawn over, it only has to be acquired
+    m_backbuffer = m_graph.ImportImage("backbuffer", m_swapchain->images[m_currentImageIndex], m_swapchain->imageViews[m_currentImageIndex],
+                                       {m_swapchain->imageFormat, extent, VK_IMAGE_ASPECT_COLOR_BIT}, 0, true);
+    // offscreen images are left ready to be copied out, there is no present layout without a swapchain
+    m_graph.SetOutput(m_backbuffer, m_renderDevice.headless ? RGAccess::TransferSrc : RGAccess::Present);
+
+    m_sceneDepth = m_graph.CreateImage("depth", {m_depthFormat, extent, VK_IMAGE_ASPECT_DEPTH_BIT});
 
     return status;
 }
 
 void Vulkan_Backend::EndFrame() {
-    auto *cmdbuf = GetCurrentCommandBuffer();
+    XJAR_ZONE("Vulkan_Backend::EndFrame");
 
+    auto *cmdbuf = GetCurrentCommandBuffer();
 
-    auto &window = GetWindow();
-
-    const VkRect2D screenRect = {
-        .offset = {0, 0},
-        .extent = {.width = window.width, .height = window.height}};
+    // no meshes were drawn, so the grid is the first to use the depth
+    if (m_gridPending)
+        AddGridPass(RGLoad::Clear);
 
-    VkRenderPassBeginInfo passInfo {};
-    passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    passInfo.renderPass = m_lastRenderPass;
-    passInfo.framebuffer = m_swapchain->framebuffers[m_currentImageIndex];
-    passInfo.renderArea = screenRect;
+    m_graph.Compile();
+    m_graph.Execute(*cmdbuf, m_gpuProfiler);
 
-    vkCmdBeginRenderPass(*cmdbuf, &passInfo, VK_SUBPASS_CONTENTS_INLINE);
-    vkCmdEndRenderPass(*cmdbuf); // transition to swapchain KHR layout
+    {
+        Vulkan_GpuZone zone(m_gpuProfiler, *cmdbuf, GPU_PASS_FINAL);
+        m_graph.TransitionOutputs(*cmdbuf);
+    }
 
     if (vkEndCommandBuffer(*cmdbuf) != VK_SUCCESS) {
         fprintf(stderr, "Failed to end recording\n");
         exit(1);
     }
 
-    VkResult result = SubmitCommandBuffers(m_swapchain.get(), &m_renderDevice, cmdbuf, &m_currentImageIndex);
+    VkResult result = SubmitCommandBuffers(m_swapchain.get(), &m_renderDevice, m_frames[m_currentFrameIndex], &m_currentImageIndex);
     if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
         //window.resized = false;
 
@@ -332,62 +358,201 @@ void Vulkan_Backend::EndFrame() {
 }
 
 void Vulkan_Backend::DrawGrid(FrameStatus frame, GPU_SceneData *sceneData) {
-    m_gridFeature->Draw(frame, sceneData);
+    m_gridFeature->Prepare(frame, sceneData);
+    m_gridPending = true;
 }
 
-void Vulkan_Backend::DrawEntities(FrameStatus frame, GPU_SceneData *sceneData, std::initializer_list<Entity *> entities) {
-    if (m_multiMeshFeature->IsShadowsEnabled()) {
-        m_multiMeshFeature->BeginShadowPass(frame);
-        m_multiMeshFeature->DrawEntities(frame, sceneData, entities);
-        m_multiMeshFeature->EndShadowPass(frame);
-    }
+void Vulkan_Backend::AddGridPass(RGLoad depthLoad) {
+    VkClearValue depthClear {};
+    depthClear.depthStencil = {1.0f, 0};
+
+    const u32 pass = m_graph.AddPass("grid", GPU_PASS_GRID, [this](VkCommandBuffer cmdbuf, const RGPassContext &context) {
+        m_gridFeature->Draw(cmdbuf, context);
+    });
+    m_graph.Attach(pass, m_backbuffer, RGAccess::ColorAttachment, RGLoad::Load);
+    // tested against the depth of the meshes without writing it. With the same attachments the graph merges
+    // the two passes, unless the meshes are recorded into secondaries and the grid is inline
+    m_graph.Attach(pass, m_sceneDepth, RGAccess::DepthAttachment, depthLoad, depthClear);
 
-    m_multiMeshFeature->BeginDefaultPass(frame);
-    m_multiMeshFeature->DrawEntities(frame, sceneData, entities);
-    m_multiMeshFeature->EndDefaultPass(frame);
+    m_gridPending = false;
 }
 
-void Vulkan_Backend::ClearColor(FrameStatus frame, f32 r, f32 g, f32 b, f32 a) {
-    VkCommandBuffer *cmdbuf = (VkCommandBuffer *)frame.commandBuffer;
+void Vulkan_Backend::SetDrawMode(DrawMode mode) {
+    m_multiMeshFeature->SetDrawMode(mode);
+}
 
-    std::array<VkClearValue, 2> clearValues {};
-    clearValues[0].color = {r, g, b, a};
-    clearValues[1].depthStencil = {1.0f, 0};
+void Vulkan_Backend::SetParallelRecording(b32 enabled) {
+    m_multiMeshFeature->SetParallelRecording(enabled);
+}
 
-    VkRenderPassBeginInfo passInfo {};
-    passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    passInfo.renderPass = m_swapchain->renderPass;
-    passInfo.framebuffer = m_swapchain->framebuffers[m_currentImageIndex];
-    passInfo.renderArea.offset = {0, 0};
-    passInfo.renderArea.extent = m_swapchain->swapchainExtent;
-    passInfo.clearValueCount = static_cast<u32>(clearValues.size());
-    passInfo.pClearValues = clearValues.data();
+void Vulkan_Backend::SetShadowSettings(const ShadowSettings &settings) {
+    m_multiMeshFeature->SetShadowSettings(settings);
+}
 
-    vkCmdBeginRenderPass(*cmdbuf, &passInfo, VK_SUBPASS_CONTENTS_INLINE);
-    vkCmdEndRenderPass(*cmdbuf); // transition to optimal
+void Vulkan_Backend::SetDepthPrepass(b32 enabled) {
+    m_multiMeshFeature->SetDepthPrepass(enabled);
+}
 
-    
-    VkViewport viewport {};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = static_cast<f32>(m_swapchain->swapchainExtent.width);
-    viewport.height = static_cast<f32>(m_swapchain->swapchainExtent.height);
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-    VkRect2D scissor {{0, 0}, m_swapchain->swapchainExtent};
-
-    vkCmdSetViewport(*cmdbuf, 0, 1, &viewport);
-    vkCmdSetScissor(*cmdbuf, 0, 1, &scissor);
+void Vulkan_Backend::SetDynamicRendering(b32 enabled) {
+    m_dynamicRendering = enabled;
+}
+
+b32 Vulkan_Backend::IsDynamicRendering() {
+    return m_renderDevice.dynamicRendering;
+}
+
+void Vulkan_Backend::AddShadowPass(const char *name, FrameStatus frame, u32 cascade, RGHandle target, RGLoad load, const RenderList &casters) {
+    VkClearValue clear {};
+    clear.depthStencil = {1.0f, 0};
+
+    const u32 pass = m_graph.AddPass(name, GPU_PASS_SHADOW, [this, frame, cascade, casters](VkCommandBuffer cmdbuf, const RGPassContext &context) {
+        m_multiMeshFeature->BeginShadowPass(cmdbuf, context, cascade);
+        m_multiMeshFeature->DrawEntities(frame, &m_sceneData, casters);
+    });
+    m_graph.Attach(pass, target, RGAccess::DepthAttachment, load, clear);
+
+    if (m_multiMeshFeature->IsParallelRecording())
+        m_graph.SetSecondaries(pass);
+}
+
+void Vulkan_Backend::DrawEntities(FrameStatus frame, GPU_SceneData *sceneData, const RenderList &list) {
+    XJAR_ZONE("Vulkan_Backend::DrawEntities");
+
+    // the passes run in EndFrame, list only references what outlives the frame
+    m_sceneData = *sceneData;
+    m_list = list;
+
+    // before the default pass flips the projection the clusters are built from
+    m_multiMeshFeature->UpdateLights(frame, &m_sceneData, list.lights);
+
+    const RGHandle lightGrid = m_graph.ImportBuffer("light grid", m_multiMeshFeature->GetLightGrid());
+    const bool     hasLights = m_sceneData.clusterCount.w > 0;
+
+    // culled when the default pass doesn't read the grid
+    const u32 binning = m_graph.AddPass("light binning", GPU_PASS_LIGHTS, [this](VkCommandBuffer cmdbuf, const RGPassContext &) {
+        m_multiMeshFeature->DispatchLights(cmdbuf);
+    });
+    m_graph.Use(binning, lightGrid, RGAccess::StorageWriteCompute);
+
+    VkClearValue depthClear {};
+    depthClear.depthStencil = {1.0f, 0};
+
+    const bool shadowsEnabled = m_multiMeshFeature->IsShadowsEnabled();
+    if (shadowsEnabled) {
+        Vulkan_ShadowTechnique &shadows = m_multiMeshFeature->GetShadowTechnique();
+        const ShadowCascades   &cascades = m_multiMeshFeature->UpdateShadowCascades(&m_sceneData);
+
+        const bool cacheStatic = shadows.m_settings.cacheStatic;
+        if (cacheStatic)
+            shadows.EnsureStaticCache(&m_renderDevice);
+
+        const RGImageDesc shadowDesc = {m_depthFormat, shadows.GetExtent(), VK_IMAGE_ASPECT_DEPTH_BIT};
+        for (u32 c = 0; c < MAX_SHADOW_CASCADES; c++)
+            m_shadowLayers[c] = m_graph.ImportImage("shadow map", shadows.m_depthImage, shadows.m_layerViews[c], shadowDesc, c);
+
+        RenderList casters = list;
+        casters.culled = true;
+
+        for (u32 c = 0; c < cascades.count; c++) {
+            // casters outside the camera frustum still shadow what is inside it, each cascade culls against its own box
+            if (list.bounds) {
+                CullFrustumParallel(cascades.casters[c], *list.bounds, m_casters[c]);
+            } else {
+                m_casters[c].resize(list.renderables.size());
+                std::iota(m_casters[c].begin(), m_casters[c].end(), 0u);
+            }
+
+            if (!cacheStatic) {
+                casters.visible = m_casters[c];
+                AddShadowPass("shadow casters", frame, c, m_shadowLayers[c], RGLoad::Clear, casters);
+                continue;
+            }
+
+            m_staticCasters[c].clear();
+            m_dynamicCasters[c].clear();
+            for (u32 i : m_casters[c])
+                (list.renderables[i].isStatic ? m_staticCasters[c] : m_dynamicCasters[c]).push_back(i);
+
+            // kept for the next frames even when nothing reads it in this one
+            const RGHandle cache = m_graph.ImportImage("shadow cache", shadows.m_cacheImage, shadows.m_cacheLayerViews[c], shadowDesc, c);
+            m_graph.SetOutput(cache);
+
+            // the static casters are only redrawn when they or the cascade changed
+            if (!shadows.IsCacheValid(c, list.staticVersion)) {
+                casters.visible = m_staticCasters[c];
+                AddShadowPass("static shadow casters", frame, c, cache, RGLoad::Clear, casters);
+                shadows.MarkCached(c, list.staticVersion);
+            }
+
+            const u32 copy = m_graph.AddPass("copy static shadows", GPU_PASS_SHADOW, [&shadows, c](VkCommandBuffer cmdbuf, const RGPassContext &) {
+                shadows.CopyStaticCache(cmdbuf, c);
+            });
+            m_graph.Use(copy, cache, RGAccess::TransferSrc);
+            m_graph.Use(copy, m_shadowLayers[c], RGAccess::TransferDst);
+
+            casters.visible = m_dynamicCasters[c];
+            AddShadowPass("dynamic shadow casters", frame, c, m_shadowLayers[c], RGLoad::Load, casters);
+        }
+
+        // the unused layers are only cleared, the lit pass samples the whole map
+        for (u32 c = cascades.count; c < MAX_SHADOW_CASCADES; c++) {
+            const u32 clear = m_graph.AddPass("clear shadow map", GPU_PASS_SHADOW, nullptr);
+            m_graph.Attach(clear, m_shadowLayers[c], RGAccess::DepthAttachment, RGLoad::Clear, depthClear);
+        }
+    }
+
+    const bool prepass = m_multiMeshFeature->IsDepthPrepassEnabled();
+    if (prepass) {
+        const u32 pass = m_graph.AddPass("depth prepass", GPU_PASS_PREPASS, [this, frame](VkCommandBuffer cmdbuf, const RGPassContext &context) {
+            m_multiMeshFeature->BeginDepthPrepass(cmdbuf, context);
+            m_multiMeshFeature->DrawEntities(frame, &m_sceneData, m_list);
+        });
+        m_graph.Attach(pass, m_sceneDepth, RGAccess::DepthAttachment, RGLoad::Clear, depthClear);
+
+        if (m_multiMeshFeature->IsParallelRecording())
+            m_graph.SetSecondaries(pass);
+    }
+
+    const RGLoad depthLoad = prepass ? RGLoad::Load : RGLoad::Clear;
+
+    const u32 pass = m_graph.AddPass("meshes", GPU_PASS_MESH, [this, frame, prepass](VkCommandBuffer cmdbuf, const RGPassContext &context) {
+        m_multiMeshFeature->BeginDefaultPass(cmdbuf, context, prepass);
+        m_multiMeshFeature->DrawEntities(frame, &m_sceneData, m_list);
+    });
+    m_graph.Attach(pass, m_backbuffer, RGAccess::ColorAttachment, RGLoad::Load);
+    m_graph.Attach(pass, m_sceneDepth, RGAccess::DepthAttachment, depthLoad, depthClear);
+
+    if (shadowsEnabled) {
+        for (u32 c = 0; c < MAX_SHADOW_CASCADES; c++)
+            m_graph.Use(pass, m_shadowLayers[c], RGAccess::SampledFragment);
+    }
+
+    if (hasLights)
+        m_graph.Use(pass, lightGrid, RGAccess::StorageReadFragment);
+
+    if (m_multiMeshFeature->IsParallelRecording())
+        m_graph.SetSecondaries(pass);
+
+    // blended over the meshes, which hide the parts of it behind them
+    if (m_gridPending)
+        AddGridPass(RGLoad::Load);
 }
 
-void Vulkan_Backend::BeginGridPass(FrameStatus frame) {
-    m_gridFeature->BeginPass(frame);
+void Vulkan_Backend::ClearColor(FrameStatus frame, f32 r, f32 g, f32 b, f32 a) {
+    VkClearValue clear {};
+    clear.color = {r, g, b, a};
+
+    // becomes the load op of the first pass that draws into the backbuffer
+    const u32 pass = m_graph.AddPass("clear", GPU_PASS_COUNT, nullptr);
+    m_graph.Attach(pass, m_backbuffer, RGAccess::ColorAttachment, RGLoad::Clear, clear);
 }
 
-void Vulkan_Backend::EndGridPass(FrameStatus frame) {
-    VkCommandBuffer *cmdbuf = (VkCommandBuffer *)frame.commandBuffer;
+GpuProfileHistory *Vulkan_Backend::GetGpuProfile() {
+    return m_gpuProfiler.GetHistory();
+}
 
-    vkCmdEndRenderPass(*cmdbuf);
+u64 Vulkan_Backend::GetDeviceMemoryUsage() {
+    return m_renderDevice.allocatedBytes;
 }
 
 void Vulkan_Backend::UpdateGlobalState(const GPU_SceneData &sceneData) {
@@ -408,72 +573,8 @@ void Vulkan_Backend::UpdateGlobalState(const GPU_SceneData &sceneData) {
 #endif
 }
 
-void Vulkan_Backend::CreateLastRenderPass() {
-
-        VkAttachmentDescription depthAttachment {};
-        depthAttachment.format = FindDepthFormat(m_renderDevice.physicalDevice);
-        depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-        depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
-        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-        depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-        depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-        VkAttachmentReference depthAttachmentRef {};
-        depthAttachmentRef.attachment = 1;
-        depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-        VkAttachmentReference colorAttachmentRef = {};
-        colorAttachmentRef.attachment = 0;
-        colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-        VkAttachmentDescription colorAttachment = {};
-        colorAttachment.format = m_swapchain->imageFormat;
-        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
-        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-        colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-        VkSubpassDescription subpass = {};
-        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-        subpass.colorAttachmentCount = 1;
-        subpass.pColorAttachments = &colorAttachmentRef;
-        subpass.pDepthStencilAttachment = &depthAttachmentRef;
-
-        VkSubpassDependency dependency = {};
-        dependency.dstSubpass = 0;
-        dependency.dstAccessMask =
-            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-        dependency.dstStageMask =
-            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-        dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-        dependency.srcAccessMask = 0;
-        dependency.srcStageMask =
-            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-
-        std::array<VkAttachmentDescription, 2> attachments = {colorAttachment, depthAttachment};
-
-        VkRenderPassCreateInfo renderPassInfo = {};
-        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-        renderPassInfo.attachmentCount = static_cast<u32>(attachments.size());
-        renderPassInfo.pAttachments = attachments.data();
-        renderPassInfo.subpassCount = 1;
-        renderPassInfo.pSubpasses = &subpass;
-        renderPassInfo.dependencyCount = 1;
-        renderPassInfo.pDependencies = &dependency;
-
-        if (vkCreateRenderPass(m_renderDevice.device, &renderPassInfo, nullptr, &m_lastRenderPass) != VK_SUCCESS) {
-            fprintf(stderr, "Failed to create render pass\n");
-            exit(1);
-        }
-}
-
 VkCommandBuffer *Vulkan_Backend::GetCurrentCommandBuffer() {
-    return &m_commandBuffers[m_currentFrameIndex];
+    return &m_frames[m_currentFrameIndex].commandBuffer;
 }
 
 void *Vulkan_Backend::GetDefaultRenderPass() {
@@ -2,8 +2,11 @@
 #include "vulkan_render_device.h"
 #include "vulkan_pipeline.h"
 #include "vulkan_swapchain.h"
+#include "vulkan_frame.h"
+#include "vulkan_gpu_profiler.h"
 #include "vulkan_multimesh_feature.h"
 #include "vulkan_grid_feature.h"
+#include "vulkan_render_graph.h"
 
 
 namespace xjar {
@@ -24,11 +27,17 @@ public:
     void        DestroyTexture(Texture *texture) override;
     FrameStatus BeginFrame() override;
     void        EndFrame() override;
-    void        DrawEntities(FrameStatus frame, GPU_SceneData *sceneData, std::initializer_list<Entity *> entities) override;
+    void        DrawEntities(FrameStatus frame, GPU_SceneData *sceneData, const RenderList &list) override;
     void        DrawGrid(FrameStatus frame, GPU_SceneData *sceneData) override;
+    void        SetDrawMode(DrawMode mode) override;
+    void        SetParallelRecording(b32 enabled) override;
+    void        SetShadowSettings(const ShadowSettings &settings) override;
+    void        SetDepthPrepass(b32 enabled) override;
+    void        SetDynamicRendering(b32 enabled) override;
+    b32         IsDynamicRendering() override;
     void        ClearColor(FrameStatus frame, f32 r, f32 g, f32 b, f32 a) override;
-    void        BeginGridPass(FrameStatus frame) override;
-    void        EndGridPass(FrameStatus frame) override;
+    GpuProfileHistory *GetGpuProfile() override;
+    u64         GetDeviceMemoryUsage() override;
     void        CreateModel(std::vector<InstanceData> &instances,
                     std::vector<MaterialDescr> &materials,
                     const std::vector<std::string> &textureFilenames,
@@ -38,7 +47,6 @@ public:
     void       *GetRenderDevice() override;
     void       *GetSwapchain() override;
 
-    void CreateBuffers();
     void RecreateSwapchain();
     VkCommandBuffer *GetCurrentCommandBuffer();
 
@@ -46,16 +54,34 @@ public:
 
 
 private:
-    void                                CreateLastRenderPass();
+    void                                AddShadowPass(const char *name, FrameStatus frame, u32 cascade, RGHandle target, RGLoad load, const RenderList &casters);
+    void                                AddGridPass(RGLoad depthLoad);
 
     Vulkan_MultiMeshFeature *           m_multiMeshFeature;
     Vulkan_GridFeature *                m_gridFeature;
     Vulkan_RenderDevice                 m_renderDevice;
-    VkRenderPass                        m_lastRenderPass;
+    VkFormat                            m_depthFormat;
+    b32                                 m_dynamicRendering = false; // asked for, see m_renderDevice for what the device does
     std::unique_ptr<Vulkan_Swapchain>   m_swapchain;
-    std::vector<VkCommandBuffer>        m_commandBuffers;
+    Vulkan_FrameContext                 m_frames[MAX_FRAMES_IN_FLIGHT];
+    Vulkan_FrameRingBuffer              m_ringBuffer;
+    Vulkan_GpuProfiler                  m_gpuProfiler;
     int                                 m_effects = 0;
     u32                                 m_currentImageIndex;
-    i32                                 m_currentFrameIndex = 0;
+    u32                                 m_currentFrameIndex = 0;
+    // the passes of the frame are added by the draw calls and recorded in EndFrame
+    Vulkan_RenderGraph                  m_graph;
+    RGHandle                            m_backbuffer;
+    RGHandle                            m_sceneDepth;
+    RGHandle                            m_shadowLayers[MAX_SHADOW_CASCADES];
+    // DrawGrid was called, the pass is added after the one of the meshes so that they can share it
+    b32                                 m_gridPending = false;
+    // what the passes of DrawEntities draw with, until EndFrame
+    GPU_SceneData                       m_sceneData;
+    RenderList                          m_list;
+    // per cascade
+    std::vector<u32>                    m_casters[MAX_SHADOW_CASCADES];
+    std::vector<u32>                    m_staticCasters[MAX_SHADOW_CASCADES];
+    std::vector<u32>                    m_dynamicCasters[MAX_SHADOW_CASCADES];
 };
 }
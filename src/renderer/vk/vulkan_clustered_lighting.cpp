@@ -0,0 +1,113 @@
+#include "pch.h"
+#include "vulkan_clustered_lighting.h"
+#include "vulkan_render_device.h"
+#include "vulkan_frame.h"
+#include "geometry.h"
+#include "io.h"
+
+namespace xjar {
+
+void Vulkan_ClusteredLighting::CreateBinningPipeline(Vulkan_RenderDevice *rd) {
+    auto compShaderCode = ReadFile("shaders/cluster_lights.comp.spv");
+
+    VkPipelineShaderStageCreateInfo compShaderStageInfo {};
+    compShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    compShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    compShaderStageInfo.module = CreateShaderModule(rd, compShaderCode);
+    compShaderStageInfo.pName = "main";
+
+    VkPipelineShaderStageCreateInfo shaderStages[] = {compShaderStageInfo};
+
+    m_binningPipeline.SetShaders(shaderStages);
+    m_binningPipeline.SetDescriptorSets(&m_dsLayout, 1);
+    m_binningPipeline.CreateCompute(rd);
+
+    vkDestroyShaderModule(rd->device, compShaderStageInfo.module, nullptr);
+}
+
+void Vulkan_ClusteredLighting::Create(Vulkan_RenderDevice *rd, VkBuffer ringBuffer, Vulkan_PipelineBatch &pipelines) {
+    CreateBuffer(rd, CLUSTER_GRID_SIZE,
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                 m_gridBuffer, m_gridBufferMemory);
+
+    DescriptorLayoutBuilder dsBindings;
+    dsBindings.AddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_COMPUTE_BIT); // cluster params in the frame ring
+    dsBindings.AddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, VK_SHADER_STAGE_COMPUTE_BIT); // lights in the frame ring
+    dsBindings.AddBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);         // cluster grid
+
+    m_dsLayout = dsBindings.Build(rd->device);
+
+    std::vector<PoolSizeRatio> poolSizes = {
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1}
+    };
+
+    m_dsAllocator.Init(rd->device, 1, poolSizes);
+
+    // every frame ring lives in the same buffer, the frame is picked by the dynamic offsets at bind time
+    m_descriptorSet = m_dsAllocator.Allocate(rd->device, m_dsLayout);
+
+    DescriptorWriter writer;
+    writer.WriteBuffer(0, ringBuffer, sizeof(GPU_ClusterParams), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+    writer.WriteBuffer(1, ringBuffer, LIGHT_LIST_SIZE, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC);
+    writer.WriteBuffer(2, m_gridBuffer, CLUSTER_GRID_SIZE, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.UpdateSet(rd->device, m_descriptorSet);
+
+    pipelines.Add([this, rd]() { CreateBinningPipeline(rd); });
+}
+
+void Vulkan_ClusteredLighting::Destroy(Vulkan_RenderDevice *rd) {
+    m_binningPipeline.Destroy(rd->device);
+    m_dsAllocator.DestroyPools(rd->device);
+    vkDestroyDescriptorSetLayout(rd->device, m_dsLayout, nullptr);
+
+    vkDestroyBuffer(rd->device, m_gridBuffer, nullptr);
+    vkFreeMemory(rd->device, m_gridBufferMemory, nullptr);
+}
+
+u32 Vulkan_ClusteredLighting::Update(Vulkan_FrameRing &ring, GPU_SceneData &sceneData,
+                                     std::span<const GPU_PointLight> lights, VkExtent2D extent) {
+    const u32 lightCount = std::min(static_cast<u32>(lights.size()), MAX_POINT_LIGHTS);
+
+    f32 nearPlane, farPlane;
+    GetClipPlanes(sceneData.projMat, nearPlane, farPlane);
+
+    // slice = log(depth) * scale + bias puts the near plane at 0 and the far one at CLUSTER_SLICES
+    const f32 sliceScale = CLUSTER_SLICES / std::log(farPlane / nearPlane);
+
+    sceneData.clusterCount = glm::uvec4(CLUSTER_TILES_X, CLUSTER_TILES_Y, CLUSTER_SLICES, lightCount);
+    sceneData.clusterScale = glm::vec4(static_cast<f32>(CLUSTER_TILES_X) / std::max(extent.width, 1u),
+                                       static_cast<f32>(CLUSTER_TILES_Y) / std::max(extent.height, 1u),
+                                       sliceScale, -sliceScale * std::log(nearPlane));
+
+    // the lit pass skips the grid without lights, the offset only has to be valid
+    if (lightCount == 0)
+        return 0;
+
+    // the binding always spans LIGHT_LIST_SIZE, so that much is reserved whatever the count
+    u32 lightsOffset;
+    memcpy(ring.Allocate(LIGHT_LIST_SIZE, lightsOffset), lights.data(), lightCount * sizeof(GPU_PointLight));
+
+    // the lit pass flips y, see Vulkan_MultiMeshFeature::DrawEntities
+    GPU_ClusterParams params;
+    params.viewMat = sceneData.viewMat;
+    params.clusterCount = sceneData.clusterCount;
+    params.projection = glm::vec4(1.0f / sceneData.projMat[0][0], -1.0f / sceneData.projMat[1][1], nearPlane, farPlane);
+
+    m_dynamicOffsets[0] = ring.Push(&params, sizeof(params));
+    m_dynamicOffsets[1] = lightsOffset;
+
+    return lightsOffset;
+}
+
+void Vulkan_ClusteredLighting::Dispatch(VkCommandBuffer cmdbuf) {
+    m_binningPipeline.Bind(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE);
+    vkCmdBindDescriptorSets(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_binningPipeline.pipelineLayout, 0, 1, &m_descriptorSet, 2, m_dynamicOffsets);
+
+    // a workgroup per cluster
+    vkCmdDispatch(cmdbuf, CLUSTER_TILES_X, CLUSTER_TILES_Y, CLUSTER_SLICES);
+}
+
+}
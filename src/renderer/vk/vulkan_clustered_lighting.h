@@ -0,0 +1,53 @@
+#pragma once
+
+#include "vulkan_pipeline.h"
+#include "vulkan_ds.h"
+#include "renderer/renderer_types.h"
+
+namespace xjar {
+
+struct Vulkan_RenderDevice;
+struct Vulkan_FrameRing;
+
+// the light grid, screen tiles by depth slices spaced exponentially between the camera planes
+static constexpr u32 CLUSTER_TILES_X = 16;
+static constexpr u32 CLUSTER_TILES_Y = 9;
+static constexpr u32 CLUSTER_SLICES = 24;
+// a crowded cluster keeps whichever lights claim its slots first, so the dropped ones are arbitrary and can
+// change from frame to frame
+static constexpr u32 MAX_LIGHTS_PER_CLUSTER = 64;
+
+// each cluster holds its light count followed by MAX_LIGHTS_PER_CLUSTER light indices
+static constexpr VkDeviceSize CLUSTER_GRID_SIZE = CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES * (MAX_LIGHTS_PER_CLUSTER + 1) * sizeof(u32);
+static constexpr VkDeviceSize LIGHT_LIST_SIZE = MAX_POINT_LIGHTS * sizeof(GPU_PointLight);
+
+struct GPU_ClusterParams {
+    alignas(16) glm::mat4  viewMat;
+    alignas(16) glm::uvec4 clusterCount; // as in GPU_SceneData
+    alignas(16) glm::vec4  projection;   // 1 / P00 and 1 / P11 of the lit pass, near and far plane
+};
+
+// Bins the point lights of a frame into the cluster grid with a compute pass, so the lit pass only loops
+// over the lights of its fragment's cluster. The lights are pushed into the frame ring, the grid is shared
+// by the frames in flight and ordered by the render graph like the shadow map.
+struct Vulkan_ClusteredLighting {
+    VkBuffer              m_gridBuffer;
+    VkDeviceMemory        m_gridBufferMemory;
+    VkDescriptorSetLayout m_dsLayout;
+    VkDescriptorSet       m_descriptorSet;
+    DescriptorAllocator   m_dsAllocator;
+    Vulkan_Pipeline       m_binningPipeline;
+    u32                   m_dynamicOffsets[2]; // of this frame's cluster params and lights
+
+    void Create(Vulkan_RenderDevice *rd, VkBuffer ringBuffer, Vulkan_PipelineBatch &pipelines);
+    void Destroy(Vulkan_RenderDevice *rd);
+    // Pushes the lights and cluster params, before the lit pass flips the projection of sceneData.
+    // Writes the grid the lit pass reads into sceneData and returns the dynamic offset of the lights.
+    u32  Update(Vulkan_FrameRing &ring, GPU_SceneData &sceneData,
+                std::span<const GPU_PointLight> lights, VkExtent2D extent);
+    // bins what Update pushed into the grid, outside of a render pass
+    void Dispatch(VkCommandBuffer cmdbuf);
+    void CreateBinningPipeline(Vulkan_RenderDevice *rd);
+};
+
+}
@@ -0,0 +1,126 @@
+#include "pch.h"
+#include "vulkan_frame.h"
+#include "vulkan_render_device.h"
+
+namespace xjar {
+
+u8 *Vulkan_FrameRing::Allocate(u32 dataSize, u32 &offset) {
+    const u32 start = (head + alignment - 1) & ~(alignment - 1);
+    if (start + dataSize > FRAME_RING_SIZE) {
+        fprintf(stderr, "Frame ring is out of memory\n");
+        exit(1);
+    }
+
+    head = start + dataSize;
+    offset = baseOffset + start;
+
+    return mapped + start;
+}
+
+u32 Vulkan_FrameRing::Push(const void *data, u32 dataSize) {
+    u32 offset;
+    memcpy(Allocate(dataSize, offset), data, dataSize);
+
+    return offset;
+}
+
+void CreateFrameContexts(Vulkan_RenderDevice *rd, std::span<Vulkan_FrameContext> frames, Vulkan_FrameRingBuffer &ringBuffer) {
+    const u32 frameCount = static_cast<u32>(frames.size());
+
+    VkPhysicalDeviceProperties devProps;
+    vkGetPhysicalDeviceProperties(rd->physicalDevice, &devProps);
+    // both are powers of two, the larger one suits uniform and storage bindings
+    const u32 alignment = static_cast<u32>(std::max(devProps.limits.minUniformBufferOffsetAlignment,
+                                                    devProps.limits.minStorageBufferOffsetAlignment));
+
+    // one persistently mapped buffer, every frame owns a FRAME_RING_SIZE region of it
+    CreateBuffer(rd, FRAME_RING_SIZE * frameCount,
+                 VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 ringBuffer.buffer, ringBuffer.memory);
+
+    u8 *mapped = nullptr;
+    vkMapMemory(rd->device, ringBuffer.memory, 0, VK_WHOLE_SIZE, 0, (void **)&mapped);
+
+    QueueFamily families = FindQueueFamilies(rd->physicalDevice, rd->surface);
+
+    VkCommandPoolCreateInfo poolInfo {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = families.graphicsFamily.value();
+
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+    std::vector<PoolSizeRatio> poolSizes = {
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2}
+    };
+
+    for (u32 i = 0; i < frameCount; i++) {
+        Vulkan_FrameContext &frame = frames[i];
+
+        if (vkCreateCommandPool(rd->device, &poolInfo, nullptr, &frame.commandPool) != VK_SUCCESS) {
+            fprintf(stderr, "Failed to create frame command pool\n");
+            exit(1);
+        }
+
+        VkCommandBufferAllocateInfo allocInfo {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool = frame.commandPool;
+        allocInfo.commandBufferCount = 1;
+
+        if (vkAllocateCommandBuffers(rd->device, &allocInfo, &frame.commandBuffer) != VK_SUCCESS) {
+            fprintf(stderr, "Failed to allocate buffers\n");
+            exit(1);
+        }
+
+        if (vkCreateSemaphore(rd->device, &semaphoreInfo, nullptr, &frame.imageAvailableSem) != VK_SUCCESS ||
+            vkCreateSemaphore(rd->device, &semaphoreInfo, nullptr, &frame.renderFinishedSem) != VK_SUCCESS ||
+            vkCreateFence(rd->device, &fenceInfo, nullptr, &frame.inFlightFence) != VK_SUCCESS) {
+            fprintf(stderr, "Failed to create sync object\n");
+            exit(1);
+        }
+
+        frame.ring = {
+            .buffer = ringBuffer.buffer,
+            .mapped = mapped + i * FRAME_RING_SIZE,
+            .baseOffset = i * FRAME_RING_SIZE,
+            .head = 0,
+            .alignment = alignment};
+
+        frame.descriptors.Init(rd->device, 64, poolSizes);
+    }
+}
+
+void DestroyFrameContexts(Vulkan_RenderDevice *rd, std::span<Vulkan_FrameContext> frames, Vulkan_FrameRingBuffer &ringBuffer) {
+    for (Vulkan_FrameContext &frame : frames) {
+        frame.descriptors.DestroyPools(rd->device);
+
+        vkDestroySemaphore(rd->device, frame.renderFinishedSem, nullptr);
+        vkDestroySemaphore(rd->device, frame.imageAvailableSem, nullptr);
+        vkDestroyFence(rd->device, frame.inFlightFence, nullptr);
+
+        // destroying the pool frees the command buffer
+        vkDestroyCommandPool(rd->device, frame.commandPool, nullptr);
+    }
+
+    vkUnmapMemory(rd->device, ringBuffer.memory);
+    vkDestroyBuffer(rd->device, ringBuffer.buffer, nullptr);
+    vkFreeMemory(rd->device, ringBuffer.memory, nullptr);
+}
+
+void ResetFrameContext(Vulkan_RenderDevice *rd, Vulkan_FrameContext &frame) {
+    vkWaitForFences(rd->device, 1, &frame.inFlightFence, VK_TRUE, UINT64_MAX);
+
+    vkResetCommandPool(rd->device, frame.commandPool, 0);
+    frame.descriptors.ClearPools(rd->device);
+    frame.ring.head = 0;
+}
+
+}
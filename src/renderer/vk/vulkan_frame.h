@@ -0,0 +1,55 @@
+#pragma once
+
+#include "types.h"
+#define VK_USE_PLATFORM_WIN32_KHR
+#include <vulkan/vulkan.h>
+
+#include <span>
+#include "vulkan_ds.h"
+
+namespace xjar {
+
+struct Vulkan_RenderDevice;
+
+// bytes of per-frame uniform and storage data a frame can push
+static constexpr u32 FRAME_RING_SIZE = 256 * 1024;
+
+// linear allocator over this frame's region of the shared ring buffer,
+// the region is only rewritten after the fence of the frame has signalled
+struct Vulkan_FrameRing {
+    VkBuffer buffer;
+    u8      *mapped;     // start of the region
+    u32      baseOffset; // of the region in buffer
+    u32      head;
+    u32      alignment;
+
+    // copies data into the region and returns its offset in buffer, usable as a dynamic offset
+    u32 Push(const void *data, u32 dataSize);
+    // reserves dataSize bytes to be written through the returned pointer, offset is set like Push returns it
+    u8 *Allocate(u32 dataSize, u32 &offset);
+};
+
+// everything one frame in flight records into or reads from,
+// there are MAX_FRAMES_IN_FLIGHT of them however many images the swapchain has
+struct Vulkan_FrameContext {
+    VkCommandPool       commandPool;
+    VkCommandBuffer     commandBuffer;
+    VkFence             inFlightFence;
+    VkSemaphore         imageAvailableSem;
+    VkSemaphore         renderFinishedSem;
+    Vulkan_FrameRing    ring;
+    DescriptorAllocator descriptors; // sets allocated here live until the frame comes around again
+};
+
+struct Vulkan_FrameRingBuffer {
+    VkBuffer       buffer;
+    VkDeviceMemory memory;
+};
+
+void CreateFrameContexts(Vulkan_RenderDevice *rd, std::span<Vulkan_FrameContext> frames, Vulkan_FrameRingBuffer &ringBuffer);
+void DestroyFrameContexts(Vulkan_RenderDevice *rd, std::span<Vulkan_FrameContext> frames, Vulkan_FrameRingBuffer &ringBuffer);
+
+// waits until the GPU is done with the frame and recycles its memory
+void ResetFrameContext(Vulkan_RenderDevice *rd, Vulkan_FrameContext &frame);
+
+}
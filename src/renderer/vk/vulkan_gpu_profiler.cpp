@@ -0,0 +1,119 @@
+#include "pch.h"
+#include "vulkan_gpu_profiler.h"
+#include "vulkan_render_device.h"
+
+namespace xjar {
+
+static constexpr u32 QUERIES_PER_FRAME = GPU_PASS_COUNT * 2;
+
+void Vulkan_GpuProfiler::Init(Vulkan_RenderDevice *rd) {
+    m_renderDevice = rd;
+
+    VkPhysicalDeviceProperties devProps;
+    vkGetPhysicalDeviceProperties(rd->physicalDevice, &devProps);
+
+    u32 familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(rd->physicalDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(rd->physicalDevice, &familyCount, families.data());
+
+    QueueFamily indices = FindQueueFamilies(rd->physicalDevice, rd->surface);
+    const u32   validBits = families[indices.graphicsFamily.value()].timestampValidBits;
+
+    if (validBits == 0 || devProps.limits.timestampPeriod == 0.0f) {
+        fprintf(stderr, "Timestamps are not supported on the graphics queue, GPU profiling is off\n");
+        return;
+    }
+
+    m_supported = true;
+    m_nsPerTick = devProps.limits.timestampPeriod;
+    m_timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+    VkQueryPoolCreateInfo poolInfo {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = QUERIES_PER_FRAME * MAX_FRAMES_IN_FLIGHT;
+
+    if (vkCreateQueryPool(rd->device, &poolInfo, nullptr, &m_queryPool) != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create timestamp query pool\n");
+        exit(1);
+    }
+}
+
+void Vulkan_GpuProfiler::Destroy() {
+    if (m_queryPool != VK_NULL_HANDLE)
+        vkDestroyQueryPool(m_renderDevice->device, m_queryPool, nullptr);
+}
+
+void Vulkan_GpuProfiler::ReadBack(u32 frameIndex) {
+    // value and availability of every query
+    u64 results[QUERIES_PER_FRAME][2];
+
+    // VK_NOT_READY only means some passes were not recorded, their availability stays 0
+    vkGetQueryPoolResults(m_renderDevice->device, m_queryPool,
+                          QueryIndex(frameIndex, 0), QUERIES_PER_FRAME,
+                          sizeof(results), results, sizeof(results[0]),
+                          VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+    f64 passMs[GPU_PASS_COUNT];
+    u64 first = ~0ull;
+    u64 last = 0;
+
+    for (u32 pass = 0; pass < GPU_PASS_COUNT; pass++) {
+        passMs[pass] = -1.0;
+
+        const u64 *begin = results[pass * 2];
+        const u64 *end = results[pass * 2 + 1];
+        if (!(m_endedPasses[frameIndex] & (1u << pass)) || begin[1] == 0 || end[1] == 0)
+            continue;
+
+        const u64 ticks = (end[0] - begin[0]) & m_timestampMask;
+        passMs[pass] = ticks * m_nsPerTick * 1e-6;
+
+        first = std::min(first, begin[0]);
+        last = std::max(last, end[0]);
+    }
+
+    if (first > last)
+        return;
+
+    const f64 frameMs = ((last - first) & m_timestampMask) * m_nsPerTick * 1e-6;
+    m_history.AddFrame(m_frameNumbers[frameIndex], passMs, frameMs);
+}
+
+void Vulkan_GpuProfiler::BeginFrame(VkCommandBuffer cmdbuf, u32 frameIndex) {
+    if (!m_supported)
+        return;
+
+    m_currentFrame = frameIndex;
+
+    if (m_endedPasses[frameIndex] != 0)
+        ReadBack(frameIndex);
+
+    vkCmdResetQueryPool(cmdbuf, m_queryPool, QueryIndex(frameIndex, 0), QUERIES_PER_FRAME);
+
+    m_beganPasses[frameIndex] = 0;
+    m_endedPasses[frameIndex] = 0;
+    m_frameNumbers[frameIndex] = m_frameNumber++;
+}
+
+void Vulkan_GpuProfiler::BeginPass(VkCommandBuffer cmdbuf, u32 pass) {
+    // a query can be written once between resets, a pass recorded twice keeps its first timing
+    const u32 bit = 1u << pass;
+    if (!m_supported || (m_beganPasses[m_currentFrame] & bit))
+        return;
+
+    m_beganPasses[m_currentFrame] |= bit;
+    vkCmdWriteTimestamp(cmdbuf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_queryPool, QueryIndex(m_currentFrame, pass));
+}
+
+void Vulkan_GpuProfiler::EndPass(VkCommandBuffer cmdbuf, u32 pass) {
+    const u32 bit = 1u << pass;
+    if (!m_supported || !(m_beganPasses[m_currentFrame] & bit) || (m_endedPasses[m_currentFrame] & bit))
+        return;
+
+    m_endedPasses[m_currentFrame] |= bit;
+    vkCmdWriteTimestamp(cmdbuf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPool, QueryIndex(m_currentFrame, pass) + 1);
+}
+
+}
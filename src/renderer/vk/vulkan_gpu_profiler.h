@@ -0,0 +1,70 @@
+#pragma once
+
+#include "types.h"
+#define VK_USE_PLATFORM_WIN32_KHR
+#include <vulkan/vulkan.h>
+
+#include "renderer/gpu_profiler.h"
+
+namespace xjar {
+
+struct Vulkan_RenderDevice;
+
+// timestamps around the passes of every frame in flight. The queries of a frame are read back
+// when the frame comes around again, after its fence has signalled, so reading never stalls.
+class Vulkan_GpuProfiler final {
+public:
+    void Init(Vulkan_RenderDevice *rd);
+    void Destroy();
+
+    // collects what frameIndex recorded MAX_FRAMES_IN_FLIGHT frames ago and resets its queries,
+    // has to be recorded outside of a render pass
+    void BeginFrame(VkCommandBuffer cmdbuf, u32 frameIndex);
+    // inside of a render pass only if its contents are inline, a pass with secondaries only takes vkCmdExecuteCommands
+    void BeginPass(VkCommandBuffer cmdbuf, u32 pass);
+    void EndPass(VkCommandBuffer cmdbuf, u32 pass);
+
+    GpuProfileHistory *GetHistory() {
+        return m_supported ? &m_history : nullptr;
+    }
+
+private:
+    u32 QueryIndex(u32 frameIndex, u32 pass) const {
+        return (frameIndex * GPU_PASS_COUNT + pass) * 2;
+    }
+
+    void ReadBack(u32 frameIndex);
+
+    Vulkan_RenderDevice *m_renderDevice;
+    VkQueryPool          m_queryPool = VK_NULL_HANDLE;
+    b32                  m_supported = false;
+    f64                  m_nsPerTick;
+    u64                  m_timestampMask;
+
+    u32 m_currentFrame = 0;
+    u64 m_frameNumber = 0;
+    // per frame in flight, bit i is pass i
+    u32 m_beganPasses[MAX_FRAMES_IN_FLIGHT] = {};
+    u32 m_endedPasses[MAX_FRAMES_IN_FLIGHT] = {};
+    u64 m_frameNumbers[MAX_FRAMES_IN_FLIGHT] = {};
+
+    GpuProfileHistory m_history;
+};
+
+// times the commands recorded in its scope
+struct Vulkan_GpuZone {
+    Vulkan_GpuZone(Vulkan_GpuProfiler &profiler, VkCommandBuffer cmdbuf, u32 pass):
+        profiler(profiler), cmdbuf(cmdbuf), pass(pass) {
+        profiler.BeginPass(cmdbuf, pass);
+    }
+
+    ~Vulkan_GpuZone() {
+        profiler.EndPass(cmdbuf, pass);
+    }
+
+    Vulkan_GpuProfiler &profiler;
+    VkCommandBuffer     cmdbuf;
+    u32                 pass;
+};
+
+}
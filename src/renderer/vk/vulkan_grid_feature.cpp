@@ -6,6 +6,7 @@
 #include "vulkan_pipeline.h"
 #include "vulkan_ds.h"
 #include "vulkan_texture.h"
+#include "vulkan_frame.h"
 
 #include "io.h"
 #include "world.h"
@@ -23,81 +24,19 @@ struct GPU_Grid {
 
 static_assert(sizeof(GPU_Grid) % 16 == 0, "GPU_Grid should be padded to 16 bytes");
 
-void Vulkan_GridFeature::Init(Vulkan_RenderDevice *device, Vulkan_Swapchain *swapchain) {
+void Vulkan_GridFeature::Init(Vulkan_RenderDevice *device, Vulkan_Swapchain *swapchain, Vulkan_FrameContext *frames, Vulkan_PipelineBatch &pipelines) {
     m_renderDevice = device;
     m_swapchain = swapchain;
+    m_frames = frames;
 
-    CreateColorRenderPass();
-    CreateFramebuffers();
-    CreateUniformBuffers();
-    CreateDescriptorPool();
-    AllocateDescriptorSets();
-    CreatePipeline();
+    // the pipelines only need the attachment formats with dynamic rendering
+    if (!m_renderDevice->dynamicRendering)
+        CreateColorAndDepthRenderPass();
+    CreateDescriptorLayout();
+    pipelines.Add([this]() { CreatePipeline(); });
 }
 
-void Vulkan_GridFeature::BeginPass(FrameStatus frame) {
-    VkCommandBuffer *vkcmdbuf = (VkCommandBuffer *)frame.commandBuffer;
-
-    std::array<VkClearValue, 2> clearValues {};
-    clearValues[0].color = {0.1f, 0.1f, 0.1f, 1.0f};
-    clearValues[1].depthStencil = {1.0f, 0};
-
-    VkRenderPassBeginInfo passInfo {};
-    passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    passInfo.renderPass = m_renderPass;
-    passInfo.framebuffer = m_framebuffers[frame.currentImage];
-    passInfo.renderArea.offset = {0, 0};
-    passInfo.renderArea.extent = m_swapchain->swapchainExtent;
-    passInfo.clearValueCount = static_cast<u32>(clearValues.size());
-    passInfo.pClearValues = clearValues.data();
-
-    vkCmdBeginRenderPass(*vkcmdbuf, &passInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-    VkViewport viewport {};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = static_cast<f32>(m_swapchain->swapchainExtent.width);
-    viewport.height = static_cast<f32>(m_swapchain->swapchainExtent.height);
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-    VkRect2D scissor {{0, 0}, m_swapchain->swapchainExtent};
-
-    vkCmdSetViewport(*vkcmdbuf, 0, 1, &viewport);
-    vkCmdSetScissor(*vkcmdbuf, 0, 1, &scissor);
-
-    m_pipeline.Bind(*vkcmdbuf);
-}
-
-
-void Vulkan_GridFeature::CreateFramebuffers() {
-    auto window = GetWindow();
-
-    size_t imageCount = m_swapchain->images.size();
-    m_framebuffers.resize(imageCount);
-    for (size_t i = 0; i < imageCount; i++) {
-        std::array<VkImageView, 2> attachments = {m_swapchain->imageViews[i], m_swapchain->depthImageViews[i]};
-
-        VkFramebufferCreateInfo framebufferInfo = {};
-        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        framebufferInfo.renderPass = m_renderPass;
-        framebufferInfo.attachmentCount = 1;
-        framebufferInfo.pAttachments = attachments.data();
-        framebufferInfo.width = window.width;
-        framebufferInfo.height = window.height;
-        framebufferInfo.layers = 1;
-
-        if (vkCreateFramebuffer(
-                m_renderDevice->device,
-                &framebufferInfo,
-                nullptr,
-                &m_framebuffers[i]) != VK_SUCCESS) {
-            fprintf(stderr, "Failed to create framebuffer\n");
-            exit(1);
-        }
-    }
-}
-
-void Vulkan_GridFeature::CreateColorRenderPass() {
+void Vulkan_GridFeature::CreateColorAndDepthRenderPass() {
     VkAttachmentDescription depthAttachment {};
     depthAttachment.format = FindDepthFormat(m_renderDevice->physicalDevice);
     depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
@@ -130,7 +69,7 @@ void Vulkan_GridFeature::CreateColorRenderPass() {
     subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
     subpass.colorAttachmentCount = 1;
     subpass.pColorAttachments = &colorAttachmentRef;
-    subpass.pDepthStencilAttachment = nullptr;
+    subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
     VkSubpassDependency dependency = {};
     dependency.dstSubpass = 0;
@@ -147,7 +86,7 @@ void Vulkan_GridFeature::CreateColorRenderPass() {
 
     VkRenderPassCreateInfo renderPassInfo = {};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassInfo.attachmentCount = 1; // don't use depth
+    renderPassInfo.attachmentCount = static_cast<u32>(attachments.size()); // not tested against, the grid shares the pass of the meshes
     renderPassInfo.pAttachments = attachments.data();
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
@@ -162,109 +101,58 @@ void Vulkan_GridFeature::CreateColorRenderPass() {
 void Vulkan_GridFeature::Destroy() {
     vkDestroyRenderPass(m_renderDevice->device, m_renderPass, nullptr);
 
-    size_t imageCount = m_swapchain->images.size();
-
-    vkDestroyDescriptorPool(m_renderDevice->device, m_dsPool, nullptr);
-
-    for (u32 i = 0; i < imageCount; i++) {
-        vkDestroyFramebuffer(m_renderDevice->device, m_framebuffers[i], nullptr);
-
-        vkDestroyBuffer(m_renderDevice->device, m_uniformBuffers[i], nullptr);
-        vkFreeMemory(m_renderDevice->device, m_uniformBuffersMemory[i], nullptr);
-    }
-
     vkDestroyDescriptorSetLayout(m_renderDevice->device, m_dsLayout, nullptr);
     m_pipeline.Destroy(m_renderDevice->device);
 }
 
-void Vulkan_GridFeature::AllocateDescriptorSets() {
-    const u32 imageCount = static_cast<u32>(m_swapchain->images.size());
-    m_descriptorSets.resize(imageCount);
-
-    for (u32 i = 0; i < imageCount; i++) {
-        VkDescriptorSetAllocateInfo        allocInfo {};
-        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        allocInfo.descriptorPool = m_dsPool;
-        allocInfo.descriptorSetCount = 1;
-        allocInfo.pSetLayouts = &m_dsLayout;
-
-        if (vkAllocateDescriptorSets(m_renderDevice->device, &allocInfo, &m_descriptorSets[i]) != VK_SUCCESS) {
-            fprintf(stderr, "Failed to allocate descriptor sets\n");
-            exit(1);
-        }
-
-        DescriptorWriter writer;
-        writer.WriteBuffer(0, m_uniformBuffers[i], sizeof(GPU_Grid), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-
-        writer.UpdateSet(m_renderDevice->device, m_descriptorSets[i]);
-    }
-}
-
-void Vulkan_GridFeature::Draw(FrameStatus frame, GPU_SceneData *sceneData) {
-    VkCommandBuffer *vkcmdbuf = (VkCommandBuffer *)frame.commandBuffer;
-
+void Vulkan_GridFeature::Prepare(FrameStatus frame, GPU_SceneData *sceneData) {
     GPU_Grid gridData {};
     gridData.view = sceneData->viewMat;
     gridData.projection = sceneData->projMat;
 
     gridData.projection[1][1] *= -1;
 
-    UploadBufferData(m_renderDevice, m_uniformBuffersMemory[frame.currentImage], 0, &gridData, sizeof(GPU_Grid));
+    // the set is rebuilt every frame, the frame's pool is cleared once its fence has signalled
+    Vulkan_FrameContext &frameContext = m_frames[frame.currentFrame];
+    const u32 offset = frameContext.ring.Push(&gridData, sizeof(GPU_Grid));
 
-    vkCmdBindDescriptorSets(*vkcmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline.pipelineLayout, 0, 1, &m_descriptorSets[frame.currentImage], 0, nullptr);
+    m_descriptorSet = frameContext.descriptors.Allocate(m_renderDevice->device, m_dsLayout);
 
-    vkCmdDraw(*vkcmdbuf, 6, 1, 0, 0);
+    DescriptorWriter writer;
+    writer.WriteBuffer(0, frameContext.ring.buffer, sizeof(GPU_Grid), offset, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    writer.UpdateSet(m_renderDevice->device, m_descriptorSet);
 }
 
-void Vulkan_GridFeature::OnResize(Vulkan_Swapchain *swapchain) {
-    m_swapchain = swapchain;
-
-    size_t imageCount = m_swapchain->images.size();
-    for (size_t i = 0; i < imageCount; i++) {
-        vkDestroyFramebuffer(m_renderDevice->device, m_framebuffers[i], nullptr);
-    }
-
-    CreateFramebuffers();
-}
+void Vulkan_GridFeature::Draw(VkCommandBuffer cmdbuf, const RGPassContext &context) {
+    VkViewport viewport {};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = static_cast<f32>(context.extent.width);
+    viewport.height = static_cast<f32>(context.extent.height);
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    VkRect2D scissor {{0, 0}, context.extent};
 
-void Vulkan_GridFeature::CreateDescriptorPool() {
-    const u32 imageCount = static_cast<u32>(m_swapchain->images.size());
+    vkCmdSetViewport(cmdbuf, 0, 1, &viewport);
+    vkCmdSetScissor(cmdbuf, 0, 1, &scissor);
 
-    VkDescriptorPoolSize poolSize {};
-    poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSize.descriptorCount = imageCount;
+    m_pipeline.Bind(cmdbuf);
+    vkCmdBindDescriptorSets(cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline.pipelineLayout, 0, 1, &m_descriptorSet, 0, nullptr);
 
-    VkDescriptorPoolCreateInfo poolInfo {};
-    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolInfo.poolSizeCount = 1;
-    poolInfo.pPoolSizes = &poolSize;
-    poolInfo.maxSets = imageCount;
+    vkCmdDraw(cmdbuf, 6, 1, 0, 0);
+}
 
-    if (vkCreateDescriptorPool(m_renderDevice->device, &poolInfo, nullptr, &m_dsPool) != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create descriptor pool\n");
-        exit(1);
-    }
+void Vulkan_GridFeature::OnResize(Vulkan_Swapchain *swapchain) {
+    m_swapchain = swapchain;
+}
 
+void Vulkan_GridFeature::CreateDescriptorLayout() {
     DescriptorLayoutBuilder dsBindings;
     dsBindings.AddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);
 
     m_dsLayout = dsBindings.Build(m_renderDevice->device);
 }
 
-void Vulkan_GridFeature::CreateUniformBuffers() {
-    const u32 imageCount = static_cast<u32>(m_swapchain->images.size());
-
-    m_uniformBuffers.resize(imageCount);
-    m_uniformBuffersMemory.resize(imageCount);
-
-    for (u32 i = 0; i < imageCount; i++) {
-        CreateBuffer(m_renderDevice, sizeof(GPU_Grid),
-                     VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                     m_uniformBuffers[i], m_uniformBuffersMemory[i]);
-    }
-}
-
 void Vulkan_GridFeature::CreatePipeline() {
     auto vertShaderCode = ReadFile("shaders/grid.vert.spv");
     auto fragShaderCode = ReadFile("shaders/grid.frag.spv");
@@ -293,9 +181,11 @@ void Vulkan_GridFeature::CreatePipeline() {
     m_pipeline.SetCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
     m_pipeline.SetMultisamplingNone();
     m_pipeline.EnableBlendingAlphablend();
-    m_pipeline.DisableDepthtest();
+    // drawn after the meshes, behind them it is hidden
+    m_pipeline.EnableDepthtest(VK_FALSE, VK_COMPARE_OP_LESS_OR_EQUAL);
     m_pipeline.SetShaders(shaderStages);
     m_pipeline.SetDescriptorSets(&m_dsLayout, 1);
+    m_pipeline.SetAttachmentFormats(m_renderDevice->swapchainImageFormat, FindDepthFormat(m_renderDevice->physicalDevice));
     m_pipeline.Create(m_renderDevice, m_renderPass);
 
     vkDestroyShaderModule(m_renderDevice->device, fragShaderModule, nullptr);
@@ -5,42 +5,38 @@
 #include "renderer/camera.h"
 #include "vulkan_pipeline.h"
 #include "vulkan_ds.h"
+#include "vulkan_render_graph.h"
 #include <unordered_set>
 
 namespace xjar {
 
 struct Vulkan_Swapchain;
 struct Vulkan_RenderDevice;
+struct Vulkan_FrameContext;
 struct GPU_SceneData;
 
 class Vulkan_GridFeature final {
 public:
-    void Init(Vulkan_RenderDevice *device, Vulkan_Swapchain *swapchain);
+    void Init(Vulkan_RenderDevice *device, Vulkan_Swapchain *swapchain, Vulkan_FrameContext *frames, Vulkan_PipelineBatch &pipelines);
     void Destroy();
-    void Draw(FrameStatus frame, GPU_SceneData *sceneData);
+    // pushes the grid uniforms of the frame, the pass is recorded later by the render graph
+    void Prepare(FrameStatus frame, GPU_SceneData *sceneData);
+    void Draw(VkCommandBuffer cmdbuf, const RGPassContext &context);
     void OnResize(Vulkan_Swapchain *swapchain);
-    void BeginPass(FrameStatus frame);
 
 private:
-    void CreateColorRenderPass();
-    void CreateFramebuffers();
+    void CreateColorAndDepthRenderPass();
     void CreatePipeline();
-    void CreateDescriptorPool();
-    void CreateUniformBuffers();
-    void AllocateDescriptorSets();
-
-    std::vector<VkFramebuffer> m_framebuffers;
+    void CreateDescriptorLayout();
 
     Vulkan_RenderDevice *m_renderDevice;
     Vulkan_Pipeline      m_pipeline;
     Vulkan_Swapchain    *m_swapchain;
+    Vulkan_FrameContext *m_frames; // the grid uniforms and set live in the frame's ring and descriptor pool
 
-    VkDescriptorPool                 m_dsPool;
     VkDescriptorSetLayout            m_dsLayout;
-    VkRenderPass                     m_renderPass;
-    std::vector<VkBuffer>       m_uniformBuffers;
-    std::vector<VkDeviceMemory> m_uniformBuffersMemory;
-    std::vector<VkDescriptorSet> m_descriptorSets;
+    VkDescriptorSet                  m_descriptorSet; // of the frame being recorded
+    VkRenderPass                     m_renderPass = VK_NULL_HANDLE; // the pipeline is made with it, unless with dynamic rendering
 };
 
 }
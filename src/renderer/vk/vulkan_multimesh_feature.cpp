@@ -6,31 +6,37 @@
 #include "vulkan_pipeline.h"
 #include "vulkan_ds.h"
 #include "vulkan_texture.h"
+#include "vulkan_frame.h"
 
 #include "io.h"
-#include "world.h"
 #include "window.h"
 #include "material_descr.h"
 #include "texture_manager.h"
+#include "profiler.h"
 
 namespace xjar {
 
 static u32 g_offsetAlignment;
 
+static u32 AlignToStorageOffset(u32 size) {
+    return (size + g_offsetAlignment - 1) & ~(g_offsetAlignment - 1);
+}
+
 static constexpr int MAX_COMMANDS = 2048;
 
-void Vulkan_MultiMeshFeature::Init(Vulkan_RenderDevice *device, Vulkan_Swapchain *swapchain) {
+void Vulkan_MultiMeshFeature::Init(Vulkan_RenderDevice *device, Vulkan_Swapchain *swapchain, Vulkan_FrameContext *frames, Vulkan_PipelineBatch &pipelines) {
     m_renderDevice = device;
     m_swapchain = swapchain;
+    m_frames = frames;
 
-    CreateColorAndDepthRenderPass();
-    CreateDepthResources();
-    CreateFramebuffers();
+    // the pipelines only need the attachment formats with dynamic rendering
+    m_renderPass = m_renderDevice->dynamicRendering ? VK_NULL_HANDLE : CreateColorAndDepthRenderPass();
     CreateDescriptorPool();
-    CreatePipeline();
-    CreateUniformBuffers();
-    
-    const u32 imageCount = static_cast<u32>(m_swapchain->images.size());
+    m_clusteredLighting.Create(m_renderDevice, m_frames[0].ring.buffer, pipelines);
+    m_pipelineVariants.Init(m_renderDevice->device, [this](Vulkan_Pipeline &pipeline, u32 key) { CreatePipeline(pipeline, "shaders/basic.vert.spv", key); });
+    m_indexedPipelineVariants.Init(m_renderDevice->device, [this](Vulkan_Pipeline &pipeline, u32 key) { CreatePipeline(pipeline, "shaders/basic_indexed.vert.spv", key); });
+    // the rest of the variants are built when a model needs them
+    pipelines.Add([this]() { m_pipelineVariants.Get(GetVariantKey(MaterialDescr {}, 0)); });
 
 
 	VkSamplerCreateInfo sampler {};
@@ -44,61 +50,55 @@ void Vulkan_MultiMeshFeature::Init(Vulkan_RenderDevice *device, Vulkan_Swapchain
     sampler.minFilter = VK_FILTER_LINEAR;
     vkCreateSampler(m_renderDevice->device, &sampler, nullptr, &m_defaultSamplerLinear);
 
-    m_indirectBuffers.resize(imageCount);
-    m_indirectBuffersMemory.resize(imageCount);
+    CreateBuffer(m_renderDevice, MAX_COMMANDS * sizeof(VkDrawIndirectCommand),
+                 VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 m_indirectBuffer, m_indirectBufferMemory);
 
-    for (size_t i = 0; i < imageCount; i++) {
-        CreateBuffer(m_renderDevice, MAX_COMMANDS * sizeof(VkDrawIndirectCommand),
-                     VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
-                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                     m_indirectBuffers[i], m_indirectBuffersMemory[i]);
-    }
-    m_models.resize(32);
+    CreateBuffer(m_renderDevice, MAX_COMMANDS * sizeof(VkDrawIndexedIndirectCommand),
+                 VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 m_indexedIndirectBuffer, m_indexedIndirectBufferMemory);
 
     VkPhysicalDeviceProperties devProps;
     vkGetPhysicalDeviceProperties(m_renderDevice->physicalDevice, &devProps);
 
-    EnableShadows();
+    EnableShadows(pipelines);
+
+    m_recorder.Init(m_renderDevice);
     g_offsetAlignment = static_cast<u32>(devProps.limits.minStorageBufferOffsetAlignment);
 }
 
 void Vulkan_MultiMeshFeature::Destroy() {
-    u32 imageCount = static_cast<u32>(m_swapchain->images.size());
-
-    m_shadowTechnique.Destroy(m_renderDevice, imageCount);
+    m_shadowTechnique.Destroy(m_renderDevice);
+    m_clusteredLighting.Destroy(m_renderDevice);
+    m_recorder.Destroy();
 
     vkDestroySampler(m_renderDevice->device, m_defaultSamplerLinear, nullptr);
     vkDestroySampler(m_renderDevice->device, m_defaultSamplerNearest, nullptr);
 
     vkDestroyRenderPass(m_renderDevice->device, m_renderPass, nullptr);
 
-    vkDestroyImageView(m_renderDevice->device, m_depthImageView, nullptr);
-    vkDestroyImage(m_renderDevice->device, m_depthImage, nullptr);
-    vkFreeMemory(m_renderDevice->device, m_depthImageMemory, nullptr);
-  
-    for (u32 i = 0; i < imageCount; i++) {
-        vkDestroyFramebuffer(m_renderDevice->device, m_framebuffers[i], nullptr);
-        m_dsAllocators[i].DestroyPools(m_renderDevice->device);
-
-        m_offscreenDsAllocators[i].DestroyPools(m_renderDevice->device);
+    m_dsAllocator.DestroyPools(m_renderDevice->device);
+    m_offscreenDsAllocator.DestroyPools(m_renderDevice->device);
 
-        vkDestroyBuffer(m_renderDevice->device, m_uniformBuffers[i], nullptr);
-        vkFreeMemory(m_renderDevice->device, m_uniformBuffersMemory[i], nullptr);
+    vkDestroyBuffer(m_renderDevice->device, m_indirectBuffer, nullptr);
+    vkFreeMemory(m_renderDevice->device, m_indirectBufferMemory, nullptr);
 
-        vkDestroyBuffer(m_renderDevice->device, m_indirectBuffers[i], nullptr);
-        vkFreeMemory(m_renderDevice->device, m_indirectBuffersMemory[i], nullptr);
-
-    }
+    vkDestroyBuffer(m_renderDevice->device, m_indexedIndirectBuffer, nullptr);
+    vkFreeMemory(m_renderDevice->device, m_indexedIndirectBufferMemory, nullptr);
 
     for (u32 i = 0; i < m_modelCount; i++) {
         DestroyModelResources(m_renderDevice->device, m_models[i]);
     }
 
     vkDestroyDescriptorSetLayout(m_renderDevice->device, m_dsLayout, nullptr);
-    m_pipeline.Destroy(m_renderDevice->device);
+    m_pipelineVariants.Destroy(m_renderDevice->device);
+    m_indexedPipelineVariants.Destroy(m_renderDevice->device);
 }
 
-void Vulkan_MultiMeshFeature::CreateColorAndDepthRenderPass() {
+// the pipelines are made with it, the render graph begins compatible passes with the load ops the frame needs
+VkRenderPass Vulkan_MultiMeshFeature::CreateColorAndDepthRenderPass() {
     VkAttachmentDescription depthAttachment {};
     depthAttachment.format = FindDepthFormat(m_renderDevice->physicalDevice);
     depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
@@ -133,17 +133,6 @@ void Vulkan_MultiMeshFeature::CreateColorAndDepthRenderPass() {
     subpass.pColorAttachments = &colorAttachmentRef;
     subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
-    VkSubpassDependency dependency = {};
-    dependency.dstSubpass = 0;
-    dependency.dstAccessMask =
-        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-    dependency.dstStageMask =
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.srcAccessMask = 0;
-    dependency.srcStageMask =
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-
     std::array<VkAttachmentDescription, 2> attachments = {colorAttachment, depthAttachment};
 
     VkRenderPassCreateInfo renderPassInfo = {};
@@ -152,27 +141,18 @@ void Vulkan_MultiMeshFeature::CreateColorAndDepthRenderPass() {
     renderPassInfo.pAttachments = attachments.data();
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
 
-    if (vkCreateRenderPass(m_renderDevice->device, &renderPassInfo, nullptr, &m_renderPass) != VK_SUCCESS) {
+    VkRenderPass renderPass;
+    if (vkCreateRenderPass(m_renderDevice->device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
         fprintf(stderr, "Failed to create render pass\n");
         exit(1);
     }
+
+    return renderPass;
 }
 
 void Vulkan_MultiMeshFeature::OnResize(Vulkan_Swapchain *swapchain) {
-    auto &window = GetWindow();
     m_swapchain = swapchain;
-
-    vkDestroyImageView(m_renderDevice->device, m_depthImageView, nullptr);
-    u32 imageCount = static_cast<u32>(m_swapchain->images.size());
-    for (u32 i = 0; i < imageCount; i++) {
-        vkDestroyFramebuffer(m_renderDevice->device, m_framebuffers[i], nullptr);
-    }
-
-    CreateDepthResources();
-    CreateFramebuffers();
 }
 
 void Vulkan_MultiMeshFeature::CreateModel(std::vector<InstanceData>  &instances,
@@ -184,11 +164,65 @@ void Vulkan_MultiMeshFeature::CreateModel(std::vector<InstanceData>  &instances,
     *handle = m_modelID;
 
     model.handle = handle;
+
+    // a deque keeps the earlier models in place while it grows
+    m_models.emplace_back();
     ModelResources &res = m_models[m_modelID++];
     m_modelCount++;
 
     res.m_maxInstanceCount = static_cast<u32>(instances.size());
-    res.m_instances = std::move(instances);
+    if (m_commandCount + res.m_maxInstanceCount > MAX_COMMANDS) {
+        fprintf(stderr, "Too many mesh instances, the indirect buffers hold %d draws\n", MAX_COMMANDS);
+        exit(1);
+    }
+
+    res.m_firstCommand = m_commandCount;
+    m_commandCount += res.m_maxInstanceCount;
+    res.m_instances.reserve(res.m_maxInstanceCount);
+    res.m_mixedIndexTypes = false;
+
+    for (u32 i = 0; i < res.m_maxInstanceCount; i++) {
+        const InstanceData &instance = instances[i];
+        const u32           indexFormat = model.mesh.meshes[instance.meshIndex].indexFormat;
+        const VkIndexType   indexType = indexFormat == INDEX_FORMAT_U16 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+
+        if (i == 0) {
+            res.m_indexType = indexType;
+        } else if (res.m_indexType != indexType) {
+            res.m_mixedIndexTypes = true;
+        }
+
+        res.m_instances.push_back(GPU_InstanceData {
+            .meshIndex = instance.meshIndex,
+            .materialIndex = instance.materialIndex,
+            .LOD = instance.LOD,
+            .indexOffset = instance.indexOffset,
+            .vertexOffset = instance.vertexOffset,
+            .transformIndex = instance.transformIndex,
+            .indexFormat = indexFormat});
+    }
+
+    // group the instances by pipeline variant so every variant is a single multi draw
+    const u32 textureCount = static_cast<u32>(textureFilenames.size());
+    auto instanceKey = [&](const GPU_InstanceData &instance) {
+        const MaterialDescr material = instance.materialIndex < materials.size() ? materials[instance.materialIndex] : MaterialDescr {};
+        return GetVariantKey(material, textureCount);
+    };
+
+    std::stable_sort(res.m_instances.begin(), res.m_instances.end(), [&](const GPU_InstanceData &a, const GPU_InstanceData &b) {
+        return instanceKey(a) < instanceKey(b);
+    });
+
+    for (u32 i = 0; i < res.m_maxInstanceCount; i++) {
+        const u32 key = instanceKey(res.m_instances[i]);
+        if (res.m_drawRanges.empty() || res.m_drawRanges.back().variantKey != key) {
+            res.m_drawRanges.push_back({.firstInstance = i, .instanceCount = 0, .variantKey = key});
+        }
+        res.m_drawRanges.back().instanceCount++;
+    }
+
+    // build the missing variants now rather than on the first frame that draws the model
+    BuildVariants(m_modelCount - 1);
 
     m_instanceCount += res.m_maxInstanceCount;
 
@@ -197,7 +231,7 @@ void Vulkan_MultiMeshFeature::CreateModel(std::vector<InstanceData>  &instances,
     const size_t materialsSize = materials.size() * sizeof(MaterialDescr);
     const size_t indirectDataSize = res.m_maxInstanceCount * sizeof(VkDrawIndirectCommand);
 
-    res.m_maxInstanceSize = res.m_maxInstanceCount * sizeof(InstanceData);
+    res.m_maxInstanceSize = res.m_maxInstanceCount * sizeof(GPU_InstanceData);
     res.m_materials = std::move(materials);
     res.m_maxMaterialSize = static_cast<u32>(materialsSize);
     res.m_loadedTextures.reserve(textureFilenames.size());
@@ -208,10 +242,6 @@ void Vulkan_MultiMeshFeature::CreateModel(std::vector<InstanceData>  &instances,
         textureManager.Acquire(textureName);
     }
 
-    const size_t imageCount = m_swapchain->images.size();
-    res.m_instanceBuffers.resize(imageCount);
-    res.m_instanceBuffersMemory.resize(imageCount);
-
     CreateBuffer(m_renderDevice, res.m_maxMaterialSize,
                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
@@ -219,251 +249,169 @@ void Vulkan_MultiMeshFeature::CreateModel(std::vector<InstanceData>  &instances,
 
     UploadBufferData(m_renderDevice, res.m_materialBufferMemory, 0, res.m_materials.data(), materialsSize);
 
-    res.m_maxVertexBufferSize = static_cast<u32>(vertexDataSize);
+    // attribute streams | position streams | indices, each range starts at a valid storage buffer offset
+    res.m_attributeStreamSize = model.mesh.positionStreamOffset;
+    res.m_positionStreamOffset = AlignToStorageOffset(res.m_attributeStreamSize);
+    res.m_positionStreamSize = static_cast<u32>(vertexDataSize) - model.mesh.positionStreamOffset;
+    res.m_maxVertexBufferSize = AlignToStorageOffset(res.m_positionStreamOffset + res.m_positionStreamSize);
     res.m_maxIndexBufferSize = static_cast<u32>(indexDataSize);
 
-
-    if ((res.m_maxVertexBufferSize & (g_offsetAlignment - 1)) != 0) {
-        int floats = (g_offsetAlignment - (res.m_maxVertexBufferSize & (g_offsetAlignment - 1))) / sizeof(f32);
-        for (int ii = 0; ii < floats; ii++)
-            model.mesh.vertexData.push_back(0);
-        res.m_maxVertexBufferSize = (res.m_maxVertexBufferSize + g_offsetAlignment) & ~(g_offsetAlignment - 1);
-    }
-
+    // the index range doubles as a real index buffer for DrawMode::Indexed
     CreateBuffer(m_renderDevice, res.m_maxVertexBufferSize + res.m_maxIndexBufferSize,
-                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
                  res.m_storageBuffer, res.m_storageBufferMemory);
 
-    UploadBufferData(m_renderDevice, res.m_storageBufferMemory, 0, model.mesh.vertexData.data(), vertexDataSize);
+    const u8 *vertexData = (const u8 *)model.mesh.vertexData.data();
+    UploadBufferData(m_renderDevice, res.m_storageBufferMemory, 0, vertexData, res.m_attributeStreamSize);
+    UploadBufferData(m_renderDevice, res.m_storageBufferMemory, res.m_positionStreamOffset, vertexData + res.m_attributeStreamSize, res.m_positionStreamSize);
     UploadBufferData(m_renderDevice, res.m_storageBufferMemory, res.m_maxVertexBufferSize, model.mesh.indexData.data(), indexDataSize);
 
-    size_t offsetMemory = *handle * sizeof(VkDrawIndirectCommand);
-    for (auto i = 0; i < imageCount; i++) {
-
-        VkDrawIndirectCommand *data = nullptr;
-        vkMapMemory(m_renderDevice->device, m_indirectBuffersMemory[i],
-            offsetMemory, res.m_maxInstanceCount * sizeof(VkDrawIndirectCommand),
-            0, (void **)&data);
-
-        for (u32 i = 0; i < res.m_maxInstanceCount; i++) {
-            const u32 j = res.m_instances[i].meshIndex;
-            const u32 lod = res.m_instances[i].LOD;
-            data[i] = {
-                .vertexCount = (u32)model.mesh.meshes[j].LodSize(j),
-                .instanceCount = 1,
-                .firstVertex = 0,
-                .firstInstance = i};
-        }
+    // the draw commands and instances are static, one copy serves every frame in flight
+    size_t offsetMemory = res.m_firstCommand * sizeof(VkDrawIndirectCommand);
+    size_t offsetIndexedMemory = res.m_firstCommand * sizeof(VkDrawIndexedIndirectCommand);
+
+    VkDrawIndirectCommand *data = nullptr;
+    vkMapMemory(m_renderDevice->device, m_indirectBufferMemory,
+        offsetMemory, res.m_maxInstanceCount * sizeof(VkDrawIndirectCommand),
+        0, (void **)&data);
+
+    VkDrawIndexedIndirectCommand *indexedData = nullptr;
+    vkMapMemory(m_renderDevice->device, m_indexedIndirectBufferMemory,
+        offsetIndexedMemory, res.m_maxInstanceCount * sizeof(VkDrawIndexedIndirectCommand),
+        0, (void **)&indexedData);
+
+    for (u32 i = 0; i < res.m_maxInstanceCount; i++) {
+        const u32 j = res.m_instances[i].meshIndex;
+        const u32 lod = res.m_instances[i].LOD;
+        const u32 indexCount = model.mesh.meshes[j].LodIndexCount(lod);
+
+        data[i] = {
+            .vertexCount = indexCount,
+            .instanceCount = 1,
+            .firstVertex = 0,
+            .firstInstance = i};
+
+        // gl_VertexIndex = index + vertexOffset (gl_BaseVertex), same as the pulled ibo.data[refIdx] + vertexOffset
+        indexedData[i] = {
+            .indexCount = indexCount,
+            .instanceCount = 1,
+            .firstIndex = res.m_instances[i].indexOffset,
+            .vertexOffset = static_cast<i32>(res.m_instances[i].vertexOffset),
+            .firstInstance = i};
+    }
 
-        vkUnmapMemory(m_renderDevice->device, m_indirectBuffersMemory[i]);
+    vkUnmapMemory(m_renderDevice->device, m_indirectBufferMemory);
+    vkUnmapMemory(m_renderDevice->device, m_indexedIndirectBufferMemory);
 
-        CreateBuffer(m_renderDevice, res.m_maxInstanceSize,
-                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                     res.m_instanceBuffers[i], res.m_instanceBuffersMemory[i]);
+    CreateBuffer(m_renderDevice, res.m_maxInstanceSize,
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 res.m_instanceBuffer, res.m_instanceBufferMemory);
 
-        UploadBufferData(m_renderDevice, res.m_instanceBuffersMemory[i], 0, res.m_instances.data(), res.m_maxInstanceSize);
-    }
+    UploadBufferData(m_renderDevice, res.m_instanceBufferMemory, 0, res.m_instances.data(), res.m_maxInstanceSize);
 
     AllocateDescriptorSets(res);
 }
 
 void Vulkan_MultiMeshFeature::CreateDescriptorPool() {
-    
-    const u32 imageCount = static_cast<u32>(m_swapchain->images.size());
-
     std::vector<PoolSizeRatio> poolSizes = {
-        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3},
-        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3},
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4},
         {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2}
     };
 
-    m_dsAllocators.resize(imageCount);
-    m_offscreenDsAllocators.resize(imageCount);
-
-    for (u32 i = 0; i < imageCount; i++) {
-        DescriptorAllocator &dsAllocator = m_dsAllocators[i];
-        dsAllocator.Init(m_renderDevice->device, 1000, poolSizes);
-
-        DescriptorAllocator &offscreenDsAllocator = m_offscreenDsAllocators[i];
-        offscreenDsAllocator.Init(m_renderDevice->device, 1000, poolSizes);
-    }
+    m_dsAllocator.Init(m_renderDevice->device, 1000, poolSizes);
+    m_offscreenDsAllocator.Init(m_renderDevice->device, 1000, poolSizes);
 
     DescriptorLayoutBuilder dsBindings;
-    dsBindings.AddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT); // viewProjection 
+    dsBindings.AddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT); // viewProjection, in the frame ring
     dsBindings.AddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);   // vertex
     dsBindings.AddBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);   // index
     dsBindings.AddBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);   // instance data buffer
     dsBindings.AddBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT); // material
     dsBindings.AddBinding(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 1024);
     dsBindings.AddBinding(6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+    dsBindings.AddBinding(7, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, VK_SHADER_STAGE_FRAGMENT_BIT); // point lights, in the frame ring
+    dsBindings.AddBinding(8, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);         // light clusters
 
     m_dsLayout = dsBindings.Build(m_renderDevice->device);
 
 }
 
-void Vulkan_MultiMeshFeature::CreateUniformBuffers() {
-    const u32 imageCount = static_cast<u32>(m_swapchain->images.size());
-
-    m_uniformBuffers.resize(imageCount);
-    m_uniformBuffersMemory.resize(imageCount);
-
-    for (u32 i = 0; i < imageCount; i++) {
-        CreateBuffer(m_renderDevice, sizeof(GPU_SceneData),
-                     VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                     m_uniformBuffers[i], m_uniformBuffersMemory[i]);
-    }
-}
-
 void Vulkan_MultiMeshFeature::AllocateDescriptorSets(ModelResources &res) {
-    const u32 imageCount = static_cast<u32>(m_swapchain->images.size());
-    res.m_descriptorSets.resize(imageCount);
-    res.m_offscreenDescriptorSets.resize(imageCount);
-
     auto &textureManager = TextureManager::Instance();
-    for (u32 i = 0; i < imageCount; i++) {
 
-        res.m_descriptorSets[i] = m_dsAllocators[i].Allocate(m_renderDevice->device, m_dsLayout);
+    // every frame ring lives in the same buffer, the frame is picked by the dynamic offset at bind time
+    const VkBuffer ringBuffer = m_frames[0].ring.buffer;
 
-        DescriptorWriter writer;
-        writer.WriteBuffer(0, m_uniformBuffers[i], sizeof(GPU_SceneData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-        writer.WriteBuffer(1, res.m_storageBuffer, res.m_maxVertexBufferSize, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-        writer.WriteBuffer(2, res.m_storageBuffer, res.m_maxIndexBufferSize, res.m_maxVertexBufferSize, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-        writer.WriteBuffer(3, res.m_instanceBuffers[i], res.m_maxInstanceSize, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-        writer.WriteBuffer(4, res.m_materialBuffer, res.m_maxMaterialSize, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-
-        // Bind all loaded textures
-        std::vector<VkDescriptorImageInfo> imageInfos;
-        for (const auto &textureName : res.m_loadedTextures) {
-            Texture texture = textureManager.Acquire(textureName);
-            Vulkan_Texture *vktexture = (Vulkan_Texture *)texture.handle;
-
-            imageInfos.emplace_back(VkDescriptorImageInfo {
-                .sampler = m_defaultSamplerLinear,
-                .imageView = vktexture->view,
-                .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL });
-        }
+    res.m_descriptorSet = m_dsAllocator.Allocate(m_renderDevice->device, m_dsLayout);
 
-        VkWriteDescriptorSet write {};
-        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        write.dstBinding = 5;
-        write.dstSet = VK_NULL_HANDLE;
-        write.descriptorCount = static_cast<u32>(imageInfos.size());
-        write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        write.pImageInfo = imageInfos.data();
+    DescriptorWriter writer;
+    writer.WriteBuffer(0, ringBuffer, sizeof(GPU_SceneData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+    writer.WriteBuffer(1, res.m_storageBuffer, res.m_attributeStreamSize, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.WriteBuffer(2, res.m_storageBuffer, res.m_maxIndexBufferSize, res.m_maxVertexBufferSize, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.WriteBuffer(3, res.m_instanceBuffer, res.m_maxInstanceSize, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.WriteBuffer(4, res.m_materialBuffer, res.m_maxMaterialSize, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
 
-        writer.writes.push_back(write);
+    // Bind all loaded textures
+    std::vector<VkDescriptorImageInfo> imageInfos;
+    for (const auto &textureName : res.m_loadedTextures) {
+        Texture texture = textureManager.Acquire(textureName);
+        Vulkan_Texture *vktexture = (Vulkan_Texture *)texture.handle;
 
-        writer.WriteImage(6, m_shadowTechnique.m_depthImageView, m_shadowTechnique.m_depthSampler, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-        
-        writer.UpdateSet(m_renderDevice->device, res.m_descriptorSets[i]);
+        imageInfos.emplace_back(VkDescriptorImageInfo {
+            .sampler = m_defaultSamplerLinear,
+            .imageView = vktexture->view,
+            .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL });
     }
 
+    VkWriteDescriptorSet write {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstBinding = 5;
+    write.dstSet = VK_NULL_HANDLE;
+    write.descriptorCount = static_cast<u32>(imageInfos.size());
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = imageInfos.data();
+
+    writer.writes.push_back(write);
+
+    writer.WriteImage(6, m_shadowTechnique.m_depthImageView, m_shadowTechnique.m_depthSampler, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    writer.WriteBuffer(7, ringBuffer, LIGHT_LIST_SIZE, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC);
+    writer.WriteBuffer(8, m_clusteredLighting.m_gridBuffer, CLUSTER_GRID_SIZE, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    
+    writer.UpdateSet(m_renderDevice->device, res.m_descriptorSet);
+
     if (m_enableShadows) {
-        VkDescriptorSetAllocateInfo allocInfo {};
-        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        allocInfo.descriptorPool = m_offscreenDsPool;
-        allocInfo.descriptorSetCount = 1;
-        allocInfo.pSetLayouts = &m_dsLayout;
-
-        for (u32 i = 0; i < imageCount; i++) {
-
-            res.m_offscreenDescriptorSets[i] = m_offscreenDsAllocators[i].Allocate(m_renderDevice->device, m_shadowTechnique.m_dsLayout);
-
-            //shadowmap depth
-            DescriptorWriter writer;
-            writer.WriteBuffer(0, m_shadowTechnique.m_uniformsDepth[i], sizeof(GPU_ShadowDepth), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-            writer.WriteBuffer(1, res.m_storageBuffer, res.m_maxVertexBufferSize, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-            writer.WriteBuffer(2, res.m_storageBuffer, res.m_maxIndexBufferSize, res.m_maxVertexBufferSize, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-            writer.WriteBuffer(3, res.m_instanceBuffers[i], res.m_maxInstanceSize, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-            writer.UpdateSet(m_renderDevice->device, res.m_offscreenDescriptorSets[i]);
-        }
-    }
-}
+        res.m_offscreenDescriptorSet = m_offscreenDsAllocator.Allocate(m_renderDevice->device, m_shadowTechnique.m_dsLayout);
 
-void Vulkan_MultiMeshFeature::CreateFramebuffers() {
-    auto window = GetWindow(); 
-
-    size_t imageCount = m_swapchain->images.size();
-    m_framebuffers.resize(imageCount);
-    for (size_t i = 0; i < imageCount; i++) {
-        std::array<VkImageView, 2> attachments = {m_swapchain->imageViews[i], m_depthImageView};
-
-        VkFramebufferCreateInfo framebufferInfo = {};
-        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        framebufferInfo.renderPass = m_renderPass;
-        framebufferInfo.attachmentCount = static_cast<u32>(attachments.size());
-        framebufferInfo.pAttachments = attachments.data();
-        framebufferInfo.width = window.width;
-        framebufferInfo.height = window.height;
-        framebufferInfo.layers = 1;
-
-        if (vkCreateFramebuffer(
-                m_renderDevice->device,
-                &framebufferInfo,
-                nullptr,
-                &m_framebuffers[i]) != VK_SUCCESS) {
-            fprintf(stderr, "Failed to create framebuffer\n");
-            exit(1);
-        }
+        //shadowmap depth
+        DescriptorWriter writer;
+        writer.WriteBuffer(0, ringBuffer, sizeof(GPU_ShadowDepth), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+        writer.WriteBuffer(1, res.m_storageBuffer, res.m_positionStreamSize, res.m_positionStreamOffset, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER); // positions only
+        writer.WriteBuffer(2, res.m_storageBuffer, res.m_maxIndexBufferSize, res.m_maxVertexBufferSize, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        writer.WriteBuffer(3, res.m_instanceBuffer, res.m_maxInstanceSize, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        writer.UpdateSet(m_renderDevice->device, res.m_offscreenDescriptorSet);
     }
 }
 
-void Vulkan_MultiMeshFeature::CreateDepthResources() {
-
-        auto depthFormat = FindDepthFormat(m_renderDevice->physicalDevice);
-
-        auto window = GetWindow(); 
-        VkImageCreateInfo imageInfo {};
-        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-        imageInfo.imageType = VK_IMAGE_TYPE_2D;
-        imageInfo.extent.width = window.width;
-        imageInfo.extent.height = window.height;
-        imageInfo.extent.depth = 1;
-        imageInfo.mipLevels = 1;
-        imageInfo.arrayLayers = 1;
-        imageInfo.format = depthFormat;
-        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL; // let the gpu to shuffle the data however it sees fit
-        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        imageInfo.flags = 0;
-
-        CreateImage(
-            m_renderDevice,
-            imageInfo,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-            m_depthImage,
-            m_depthImageMemory);
-
-        VkImageViewCreateInfo viewInfo {};
-        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-        viewInfo.image = m_depthImage;
-        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-        viewInfo.format = depthFormat;
-        viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-        viewInfo.subresourceRange.baseMipLevel = 0;
-        viewInfo.subresourceRange.levelCount = 1;
-        viewInfo.subresourceRange.baseArrayLayer = 0;
-        viewInfo.subresourceRange.layerCount = 1;
-
-        if (vkCreateImageView(m_renderDevice->device, &viewInfo, nullptr, &m_depthImageView) != VK_SUCCESS) {
-            fprintf(stderr, "Failed to create texture image view\n");
-            exit(1);
-        }
-
-        VkCommandBuffer cmdbuf = BeginImmediateCommands(m_renderDevice);
-        
-        TransitionImageLayout(cmdbuf, m_depthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
-
-        EndImmediateCommands(m_renderDevice, cmdbuf);
+u32 Vulkan_MultiMeshFeature::GetVariantKey(const MaterialDescr &material, u32 textureCount) const {
+    u32 key = 0;
+    if (m_enableShadows)
+        key |= VARIANT_SHADOWS;
+    if (m_blinnPhong)
+        key |= VARIANT_BLINN_PHONG;
+    if (material.diffuseMap < textureCount)
+        key |= VARIANT_DIFFUSE_MAP;
+    if (material.specularMap < textureCount)
+        key |= VARIANT_SPECULAR_MAP;
+
+    return key;
 }
 
-void Vulkan_MultiMeshFeature::CreatePipeline() {
-    auto vertShaderCode = ReadFile("shaders/basic.vert.spv");
+void Vulkan_MultiMeshFeature::CreatePipeline(Vulkan_Pipeline &pipeline, const char *vertShader, u32 variantKey) {
+    auto vertShaderCode = ReadFile(vertShader);
     auto fragShaderCode = ReadFile("shaders/basic.frag.spv");
 
     VkShaderModule vertShaderModule = CreateShaderModule(m_renderDevice, vertShaderCode);
@@ -491,129 +439,356 @@ void Vulkan_MultiMeshFeature::CreatePipeline() {
     push.size = sizeof(PushConstantData);
     push.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
-    m_pipeline.SetInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
-    m_pipeline.SetPolygonMode(VK_POLYGON_MODE_FILL);
-    m_pipeline.SetCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
-    m_pipeline.SetMultisamplingNone();
-    m_pipeline.DisableBlending();
-    m_pipeline.EnableDepthtest(VK_TRUE, VK_COMPARE_OP_LESS);
-    m_pipeline.SetPushConstants(push, 1);
-    m_pipeline.SetShaders(shaderStages);
-    m_pipeline.SetDescriptorSets(&m_dsLayout, 1);
-    m_pipeline.Create(m_renderDevice, m_renderPass);
+    pipeline.SetInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+    pipeline.SetPolygonMode(VK_POLYGON_MODE_FILL);
+    pipeline.SetCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+    pipeline.SetMultisamplingNone();
+    pipeline.DisableBlending();
+    if (variantKey & VARIANT_DEPTH_EQUAL) {
+        pipeline.EnableDepthtest(VK_FALSE, VK_COMPARE_OP_EQUAL);
+    } else {
+        pipeline.EnableDepthtest(VK_TRUE, VK_COMPARE_OP_LESS);
+    }
+    pipeline.SetPushConstants(push, 1);
+    pipeline.SetShaders(shaderStages);
+    pipeline.SetDescriptorSets(&m_dsLayout, 1);
+
+    // constant_id 0..3 in basic.frag
+    const VkBool32 constants[] = {
+        (variantKey & VARIANT_SHADOWS) != 0,
+        (variantKey & VARIANT_BLINN_PHONG) != 0,
+        (variantKey & VARIANT_DIFFUSE_MAP) != 0,
+        (variantKey & VARIANT_SPECULAR_MAP) != 0};
+
+    VkSpecializationMapEntry entries[std::size(constants)];
+    for (u32 i = 0; i < std::size(constants); i++)
+        entries[i] = {.constantID = i, .offset = i * (u32)sizeof(VkBool32), .size = sizeof(VkBool32)};
+
+    pipeline.SetSpecializationConstants(VK_SHADER_STAGE_FRAGMENT_BIT, entries, constants, sizeof(constants));
+    pipeline.SetAttachmentFormats(m_swapchain->imageFormat, FindDepthFormat(m_renderDevice->physicalDevice));
+    pipeline.Create(m_renderDevice, m_renderPass);
 
     vkDestroyShaderModule(m_renderDevice->device, fragShaderModule, nullptr);
     vkDestroyShaderModule(m_renderDevice->device, vertShaderModule, nullptr);
 }
 
-void Vulkan_MultiMeshFeature::BeginShadowPass(FrameStatus frame) {
-    VkCommandBuffer *vkcmdbuf = (VkCommandBuffer *)frame.commandBuffer;
-
-    m_shadowTechnique.BeginPass(*vkcmdbuf, m_swapchain->swapchainExtent, frame.currentImage);
-
-    m_passState = SHADOW_PASS;
+const ShadowCascades &Vulkan_MultiMeshFeature::UpdateShadowCascades(GPU_SceneData *sceneData) {
+    return m_shadowTechnique.Update(*sceneData);
 }
 
-void Vulkan_MultiMeshFeature::EndShadowPass(FrameStatus frame) {
-    VkCommandBuffer *vkcmdbuf = (VkCommandBuffer *)frame.commandBuffer;
+void Vulkan_MultiMeshFeature::UpdateLights(FrameStatus frame, GPU_SceneData *sceneData, std::span<const GPU_PointLight> lights) {
+    m_lightsOffset = m_clusteredLighting.Update(m_frames[frame.currentFrame].ring, *sceneData, lights, m_swapchain->swapchainExtent);
+}
 
-    m_shadowTechnique.EndPass(*vkcmdbuf);
+void Vulkan_MultiMeshFeature::DispatchLights(VkCommandBuffer cmdbuf) {
+    m_clusteredLighting.Dispatch(cmdbuf);
 }
 
-void Vulkan_MultiMeshFeature::EnableShadows() {
-    m_enableShadows = true;
+void Vulkan_MultiMeshFeature::BeginPass(VkCommandBuffer cmdbuf, const RGPassContext &context, const VkViewport &viewport, int passState) {
+    VkRect2D scissor {{0, 0}, context.extent};
 
-    m_shadowTechnique.m_width = 1920;
-    m_shadowTechnique.m_height = 1080;
-    m_shadowTechnique.Create(m_renderDevice, m_swapchain);
-}
+    // with secondaries only vkCmdExecuteCommands may be recorded into the pass
+    if (context.contents == VK_SUBPASS_CONTENTS_INLINE) {
+        vkCmdSetViewport(cmdbuf, 0, 1, &viewport);
+        vkCmdSetScissor(cmdbuf, 0, 1, &scissor);
+    }
 
-void Vulkan_MultiMeshFeature::BeginDefaultPass(FrameStatus frame) {
-    VkCommandBuffer *vkcmdbuf = (VkCommandBuffer *)frame.commandBuffer;
+    m_passViewport = viewport;
+    m_passScissor = scissor;
+    m_passColorFormat = context.colorFormat;
+
+    // without a render pass the secondaries are told the formats of the attachments instead
+    m_passRendering = {};
+    m_passRendering.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO_KHR;
+    m_passRendering.colorAttachmentCount = context.colorFormat != VK_FORMAT_UNDEFINED ? 1 : 0;
+    m_passRendering.pColorAttachmentFormats = &m_passColorFormat;
+    m_passRendering.depthAttachmentFormat = context.depthFormat;
+    m_passRendering.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    m_passInheritance = {};
+    m_passInheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    m_passInheritance.pNext = context.renderPass == VK_NULL_HANDLE ? &m_passRendering : nullptr;
+    m_passInheritance.renderPass = context.renderPass;
+    m_passInheritance.subpass = 0;
+    m_passInheritance.framebuffer = context.framebuffer;
+
+    m_passState = passState;
+}
 
-    std::array<VkClearValue, 2> clearValues {};
-    clearValues[0].color = {0.0f, 0.0f, 0.0f, 1.0f};
-    clearValues[1].depthStencil = {1.0f, 0};
+void Vulkan_MultiMeshFeature::BeginShadowPass(VkCommandBuffer cmdbuf, const RGPassContext &context, u32 cascade) {
+    BeginPass(cmdbuf, context, m_shadowTechnique.GetViewport(), SHADOW_PASS);
+    m_shadowCascade = cascade;
+}
 
-    VkRenderPassBeginInfo passInfo {};
-    passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    passInfo.renderPass = m_renderPass;
-    passInfo.framebuffer = m_framebuffers[frame.currentImage];
-    passInfo.renderArea.offset = {0, 0};
-    passInfo.renderArea.extent = m_swapchain->swapchainExtent;
-    passInfo.clearValueCount = static_cast<u32>(clearValues.size());
-    passInfo.pClearValues = clearValues.data();
+void Vulkan_MultiMeshFeature::EnableShadows(Vulkan_PipelineBatch &pipelines) {
+    m_enableShadows = true;
 
-    vkCmdBeginRenderPass(*vkcmdbuf, &passInfo, VK_SUBPASS_CONTENTS_INLINE);
+    // per cascade
+    m_shadowTechnique.m_width = 2048;
+    m_shadowTechnique.m_height = 2048;
+    m_shadowTechnique.Create(m_renderDevice, m_swapchain, pipelines);
+}
 
+static VkViewport ScreenViewport(VkExtent2D extent) {
     VkViewport viewport {};
     viewport.x = 0.0f;
     viewport.y = 0.0f;
-    viewport.width = static_cast<f32>(m_swapchain->swapchainExtent.width);
-    viewport.height = static_cast<f32>(m_swapchain->swapchainExtent.height);
+    viewport.width = static_cast<f32>(extent.width);
+    viewport.height = static_cast<f32>(extent.height);
     viewport.minDepth = 0.0f;
     viewport.maxDepth = 1.0f;
-    VkRect2D scissor {{0, 0}, m_swapchain->swapchainExtent};
 
-    vkCmdSetViewport(*vkcmdbuf, 0, 1, &viewport);
-    vkCmdSetScissor(*vkcmdbuf, 0, 1, &scissor);
+    return viewport;
+}
 
-    m_passState = DEFAULT_PASS;
+void Vulkan_MultiMeshFeature::BeginDepthPrepass(VkCommandBuffer cmdbuf, const RGPassContext &context) {
+    BeginPass(cmdbuf, context, ScreenViewport(context.extent), DEPTH_PREPASS);
 }
 
-void Vulkan_MultiMeshFeature::EndDefaultPass(FrameStatus frame) {
-    VkCommandBuffer *vkcmdbuf = (VkCommandBuffer *)frame.commandBuffer;
+void Vulkan_MultiMeshFeature::BeginDefaultPass(VkCommandBuffer cmdbuf, const RGPassContext &context, b32 afterPrepass) {
+    BeginPass(cmdbuf, context, ScreenViewport(context.extent), DEFAULT_PASS);
+
+    // keeps the depth of the pre-pass, the shading only runs for the visible fragments
+    m_depthPrepassDrawn = afterPrepass;
+}
 
-    vkCmdEndRenderPass(*vkcmdbuf);
+void Vulkan_MultiMeshFeature::DrawInstances(VkCommandBuffer cmdbuf, ModelResources &res, u32 firstInstance, u32 instanceCount) {
+    if (m_drawMode == DrawMode::Indexed) {
+        size_t offsetMemory = (res.m_firstCommand + firstInstance) * sizeof(VkDrawIndexedIndirectCommand);
+
+        if (!res.m_mixedIndexTypes) {
+            vkCmdBindIndexBuffer(cmdbuf, res.m_storageBuffer, res.m_maxVertexBufferSize, res.m_indexType);
+            vkCmdDrawIndexedIndirect(cmdbuf, m_indexedIndirectBuffer, offsetMemory, instanceCount, sizeof(VkDrawIndexedIndirectCommand));
+        } else {
+            // firstIndex is in units of the mesh index type, so the buffer is rebound whenever the type changes
+            VkIndexType boundType = VK_INDEX_TYPE_MAX_ENUM;
+            for (u32 i = firstInstance; i < firstInstance + instanceCount; i++) {
+                const VkIndexType indexType = res.m_instances[i].indexFormat == INDEX_FORMAT_U16 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+                if (indexType != boundType) {
+                    vkCmdBindIndexBuffer(cmdbuf, res.m_storageBuffer, res.m_maxVertexBufferSize, indexType);
+                    boundType = indexType;
+                }
+
+                vkCmdDrawIndexedIndirect(cmdbuf, m_indexedIndirectBuffer,
+                                         (res.m_firstCommand + i) * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+            }
+        }
+    } else {
+        size_t offsetMemory = (res.m_firstCommand + firstInstance) * sizeof(VkDrawIndirectCommand);
+        vkCmdDrawIndirect(cmdbuf, m_indirectBuffer, offsetMemory, instanceCount, sizeof(VkDrawIndirectCommand));
+    }
 }
 
-void Vulkan_MultiMeshFeature::DrawEntities(FrameStatus frame, GPU_SceneData *sceneData, std::initializer_list<Entity *> entities) {
+void Vulkan_MultiMeshFeature::BuildVariants(u32 firstModel) {
+    Vulkan_PipelineVariants &variants = m_drawMode == DrawMode::Indexed ? m_indexedPipelineVariants : m_pipelineVariants;
+
+    std::set<u32> keys;
+    for (u32 i = firstModel; i < m_modelCount; i++) {
+        for (const VariantDrawRange &range : m_models[i].m_drawRanges) {
+            keys.insert(range.variantKey);
+            // the lit pass draws with these after the pre-pass, the ones above stay for turning it off
+            if (IsDepthPrepassEnabled()) {
+                keys.insert(range.variantKey | VARIANT_DEPTH_EQUAL);
+            }
+        }
+    }
 
-    VkCommandBuffer *vkcmdbuf = (VkCommandBuffer *)frame.commandBuffer;
+    // the variants built already are only looked up
+    Vulkan_PipelineBatch pipelines;
+    for (const u32 key : keys) {
+        pipelines.Add([&variants, key]() { variants.Get(key); });
+    }
+    pipelines.Build();
+}
 
-    if (m_passState == DEFAULT_PASS) {
-        m_pipeline.Bind(*vkcmdbuf); 
-        
-        sceneData->projMat[1][1] *= -1;
+void Vulkan_MultiMeshFeature::SetDrawMode(DrawMode mode) {
+    if (mode == m_drawMode)
+        return;
 
-        UploadBufferData(m_renderDevice, m_uniformBuffersMemory[frame.currentImage], 0, sceneData, sizeof(*sceneData));
-    } else if (m_passState == SHADOW_PASS) {
-        m_shadowTechnique.m_offscreenPipeline.Bind(*vkcmdbuf);
+    m_drawMode = mode;
 
-        m_shadowTechnique.Update(m_renderDevice, frame.currentImage, glm::vec3(-2.0f, 4.0f, 1.0f));
-        
-        sceneData->lightSpaceMat = m_shadowTechnique.m_lightSpaceMatrix;
+    // otherwise every variant of the other vertex shader would compile in the draw path
+    BuildVariants(0);
+}
+
+void Vulkan_MultiMeshFeature::SetDepthPrepass(b32 enabled) {
+    const bool wasEnabled = IsDepthPrepassEnabled();
+    m_depthPrepass = enabled;
 
+    if (!wasEnabled && IsDepthPrepassEnabled()) {
+        BuildVariants(0);
     }
+}
 
+// Vulkan's y points down, the lit pass and the depth pre-pass have to compute the exact same matrix
+// for the EQUAL depth test, see basic.vert
+static glm::mat4 LitViewProjection(const GPU_SceneData &sceneData) {
+    glm::mat4 proj = sceneData.projMat;
+    proj[1][1] *= -1;
 
-    for (Entity *ent : entities) {
-        int modelID = *(int *)ent->model.handle;
-        ModelResources &res = m_models[modelID];
+    return proj * sceneData.viewMat;
+}
 
-        if (m_passState == DEFAULT_PASS) {
-            vkCmdBindDescriptorSets(*vkcmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline.pipelineLayout, 0, 1, &res.m_descriptorSets[frame.currentImage], 0, nullptr);
+std::span<const u32> Vulkan_MultiMeshFeature::SortDraws(const RenderList &list, const glm::mat4 &viewProj) {
+    XJAR_ZONE("Vulkan_MultiMeshFeature::SortDraws");
+
+    const bool depthOnly = m_passState == SHADOW_PASS || m_passState == DEPTH_PREPASS;
+    const u32  variantFlags = m_depthPrepassDrawn ? VARIANT_DEPTH_EQUAL : 0;
+
+    // the clip space z of the origin grows linearly away from the camera or the light
+    const glm::vec4 depthRow(viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]);
+
+    m_draws.clear();
+    m_queue.Clear();
 
-            PushConstantData constants;
-            constants.model = ent->model.localTransform;
+    const u32 count = list.Count();
+    for (u32 drawIndex = 0; drawIndex < count; drawIndex++) {
+        const u32    i = list.Index(drawIndex);
+        const Model *model = list.renderables[i].model;
+        if (!model)
+            continue;
 
-            vkCmdPushConstants(*vkcmdbuf, m_pipeline.pipelineLayout,
+        const int             modelID = *(int *)model->handle;
+        const ModelResources &res = m_models[modelID];
+        const f32             depth = glm::dot(depthRow, list.transforms[i][3]);
+
+        // the depth only passes draw a whole entity with one pipeline
+        if (depthOnly) {
+            m_queue.Push(MakeSortKey(static_cast<u32>(m_passState), 0, static_cast<u32>(modelID), depth), static_cast<u32>(m_draws.size()));
+            m_draws.push_back({.entity = i, .range = 0});
+            continue;
+        }
+
+        // the lit pass draws every variant range on its own, so the ranges of all entities sharing a variant follow each other
+        for (u32 r = 0; r < res.m_drawRanges.size(); r++) {
+            const u32 variant = res.m_drawRanges[r].variantKey | variantFlags;
+
+            m_queue.Push(MakeSortKey(static_cast<u32>(m_passState), variant, static_cast<u32>(modelID), depth), static_cast<u32>(m_draws.size()));
+            m_draws.push_back({.entity = i, .range = r});
+        }
+    }
+
+    return m_queue.Sort();
+}
+
+void Vulkan_MultiMeshFeature::RecordEntities(VkCommandBuffer cmdbuf, FrameStatus frame, const RenderList &list, std::span<const u32> drawOrder) {
+    XJAR_ZONE("Vulkan_MultiMeshFeature::RecordEntities");
+
+    const bool indexed = m_drawMode == DrawMode::Indexed;
+    Vulkan_PipelineVariants &variants = indexed ? m_indexedPipelineVariants : m_pipelineVariants;
+    Vulkan_Pipeline *pipeline = nullptr;
+
+    // the depth pre-pass draws the positions like a shadow pass, from the camera
+    const bool depthOnly = m_passState == SHADOW_PASS || m_passState == DEPTH_PREPASS;
+    const u32  depthUniformOffset = m_passState == SHADOW_PASS ? m_shadowUniformOffset : m_prepassUniformOffset;
+
+    // the lit pass only shades what the pre-pass left visible
+    const u32 variantFlags = m_depthPrepassDrawn ? VARIANT_DEPTH_EQUAL : 0;
+
+    if (depthOnly) {
+        pipeline = indexed ? &m_shadowTechnique.m_offscreenIndexedPipeline : &m_shadowTechnique.m_offscreenPipeline;
+        pipeline->Bind(cmdbuf);
+    }
+
+    // the sorted draws of a model follow each other, its set is bound once for all of them. All variants have
+    // compatible layouts, so the set and the push constants survive the pipeline switches
+    const ModelResources *boundModel = nullptr;
+    u32                   pushedEntity = ~0u;
+
+    for (const u32 d : drawOrder) {
+        const EntityDraw &draw = m_draws[d];
+        const u32         i = draw.entity;
+
+        int modelID = *(int *)list.renderables[i].model->handle;
+        ModelResources &res = m_models[modelID];
+
+        if (m_passState == DEFAULT_PASS) {
+            const VariantDrawRange &range = res.m_drawRanges[draw.range];
+
+            Vulkan_Pipeline *variant = variants.Get(range.variantKey | variantFlags);
+            if (variant != pipeline) {
+                variant->Bind(cmdbuf);
+                pipeline = variant;
+            }
+
+            if (&res != boundModel) {
+                // in binding order, the scene uniforms and the point lights
+                const u32 dynamicOffsets[] = {m_sceneUniformOffset, m_lightsOffset};
+                vkCmdBindDescriptorSets(cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipelineLayout, 0, 1, &res.m_descriptorSet, 2, dynamicOffsets);
+                boundModel = &res;
+            }
+
+            if (i != pushedEntity) {
+                PushConstantData constants;
+                constants.model = list.transforms[i];
+                constants.normal = list.normalMatrices[i];
+
+                vkCmdPushConstants(cmdbuf, pipeline->pipelineLayout,
+                                   VK_SHADER_STAGE_VERTEX_BIT,
+                                   0, sizeof(PushConstantData), &constants);
+                pushedEntity = i;
+            }
+
+            DrawInstances(cmdbuf, res, range.firstInstance, range.instanceCount);
+        } else if (depthOnly) {
+            if (&res != boundModel) {
+                vkCmdBindDescriptorSets(cmdbuf,
+                    VK_PIPELINE_BIND_POINT_GRAPHICS,
+                    pipeline->pipelineLayout,
+                    0, 1,
+                    &res.m_offscreenDescriptorSet,
+                    1, &depthUniformOffset);
+                boundModel = &res;
+            }
+
+            vkCmdPushConstants(cmdbuf, pipeline->pipelineLayout,
                                VK_SHADER_STAGE_VERTEX_BIT,
-                               0, sizeof(PushConstantData), &constants);
-        } else if (m_passState == SHADOW_PASS) {
-        
-            vkCmdBindDescriptorSets(*vkcmdbuf,
-                VK_PIPELINE_BIND_POINT_GRAPHICS,
-                m_shadowTechnique.m_offscreenPipeline.pipelineLayout,
-                0, 1,
-                &res.m_offscreenDescriptorSets[frame.currentImage],
-                0, nullptr);
+                               0, sizeof(glm::mat4), &list.transforms[i]);
 
+            DrawInstances(cmdbuf, res, 0, res.m_maxInstanceCount);
         }
+    }
+}
+
+void Vulkan_MultiMeshFeature::DrawEntities(FrameStatus frame, GPU_SceneData *sceneData, const RenderList &list) {
 
-        size_t offsetMemory = modelID  * sizeof(VkDrawIndirectCommand);
-        vkCmdDrawIndirect(*vkcmdbuf, m_indirectBuffers[frame.currentImage], offsetMemory, res.m_maxInstanceCount, sizeof(VkDrawIndirectCommand));
+    VkCommandBuffer *vkcmdbuf = (VkCommandBuffer *)frame.commandBuffer;
+
+    Vulkan_FrameRing &ring = m_frames[frame.currentFrame].ring;
+
+    // per pass data is written before any recording starts
+    glm::mat4 viewProj;
+    if (m_passState == DEFAULT_PASS) {
+        sceneData->viewProjMat = LitViewProjection(*sceneData);
+        sceneData->projMat[1][1] *= -1;
+
+        m_sceneUniformOffset = ring.Push(sceneData, sizeof(*sceneData));
+        viewProj = sceneData->viewProjMat;
+    } else if (m_passState == DEPTH_PREPASS) {
+        const GPU_ShadowDepth depth {.m_depthMVP = LitViewProjection(*sceneData)};
+
+        m_prepassUniformOffset = ring.Push(&depth, sizeof(depth));
+        viewProj = depth.m_depthMVP;
+    } else {
+        m_shadowUniformOffset = m_shadowTechnique.PushCascade(ring, m_shadowCascade);
+        viewProj = ShadowDepthMatrix(m_shadowTechnique.m_cascades, m_shadowCascade);
+    }
+
+    const std::span<const u32> drawOrder = SortDraws(list, viewProj);
+    const u32 count = static_cast<u32>(drawOrder.size());
+
+    if (!m_parallelRecording) {
+        RecordEntities(*vkcmdbuf, frame, list, drawOrder);
+        return;
     }
+
+    // dynamic state is not inherited by the secondaries
+    m_recorder.Record(*vkcmdbuf, m_passInheritance, count, [&](VkCommandBuffer cmdbuf, u32 first, u32 chunkCount) {
+        vkCmdSetViewport(cmdbuf, 0, 1, &m_passViewport);
+        vkCmdSetScissor(cmdbuf, 0, 1, &m_passScissor);
+
+        RecordEntities(cmdbuf, frame, list, drawOrder.subspan(first, chunkCount));
+    });
 }
 
 }
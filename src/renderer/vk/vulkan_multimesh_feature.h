@@ -1,42 +1,76 @@
 #pragma once
 
-#include <initializer_list>
 #include "renderer/mesh_feature.h"
 #include "renderer/camera.h"
+#include "renderer/render_queue.h"
 #include "vulkan_pipeline.h"
 #include "vulkan_ds.h"
 #include "material_descr.h"
 #include "vulkan_shadow_technique.h"
+#include "vulkan_clustered_lighting.h"
+#include "vulkan_parallel_recorder.h"
+#include "vulkan_render_graph.h"
 
 namespace xjar {
 
 struct Vulkan_Swapchain;
 struct Vulkan_RenderDevice;
+struct Vulkan_FrameContext;
 
 enum {
     DEFAULT_PASS = 0,
-    SHADOW_PASS
+    SHADOW_PASS,
+    DEPTH_PREPASS
+};
+
+// specialization constants of basic.frag, a pipeline variant key is a combination of these
+enum ShaderVariantFlags : u32 {
+    VARIANT_SHADOWS      = 1 << 0,
+    VARIANT_BLINN_PHONG  = 1 << 1, // otherwise phong
+    VARIANT_DIFFUSE_MAP  = 1 << 2,
+    VARIANT_SPECULAR_MAP = 1 << 3,
+    VARIANT_DEPTH_EQUAL  = 1 << 4  // pipeline state, not a constant: depth tested EQUAL against the pre-pass without writes
+};
+
+// instances [firstInstance, firstInstance + instanceCount) are drawn with the same pipeline variant
+struct VariantDrawRange {
+    u32 firstInstance;
+    u32 instanceCount;
+    u32 variantKey;
+};
+
+// a draw of the sorted queue, one variant range of an entity in the lit pass, all of it in the depth only passes
+struct EntityDraw {
+    u32 entity; // into the spans of the RenderList
+    u32 range;  // into the model's m_drawRanges
 };
 
 struct ModelResources {
-    std::vector<InstanceData>       m_instances;
+    std::vector<GPU_InstanceData>   m_instances;
     std::vector<MaterialDescr>      m_materials;
-    std::vector<VkDescriptorSet>    m_descriptorSets;
-    std::vector<VkDescriptorSet>    m_offscreenDescriptorSets;
+    VkDescriptorSet                 m_descriptorSet;
+    VkDescriptorSet                 m_offscreenDescriptorSet;
+    std::vector<VariantDrawRange>   m_drawRanges; // the instances are sorted by variant key
 
     u32 m_maxVertexBufferSize, m_maxIndexBufferSize;
+    u32 m_attributeStreamSize;
+    u32 m_positionStreamOffset, m_positionStreamSize; // the depth only passes read just the positions
     u32 m_maxInstances;
     u32 m_maxInstanceSize, m_maxMaterialSize;
     u32 m_maxInstanceCount;
+    u32 m_firstCommand; // of the model's draws in the shared indirect buffers
+
+    // meshes of one model may use different index formats, then the indexed draw is split per instance
+    VkIndexType m_indexType;
+    b32         m_mixedIndexTypes;
 
     VkBuffer                        m_storageBuffer;
     VkDeviceMemory                  m_storageBufferMemory;
     VkBuffer                        m_materialBuffer;
     VkDeviceMemory                  m_materialBufferMemory;
+    VkBuffer                        m_instanceBuffer;
+    VkDeviceMemory                  m_instanceBufferMemory;
 
-    // for each swapchain image
-    std::vector<VkBuffer>       m_instanceBuffers;
-    std::vector<VkDeviceMemory> m_instanceBuffersMemory;
     std::vector<std::string>    m_loadedTextures;
 };
 
@@ -48,32 +82,74 @@ inline void DestroyModelResources(VkDevice device, ModelResources &res) {
     vkDestroyBuffer(device, res.m_materialBuffer, nullptr);
     vkFreeMemory(device, res.m_materialBufferMemory, nullptr);
 
-    for (size_t i = 0; i < res.m_instanceBuffers.size(); i++) {
-        vkDestroyBuffer(device, res.m_instanceBuffers[i], nullptr);
-        vkFreeMemory(device, res.m_instanceBuffersMemory[i], nullptr);
-    }
+    vkDestroyBuffer(device, res.m_instanceBuffer, nullptr);
+    vkFreeMemory(device, res.m_instanceBufferMemory, nullptr);
 }
 
 class Vulkan_MultiMeshFeature final {
 public:
-    void Init(Vulkan_RenderDevice *device, Vulkan_Swapchain *swapchain);
+    void Init(Vulkan_RenderDevice *device, Vulkan_Swapchain *swapchain, Vulkan_FrameContext *frames, Vulkan_PipelineBatch &pipelines);
     void CreateModel(std::vector<InstanceData> &instances,
         std::vector<MaterialDescr> &materials, 
         const std::vector<std::string> &textureFilenames,
         Model &model);
 
-    void EnableShadows();
-    void DrawEntities(FrameStatus frame, GPU_SceneData *sceneData, std::initializer_list<Entity *> entities);
+    void EnableShadows(Vulkan_PipelineBatch &pipelines);
+    void DrawEntities(FrameStatus frame, GPU_SceneData *sceneData, const RenderList &list);
     void OnResize(Vulkan_Swapchain *swapchain);
-    void BeginDefaultPass(FrameStatus frame);
-    void EndDefaultPass(FrameStatus frame);
-    void BeginShadowPass(FrameStatus frame);
-    void EndShadowPass(FrameStatus frame);
+    // The passes are begun by the render graph, these only set up what the draws of DrawEntities need.
+    // lays down the depth of the default pass with the shadow pipelines, which then shades each pixel once
+    void BeginDepthPrepass(VkCommandBuffer cmdbuf, const RGPassContext &context);
+    void BeginDefaultPass(VkCommandBuffer cmdbuf, const RGPassContext &context, b32 afterPrepass);
+    // once per cascade and layer it renders into, after UpdateShadowCascades
+    void BeginShadowPass(VkCommandBuffer cmdbuf, const RGPassContext &context, u32 cascade);
+    const ShadowCascades &UpdateShadowCascades(GPU_SceneData *sceneData);
+    // pushes the point lights for the default pass, DispatchLights bins them outside of any render pass
+    void UpdateLights(FrameStatus frame, GPU_SceneData *sceneData, std::span<const GPU_PointLight> lights);
+    void DispatchLights(VkCommandBuffer cmdbuf);
 
     bool IsShadowsEnabled() const {
         return m_enableShadows;
     }
 
+    // builds the variants of the new mode for the loaded models before the next frame records
+    void SetDrawMode(DrawMode mode);
+
+    void SetParallelRecording(b32 enabled) {
+        m_parallelRecording = enabled;
+    }
+
+    // the passes then only take vkCmdExecuteCommands
+    bool IsParallelRecording() const {
+        return m_parallelRecording;
+    }
+
+    // builds the EQUAL tested variants of the loaded models before the next frame records
+    void SetDepthPrepass(b32 enabled);
+
+    // the pre-pass binds the per model sets of the shadow pipelines
+    bool IsDepthPrepassEnabled() const {
+        return m_depthPrepass && m_enableShadows;
+    }
+
+    void SetShadowSettings(const ShadowSettings &settings) {
+        m_shadowTechnique.m_settings = settings;
+    }
+
+    // the static caster cache, see Vulkan_Backend::DrawEntities
+    Vulkan_ShadowTechnique &GetShadowTechnique() {
+        return m_shadowTechnique;
+    }
+
+    // written by DispatchLights, read by the default pass
+    VkBuffer GetLightGrid() const {
+        return m_clusteredLighting.m_gridBuffer;
+    }
+
+    void BeginFrame(FrameStatus frame) {
+        m_recorder.BeginFrame(frame.currentFrame);
+    }
+
     VkRenderPass *GetPass() {
         return &m_renderPass;
     }
@@ -81,45 +157,76 @@ public:
     void Destroy();
 
 private:
-    void CreatePipeline();
-    void CreateColorAndDepthRenderPass();
-    void CreateDepthResources();
-    void CreateFramebuffers();
+    void CreatePipeline(Vulkan_Pipeline &pipeline, const char *vertShader, u32 variantKey);
+    // records the draws of m_draws in the order of drawOrder
+    void RecordEntities(VkCommandBuffer cmdbuf, FrameStatus frame, const RenderList &list, std::span<const u32> drawOrder);
+    // fills m_draws with the draws of the list and sorts them by pipeline variant, model and depth under viewProj,
+    // see MakeSortKey
+    std::span<const u32> SortDraws(const RenderList &list, const glm::mat4 &viewProj);
+    void DrawInstances(VkCommandBuffer cmdbuf, ModelResources &res, u32 firstInstance, u32 instanceCount);
+    u32  GetVariantKey(const MaterialDescr &material, u32 textureCount) const;
+    // compiles the variants the draws of the models from firstModel on need in the current draw mode
+    // and with the depth pre-pass, on the job system
+    void BuildVariants(u32 firstModel);
+    void BeginPass(VkCommandBuffer cmdbuf, const RGPassContext &context, const VkViewport &viewport, int passState);
+    VkRenderPass CreateColorAndDepthRenderPass();
     void CreateDescriptorPool();
-    void CreateUniformBuffers();
     void AllocateDescriptorSets(ModelResources &res);
 
-    std::vector<VkFramebuffer>  m_framebuffers;
-
     Vulkan_RenderDevice *m_renderDevice;
-    VkRenderPass         m_renderPass;
-    Vulkan_Pipeline      m_pipeline;
+    VkRenderPass         m_renderPass; // the pipelines are made with it, null with dynamic rendering
+    Vulkan_PipelineVariants m_pipelineVariants;
+    Vulkan_PipelineVariants m_indexedPipelineVariants;
     Vulkan_Swapchain    *m_swapchain;
+    Vulkan_FrameContext *m_frames; // MAX_FRAMES_IN_FLIGHT, owned by the backend
     Vulkan_ShadowTechnique m_shadowTechnique;
+    Vulkan_ClusteredLighting m_clusteredLighting;
 
-    std::vector<DescriptorAllocator> m_dsAllocators;
-    std::vector<DescriptorAllocator> m_offscreenDsAllocators;
+    DescriptorAllocator  m_dsAllocator;
+    DescriptorAllocator  m_offscreenDsAllocator;
 
     VkDescriptorSetLayout           m_dsLayout;
-    VkImage        m_depthImage;
-    VkImageView    m_depthImageView;
-    VkDeviceMemory m_depthImageMemory;
-    std::vector<VkBuffer>       m_indirectBuffers;
-    std::vector<VkDeviceMemory> m_indirectBuffersMemory;
+    // written once per model, never changes while frames are in flight
+    VkBuffer       m_indirectBuffer;
+    VkDeviceMemory m_indirectBufferMemory;
+    VkBuffer       m_indexedIndirectBuffer;
+    VkDeviceMemory m_indexedIndirectBufferMemory;
 
     VkDescriptorPool            m_offscreenDsPool;
     VkSampler                   m_defaultSamplerLinear;
     VkSampler                   m_defaultSamplerNearest;
 
-    std::vector<VkBuffer>       m_uniformBuffers;
-    std::vector<VkDeviceMemory> m_uniformBuffersMemory;
+    // dynamic offsets of this frame's pass uniforms in the frame ring
+    u32                         m_sceneUniformOffset = 0;
+    u32                         m_lightsOffset = 0;
+    u32                         m_shadowUniformOffset = 0;
+    u32                         m_prepassUniformOffset = 0;
+    u32                         m_shadowCascade = 0;
 
     std::deque<ModelResources>  m_models;
     u32                         m_modelCount = 0;
+    u32                         m_commandCount = 0; // used entries of the indirect buffers
     int                         m_instanceCount = 0;
     int                         m_modelID = 0;
     int                         m_passState = DEFAULT_PASS;
     b32                         m_enableShadows = false;
+    b32                         m_depthPrepass = false;
+    b32                         m_depthPrepassDrawn = false; // before the default pass being recorded
+    b32                         m_blinnPhong = true;
+    DrawMode                    m_drawMode = DrawMode::VertexPulling;
+
+    // the draw list is recorded into secondaries on worker threads
+    Vulkan_ParallelRecorder         m_recorder;
+    b32                             m_parallelRecording = false;
+    VkViewport                      m_passViewport;
+    VkRect2D                        m_passScissor;
+    VkCommandBufferInheritanceInfo  m_passInheritance;
+    VkCommandBufferInheritanceRenderingInfoKHR m_passRendering; // chained to m_passInheritance with dynamic rendering
+    VkFormat                        m_passColorFormat;
+
+    // reused by every pass, sorted before the recording starts
+    RenderQueue                     m_queue;
+    std::vector<EntityDraw>         m_draws;
 };
 
 }
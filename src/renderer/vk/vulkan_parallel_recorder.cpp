@@ -0,0 +1,105 @@
+#include "pch.h"
+#include "vulkan_parallel_recorder.h"
+#include "vulkan_render_device.h"
+#include "job_system.h"
+
+namespace xjar {
+
+void Vulkan_ParallelRecorder::Init(Vulkan_RenderDevice *rd) {
+    m_renderDevice = rd;
+    m_workers.resize(std::max(1u, JobSystem::Instance().GetWorkerCount()));
+
+    QueueFamily queueFamily = FindQueueFamilies(rd->physicalDevice, rd->surface);
+
+    VkCommandPoolCreateInfo poolInfo {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = queueFamily.graphicsFamily.value();
+
+    for (Worker &worker : m_workers) {
+        worker.used = 0;
+        for (u32 i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            if (vkCreateCommandPool(rd->device, &poolInfo, nullptr, &worker.pools[i]) != VK_SUCCESS) {
+                fprintf(stderr, "Failed to create recorder command pool\n");
+                exit(1);
+            }
+        }
+    }
+}
+
+void Vulkan_ParallelRecorder::Destroy() {
+    // destroying the pools frees their command buffers
+    for (Worker &worker : m_workers) {
+        for (u32 i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+            vkDestroyCommandPool(m_renderDevice->device, worker.pools[i], nullptr);
+    }
+    m_workers.clear();
+}
+
+void Vulkan_ParallelRecorder::BeginFrame(u32 frameIndex) {
+    m_frameIndex = frameIndex;
+
+    for (Worker &worker : m_workers) {
+        vkResetCommandPool(m_renderDevice->device, worker.pools[frameIndex], 0);
+        worker.used = 0;
+    }
+}
+
+VkCommandBuffer Vulkan_ParallelRecorder::AcquireBuffer(Worker &worker) {
+    std::vector<VkCommandBuffer> &buffers = worker.buffers[m_frameIndex];
+
+    if (worker.used == buffers.size()) {
+        VkCommandBufferAllocateInfo allocInfo {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandPool = worker.pools[m_frameIndex];
+        allocInfo.commandBufferCount = 1;
+
+        VkCommandBuffer cmdbuf;
+        if (vkAllocateCommandBuffers(m_renderDevice->device, &allocInfo, &cmdbuf) != VK_SUCCESS) {
+            fprintf(stderr, "Failed to allocate secondary command buffer\n");
+            exit(1);
+        }
+        buffers.push_back(cmdbuf);
+    }
+
+    return buffers[worker.used++];
+}
+
+void Vulkan_ParallelRecorder::Record(VkCommandBuffer primary, const VkCommandBufferInheritanceInfo &inheritance, u32 count, const RecordFunc &record) {
+    if (count == 0)
+        return;
+
+    // one chunk per thread, a thread that runs several chunks takes a buffer for each
+    const u32 chunkCount = std::min(count, static_cast<u32>(m_workers.size()));
+    const u32 grain = (count + chunkCount - 1) / chunkCount;
+    m_chunkBuffers.assign((count + grain - 1) / grain, VK_NULL_HANDLE);
+
+    JobSystem::Instance().ParallelFor(count, grain, [&](u32 first, u32 chunkSize) {
+        VkCommandBuffer cmdbuf = AcquireBuffer(m_workers[JobSystem::GetThreadIndex()]);
+
+        VkCommandBufferBeginInfo beginInfo {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        beginInfo.pInheritanceInfo = &inheritance;
+
+        if (vkBeginCommandBuffer(cmdbuf, &beginInfo) != VK_SUCCESS) {
+            fprintf(stderr, "Failed to begin secondary recording\n");
+            exit(1);
+        }
+
+        record(cmdbuf, first, chunkSize);
+
+        if (vkEndCommandBuffer(cmdbuf) != VK_SUCCESS) {
+            fprintf(stderr, "Failed to end secondary recording\n");
+            exit(1);
+        }
+
+        m_chunkBuffers[first / grain] = cmdbuf;
+    });
+
+    // chunk order keeps the draw order of the list
+    vkCmdExecuteCommands(primary, static_cast<u32>(m_chunkBuffers.size()), m_chunkBuffers.data());
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "types.h"
+#define VK_USE_PLATFORM_WIN32_KHR
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <functional>
+
+namespace xjar {
+
+struct Vulkan_RenderDevice;
+
+// records a draw list split into chunks into secondary command buffers on the job system.
+// Every job system thread owns a command pool per frame in flight,
+// so nothing is shared between threads while recording.
+class Vulkan_ParallelRecorder final {
+public:
+    using RecordFunc = std::function<void(VkCommandBuffer cmdbuf, u32 first, u32 count)>;
+
+    void Init(Vulkan_RenderDevice *rd);
+    void Destroy();
+
+    // the fence of the frame has been waited on, its command buffers can be reused
+    void BeginFrame(u32 frameIndex);
+
+    // the primary has to be inside a render pass begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS,
+    // the secondaries are executed in the order of the chunks
+    void Record(VkCommandBuffer primary, const VkCommandBufferInheritanceInfo &inheritance, u32 count, const RecordFunc &record);
+
+    u32 GetWorkerCount() const {
+        return static_cast<u32>(m_workers.size());
+    }
+
+private:
+    struct Worker {
+        VkCommandPool                pools[MAX_FRAMES_IN_FLIGHT];
+        std::vector<VkCommandBuffer> buffers[MAX_FRAMES_IN_FLIGHT];
+        u32                          used;
+    };
+
+    VkCommandBuffer AcquireBuffer(Worker &worker);
+
+    Vulkan_RenderDevice         *m_renderDevice;
+    std::vector<Worker>          m_workers;
+    u32                          m_frameIndex = 0;
+    std::vector<VkCommandBuffer> m_chunkBuffers;
+};
+
+}
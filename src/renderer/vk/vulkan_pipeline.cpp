@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "vulkan_pipeline.h"
 #include "vulkan_render_device.h"
+#include "job_system.h"
 
 namespace xjar {
 
@@ -24,6 +25,14 @@ void Vulkan_Pipeline::Reset() {
 	pipelineLayout = {};
 	depthStencil = {};
 	depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	pushConstantRange = {};
+	colorAttachmentFormat = VK_FORMAT_UNDEFINED;
+	depthAttachmentFormat = VK_FORMAT_UNDEFINED;
+
+	specializationStages = 0;
+	specializationEntries.clear();
+	specializationData.clear();
+	specializationInfo = {};
 
 	shaderStages.clear();
 }
@@ -46,17 +55,21 @@ void Vulkan_Pipeline::Create(Vulkan_RenderDevice *rd, VkRenderPass renderPass) {
 	colorBlending.attachmentCount = 1;
 	colorBlending.pAttachments = &colorBlendAttachment;
 
-	if (vkCreatePipelineLayout(rd->device,
-		&pipelineLayoutInfo,
-		nullptr,
-		&pipelineLayout
-	) != VK_SUCCESS) {
-		fprintf(stderr, "Failed to create pipeline\n");
-		exit(EXIT_FAILURE);
-	}
+	// without a render pass the attachments are only described by their formats
+	VkPipelineRenderingCreateInfoKHR renderingInfo{};
+	renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+	renderingInfo.colorAttachmentCount = colorAttachmentFormat != VK_FORMAT_UNDEFINED ? 1 : 0;
+	renderingInfo.pColorAttachmentFormats = &colorAttachmentFormat;
+	renderingInfo.depthAttachmentFormat = depthAttachmentFormat;
+
+	if (renderPass == VK_NULL_HANDLE)
+		colorBlending.attachmentCount = renderingInfo.colorAttachmentCount;
+
+	CreateLayout(rd);
 
 	VkGraphicsPipelineCreateInfo graphicsPipelineInfo{};
 	graphicsPipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	graphicsPipelineInfo.pNext = renderPass == VK_NULL_HANDLE ? &renderingInfo : nullptr;
 	graphicsPipelineInfo.stageCount = (uint32_t)shaderStages.size();
 	graphicsPipelineInfo.pStages = shaderStages.data();
 	graphicsPipelineInfo.pVertexInputState = &vertexInputInfo;
@@ -79,12 +92,55 @@ void Vulkan_Pipeline::Create(Vulkan_RenderDevice *rd, VkRenderPass renderPass) {
 
 	graphicsPipelineInfo.pDynamicState = &dynamicInfo;
 
-	if (vkCreateGraphicsPipelines(rd->device, VK_NULL_HANDLE, 1, &graphicsPipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
+	ApplySpecialization();
+
+	if (vkCreateGraphicsPipelines(rd->device, rd->pipelineCache, 1, &graphicsPipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
 		fprintf(stderr, "failed to create pipeline\n");
 		pipeline = VK_NULL_HANDLE;
 	}
 }
 
+void Vulkan_Pipeline::CreateCompute(Vulkan_RenderDevice *rd) {
+	CreateLayout(rd);
+	ApplySpecialization();
+
+	VkComputePipelineCreateInfo computePipelineInfo{};
+	computePipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	computePipelineInfo.stage = shaderStages[0];
+	computePipelineInfo.layout = pipelineLayout;
+
+	if (vkCreateComputePipelines(rd->device, rd->pipelineCache, 1, &computePipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
+		fprintf(stderr, "failed to create compute pipeline\n");
+		pipeline = VK_NULL_HANDLE;
+	}
+}
+
+void Vulkan_Pipeline::CreateLayout(Vulkan_RenderDevice *rd) {
+	if (vkCreatePipelineLayout(rd->device,
+		&pipelineLayoutInfo,
+		nullptr,
+		&pipelineLayout
+	) != VK_SUCCESS) {
+		fprintf(stderr, "Failed to create pipeline\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void Vulkan_Pipeline::ApplySpecialization() {
+	if (specializationEntries.empty())
+		return;
+
+	specializationInfo.mapEntryCount = static_cast<u32>(specializationEntries.size());
+	specializationInfo.pMapEntries = specializationEntries.data();
+	specializationInfo.dataSize = specializationData.size();
+	specializationInfo.pData = specializationData.data();
+
+	for (VkPipelineShaderStageCreateInfo &stage : shaderStages) {
+		if (stage.stage & specializationStages)
+			stage.pSpecializationInfo = &specializationInfo;
+	}
+}
+
 void Vulkan_Pipeline::Destroy(VkDevice device) {
 	vkDestroyPipeline(device, pipeline, nullptr);
 	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
@@ -105,13 +161,21 @@ void Vulkan_Pipeline::SetDescriptorSets(VkDescriptorSetLayout *layouts, u32 layo
 	pipelineLayoutInfo.pSetLayouts = layouts;
 }
 
+void Vulkan_Pipeline::SetSpecializationConstants(VkShaderStageFlags stages, std::span<const VkSpecializationMapEntry> entries, const void *data, u32 dataSize) {
+	specializationStages = stages;
+	specializationEntries.assign(entries.begin(), entries.end());
+	specializationData.resize(dataSize);
+	memcpy(specializationData.data(), data, dataSize);
+}
+
 void Vulkan_Pipeline::SetInputTopology(VkPrimitiveTopology topology) {
 	inputAssembly.topology = topology;
 	inputAssembly.primitiveRestartEnable = VK_FALSE;
 }
 
 void Vulkan_Pipeline::SetPushConstants(VkPushConstantRange range, u32 count) {
-    pipelineLayoutInfo.pPushConstantRanges = &range;
+    pushConstantRange = range; // keep it alive until Create
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
     pipelineLayoutInfo.pushConstantRangeCount = count;
 }
 
@@ -196,9 +260,63 @@ void Vulkan_Pipeline::EnableBlendingAlphablend() {
 	colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
 }
 
+void Vulkan_Pipeline::SetAttachmentFormats(VkFormat color, VkFormat depth) {
+	colorAttachmentFormat = color;
+	depthAttachmentFormat = depth;
+}
+
 void Vulkan_Pipeline::Bind(VkCommandBuffer cmd, VkPipelineBindPoint point) {
 	vkCmdBindPipeline(cmd, point, pipeline);
 }
 
+Vulkan_Pipeline *Vulkan_PipelineVariants::Get(u32 key) {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		auto it = m_variants.find(key);
+		if (it != m_variants.end())
+			return it->second.get();
+	}
+
+	// built outside of the lock so different variants can be compiled in parallel
+	auto pipeline = std::make_unique<Vulkan_Pipeline>();
+	m_build(*pipeline, key);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto [it, inserted] = m_variants.try_emplace(key, std::move(pipeline)); // leaves pipeline untouched if the key exists
+	if (!inserted) {
+		// another thread built the same variant meanwhile
+		pipeline->Destroy(m_device);
+	}
+
+	return it->second.get();
+}
+
+Vulkan_Pipeline *Vulkan_PipelineVariants::Any() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	return m_variants.empty() ? nullptr : m_variants.begin()->second.get();
+}
+
+void Vulkan_PipelineVariants::Destroy(VkDevice device) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (auto &[key, pipeline] : m_variants)
+		pipeline->Destroy(device);
+
+	m_variants.clear();
+}
+
+void Vulkan_PipelineBatch::Build() {
+	// one build per job, their costs differ too much to batch them
+	JobSystem::Instance().ParallelFor(static_cast<u32>(builds.size()), 1, [&](u32 first, u32 count) {
+		for (u32 i = first; i < first + count; i++)
+			builds[i]();
+	});
+
+	builds.clear();
+}
+
 }
 
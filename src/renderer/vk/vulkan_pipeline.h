@@ -7,6 +7,10 @@
 
 #include <vector>
 #include <span>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 namespace xjar {
 
@@ -22,14 +26,25 @@ struct Vulkan_Pipeline {
     VkPipelineVertexInputStateCreateInfo         vertexInputInfo;
     VkPipelineLayout                             pipelineLayout;
     VkPipelineDepthStencilStateCreateInfo        depthStencil;
-    VkFormat                                     colorAttachmentFormat;
+    VkPushConstantRange                          pushConstantRange;
+    VkFormat                                     colorAttachmentFormat; // with dynamic rendering, see SetAttachmentFormats
+    VkFormat                                     depthAttachmentFormat;
     VkPipeline                                   pipeline;
 
+    // specialization constants, applied to the stages in specializationStages on Create
+    VkShaderStageFlags                           specializationStages;
+    std::vector<VkSpecializationMapEntry>        specializationEntries;
+    std::vector<u8>                              specializationData;
+    VkSpecializationInfo                         specializationInfo;
+
     Vulkan_Pipeline() {
         Reset();
     }
 
+    // a null render pass makes the pipeline for dynamic rendering, with the formats of SetAttachmentFormats
     void Create(Vulkan_RenderDevice *rd, VkRenderPass renderPass);
+    // from the single compute stage set with SetShaders, only the layout and specialization state apply
+    void CreateCompute(Vulkan_RenderDevice *rd);
     void Destroy(VkDevice device);
     void Reset();
 
@@ -41,14 +56,56 @@ struct Vulkan_Pipeline {
     void SetCullMode(VkCullModeFlags mode, VkFrontFace frontFace);
     void SetPushConstants(VkPushConstantRange range, u32 count);
     void SetDescriptorSets(VkDescriptorSetLayout *layouts, u32 layoutsNum);
+    void SetSpecializationConstants(VkShaderStageFlags stages, std::span<const VkSpecializationMapEntry> entries, const void *data, u32 dataSize);
     void SetMultisamplingNone();
     void DisableBlending();
     void DisableDepthtest();
     void EnableDepthtest(bool depthWriteEnable, VkCompareOp op);
     void EnableBlendingAdditive();
     void EnableBlendingAlphablend();
+    // VK_FORMAT_UNDEFINED for an attachment the passes don't have
+    void SetAttachmentFormats(VkFormat color, VkFormat depth);
 
     void Bind(VkCommandBuffer, VkPipelineBindPoint point = VK_PIPELINE_BIND_POINT_GRAPHICS);
+
+private:
+    void CreateLayout(Vulkan_RenderDevice *rd);
+    void ApplySpecialization();
+};
+
+// pipelines that differ only in specialization constants, a variant is built on its first use and cached by key
+class Vulkan_PipelineVariants {
+public:
+    using BuildFunc = std::function<void(Vulkan_Pipeline &pipeline, u32 key)>;
+
+    void Init(VkDevice device, BuildFunc build) {
+        m_device = device;
+        m_build = std::move(build);
+    }
+
+    Vulkan_Pipeline *Get(u32 key);
+    void             Destroy(VkDevice device);
+
+    // any variant, they all share the same layout
+    Vulkan_Pipeline *Any();
+
+private:
+    VkDevice                                                  m_device;
+    BuildFunc                                                 m_build;
+    std::mutex                                                m_mutex;
+    std::unordered_map<u32, std::unique_ptr<Vulkan_Pipeline>> m_variants;
+};
+
+// collects the pipeline builds of all features and runs them on the job system,
+// pipeline creation and the pipeline cache are internally synchronized by the driver
+struct Vulkan_PipelineBatch {
+    std::vector<std::function<void()>> builds;
+
+    void Add(std::function<void()> build) {
+        builds.push_back(std::move(build));
+    }
+
+    void Build();
 };
 
 }
@@ -0,0 +1,106 @@
+#include "pch.h"
+#include "vulkan_pipeline_cache.h"
+#include "vulkan_render_device.h"
+
+namespace xjar {
+
+static constexpr u32 PIPELINE_CACHE_MAGIC = 0x4350584a; // "JXPC"
+
+static PipelineCacheHdr MakeHeader(Vulkan_RenderDevice *rd, u32 dataSize) {
+    VkPhysicalDeviceIDProperties idProps {};
+    idProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+
+    VkPhysicalDeviceProperties2 props {};
+    props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    props.pNext = &idProps;
+    vkGetPhysicalDeviceProperties2(rd->physicalDevice, &props);
+
+    PipelineCacheHdr hdr {};
+    hdr.magicValue = PIPELINE_CACHE_MAGIC;
+    hdr.dataSize = dataSize;
+    hdr.vendorID = props.properties.vendorID;
+    hdr.deviceID = props.properties.deviceID;
+    hdr.driverVersion = props.properties.driverVersion;
+    memcpy(hdr.pipelineCacheUUID, props.properties.pipelineCacheUUID, VK_UUID_SIZE);
+    memcpy(hdr.driverUUID, idProps.driverUUID, VK_UUID_SIZE);
+
+    return hdr;
+}
+
+static bool IsCacheDataValid(const PipelineCacheHdr &expected, const PipelineCacheHdr &hdr, const std::vector<u8> &data) {
+    if (hdr.magicValue != expected.magicValue ||
+        hdr.vendorID != expected.vendorID ||
+        hdr.deviceID != expected.deviceID ||
+        hdr.driverVersion != expected.driverVersion ||
+        memcmp(hdr.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) != 0 ||
+        memcmp(hdr.driverUUID, expected.driverUUID, VK_UUID_SIZE) != 0) {
+        return false;
+    }
+
+    // the blob carries its own header as well, the driver would reject a mismatch but not every driver does it gracefully
+    VkPipelineCacheHeaderVersionOne blobHdr;
+    if (data.size() < sizeof(blobHdr))
+        return false;
+
+    memcpy(&blobHdr, data.data(), sizeof(blobHdr));
+
+    return blobHdr.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           blobHdr.vendorID == expected.vendorID &&
+           blobHdr.deviceID == expected.deviceID &&
+           memcmp(blobHdr.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+VkPipelineCache LoadPipelineCache(Vulkan_RenderDevice *rd, const char *filename) {
+    std::vector<u8> data;
+
+    FILE *f = fopen(filename, "rb");
+    if (f) {
+        PipelineCacheHdr hdr;
+        if (fread(&hdr, 1, sizeof(hdr), f) == sizeof(hdr)) {
+            data.resize(hdr.dataSize);
+            if (fread(data.data(), 1, hdr.dataSize, f) != hdr.dataSize ||
+                !IsCacheDataValid(MakeHeader(rd, hdr.dataSize), hdr, data)) {
+                fprintf(stderr, "Pipeline cache %s is stale, rebuilding\n", filename);
+                data.clear();
+            }
+        }
+
+        fclose(f);
+    }
+
+    VkPipelineCacheCreateInfo cacheInfo {};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.initialDataSize = data.size();
+    cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+    VkPipelineCache cache;
+    if (vkCreatePipelineCache(rd->device, &cacheInfo, nullptr, &cache) != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create pipeline cache\n");
+        exit(1);
+    }
+
+    return cache;
+}
+
+void SavePipelineCache(Vulkan_RenderDevice *rd, VkPipelineCache cache, const char *filename) {
+    size_t dataSize = 0;
+    if (vkGetPipelineCacheData(rd->device, cache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0)
+        return;
+
+    std::vector<u8> data(dataSize);
+    if (vkGetPipelineCacheData(rd->device, cache, &dataSize, data.data()) != VK_SUCCESS)
+        return;
+
+    FILE *f = fopen(filename, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to write pipeline cache %s\n", filename);
+        return;
+    }
+
+    const PipelineCacheHdr hdr = MakeHeader(rd, static_cast<u32>(dataSize));
+    fwrite(&hdr, 1, sizeof(hdr), f);
+    fwrite(data.data(), 1, dataSize, f);
+    fclose(f);
+}
+
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "types.h"
+
+#define VK_USE_PLATFORM_WIN32_KHR
+#include <vulkan/vulkan.h>
+
+namespace xjar {
+
+struct Vulkan_RenderDevice;
+
+static constexpr char PIPELINE_CACHE_FILE[] = "pipeline_cache.bin";
+
+// the cache blob is only valid for the exact device and driver it was produced by
+struct PipelineCacheHdr {
+    u32 magicValue;
+    u32 dataSize;
+    u32 vendorID;
+    u32 deviceID;
+    u32 driverVersion;
+    u8  pipelineCacheUUID[VK_UUID_SIZE];
+    u8  driverUUID[VK_UUID_SIZE];
+};
+
+// returns an empty cache if the file is missing or was written by another device/driver
+VkPipelineCache LoadPipelineCache(Vulkan_RenderDevice *rd, const char *filename);
+void            SavePipelineCache(Vulkan_RenderDevice *rd, VkPipelineCache cache, const char *filename);
+
+}
@@ -21,7 +21,28 @@ const std::vector<const char *> DEVICE_EXTENSIONS = {
     VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME
 };
 
-static u32 FindMemoryType(Vulkan_RenderDevice *rd, u32 typeFilter, VkMemoryPropertyFlags properties) {
+// only enabled when dynamic rendering was asked for, the other two are what it depends on in Vulkan 1.1
+const std::vector<const char *> DYNAMIC_RENDERING_EXTENSIONS = {
+    VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
+    VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME,
+    VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME
+};
+
+// a headless device never presents, so it does not need the swapchain extension
+static std::vector<const char *> GetDeviceExtensions(bool headless) {
+    if (!headless)
+        return DEVICE_EXTENSIONS;
+
+    std::vector<const char *> extensions;
+    for (const char *extension : DEVICE_EXTENSIONS) {
+        if (strcmp(extension, VK_KHR_SWAPCHAIN_EXTENSION_NAME) != 0)
+            extensions.push_back(extension);
+    }
+
+    return extensions;
+}
+
+u32 FindMemoryType(Vulkan_RenderDevice *rd, u32 typeFilter, VkMemoryPropertyFlags properties) {
     VkPhysicalDeviceMemoryProperties memProperties;
     vkGetPhysicalDeviceMemoryProperties(rd->physicalDevice, &memProperties);
 
@@ -46,8 +67,14 @@ QueueFamily FindQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface) {
 
     int i = 0;
     for (const auto &queueFamily : queueFamilies) {
+        // without a surface nothing is presented, the graphics queue stands in for the present queue
         VkBool32 presentSupport = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+        if (surface != VK_NULL_HANDLE) {
+            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+        } else {
+            presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+        }
+
         if (presentSupport) {
             families.presentFamily = i;
         }
@@ -258,14 +285,14 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL DebugCallback(
     return VK_FALSE;
 }
 
-static bool CheckDeviceExtSupport(VkPhysicalDevice device) {
+static bool CheckDeviceExtSupport(VkPhysicalDevice device, const std::vector<const char *> &deviceExtensions) {
     u32 extensionCount;
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
 
     std::vector<VkExtensionProperties> availableExtensions(extensionCount);
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
 
-    std::set<std::string> requiredExtensions(DEVICE_EXTENSIONS.begin(), DEVICE_EXTENSIONS.end());
+    std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
 
     for (const auto &extension : availableExtensions) {
         requiredExtensions.erase(extension.extensionName);
@@ -275,6 +302,8 @@ static bool CheckDeviceExtSupport(VkPhysicalDevice device) {
 }
 
 static bool IsDeviceSuitable(VkSurfaceKHR surface, VkPhysicalDevice device) {
+    const bool headless = surface == VK_NULL_HANDLE;
+
     VkPhysicalDeviceProperties deviceProperties;
     vkGetPhysicalDeviceProperties(device, &deviceProperties);
 
@@ -286,7 +315,8 @@ static bool IsDeviceSuitable(VkSurfaceKHR surface, VkPhysicalDevice device) {
     vkGetPhysicalDeviceFeatures2(device, &deviceFeatures2);
 
 
-    bool result = deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU &&
+    // headless runs go to whatever the loader exposes, typically a software ICD like lavapipe
+    bool result = (headless || deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) &&
                   deviceFeatures.geometryShader &&
                   deviceFeatures.shaderSampledImageArrayDynamicIndexing &&
                   deviceFeatures2.features.shaderInt64;
@@ -295,12 +325,12 @@ static bool IsDeviceSuitable(VkSurfaceKHR surface, VkPhysicalDevice device) {
 
     result = result && families.IsComplete();
 
-    bool extensionsSupported = CheckDeviceExtSupport(device);
+    bool extensionsSupported = CheckDeviceExtSupport(device, GetDeviceExtensions(headless));
 
     result = result && extensionsSupported;
 
-    bool swapChainCompatible = false;
-    if (extensionsSupported) {
+    bool swapChainCompatible = headless;
+    if (extensionsSupported && !headless) {
         SwapChainSupportDetails swapChainSupport = QuerySwapChainSupport(device, surface);
         swapChainCompatible = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
     }
@@ -327,6 +357,12 @@ static void PickPhysicalDevice(Vulkan_RenderDevice *rd) {
     for (const auto &device : devices) {
         if (IsDeviceSuitable(rd->surface, device)) {
             rd->physicalDevice = device;
+
+            if (rd->headless) {
+                VkPhysicalDeviceProperties deviceProperties;
+                vkGetPhysicalDeviceProperties(device, &deviceProperties);
+                printf("Headless device %s\n", deviceProperties.deviceName);
+            }
             break;
         }
     }
@@ -442,14 +478,31 @@ static void CreateDevice(Vulkan_RenderDevice *rd) {
 
     deviceFeatures2.features.shaderInt64 = VK_TRUE;
 
+    std::vector<const char *> deviceExtensions = GetDeviceExtensions(rd->headless);
+
+    if (rd->dynamicRendering && !CheckDeviceExtSupport(rd->physicalDevice, DYNAMIC_RENDERING_EXTENSIONS)) {
+        fprintf(stderr, "VK_KHR_dynamic_rendering is not supported, falling back to render passes\n");
+        rd->dynamicRendering = false;
+    }
+
+    VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR,
+        .dynamicRendering = VK_TRUE,
+    };
+
+    if (rd->dynamicRendering) {
+        deviceExtensions.insert(deviceExtensions.end(), DYNAMIC_RENDERING_EXTENSIONS.begin(), DYNAMIC_RENDERING_EXTENSIONS.end());
+        physicalDeviceDescriptorIndexingFeatures.pNext = &dynamicRenderingFeatures;
+    }
+
     VkDeviceCreateInfo createInfo {};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
     createInfo.pNext = &deviceFeatures2;
     createInfo.pQueueCreateInfos = queueCreateInfos.data();
     createInfo.queueCreateInfoCount = static_cast<u32>(queueCreateInfos.size());
     createInfo.pEnabledFeatures = nullptr;
-    createInfo.enabledExtensionCount = static_cast<u32>(DEVICE_EXTENSIONS.size());
-    createInfo.ppEnabledExtensionNames = DEVICE_EXTENSIONS.data();
+    createInfo.enabledExtensionCount = static_cast<u32>(deviceExtensions.size());
+    createInfo.ppEnabledExtensionNames = deviceExtensions.data();
 
     if (ENABLE_VALIDATION) {
         createInfo.enabledLayerCount = static_cast<uint32_t>(VALIDATION_LAYERS.size());
@@ -465,6 +518,12 @@ static void CreateDevice(Vulkan_RenderDevice *rd) {
 
     vkGetDeviceQueue(rd->device, families.graphicsFamily.value(), 0, &rd->graphicsQueue);
     vkGetDeviceQueue(rd->device, families.presentFamily.value(), 0, &rd->presentQueue);
+
+    // extension commands are not exported by the loader
+    if (rd->dynamicRendering) {
+        rd->cmdBeginRendering = (PFN_vkCmdBeginRenderingKHR)vkGetDeviceProcAddr(rd->device, "vkCmdBeginRenderingKHR");
+        rd->cmdEndRendering = (PFN_vkCmdEndRenderingKHR)vkGetDeviceProcAddr(rd->device, "vkCmdEndRenderingKHR");
+    }
 }
 
 void CreateCommandPool(Vulkan_RenderDevice *rd) {
@@ -503,6 +562,7 @@ void CreateImage(Vulkan_RenderDevice  *rd,
         fprintf(stderr, "Failed to allocate memory\n");
         exit(1);
     }
+    rd->allocatedBytes += allocInfo.allocationSize;
 
     if (vkBindImageMemory(rd->device, image, imageMemory, 0) != VK_SUCCESS) {
         fprintf(stderr, "Failed to bind image memory\n");
@@ -510,8 +570,10 @@ void CreateImage(Vulkan_RenderDevice  *rd,
     }
 }
 
-Vulkan_RenderDevice CreateRenderDevice(const char *appName, const char *engineName) {
+Vulkan_RenderDevice CreateRenderDevice(const char *appName, const char *engineName, b32 headless, b32 dynamicRendering) {
     Vulkan_RenderDevice rd {};
+    rd.headless = headless;
+    rd.dynamicRendering = dynamicRendering;
 
     // Create Instance
     VkApplicationInfo appInfo {};
@@ -526,17 +588,20 @@ Vulkan_RenderDevice CreateRenderDevice(const char *appName, const char *engineNa
     createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
     createInfo.pApplicationInfo = &appInfo;
 
-    const std::vector<const char *> extensions =
+    std::vector<const char *> extensions =
     {
-        "VK_KHR_surface",
-#if defined(_WIN32)
-        "VK_KHR_win32_surface",
-#endif
         VK_EXT_DEBUG_UTILS_EXTENSION_NAME,
         VK_EXT_DEBUG_REPORT_EXTENSION_NAME,
         VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME
     };
 
+    if (!headless) {
+        extensions.push_back("VK_KHR_surface");
+#if defined(_WIN32)
+        extensions.push_back("VK_KHR_win32_surface");
+#endif
+    }
+
     createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
     createInfo.ppEnabledExtensionNames = extensions.data();
 
@@ -555,7 +620,9 @@ Vulkan_RenderDevice CreateRenderDevice(const char *appName, const char *engineNa
         InitDebugMessenger(&rd);
     }
 
-    CreateSurface(&rd);
+    if (!headless)
+        CreateSurface(&rd);
+
     PickPhysicalDevice(&rd);
     CreateDevice(&rd);
     CreateCommandPool(&rd);
@@ -571,7 +638,8 @@ void DestroyRenderDevice(Vulkan_RenderDevice *rd) {
         DestroyDebugUtilsMessengerEXT(rd->instance, g_debugMessenger, nullptr);
     }
 
-    vkDestroySurfaceKHR(rd->instance, rd->surface, nullptr);
+    if (rd->surface != VK_NULL_HANDLE)
+        vkDestroySurfaceKHR(rd->instance, rd->surface, nullptr);
     vkDestroyInstance(rd->instance, nullptr);
 }
 
@@ -636,6 +704,7 @@ void CreateBuffer(Vulkan_RenderDevice *rd, VkDeviceSize size, VkBufferUsageFlags
         fprintf(stderr, "Failed to allocate memory for buffer\n");
         exit(EXIT_FAILURE);
     }
+    rd->allocatedBytes += allocInfo.allocationSize;
 
     vkBindBufferMemory(rd->device, buffer, bufferMemory, 0);
 }
@@ -28,6 +28,13 @@ struct Vulkan_RenderDevice {
     VkSurfaceKHR     surface;
     VkCommandPool    commandPool;
     VkFormat         swapchainImageFormat;
+    VkPipelineCache  pipelineCache;
+    b32              headless;       // no surface, frames go to offscreen images
+    u64              allocatedBytes; // through CreateBuffer and CreateImage, never decreases
+    // passes are begun with vkCmdBeginRenderingKHR instead of render pass objects, off if the device lacks it
+    b32                        dynamicRendering;
+    PFN_vkCmdBeginRenderingKHR cmdBeginRendering;
+    PFN_vkCmdEndRenderingKHR   cmdEndRendering;
 };
 
 QueueFamily             FindQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface);
@@ -37,7 +44,10 @@ VkFormat FindSupportedFormat(VkPhysicalDevice physicalDevice, const std::vector<
 
 VkFormat FindDepthFormat(VkPhysicalDevice physicalDevice);
 
-Vulkan_RenderDevice CreateRenderDevice(const char *appName, const char *engineName);
+// index of a memory type out of typeFilter, as in VkMemoryRequirements, that has the properties
+u32 FindMemoryType(Vulkan_RenderDevice *rd, u32 typeFilter, VkMemoryPropertyFlags properties);
+
+Vulkan_RenderDevice CreateRenderDevice(const char *appName, const char *engineName, b32 headless = false, b32 dynamicRendering = false);
 void                DestroyRenderDevice(Vulkan_RenderDevice *rd);
 
 void CreateImage(Vulkan_RenderDevice  *rd,
@@ -0,0 +1,866 @@
+#include "pch.h"
+#include "vulkan_render_graph.h"
+#include "vulkan_render_device.h"
+#include "vulkan_gpu_profiler.h"
+
+namespace xjar {
+
+static constexpr u32 NO_GROUP = ~0u;
+
+struct AccessInfo {
+    VkPipelineStageFlags stages;
+    VkAccessFlags        access;
+    VkImageLayout        layout;
+    b32                  write;
+};
+
+static AccessInfo GetAccessInfo(RGAccess access, VkImageAspectFlags aspect) {
+    const bool depth = (aspect & VK_IMAGE_ASPECT_DEPTH_BIT) != 0;
+
+    switch (access) {
+    case RGAccess::ColorAttachment:
+        return {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true};
+    case RGAccess::DepthAttachment:
+        return {VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, true};
+    case RGAccess::SampledFragment:
+        return {VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+                depth ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false};
+    case RGAccess::StorageReadFragment:
+        return {VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, false};
+    case RGAccess::StorageWriteCompute:
+        return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, true};
+    case RGAccess::TransferSrc:
+        return {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false};
+    case RGAccess::TransferDst:
+        return {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true};
+    case RGAccess::Present:
+        return {VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, false};
+    default:
+        return {VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED, false};
+    }
+}
+
+static VkImageUsageFlags GetImageUsage(RGAccess access) {
+    switch (access) {
+    case RGAccess::ColorAttachment:
+        return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    case RGAccess::DepthAttachment:
+        return VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    case RGAccess::SampledFragment:
+        return VK_IMAGE_USAGE_SAMPLED_BIT;
+    case RGAccess::StorageReadFragment:
+    case RGAccess::StorageWriteCompute:
+        return VK_IMAGE_USAGE_STORAGE_BIT;
+    case RGAccess::TransferSrc:
+        return VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    case RGAccess::TransferDst:
+        return VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    default:
+        return 0;
+    }
+}
+
+// the layout of a combined depth stencil image can only change for both aspects at once
+static VkImageAspectFlags GetBarrierAspect(const RGImageDesc &desc) {
+    if (desc.format == VK_FORMAT_D32_SFLOAT_S8_UINT || desc.format == VK_FORMAT_D24_UNORM_S8_UINT)
+        return desc.aspect | VK_IMAGE_ASPECT_STENCIL_BIT;
+
+    return desc.aspect;
+}
+
+static bool IsSameDesc(const RGImageDesc &a, const RGImageDesc &b) {
+    return a.format == b.format && a.extent.width == b.extent.width && a.extent.height == b.extent.height && a.aspect == b.aspect;
+}
+
+static bool Reads(const RGAccess access, b32 attachment, RGLoad load) {
+    if (attachment)
+        return load == RGLoad::Load;
+
+    return !GetAccessInfo(access, 0).write;
+}
+
+void Vulkan_RenderGraph::Init(Vulkan_RenderDevice *rd) {
+    m_renderDevice = rd;
+}
+
+void Vulkan_RenderGraph::Destroy() {
+    OnResize();
+
+    for (RenderPassKey &key : m_renderPasses)
+        vkDestroyRenderPass(m_renderDevice->device, key.renderPass, nullptr);
+
+    m_renderPasses.clear();
+    m_importedStates.clear();
+}
+
+void Vulkan_RenderGraph::OnResize() {
+    for (FramebufferKey &key : m_framebuffers)
+        vkDestroyFramebuffer(m_renderDevice->device, key.framebuffer, nullptr);
+
+    m_framebuffers.clear();
+    DestroyTransients();
+}
+
+void Vulkan_RenderGraph::DestroyTransients() {
+    for (PhysicalImage &physical : m_physicalImages) {
+        vkDestroyImageView(m_renderDevice->device, physical.view, nullptr);
+        vkDestroyImage(m_renderDevice->device, physical.image, nullptr);
+    }
+
+    for (MemoryBlock &block : m_memoryBlocks)
+        vkFreeMemory(m_renderDevice->device, block.memory, nullptr);
+
+    m_physicalImages.clear();
+    m_memoryBlocks.clear();
+}
+
+void Vulkan_RenderGraph::Reset() {
+    m_resources.clear();
+    m_passes.clear();
+    m_groups.clear();
+    m_outputBarriers = {};
+}
+
+RGHandle Vulkan_RenderGraph::ImportImage(const char *name, VkImage image, VkImageView view, const RGImageDesc &desc, u32 layer, b32 discard) {
+    Resource resource {};
+    resource.name = name;
+    resource.desc = desc;
+    resource.image = image;
+    resource.view = view;
+    resource.layer = layer;
+    resource.imported = true;
+    resource.discard = discard;
+
+    m_resources.push_back(resource);
+    return static_cast<RGHandle>(m_resources.size() - 1);
+}
+
+RGHandle Vulkan_RenderGraph::ImportBuffer(const char *name, VkBuffer buffer) {
+    Resource resource {};
+    resource.name = name;
+    resource.buffer = buffer;
+    resource.isBuffer = true;
+    resource.imported = true;
+
+    m_resources.push_back(resource);
+    return static_cast<RGHandle>(m_resources.size() - 1);
+}
+
+void Vulkan_RenderGraph::ForgetImage(VkImage image) {
+    ForgetImported((u64)image);
+}
+
+void Vulkan_RenderGraph::ForgetBuffer(VkBuffer buffer) {
+    ForgetImported((u64)buffer);
+}
+
+void Vulkan_RenderGraph::ForgetImported(u64 handle) {
+    // every layer of an image
+    for (auto it = m_importedStates.begin(); it != m_importedStates.end();) {
+        if (it->first.first == handle)
+            it = m_importedStates.erase(it);
+        else
+            ++it;
+    }
+}
+
+RGHandle Vulkan_RenderGraph::CreateImage(const char *name, const RGImageDesc &desc) {
+    Resource resource {};
+    resource.name = name;
+    resource.desc = desc;
+
+    m_resources.push_back(resource);
+    return static_cast<RGHandle>(m_resources.size() - 1);
+}
+
+void Vulkan_RenderGraph::SetOutput(RGHandle resource, RGAccess finalAccess) {
+    m_resources[resource].output = true;
+    m_resources[resource].finalAccess = finalAccess;
+}
+
+u32 Vulkan_RenderGraph::AddPass(const char *name, u32 gpuZone, ExecuteFunc execute) {
+    Pass pass {};
+    pass.name = name;
+    pass.gpuZone = gpuZone;
+    pass.execute = std::move(execute);
+
+    m_passes.push_back(std::move(pass));
+    return static_cast<u32>(m_passes.size() - 1);
+}
+
+void Vulkan_RenderGraph::Use(u32 pass, RGHandle resource, RGAccess access) {
+    m_passes[pass].uses.push_back({.resource = resource, .access = access, .attachment = false, .load = RGLoad::Load, .clear = {}});
+}
+
+void Vulkan_RenderGraph::Attach(u32 pass, RGHandle resource, RGAccess access, RGLoad load, VkClearValue clear) {
+    m_passes[pass].uses.push_back({.resource = resource, .access = access, .attachment = true, .load = load, .clear = clear});
+}
+
+void Vulkan_RenderGraph::SetSecondaries(u32 pass) {
+    m_passes[pass].secondaries = true;
+}
+
+void Vulkan_RenderGraph::Compile() {
+    // a clear is only folded into a pass that survived the culling, otherwise it would be lost with it
+    Cull();
+    FoldClears();
+    BuildGroups();
+    AllocateTransients();
+    SimulateGroups();
+}
+
+void Vulkan_RenderGraph::FoldClears() {
+    const u32 passCount = static_cast<u32>(m_passes.size());
+
+    for (u32 p = 0; p < passCount; p++) {
+        Pass &pass = m_passes[p];
+        if (!pass.live || pass.execute || pass.uses.empty())
+            continue;
+
+        // every attachment has to be loaded by the next live pass that touches it
+        std::vector<ResourceUse *> targets;
+        for (const ResourceUse &use : pass.uses) {
+            ResourceUse *next = nullptr;
+            for (u32 n = p + 1; n < passCount && !next; n++) {
+                if (!m_passes[n].live)
+                    continue;
+
+                for (ResourceUse &nextUse : m_passes[n].uses) {
+                    if (nextUse.resource == use.resource) {
+                        next = &nextUse;
+                        break;
+                    }
+                }
+            }
+
+            if (!use.attachment || use.load != RGLoad::Clear || !next || !next->attachment || next->load != RGLoad::Load)
+                break;
+
+            targets.push_back(next);
+        }
+
+        if (targets.size() != pass.uses.size())
+            continue;
+
+        for (u32 i = 0; i < targets.size(); i++) {
+            targets[i]->load = RGLoad::Clear;
+            targets[i]->clear = pass.uses[i].clear;
+        }
+
+        // the clears are done by the load ops of the targets now
+        pass.live = false;
+    }
+}
+
+void Vulkan_RenderGraph::Cull() {
+    // walks the passes backwards, a resource is needed while a later live pass reads it
+    std::vector<b32> needed(m_resources.size());
+    for (u32 r = 0; r < m_resources.size(); r++)
+        needed[r] = m_resources[r].output;
+
+    for (u32 p = static_cast<u32>(m_passes.size()); p-- > 0;) {
+        Pass &pass = m_passes[p];
+        pass.live = false;
+
+        for (const ResourceUse &use : pass.uses) {
+            if (GetAccessInfo(use.access, 0).write && needed[use.resource])
+                pass.live = true;
+        }
+
+        if (!pass.live)
+            continue;
+
+        // what the pass overwrites without reading was not needed before it
+        for (const ResourceUse &use : pass.uses) {
+            if (GetAccessInfo(use.access, 0).write && !Reads(use.access, use.attachment, use.load))
+                needed[use.resource] = false;
+        }
+
+        for (const ResourceUse &use : pass.uses) {
+            if (Reads(use.access, use.attachment, use.load))
+                needed[use.resource] = true;
+        }
+    }
+}
+
+bool Vulkan_RenderGraph::CanMerge(const Group &group, const Pass &pass) const {
+    const Pass &first = m_passes[group.passes[0]];
+    if (group.attachments.empty() || first.secondaries != pass.secondaries)
+        return false;
+
+    // the same attachments in the same order, loaded as the group left them
+    u32 attachmentCount = 0;
+    for (const ResourceUse &use : pass.uses) {
+        if (!use.attachment)
+            continue;
+
+        if (attachmentCount >= group.attachments.size() || group.attachments[attachmentCount].resource != use.resource ||
+            group.attachments[attachmentCount].access != use.access || use.load != RGLoad::Load)
+            return false;
+
+        attachmentCount++;
+    }
+
+    if (attachmentCount != group.attachments.size())
+        return false;
+
+    // the barriers of the pass are recorded before the render pass, so it can't depend on the group otherwise
+    for (const ResourceUse &use : pass.uses) {
+        if (use.attachment)
+            continue;
+
+        for (u32 p : group.passes) {
+            for (const ResourceUse &groupUse : m_passes[p].uses) {
+                if (groupUse.resource == use.resource && (GetAccessInfo(groupUse.access, 0).write || GetAccessInfo(use.access, 0).write))
+                    return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void Vulkan_RenderGraph::BuildGroups() {
+    for (u32 p = 0; p < m_passes.size(); p++) {
+        const Pass &pass = m_passes[p];
+        if (!pass.live)
+            continue;
+
+        if (!m_groups.empty() && CanMerge(m_groups.back(), pass)) {
+            m_groups.back().passes.push_back(p);
+            continue;
+        }
+
+        Group group {};
+        group.passes.push_back(p);
+
+        for (const ResourceUse &use : pass.uses) {
+            if (use.attachment)
+                group.attachments.push_back({.resource = use.resource, .access = use.access, .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+                                             .storeOp = VK_ATTACHMENT_STORE_OP_STORE, .clear = use.clear});
+        }
+
+        m_groups.push_back(std::move(group));
+    }
+
+    for (Resource &resource : m_resources) {
+        resource.firstGroup = NO_GROUP;
+        resource.lastGroup = 0;
+        resource.usage = 0;
+    }
+
+    for (u32 g = 0; g < m_groups.size(); g++) {
+        for (u32 p : m_groups[g].passes) {
+            for (const ResourceUse &use : m_passes[p].uses) {
+                Resource &resource = m_resources[use.resource];
+                resource.firstGroup = std::min(resource.firstGroup, g);
+                resource.lastGroup = std::max(resource.lastGroup, g);
+                resource.usage |= GetImageUsage(use.access);
+            }
+        }
+    }
+}
+
+void Vulkan_RenderGraph::AllocateTransients() {
+    for (MemoryBlock &block : m_memoryBlocks)
+        block.busy = false;
+
+    std::vector<RGHandle> transients;
+    for (u32 r = 0; r < m_resources.size(); r++) {
+        if (!m_resources[r].imported && m_resources[r].firstGroup != NO_GROUP)
+            transients.push_back(r);
+    }
+
+    std::sort(transients.begin(), transients.end(), [&](RGHandle a, RGHandle b) {
+        return m_resources[a].firstGroup < m_resources[b].firstGroup;
+    });
+
+    // the blocks are free again once the last group that used them is over
+    auto isFree = [&](u32 block, u32 firstGroup) {
+        return !m_memoryBlocks[block].busy || m_memoryBlocks[block].busyUntil < firstGroup;
+    };
+
+    for (RGHandle r : transients) {
+        Resource &resource = m_resources[r];
+
+        u32 physical = 0;
+        while (physical < m_physicalImages.size() &&
+               !(IsSameDesc(m_physicalImages[physical].desc, resource.desc) && m_physicalImages[physical].usage == resource.usage &&
+                 isFree(m_physicalImages[physical].block, resource.firstGroup)))
+            physical++;
+
+        if (physical == m_physicalImages.size()) {
+            PhysicalImage image {};
+            image.desc = resource.desc;
+            image.usage = resource.usage;
+
+            VkImageCreateInfo imageInfo {};
+            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageInfo.extent.width = resource.desc.extent.width;
+            imageInfo.extent.height = resource.desc.extent.height;
+            imageInfo.extent.depth = 1;
+            imageInfo.mipLevels = 1;
+            imageInfo.arrayLayers = 1;
+            imageInfo.format = resource.desc.format;
+            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            imageInfo.usage = resource.usage;
+            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            if (vkCreateImage(m_renderDevice->device, &imageInfo, nullptr, &image.image) != VK_SUCCESS) {
+                fprintf(stderr, "Failed to create image %s\n", resource.name);
+                exit(1);
+            }
+
+            VkMemoryRequirements memRequirements;
+            vkGetImageMemoryRequirements(m_renderDevice->device, image.image, &memRequirements);
+
+            image.block = 0;
+            while (image.block < m_memoryBlocks.size() &&
+                   !(isFree(image.block, resource.firstGroup) && m_memoryBlocks[image.block].size >= memRequirements.size &&
+                     (memRequirements.memoryTypeBits & (1u << m_memoryBlocks[image.block].memoryType))))
+                image.block++;
+
+            if (image.block == m_memoryBlocks.size()) {
+                MemoryBlock block {};
+                block.size = memRequirements.size;
+                block.memoryType = FindMemoryType(m_renderDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+                VkMemoryAllocateInfo allocInfo {};
+                allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+                allocInfo.allocationSize = block.size;
+                allocInfo.memoryTypeIndex = block.memoryType;
+
+                if (vkAllocateMemory(m_renderDevice->device, &allocInfo, nullptr, &block.memory) != VK_SUCCESS) {
+                    fprintf(stderr, "Failed to allocate memory\n");
+                    exit(1);
+                }
+                m_renderDevice->allocatedBytes += allocInfo.allocationSize;
+
+                m_memoryBlocks.push_back(block);
+            }
+
+            // the images of a block alias each other from its start
+            if (vkBindImageMemory(m_renderDevice->device, image.image, m_memoryBlocks[image.block].memory, 0) != VK_SUCCESS) {
+                fprintf(stderr, "Failed to bind image memory\n");
+                exit(1);
+            }
+
+            VkImageViewCreateInfo viewInfo {};
+            viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            viewInfo.image = image.image;
+            viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            viewInfo.format = resource.desc.format;
+            viewInfo.subresourceRange = {resource.desc.aspect, 0, 1, 0, 1};
+
+            if (vkCreateImageView(m_renderDevice->device, &viewInfo, nullptr, &image.view) != VK_SUCCESS) {
+                fprintf(stderr, "Failed to create image view %s\n", resource.name);
+                exit(1);
+            }
+
+            m_physicalImages.push_back(image);
+        }
+
+        resource.physical = physical;
+
+        MemoryBlock &block = m_memoryBlocks[m_physicalImages[physical].block];
+        block.busy = true;
+        block.busyUntil = resource.lastGroup;
+    }
+}
+
+VkImage Vulkan_RenderGraph::GetImage(const Resource &resource) const {
+    return resource.imported ? resource.image : m_physicalImages[resource.physical].image;
+}
+
+VkImageView Vulkan_RenderGraph::GetView(const Resource &resource) const {
+    return resource.imported ? resource.view : m_physicalImages[resource.physical].view;
+}
+
+void Vulkan_RenderGraph::AddBarrier(Group &group, Resource &resource, RGAccess access) {
+    const AccessInfo info = GetAccessInfo(access, resource.desc.aspect);
+    State           &state = resource.state;
+
+    const bool layoutChange = !resource.isBuffer && state.layout != info.layout;
+
+    VkPipelineStageFlags srcStages;
+    if (!info.write && !layoutChange) {
+        // reads after reads need nothing, a read after a write waits for it once per stage
+        if (state.writeStages == 0 || (state.visibleStages & info.stages) == info.stages) {
+            state.readStages |= info.stages;
+            return;
+        }
+
+        srcStages = state.writeStages;
+    } else {
+        // a write or a layout transition also waits for the reads before it
+        srcStages = state.writeStages | state.readStages;
+        if (srcStages == 0 && !layoutChange) {
+            state.writeStages = info.stages;
+            state.writeAccess = info.access;
+            return;
+        }
+    }
+
+    if (resource.isBuffer) {
+        VkBufferMemoryBarrier barrier {};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = state.writeAccess;
+        barrier.dstAccessMask = info.access;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = resource.buffer;
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+
+        group.bufferBarriers.push_back(barrier);
+    } else {
+        VkImageMemoryBarrier barrier {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = state.writeAccess;
+        barrier.dstAccessMask = info.access;
+        barrier.oldLayout = state.layout;
+        barrier.newLayout = info.layout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = GetImage(resource);
+        barrier.subresourceRange = {GetBarrierAspect(resource.desc), 0, 1, resource.layer, 1};
+
+        group.imageBarriers.push_back(barrier);
+    }
+
+    group.srcStages |= srcStages != 0 ? srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    group.dstStages |= info.stages;
+
+    if (!info.write && !layoutChange) {
+        state.visibleStages |= info.stages;
+        state.readStages |= info.stages;
+        return;
+    }
+
+    // the transition is done once the stages of the access start
+    state.layout = resource.isBuffer ? state.layout : info.layout;
+    state.writeStages = info.stages;
+    state.writeAccess = info.write ? info.access : 0;
+    state.readStages = info.write ? 0 : info.stages;
+    state.visibleStages = info.stages;
+}
+
+void Vulkan_RenderGraph::SimulateGroups() {
+    // the state the frame finds the resources in
+    for (Resource &resource : m_resources) {
+        resource.state = {};
+
+        if (resource.imported && resource.discard) {
+            // the submit waits for the swapchain image acquire at this stage
+            resource.state.writeStages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        } else if (resource.imported) {
+            auto found = m_importedStates.find({resource.isBuffer ? (u64)resource.buffer : (u64)resource.image, resource.layer});
+            if (found != m_importedStates.end())
+                resource.state = found->second;
+        }
+    }
+
+    for (u32 g = 0; g < m_groups.size(); g++) {
+        Group &group = m_groups[g];
+
+        // a transient starts undefined, after whatever used its memory before
+        for (Resource &resource : m_resources) {
+            if (!resource.imported && resource.firstGroup == g) {
+                const MemoryBlock &block = m_memoryBlocks[m_physicalImages[resource.physical].block];
+                resource.state.writeStages = block.lastStages;
+                resource.state.writeAccess = block.lastAccess;
+            }
+        }
+
+        for (Attachment &attachment : group.attachments) {
+            const Resource &resource = m_resources[attachment.resource];
+            const ResourceUse *use = nullptr;
+            for (const ResourceUse &firstUse : m_passes[group.passes[0]].uses) {
+                if (firstUse.attachment && firstUse.resource == attachment.resource)
+                    use = &firstUse;
+            }
+
+            // there is nothing to load out of an undefined image, and nothing to keep of a transient no one reads later
+            if (use->load == RGLoad::Clear) {
+                attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+                attachment.clear = use->clear;
+            } else if (use->load == RGLoad::Load && resource.state.layout != VK_IMAGE_LAYOUT_UNDEFINED) {
+                attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+            } else {
+                attachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+            }
+
+            const bool keep = resource.imported || resource.output || resource.lastGroup > g;
+            attachment.storeOp = keep ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        }
+
+        for (u32 i = 0; i < group.passes.size(); i++) {
+            for (const ResourceUse &use : m_passes[group.passes[i]].uses) {
+                // the attachments keep their layout through the render pass, which orders its draws
+                if (use.attachment && i > 0)
+                    continue;
+
+                Resource &resource = m_resources[use.resource];
+                AddBarrier(group, resource, use.access);
+
+                if (!resource.imported) {
+                    MemoryBlock &block = m_memoryBlocks[m_physicalImages[resource.physical].block];
+                    block.lastStages = resource.state.writeStages | resource.state.readStages;
+                    block.lastAccess = resource.state.writeAccess;
+                }
+            }
+        }
+    }
+
+    for (Resource &resource : m_resources) {
+        if (resource.output && resource.finalAccess != RGAccess::None)
+            AddBarrier(m_outputBarriers, resource, resource.finalAccess);
+    }
+
+    for (const Resource &resource : m_resources) {
+        if (resource.imported && !resource.discard)
+            m_importedStates[{resource.isBuffer ? (u64)resource.buffer : (u64)resource.image, resource.layer}] = resource.state;
+    }
+}
+
+VkRenderPass Vulkan_RenderGraph::GetRenderPass(const Group &group) {
+    RenderPassKey key {};
+    for (const Attachment &attachment : group.attachments) {
+        const Resource &resource = m_resources[attachment.resource];
+        key.entries.push_back({.format = resource.desc.format, .loadOp = attachment.loadOp, .storeOp = attachment.storeOp,
+                               .layout = GetAccessInfo(attachment.access, resource.desc.aspect).layout});
+    }
+
+    for (const RenderPassKey &existing : m_renderPasses) {
+        if (existing.entries.size() == key.entries.size() &&
+            std::equal(existing.entries.begin(), existing.entries.end(), key.entries.begin(), [](const RenderPassKey::Entry &a, const RenderPassKey::Entry &b) {
+                return a.format == b.format && a.loadOp == b.loadOp && a.storeOp == b.storeOp && a.layout == b.layout;
+            }))
+            return existing.renderPass;
+    }
+
+    std::vector<VkAttachmentDescription> descriptions;
+    std::vector<VkAttachmentReference>   colorRefs;
+    VkAttachmentReference                depthRef {};
+    bool                                 hasDepth = false;
+
+    for (u32 i = 0; i < key.entries.size(); i++) {
+        const RenderPassKey::Entry &entry = key.entries[i];
+
+        // the graph records the barriers around the pass, the layouts stay what they were
+        VkAttachmentDescription description {};
+        description.format = entry.format;
+        description.samples = VK_SAMPLE_COUNT_1_BIT;
+        description.loadOp = entry.loadOp;
+        description.storeOp = entry.storeOp;
+        description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        description.initialLayout = entry.layout;
+        description.finalLayout = entry.layout;
+        descriptions.push_back(description);
+
+        if (m_resources[group.attachments[i].resource].desc.aspect & VK_IMAGE_ASPECT_DEPTH_BIT) {
+            depthRef = {i, entry.layout};
+            hasDepth = true;
+        } else {
+            colorRefs.push_back({i, entry.layout});
+        }
+    }
+
+    VkSubpassDescription subpass = {};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = static_cast<u32>(colorRefs.size());
+    subpass.pColorAttachments = colorRefs.data();
+    subpass.pDepthStencilAttachment = hasDepth ? &depthRef : nullptr;
+
+    VkRenderPassCreateInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = static_cast<u32>(descriptions.size());
+    renderPassInfo.pAttachments = descriptions.data();
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+
+    if (vkCreateRenderPass(m_renderDevice->device, &renderPassInfo, nullptr, &key.renderPass) != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create render pass\n");
+        exit(1);
+    }
+
+    m_renderPasses.push_back(std::move(key));
+    return m_renderPasses.back().renderPass;
+}
+
+VkFramebuffer Vulkan_RenderGraph::GetFramebuffer(VkRenderPass renderPass, const Group &group, VkExtent2D extent) {
+    std::vector<VkImageView> views;
+    for (const Attachment &attachment : group.attachments)
+        views.push_back(GetView(m_resources[attachment.resource]));
+
+    for (const FramebufferKey &existing : m_framebuffers) {
+        if (existing.renderPass == renderPass && existing.views == views &&
+            existing.extent.width == extent.width && existing.extent.height == extent.height)
+            return existing.framebuffer;
+    }
+
+    FramebufferKey key {};
+    key.renderPass = renderPass;
+    key.views = std::move(views);
+    key.extent = extent;
+
+    VkFramebufferCreateInfo framebufferInfo = {};
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.renderPass = renderPass;
+    framebufferInfo.attachmentCount = static_cast<u32>(key.views.size());
+    framebufferInfo.pAttachments = key.views.data();
+    framebufferInfo.width = extent.width;
+    framebufferInfo.height = extent.height;
+    framebufferInfo.layers = 1;
+
+    if (vkCreateFramebuffer(m_renderDevice->device, &framebufferInfo, nullptr, &key.framebuffer) != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create framebuffer\n");
+        exit(1);
+    }
+
+    m_framebuffers.push_back(std::move(key));
+    return m_framebuffers.back().framebuffer;
+}
+
+void Vulkan_RenderGraph::RecordBarriers(VkCommandBuffer cmdbuf, const Group &group) {
+    if (group.imageBarriers.empty() && group.bufferBarriers.empty())
+        return;
+
+    vkCmdPipelineBarrier(cmdbuf, group.srcStages, group.dstStages, 0,
+                         0, nullptr,
+                         static_cast<u32>(group.bufferBarriers.size()), group.bufferBarriers.data(),
+                         static_cast<u32>(group.imageBarriers.size()), group.imageBarriers.data());
+}
+
+void Vulkan_RenderGraph::Execute(VkCommandBuffer cmdbuf, Vulkan_GpuProfiler &profiler) {
+    u32 zone = GPU_PASS_COUNT;
+
+    auto switchZone = [&](u32 passZone) {
+        if (passZone == zone)
+            return;
+
+        if (zone != GPU_PASS_COUNT)
+            profiler.EndPass(cmdbuf, zone);
+        if (passZone != GPU_PASS_COUNT)
+            profiler.BeginPass(cmdbuf, passZone);
+
+        zone = passZone;
+    };
+
+    for (const Group &group : m_groups) {
+        // the zones of a pass with secondaries can't be written inside of it, its group is timed with its first pass
+        switchZone(m_passes[group.passes[0]].gpuZone);
+
+        RecordBarriers(cmdbuf, group);
+
+        RGPassContext context {};
+        if (group.attachments.empty()) {
+            for (u32 p : group.passes)
+                m_passes[p].execute(cmdbuf, context);
+
+            continue;
+        }
+
+        const bool secondaries = m_passes[group.passes[0]].secondaries;
+
+        context.extent = m_resources[group.attachments[0].resource].desc.extent;
+        context.contents = secondaries ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE;
+
+        for (const Attachment &attachment : group.attachments) {
+            const RGImageDesc &desc = m_resources[attachment.resource].desc;
+            (desc.aspect & VK_IMAGE_ASPECT_DEPTH_BIT ? context.depthFormat : context.colorFormat) = desc.format;
+        }
+
+        if (m_renderDevice->dynamicRendering)
+            BeginRendering(cmdbuf, group, context);
+        else
+            BeginRenderPass(cmdbuf, group, context);
+
+        for (u32 p : group.passes) {
+            if (!secondaries)
+                switchZone(m_passes[p].gpuZone);
+
+            if (m_passes[p].execute)
+                m_passes[p].execute(cmdbuf, context);
+        }
+
+        if (m_renderDevice->dynamicRendering)
+            m_renderDevice->cmdEndRendering(cmdbuf);
+        else
+            vkCmdEndRenderPass(cmdbuf);
+    }
+
+    switchZone(GPU_PASS_COUNT);
+}
+
+void Vulkan_RenderGraph::BeginRenderPass(VkCommandBuffer cmdbuf, const Group &group, RGPassContext &context) {
+    context.renderPass = GetRenderPass(group);
+    context.framebuffer = GetFramebuffer(context.renderPass, group, context.extent);
+
+    std::vector<VkClearValue> clearValues;
+    for (const Attachment &attachment : group.attachments)
+        clearValues.push_back(attachment.clear);
+
+    VkRenderPassBeginInfo passInfo {};
+    passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    passInfo.renderPass = context.renderPass;
+    passInfo.framebuffer = context.framebuffer;
+    passInfo.renderArea.offset = {0, 0};
+    passInfo.renderArea.extent = context.extent;
+    passInfo.clearValueCount = static_cast<u32>(clearValues.size());
+    passInfo.pClearValues = clearValues.data();
+
+    vkCmdBeginRenderPass(cmdbuf, &passInfo, context.contents);
+}
+
+void Vulkan_RenderGraph::BeginRendering(VkCommandBuffer cmdbuf, const Group &group, const RGPassContext &context) {
+    std::vector<VkRenderingAttachmentInfoKHR> colorAttachments;
+    VkRenderingAttachmentInfoKHR              depthAttachment {};
+    bool                                      hasDepth = false;
+
+    // the barriers of the group already put the attachments in these layouts
+    for (const Attachment &attachment : group.attachments) {
+        const Resource &resource = m_resources[attachment.resource];
+
+        VkRenderingAttachmentInfoKHR info {};
+        info.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+        info.imageView = GetView(resource);
+        info.imageLayout = GetAccessInfo(attachment.access, resource.desc.aspect).layout;
+        info.loadOp = attachment.loadOp;
+        info.storeOp = attachment.storeOp;
+        info.clearValue = attachment.clear;
+
+        if (resource.desc.aspect & VK_IMAGE_ASPECT_DEPTH_BIT) {
+            depthAttachment = info;
+            hasDepth = true;
+        } else {
+            colorAttachments.push_back(info);
+        }
+    }
+
+    VkRenderingInfoKHR renderingInfo {};
+    renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+    renderingInfo.flags = context.contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT_KHR : 0;
+    renderingInfo.renderArea.offset = {0, 0};
+    renderingInfo.renderArea.extent = context.extent;
+    renderingInfo.layerCount = 1;
+    renderingInfo.colorAttachmentCount = static_cast<u32>(colorAttachments.size());
+    renderingInfo.pColorAttachments = colorAttachments.data();
+    renderingInfo.pDepthAttachment = hasDepth ? &depthAttachment : nullptr;
+
+    m_renderDevice->cmdBeginRendering(cmdbuf, &renderingInfo);
+}
+
+void Vulkan_RenderGraph::TransitionOutputs(VkCommandBuffer cmdbuf) {
+    RecordBarriers(cmdbuf, m_outputBarriers);
+}
+
+}
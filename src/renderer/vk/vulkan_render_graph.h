@@ -0,0 +1,232 @@
+#pragma once
+
+#include "types.h"
+#define VK_USE_PLATFORM_WIN32_KHR
+#include <vulkan/vulkan.h>
+
+#include <functional>
+#include <map>
+#include <vector>
+
+namespace xjar {
+
+struct Vulkan_RenderDevice;
+class Vulkan_GpuProfiler;
+
+// a resource of the frame's graph
+using RGHandle = u32;
+
+// how a pass uses a resource, the stages, access mask and layout of the barriers follow from it
+enum class RGAccess : u8 {
+    None,
+    ColorAttachment,
+    DepthAttachment,     // tested and written
+    SampledFragment,
+    StorageReadFragment,
+    StorageWriteCompute,
+    TransferSrc,
+    TransferDst,
+    Present,
+};
+
+// what a raster pass finds in an attachment
+enum class RGLoad : u8 {
+    Load,    // what the earlier passes or frames left, if anything
+    Clear,
+    Discard, // every pixel gets overwritten
+};
+
+struct RGImageDesc {
+    VkFormat           format;
+    VkExtent2D         extent;
+    VkImageAspectFlags aspect;
+};
+
+// the render pass a raster pass records into, begun by the graph
+struct RGPassContext {
+    VkRenderPass      renderPass;  // null with dynamic rendering
+    VkFramebuffer     framebuffer; // likewise
+    VkExtent2D        extent;
+    VkSubpassContents contents;
+    // what the secondaries inherit when there is no render pass, VK_FORMAT_UNDEFINED if the pass has no such attachment
+    VkFormat          colorFormat;
+    VkFormat          depthFormat;
+};
+
+// The passes of a frame declare the resources they use and the graph records them in the order they were
+// added, with the barriers and layout transitions in between. Passes that nothing reads are culled, a pass
+// that only clears becomes the load op of the next one, and consecutive passes with the same attachments
+// share a render pass. Transient images only live during the frame, images whose lifetimes don't overlap
+// share memory. Imported resources keep their state from one frame to the next.
+// On a device with dynamic rendering the passes are begun with vkCmdBeginRenderingKHR, so there are no
+// render pass or framebuffer objects to create or to recreate on resize.
+class Vulkan_RenderGraph final {
+public:
+    using ExecuteFunc = std::function<void(VkCommandBuffer cmdbuf, const RGPassContext &context)>;
+
+    void Init(Vulkan_RenderDevice *rd);
+    void Destroy();
+    // the framebuffers and transients are sized to the swapchain, the device has to be idle
+    void OnResize();
+
+    // drops the passes and resources of the previous frame
+    void Reset();
+
+    // a discarded image starts the frame undefined and only waits for the swapchain image acquire,
+    // otherwise the image is ordered after what the previous frames did with it
+    RGHandle ImportImage(const char *name, VkImage image, VkImageView view, const RGImageDesc &desc, u32 layer = 0, b32 discard = false);
+    RGHandle ImportBuffer(const char *name, VkBuffer buffer);
+    // drops the state kept for an imported image or buffer between frames, before it is destroyed,
+    // so a new one that gets the same handle doesn't start in the old one's layout
+    void     ForgetImage(VkImage image);
+    void     ForgetBuffer(VkBuffer buffer);
+    RGHandle CreateImage(const char *name, const RGImageDesc &desc);
+    // never culled, left in finalAccess at the end of the frame unless it is None
+    void     SetOutput(RGHandle resource, RGAccess finalAccess = RGAccess::None);
+
+    // a pass without execute only clears its attachments
+    u32  AddPass(const char *name, u32 gpuZone, ExecuteFunc execute);
+    void Use(u32 pass, RGHandle resource, RGAccess access);
+    // attachments are bound in the order they are added, like the render passes the pipelines are made with
+    void Attach(u32 pass, RGHandle resource, RGAccess access, RGLoad load, VkClearValue clear = {});
+    // the pass only records vkCmdExecuteCommands, see Vulkan_ParallelRecorder
+    void SetSecondaries(u32 pass);
+
+    void Compile();
+    void Execute(VkCommandBuffer cmdbuf, Vulkan_GpuProfiler &profiler);
+    // after Execute, outside of the GPU zones of the passes
+    void TransitionOutputs(VkCommandBuffer cmdbuf);
+
+private:
+    struct State {
+        VkImageLayout        layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags writeStages = 0;   // of the last write, or the layout transition
+        VkAccessFlags        writeAccess = 0;
+        VkPipelineStageFlags readStages = 0;    // read since the last write, a write waits for them
+        VkPipelineStageFlags visibleStages = 0; // the last write was already made visible to these
+    };
+
+    struct Resource {
+        const char *name;
+        RGImageDesc desc;
+        VkImage     image;
+        VkImageView view;
+        u32         layer;
+        VkBuffer    buffer;
+        b32         isBuffer;
+        b32         imported;
+        b32         discard;
+        b32         output;
+        RGAccess    finalAccess;
+        // compiled
+        u32               firstGroup;
+        u32               lastGroup;
+        VkImageUsageFlags usage;
+        u32               physical; // of a transient
+        State             state;
+    };
+
+    struct ResourceUse {
+        RGHandle     resource;
+        RGAccess     access;
+        b32          attachment;
+        RGLoad       load;
+        VkClearValue clear;
+    };
+
+    struct Pass {
+        const char      *name;
+        u32              gpuZone;
+        ExecuteFunc      execute;
+        std::vector<ResourceUse> uses;
+        b32              secondaries;
+        b32              live;
+    };
+
+    struct Attachment {
+        RGHandle            resource;
+        RGAccess            access;
+        VkAttachmentLoadOp  loadOp;
+        VkAttachmentStoreOp storeOp;
+        VkClearValue        clear;
+    };
+
+    // live passes that run back to back, inside one render pass if they have attachments
+    struct Group {
+        std::vector<u32>                   passes;
+        std::vector<Attachment>            attachments;
+        VkPipelineStageFlags               srcStages;
+        VkPipelineStageFlags               dstStages;
+        std::vector<VkImageMemoryBarrier>  imageBarriers;
+        std::vector<VkBufferMemoryBarrier> bufferBarriers;
+    };
+
+    // transient images are never rebound, their memory blocks are shared by the ones that don't overlap
+    struct PhysicalImage {
+        RGImageDesc       desc;
+        VkImageUsageFlags usage;
+        VkImage           image;
+        VkImageView       view;
+        u32               block;
+    };
+
+    struct MemoryBlock {
+        VkDeviceMemory       memory;
+        VkDeviceSize         size;
+        u32                  memoryType;
+        VkPipelineStageFlags lastStages; // of the last image that used the block, the next one waits for it
+        VkAccessFlags        lastAccess;
+        u32                  busyUntil;  // group of the last use in this frame
+        b32                  busy;
+    };
+
+    struct RenderPassKey {
+        struct Entry {
+            VkFormat            format;
+            VkAttachmentLoadOp  loadOp;
+            VkAttachmentStoreOp storeOp;
+            VkImageLayout       layout;
+        };
+
+        std::vector<Entry> entries;
+        VkRenderPass       renderPass;
+    };
+
+    struct FramebufferKey {
+        VkRenderPass             renderPass;
+        std::vector<VkImageView> views;
+        VkExtent2D               extent;
+        VkFramebuffer            framebuffer;
+    };
+
+    void          FoldClears();
+    void          Cull();
+    void          BuildGroups();
+    bool          CanMerge(const Group &group, const Pass &pass) const;
+    void          AllocateTransients();
+    void          AddBarrier(Group &group, Resource &resource, RGAccess access);
+    void          SimulateGroups();
+    void          RecordBarriers(VkCommandBuffer cmdbuf, const Group &group);
+    void          BeginRenderPass(VkCommandBuffer cmdbuf, const Group &group, RGPassContext &context);
+    void          BeginRendering(VkCommandBuffer cmdbuf, const Group &group, const RGPassContext &context);
+    VkImage       GetImage(const Resource &resource) const;
+    VkImageView   GetView(const Resource &resource) const;
+    VkRenderPass  GetRenderPass(const Group &group);
+    VkFramebuffer GetFramebuffer(VkRenderPass renderPass, const Group &group, VkExtent2D extent);
+    void          DestroyTransients();
+    void          ForgetImported(u64 handle);
+
+    Vulkan_RenderDevice        *m_renderDevice;
+    std::vector<Resource>       m_resources;
+    std::vector<Pass>           m_passes;
+    std::vector<Group>          m_groups;
+    Group                       m_outputBarriers;
+    std::vector<PhysicalImage>  m_physicalImages;
+    std::vector<MemoryBlock>    m_memoryBlocks;
+    std::vector<RenderPassKey>  m_renderPasses;
+    std::vector<FramebufferKey> m_framebuffers;
+    // of the imported resources between frames, by handle and layer
+    std::map<std::pair<u64, u32>, State> m_importedStates;
+};
+
+}
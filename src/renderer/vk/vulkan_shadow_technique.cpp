@@ -2,6 +2,7 @@
 #include "vulkan_shadow_technique.h"
 #include "vulkan_render_device.h"
 #include "vulkan_swapchain.h"
+#include "vulkan_frame.h"
 #include "vulkan_ds.h"
 #include "window.h"
 #include "io.h"
@@ -33,7 +34,7 @@ static void CreateShaderStages(Vulkan_RenderDevice *rd, const char *vs, const ch
 
 void Vulkan_ShadowTechnique::SetupDescriptorLayout(Vulkan_RenderDevice *rd) {
     DescriptorLayoutBuilder dsBindings;
-    dsBindings.AddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+    dsBindings.AddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT); // light matrix in the frame ring
     dsBindings.AddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);           // vertices of model
     dsBindings.AddBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);           // indices of model
     dsBindings.AddBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);           // instance data buffer
@@ -42,10 +43,10 @@ void Vulkan_ShadowTechnique::SetupDescriptorLayout(Vulkan_RenderDevice *rd) {
     m_dsLayout = dsBindings.Build(rd->device);
 }
 
-void Vulkan_ShadowTechnique::CreateShadowDepthPipeline(Vulkan_RenderDevice *rd, u32 imageCount) {
+void Vulkan_ShadowTechnique::CreateShadowDepthPipeline(Vulkan_RenderDevice *rd, Vulkan_Pipeline &pipeline, const char *vertShader) {
     VkPipelineShaderStageCreateInfo shaderStages[1];
 
-    auto vertShaderCode = ReadFile("shaders/shadow_depth.vert.spv");
+    auto vertShaderCode = ReadFile(vertShader);
 
     VkShaderModule vertShaderModule = CreateShaderModule(rd, vertShaderCode);
 
@@ -57,26 +58,31 @@ void Vulkan_ShadowTechnique::CreateShadowDepthPipeline(Vulkan_RenderDevice *rd,
 
     shaderStages[0] = vertShaderStageInfo;
 
-    m_offscreenPipeline.SetInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
-    m_offscreenPipeline.SetPolygonMode(VK_POLYGON_MODE_FILL);
-    m_offscreenPipeline.SetCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE);
-    m_offscreenPipeline.SetMultisamplingNone();
-    m_offscreenPipeline.DisableBlending();
-    m_offscreenPipeline.EnableDepthtest(VK_TRUE, VK_COMPARE_OP_LESS_OR_EQUAL);
-    m_offscreenPipeline.SetShaders(shaderStages);
-    m_offscreenPipeline.SetDescriptorSets(&m_dsLayout, 1);
-    m_offscreenPipeline.Create(rd, m_renderPass);
+    // the model matrix of the entity, see shadow_depth.vert
+    VkPushConstantRange push;
+    push.offset = 0;
+    push.size = sizeof(glm::mat4);
+    push.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+    pipeline.SetInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+    pipeline.SetPolygonMode(VK_POLYGON_MODE_FILL);
+    pipeline.SetCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+    pipeline.SetMultisamplingNone();
+    pipeline.DisableBlending();
+    pipeline.EnableDepthtest(VK_TRUE, VK_COMPARE_OP_LESS_OR_EQUAL);
+    pipeline.SetPushConstants(push, 1);
+    pipeline.SetShaders(shaderStages);
+    pipeline.SetDescriptorSets(&m_dsLayout, 1);
+    pipeline.SetAttachmentFormats(VK_FORMAT_UNDEFINED, FindDepthFormat(rd->physicalDevice));
+    pipeline.Create(rd, m_renderPass);
 
     vkDestroyShaderModule(rd->device, shaderStages[0].module, nullptr);
 }
 
-void Vulkan_ShadowTechnique::CreateShadowMap(Vulkan_RenderDevice *rd, u32 imageCount) {
+void Vulkan_ShadowTechnique::CreateDepthLayers(Vulkan_RenderDevice *rd, VkImageUsageFlags usage, VkImage &image,
+                                               VkDeviceMemory &memory, VkImageView *layerViews) {
     auto depthFormat = FindDepthFormat(rd->physicalDevice);
 
-    m_framebuffers.resize(imageCount);
-    m_uniformsDepth.resize(imageCount);
-    m_uniformsMemoryDepth.resize(imageCount);
-
     VkImageCreateInfo imageInfo {};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
     imageInfo.imageType = VK_IMAGE_TYPE_2D;
@@ -84,93 +90,76 @@ void Vulkan_ShadowTechnique::CreateShadowMap(Vulkan_RenderDevice *rd, u32 imageC
     imageInfo.extent.height = m_height;
     imageInfo.extent.depth = 1;
     imageInfo.mipLevels = 1;
-    imageInfo.arrayLayers = 1;
+    imageInfo.arrayLayers = MAX_SHADOW_CASCADES;
     imageInfo.format = depthFormat;
     imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL; // let the gpu to shuffle the data however it sees fit
     imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | usage;
     imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
 
     CreateImage(
         rd,
         imageInfo,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        m_depthImage,
-        m_depthImageMemory);
+        image,
+        memory);
 
+    // the depth pass of a cascade renders into its layer only
     VkImageViewCreateInfo viewInfo {};
     viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    viewInfo.image = m_depthImage;
+    viewInfo.image = image;
     viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
     viewInfo.format = depthFormat;
     viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
     viewInfo.subresourceRange.baseMipLevel = 0;
     viewInfo.subresourceRange.levelCount = 1;
-    viewInfo.subresourceRange.baseArrayLayer = 0;
     viewInfo.subresourceRange.layerCount = 1;
 
-    if (vkCreateImageView(rd->device, &viewInfo, nullptr, &m_depthImageView) != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create texture image view\n");
-        exit(1);
-    }
-}
+    for (u32 i = 0; i < MAX_SHADOW_CASCADES; i++) {
+        viewInfo.subresourceRange.baseArrayLayer = i;
 
-void Vulkan_ShadowTechnique::CreateFramebuffers(Vulkan_RenderDevice *rd, u32 imageCount) {
-    for (size_t i = 0; i < imageCount; i++) {
-        VkFramebufferCreateInfo framebufferInfo = {};
-        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        framebufferInfo.renderPass = m_renderPass;
-        framebufferInfo.attachmentCount = 1;
-        framebufferInfo.pAttachments = &m_depthImageView;
-        framebufferInfo.width = m_width;
-        framebufferInfo.height = m_height;
-        framebufferInfo.layers = 1;
-
-        if (vkCreateFramebuffer(
-                rd->device,
-                &framebufferInfo,
-                nullptr,
-                &m_framebuffers[i]) != VK_SUCCESS) {
-            fprintf(stderr, "Failed to create shadow map\n");
+        if (vkCreateImageView(rd->device, &viewInfo, nullptr, &layerViews[i]) != VK_SUCCESS) {
+            fprintf(stderr, "Failed to create texture image view\n");
             exit(1);
         }
     }
 }
 
-void Vulkan_ShadowTechnique::Create(Vulkan_RenderDevice *rd, Vulkan_Swapchain *swapchain) {
-
-    u32 imageCount = static_cast<u32>(swapchain->images.size());
-
-    CreateShadowMap(rd, imageCount);
+void Vulkan_ShadowTechnique::CreateShadowMap(Vulkan_RenderDevice *rd) {
+    CreateDepthLayers(rd, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, m_depthImage, m_depthImageMemory, m_layerViews);
 
-    VkSamplerCreateInfo sampler {};
-    sampler.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO; 
-    sampler.magFilter = VK_FILTER_LINEAR;
-    sampler.minFilter = VK_FILTER_LINEAR;
-    sampler.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-    sampler.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-    sampler.addressModeV = sampler.addressModeU;
-    sampler.addressModeW = sampler.addressModeU;
-    sampler.mipLodBias = 0.0f;
-    sampler.maxAnisotropy = 1.0f;
-    sampler.minLod = 0.0f;
-    sampler.maxLod = 1.0f;
-    sampler.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+    VkImageViewCreateInfo viewInfo {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = m_depthImage;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    viewInfo.format = FindDepthFormat(rd->physicalDevice);
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = MAX_SHADOW_CASCADES;
 
-    if (vkCreateSampler(rd->device, &sampler, nullptr, &m_depthSampler) != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create sampler for shadow pass\n");
+    if (vkCreateImageView(rd->device, &viewInfo, nullptr, &m_depthImageView) != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create texture image view\n");
         exit(1);
     }
+}
+
+void Vulkan_ShadowTechnique::CreateStaticCache(Vulkan_RenderDevice *rd) {
+    CreateDepthLayers(rd, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, m_cacheImage, m_cacheImageMemory, m_cacheLayerViews);
+}
 
+// only the format matters to the pipelines, the render graph makes the passes it begins
+static VkRenderPass CreateDepthPass(Vulkan_RenderDevice *rd, VkFormat format) {
     VkAttachmentDescription attachment {};
-    attachment.format = FindDepthFormat(rd->physicalDevice);
+    attachment.format = format;
     attachment.samples = VK_SAMPLE_COUNT_1_BIT;
     attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
     attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
     VkAttachmentReference depthAttachmentRef {};
     depthAttachmentRef.attachment = 0;
@@ -181,48 +170,63 @@ void Vulkan_ShadowTechnique::Create(Vulkan_RenderDevice *rd, Vulkan_Swapchain *s
     subpass.colorAttachmentCount = 0;
     subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
-    std::array<VkSubpassDependency, 2> dependencies;
-
-    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependencies[0].dstSubpass = 0;
-    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-    dependencies[0].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-    dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
-    dependencies[1].srcSubpass = 0;
-    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-    dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
-    dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-    dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-    dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
     VkRenderPassCreateInfo renderPassInfo = {};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
     renderPassInfo.attachmentCount = 1;
     renderPassInfo.pAttachments = &attachment;
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = static_cast<u32>(dependencies.size());
-    renderPassInfo.pDependencies = dependencies.data();
 
-    if (vkCreateRenderPass(rd->device, &renderPassInfo, nullptr, &m_renderPass) != VK_SUCCESS) {
+    VkRenderPass renderPass;
+    if (vkCreateRenderPass(rd->device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
         fprintf(stderr, "Failed to create shadow render pass\n");
         exit(1);
     }
-    
-    CreateFramebuffers(rd, imageCount);
-    SetupUniforms(rd, imageCount);
+
+    return renderPass;
+}
+
+void Vulkan_ShadowTechnique::Create(Vulkan_RenderDevice *rd, Vulkan_Swapchain *swapchain, Vulkan_PipelineBatch &pipelines) {
+    CreateShadowMap(rd);
+
+    VkSamplerCreateInfo sampler {};
+    sampler.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO; 
+    sampler.magFilter = VK_FILTER_LINEAR;
+    sampler.minFilter = VK_FILTER_LINEAR;
+    sampler.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    sampler.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler.addressModeV = sampler.addressModeU;
+    sampler.addressModeW = sampler.addressModeU;
+    sampler.mipLodBias = 0.0f;
+    sampler.maxAnisotropy = 1.0f;
+    sampler.minLod = 0.0f;
+    sampler.maxLod = 1.0f;
+    sampler.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+
+    if (vkCreateSampler(rd->device, &sampler, nullptr, &m_depthSampler) != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create sampler for shadow pass\n");
+        exit(1);
+    }
+
+    m_renderPass = rd->dynamicRendering ? VK_NULL_HANDLE : CreateDepthPass(rd, FindDepthFormat(rd->physicalDevice));
+
     SetupDescriptorLayout(rd);
-    CreateShadowDepthPipeline(rd, imageCount);
+    pipelines.Add([this, rd]() { CreateShadowDepthPipeline(rd, m_offscreenPipeline, "shaders/shadow_depth.vert.spv"); });
+    pipelines.Add([this, rd]() { CreateShadowDepthPipeline(rd, m_offscreenIndexedPipeline, "shaders/shadow_depth_indexed.vert.spv"); });
 }
 
-void Vulkan_ShadowTechnique::Destroy(Vulkan_RenderDevice *rd, u32 imageCount) {
+void Vulkan_ShadowTechnique::Destroy(Vulkan_RenderDevice *rd) {
     vkDestroyImageView(rd->device, m_depthImageView, nullptr);
-    for (size_t i = 0; i < imageCount; i++) {
-        vkDestroyFramebuffer(rd->device, m_framebuffers[i], nullptr);
+    for (u32 i = 0; i < MAX_SHADOW_CASCADES; i++) {
+        vkDestroyImageView(rd->device, m_layerViews[i], nullptr);
+    }
+
+    if (m_cacheImage != VK_NULL_HANDLE) {
+        for (u32 i = 0; i < MAX_SHADOW_CASCADES; i++)
+            vkDestroyImageView(rd->device, m_cacheLayerViews[i], nullptr);
+
+        vkDestroyImage(rd->device, m_cacheImage, nullptr);
+        vkFreeMemory(rd->device, m_cacheImageMemory, nullptr);
     }
 
     vkDestroySampler(rd->device, m_depthSampler, nullptr);
@@ -233,48 +237,25 @@ void Vulkan_ShadowTechnique::Destroy(Vulkan_RenderDevice *rd, u32 imageCount) {
 
     vkDestroyDescriptorSetLayout(rd->device, m_dsLayout, nullptr);
     m_offscreenPipeline.Destroy(rd->device);
+    m_offscreenIndexedPipeline.Destroy(rd->device);
 }
 
-void Vulkan_ShadowTechnique::SetupUniforms(Vulkan_RenderDevice *rd, u32 imageCount) {
-    for (u32 i = 0; i < imageCount; i++) {
-        CreateBuffer(rd, sizeof(GPU_ShadowDepth),
-                     VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                     m_uniformsDepth[i], m_uniformsMemoryDepth[i]);
-    }
-}
+const ShadowCascades &Vulkan_ShadowTechnique::Update(GPU_SceneData &sceneData) {
+    // a directional light pointing from lightPos at the origin
+    ComputeShadowCascades(sceneData, -sceneData.lightPos, m_settings, static_cast<u32>(m_width), m_cascades);
+    WriteShadowCascades(m_cascades, sceneData);
 
+    return m_cascades;
+}
 
-void Vulkan_ShadowTechnique::Update(Vulkan_RenderDevice *rd, int currentImage, const glm::vec3 &lightPos) {
-    f32 nearPlane = 1.0f;
-    f32 farPlane = 7.5f;
-    glm::mat4 lightProj = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, nearPlane, farPlane);
-    glm::mat4 lightView = glm::lookAt(lightPos, glm::vec3(0.0f), glm::vec3(0.0, 1.0, 0.0));
-    m_lightSpaceMatrix = lightProj * lightView;
-
+u32 Vulkan_ShadowTechnique::PushCascade(Vulkan_FrameRing &ring, u32 cascade) const {
     GPU_ShadowDepth shadowDepth {};
-    shadowDepth.m_depthMVP = m_lightSpaceMatrix;
+    shadowDepth.m_depthMVP = ShadowDepthMatrix(m_cascades, cascade);
 
-    UploadBufferData(rd, m_uniformsMemoryDepth[currentImage], 0, &shadowDepth, sizeof(GPU_ShadowDepth));
+    return ring.Push(&shadowDepth, sizeof(GPU_ShadowDepth));
 }
 
-void Vulkan_ShadowTechnique::BeginPass(VkCommandBuffer cmdbuf, VkExtent2D extent, int currentImage) {
-
-    std::array<VkClearValue, 2> clearValues {};
-    clearValues[0].depthStencil = {1.0f, 0};
-    // first pass: render the scene from light's POV
-    
-    VkRenderPassBeginInfo passInfo {};
-    passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    passInfo.renderPass = m_renderPass;
-    passInfo.framebuffer = m_framebuffers[currentImage];
-    passInfo.renderArea.offset = {0, 0};
-    passInfo.renderArea.extent = extent;
-    passInfo.clearValueCount = static_cast<u32>(clearValues.size());
-    passInfo.pClearValues = clearValues.data();
-
-    vkCmdBeginRenderPass(cmdbuf, &passInfo, VK_SUBPASS_CONTENTS_INLINE);
-
+VkViewport Vulkan_ShadowTechnique::GetViewport() const {
     VkViewport viewport {};
     viewport.x = 0.0f;
     viewport.y = 0.0f;
@@ -282,14 +263,41 @@ void Vulkan_ShadowTechnique::BeginPass(VkCommandBuffer cmdbuf, VkExtent2D extent
     viewport.height = static_cast<f32>(m_height);
     viewport.minDepth = 0.0f;
     viewport.maxDepth = 1.0f;
-    VkRect2D scissor {{0, 0}, extent};
 
-    vkCmdSetViewport(cmdbuf, 0, 1, &viewport);
-    vkCmdSetScissor(cmdbuf, 0, 1, &scissor);
+    return viewport;
 }
 
-void Vulkan_ShadowTechnique::EndPass(VkCommandBuffer cmdbuf) {
-    vkCmdEndRenderPass(cmdbuf);
+VkExtent2D Vulkan_ShadowTechnique::GetExtent() const {
+    return {static_cast<u32>(m_width), static_cast<u32>(m_height)};
+}
+
+bool Vulkan_ShadowTechnique::IsCacheValid(u32 cascade, u32 staticVersion) const {
+    const CachedCascade &cached = m_cached[cascade];
+
+    // the matrix changes with the light, the settings and whenever the cascade follows the camera by a texel,
+    // it is rebuilt from the snapped box alone and compares exactly otherwise
+    return cached.valid && cached.staticVersion == staticVersion && cached.viewProj == m_cascades.viewProj[cascade];
+}
+
+void Vulkan_ShadowTechnique::MarkCached(u32 cascade, u32 staticVersion) {
+    m_cached[cascade] = {.viewProj = m_cascades.viewProj[cascade], .staticVersion = staticVersion, .valid = true};
+}
+
+void Vulkan_ShadowTechnique::EnsureStaticCache(Vulkan_RenderDevice *rd) {
+    if (m_cacheImage == VK_NULL_HANDLE)
+        CreateStaticCache(rd);
+}
+
+void Vulkan_ShadowTechnique::CopyStaticCache(VkCommandBuffer cmdbuf, u32 cascade) {
+    VkImageCopy region {};
+    region.srcSubresource = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, cascade, 1};
+    region.dstSubresource = region.srcSubresource;
+    region.extent = {static_cast<u32>(m_width), static_cast<u32>(m_height), 1};
+
+    vkCmdCopyImage(cmdbuf,
+                   m_cacheImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   m_depthImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   1, &region);
 }
 
 }
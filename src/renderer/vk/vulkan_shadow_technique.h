@@ -1,11 +1,13 @@
 #pragma once
 
 #include "vulkan_pipeline.h"
+#include "renderer/shadow_cascades.h"
 
 namespace xjar {
 
 struct Vulkan_RenderDevice;
 struct Vulkan_Swapchain;
+struct Vulkan_FrameRing;
 
 struct GPU_ShadowDepth {
     alignas(16) glm::mat4 m_depthMVP;
@@ -16,33 +18,53 @@ struct Vulkan_ShadowTechnique {
 	int                             m_width;
     int                             m_height;
     b32                             m_quadDebug;
-	VkRenderPass	                m_renderPass;
-    VkFramebuffer	                m_framebuffer;
-    VkImage                         m_depthImage;
-    VkImageView                     m_depthImageView;
+	VkRenderPass	                m_renderPass; // the pipelines are made with it, the render graph begins the passes. Null with dynamic rendering
+    VkImage                         m_depthImage;     // a layer per cascade
+    VkImageView                     m_depthImageView; // all layers, sampled by the lit pass
+    VkImageView                     m_layerViews[MAX_SHADOW_CASCADES];
     VkDeviceMemory                  m_depthImageMemory;
+    // the static casters of each cascade, created on first use
+    VkImage                         m_cacheImage = VK_NULL_HANDLE;
+    VkDeviceMemory                  m_cacheImageMemory;
+    VkImageView                     m_cacheLayerViews[MAX_SHADOW_CASCADES];
     VkSampler                       m_depthSampler;
     VkDescriptorPool                m_dsPool;
     VkDescriptorSetLayout           m_dsLayout;
     Vulkan_Pipeline                 m_offscreenPipeline;
+    Vulkan_Pipeline                 m_offscreenIndexedPipeline;
 
-    std::vector<VkFramebuffer>      m_framebuffers;
-    std::vector<VkBuffer>           m_uniformsDepth;
-    std::vector<VkDeviceMemory>     m_uniformsMemoryDepth;
+    ShadowSettings                  m_settings;
+    ShadowCascades                  m_cascades;
 
-    glm::mat4                       m_lightSpaceMatrix;
+    // what the cache layer of a cascade was rendered with
+    struct CachedCascade {
+        glm::mat4 viewProj;
+        u32       staticVersion;
+        b32       valid;
+    };
 
+    CachedCascade                   m_cached[MAX_SHADOW_CASCADES] = {};
 
-    void Destroy(Vulkan_RenderDevice *rd, u32 imageCount);
-    void Update(Vulkan_RenderDevice *rd, int currentImage, const glm::vec3 &lightPos);
-	void Create(Vulkan_RenderDevice *rd, Vulkan_Swapchain *swapchain);
-    void BeginPass(VkCommandBuffer cmdbuf, VkExtent2D extent, int currentImage);
-    void EndPass(VkCommandBuffer cmdbuf);
-    void SetupUniforms(Vulkan_RenderDevice *rd, u32 imageCount);
+
+    void Destroy(Vulkan_RenderDevice *rd);
+    // fits the cascades to the camera of sceneData and writes what the lit pass samples into it
+    const ShadowCascades &Update(GPU_SceneData &sceneData);
+    // pushes the matrix of a cascade into the frame ring, returns the dynamic offset of binding 0
+    u32  PushCascade(Vulkan_FrameRing &ring, u32 cascade) const;
+	void Create(Vulkan_RenderDevice *rd, Vulkan_Swapchain *swapchain, Vulkan_PipelineBatch &pipelines);
+    // whether the cache layer still holds the static casters of the cascade as of Update
+    bool IsCacheValid(u32 cascade, u32 staticVersion) const;
+    void MarkCached(u32 cascade, u32 staticVersion);
+    void EnsureStaticCache(Vulkan_RenderDevice *rd);
+    // outside of a render pass, with the cache layer in TRANSFER_SRC and the shadow map layer in TRANSFER_DST
+    void CopyStaticCache(VkCommandBuffer cmdbuf, u32 cascade);
+    VkViewport GetViewport() const;
+    VkExtent2D GetExtent() const;
     void SetupDescriptorLayout(Vulkan_RenderDevice *rd);
-    void CreateShadowDepthPipeline(Vulkan_RenderDevice *rd, u32 imageCount);
-    void CreateFramebuffers(Vulkan_RenderDevice *rd, u32 imageCount);
-    void CreateShadowMap(Vulkan_RenderDevice *rd, u32 imageCount);
+    void CreateShadowDepthPipeline(Vulkan_RenderDevice *rd, Vulkan_Pipeline &pipeline, const char *vertShader);
+    void CreateDepthLayers(Vulkan_RenderDevice *rd, VkImageUsageFlags usage, VkImage &image, VkDeviceMemory &memory, VkImageView *layerViews);
+    void CreateShadowMap(Vulkan_RenderDevice *rd);
+    void CreateStaticCache(Vulkan_RenderDevice *rd);
 };
 
 
@@ -9,6 +9,7 @@
 
 #include "window.h"
 #include "vulkan_render_device.h"
+#include "vulkan_frame.h"
 
 namespace xjar {
 
@@ -136,112 +137,6 @@ void CreateRenderPass(Vulkan_Swapchain *swapchain, Vulkan_RenderDevice *rd) {
     }
 }
 
-void CreateDepthResources(Vulkan_Swapchain *swapchain, Vulkan_RenderDevice *rd) {
-    VkFormat depthFormat = FindDepthFormat(rd->physicalDevice);
-    swapchain->depthFormat = depthFormat;
-
-    size_t imageCount = swapchain->images.size();
-
-    swapchain->depthImages.resize(imageCount);
-    swapchain->depthImageMemories.resize(imageCount);
-    swapchain->depthImageViews.resize(imageCount);
-
-    for (int i = 0; i < swapchain->depthImages.size(); i++) {
-        VkImageCreateInfo imageInfo {};
-        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-        imageInfo.imageType = VK_IMAGE_TYPE_2D;
-        imageInfo.extent.width = swapchain->swapchainExtent.width;
-        imageInfo.extent.height = swapchain->swapchainExtent.height;
-        imageInfo.extent.depth = 1;
-        imageInfo.mipLevels = 1;
-        imageInfo.arrayLayers = 1;
-        imageInfo.format = swapchain->depthFormat;
-        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL; // let the gpu to shuffle the data however it sees fit
-        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        imageInfo.flags = 0;
-
-        CreateImage(
-            rd,
-            imageInfo,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-            swapchain->depthImages[i],
-            swapchain->depthImageMemories[i]);
-
-        VkImageViewCreateInfo viewInfo {};
-        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-        viewInfo.image = swapchain->depthImages[i];
-        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-        viewInfo.format = swapchain->depthFormat;
-        viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-        viewInfo.subresourceRange.baseMipLevel = 0;
-        viewInfo.subresourceRange.levelCount = 1;
-        viewInfo.subresourceRange.baseArrayLayer = 0;
-        viewInfo.subresourceRange.layerCount = 1;
-
-        if (vkCreateImageView(rd->device, &viewInfo, nullptr, &swapchain->depthImageViews[i]) != VK_SUCCESS) {
-            fprintf(stderr, "Failed to create texture image view\n");
-            exit(1);
-        }
-    }
-}
-
-void CreateFramebuffers(Vulkan_Swapchain *swapchain, Vulkan_RenderDevice *rd) {
-    size_t imageCount = swapchain->images.size();
-    swapchain->framebuffers.resize(imageCount);
-    for (size_t i = 0; i < imageCount; i++) {
-        std::array<VkImageView, 2> attachments = {swapchain->imageViews[i], swapchain->depthImageViews[i]};
-
-        VkExtent2D              swapChainExtent = swapchain->swapchainExtent;
-        VkFramebufferCreateInfo framebufferInfo = {};
-        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        framebufferInfo.renderPass = swapchain->renderPass;
-        framebufferInfo.attachmentCount = static_cast<u32>(attachments.size());
-        framebufferInfo.pAttachments = attachments.data();
-        framebufferInfo.width = swapChainExtent.width;
-        framebufferInfo.height = swapChainExtent.height;
-        framebufferInfo.layers = 1;
-
-        if (vkCreateFramebuffer(
-                rd->device,
-                &framebufferInfo,
-                nullptr,
-                &swapchain->framebuffers[i]) != VK_SUCCESS) {
-            fprintf(stderr, "Failed to create framebuffer\n");
-            exit(1);
-        }
-    }
-}
-
-void CreateSync(Vulkan_Swapchain *swapchain, Vulkan_RenderDevice *rd) {
-    size_t imageCount = swapchain->images.size();
-
-    swapchain->imageAvailableSems.resize(MAX_FRAMES_IN_FLIGHT);
-    swapchain->renderFinishedSems.resize(MAX_FRAMES_IN_FLIGHT);
-    swapchain->inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-    swapchain->imagesInFlight.resize(imageCount, VK_NULL_HANDLE);
-
-    VkSemaphoreCreateInfo semaphoreInfo = {};
-    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-
-    VkFenceCreateInfo fenceInfo = {};
-    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        if (vkCreateSemaphore(rd->device, &semaphoreInfo, nullptr, &swapchain->imageAvailableSems[i]) !=
-                VK_SUCCESS ||
-            vkCreateSemaphore(rd->device, &semaphoreInfo, nullptr, &swapchain->renderFinishedSems[i]) !=
-                VK_SUCCESS ||
-            vkCreateFence(rd->device, &fenceInfo, nullptr, &swapchain->inFlightFences[i]) != VK_SUCCESS) {
-            fprintf(stderr, "Failed to create sync object\n");
-            exit(1);
-        }
-    }
-}
-
 std::unique_ptr<Vulkan_Swapchain> CreateSwapchain(Vulkan_RenderDevice *rd, VkExtent2D windowExtent, std::shared_ptr<Vulkan_Swapchain> prev) {
     SwapChainSupportDetails swapChainSupport = QuerySwapChainSupport(rd->physicalDevice, rd->surface);
 
@@ -306,9 +201,50 @@ std::unique_ptr<Vulkan_Swapchain> CreateSwapchain(Vulkan_RenderDevice *rd, VkExt
 
     CreateImageViews(swapchain.get(), rd);
     CreateRenderPass(swapchain.get(), rd);
-    CreateDepthResources(swapchain.get(), rd);
-    CreateFramebuffers(swapchain.get(), rd);
-    CreateSync(swapchain.get(), rd);
+
+    // the semaphores and fences belong to the frame contexts, they survive a recreation
+    swapchain->imagesInFlight.resize(swapchain->images.size(), VK_NULL_HANDLE);
+
+    return swapchain;
+}
+
+std::unique_ptr<Vulkan_Swapchain> CreateOffscreenSwapchain(Vulkan_RenderDevice *rd, VkExtent2D extent) {
+    auto swapchain = std::make_unique<Vulkan_Swapchain>();
+
+    swapchain->imageFormat = VK_FORMAT_B8G8R8A8_SRGB;
+    swapchain->swapchainExtent = extent;
+    swapchain->windowExtent = extent;
+    swapchain->swapchain = VK_NULL_HANDLE;
+
+    rd->swapchainImageFormat = swapchain->imageFormat;
+
+    // the frame index picks the image, so a frame never waits on another frame's image
+    swapchain->images.resize(MAX_FRAMES_IN_FLIGHT);
+    swapchain->imageMemories.resize(MAX_FRAMES_IN_FLIGHT);
+
+    for (u32 i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        VkImageCreateInfo imageInfo {};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.extent.width = extent.width;
+        imageInfo.extent.height = extent.height;
+        imageInfo.extent.depth = 1;
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.format = swapchain->imageFormat;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT; // transfer src to read frames back
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        CreateImage(rd, imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, swapchain->images[i], swapchain->imageMemories[i]);
+    }
+
+    CreateImageViews(swapchain.get(), rd);
+    CreateRenderPass(swapchain.get(), rd);
+
+    swapchain->imagesInFlight.resize(swapchain->images.size(), VK_NULL_HANDLE);
 
     return swapchain;
 }
@@ -319,53 +255,58 @@ void DestroySwapchain(Vulkan_Swapchain *swapchain, Vulkan_RenderDevice *rd) {
     }
     swapchain->imageViews.clear();
 
-    vkDestroySwapchainKHR(rd->device, swapchain->swapchain, nullptr);
-
-    for (int i = 0; i < swapchain->depthImages.size(); i++) {
-        vkDestroyImageView(rd->device, swapchain->depthImageViews[i], nullptr);
-        vkDestroyImage(rd->device, swapchain->depthImages[i], nullptr);
-        vkFreeMemory(rd->device, swapchain->depthImageMemories[i], nullptr);
+    if (swapchain->swapchain != VK_NULL_HANDLE) {
+        vkDestroySwapchainKHR(rd->device, swapchain->swapchain, nullptr);
     }
 
-    for (auto framebuffer : swapchain->framebuffers) {
-        vkDestroyFramebuffer(rd->device, framebuffer, nullptr);
+    for (size_t i = 0; i < swapchain->imageMemories.size(); i++) {
+        vkDestroyImage(rd->device, swapchain->images[i], nullptr);
+        vkFreeMemory(rd->device, swapchain->imageMemories[i], nullptr);
     }
 
     vkDestroyRenderPass(rd->device, swapchain->renderPass, nullptr);
-
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        vkDestroySemaphore(rd->device, swapchain->renderFinishedSems[i], nullptr);
-        vkDestroySemaphore(rd->device, swapchain->imageAvailableSems[i], nullptr);
-        vkDestroyFence(rd->device, swapchain->inFlightFences[i], nullptr);
-    }
 }
 
 
-VkResult SubmitCommandBuffers(Vulkan_Swapchain *swapchain, Vulkan_RenderDevice *rd, const VkCommandBuffer *buffers, u32 *imageIndex) {
+VkResult SubmitCommandBuffers(Vulkan_Swapchain *swapchain, Vulkan_RenderDevice *rd, Vulkan_FrameContext &frame, u32 *imageIndex) {
     if (swapchain->imagesInFlight[*imageIndex] != VK_NULL_HANDLE) {
         vkWaitForFences(rd->device, 1, &swapchain->imagesInFlight[*imageIndex], VK_TRUE, UINT64_MAX);
     }
 
-    swapchain->imagesInFlight[*imageIndex] = swapchain->inFlightFences[swapchain->currentFrame];
+    swapchain->imagesInFlight[*imageIndex] = frame.inFlightFence;
 
     VkSubmitInfo submitInfo = {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-    VkSemaphore          waitSemaphores[] = {swapchain->imageAvailableSems[swapchain->currentFrame]};
+    // offscreen images were not acquired and are not presented, the frame fence is the only sync
+    if (swapchain->swapchain == VK_NULL_HANDLE) {
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &frame.commandBuffer;
+
+        vkResetFences(rd->device, 1, &frame.inFlightFence);
+        if (vkQueueSubmit(rd->graphicsQueue, 1, &submitInfo, frame.inFlightFence) != VK_SUCCESS) {
+            fprintf(stderr, "Failed to submit to graphics queue\n");
+            exit(1);
+        }
+
+        return VK_SUCCESS;
+    }
+
+    VkSemaphore          waitSemaphores[] = {frame.imageAvailableSem};
     VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
     submitInfo.waitSemaphoreCount = 1;
     submitInfo.pWaitSemaphores = waitSemaphores;
     submitInfo.pWaitDstStageMask = waitStages;
 
     submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = buffers;
+    submitInfo.pCommandBuffers = &frame.commandBuffer;
 
-    VkSemaphore signalSemaphores[] = {swapchain->renderFinishedSems[swapchain->currentFrame]};
+    VkSemaphore signalSemaphores[] = {frame.renderFinishedSem};
     submitInfo.signalSemaphoreCount = 1;
     submitInfo.pSignalSemaphores = signalSemaphores;
 
-    vkResetFences(rd->device, 1, &swapchain->inFlightFences[swapchain->currentFrame]);
-    if (vkQueueSubmit(rd->graphicsQueue, 1, &submitInfo, swapchain->inFlightFences[swapchain->currentFrame]) !=
+    vkResetFences(rd->device, 1, &frame.inFlightFence);
+    if (vkQueueSubmit(rd->graphicsQueue, 1, &submitInfo, frame.inFlightFence) !=
         VK_SUCCESS) {
         fprintf(stderr, "Failed to submit to graphics queue\n");
         exit(1);
@@ -382,10 +323,7 @@ VkResult SubmitCommandBuffers(Vulkan_Swapchain *swapchain, Vulkan_RenderDevice *
     presentInfo.pSwapchains = swapChains;
     presentInfo.pImageIndices = imageIndex;
 
-    VkResult result = vkQueuePresentKHR(rd->presentQueue, &presentInfo);
-    swapchain->currentFrame = (swapchain->currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
-
-    return result;
+    return vkQueuePresentKHR(rd->presentQueue, &presentInfo);
 }
 
 }
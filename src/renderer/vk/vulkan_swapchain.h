@@ -9,31 +9,26 @@
 namespace xjar {
 
 struct Vulkan_RenderDevice;
+struct Vulkan_FrameContext;
 
 struct Vulkan_Swapchain {
     VkFormat                          imageFormat;
-    VkFormat                          depthFormat;
     VkExtent2D                        swapchainExtent;
     VkExtent2D                        windowExtent;
-    std::vector<VkFramebuffer>        framebuffers;
-    VkRenderPass                      renderPass;
-    std::vector<VkImage>              depthImages;
-    std::vector<VkDeviceMemory>       depthImageMemories;
-    std::vector<VkImageView>          depthImageViews;
+    VkRenderPass                      renderPass;    // only describes the attachments, the render graph owns the depth and the framebuffers
     std::vector<VkImage>              images;
+    std::vector<VkDeviceMemory>       imageMemories; // only set for offscreen images, swapchain images are owned by the swapchain
     std::vector<VkImageView>          imageViews;
-    VkSwapchainKHR                    swapchain;
+    VkSwapchainKHR                    swapchain;     // VK_NULL_HANDLE when rendering offscreen
     std::shared_ptr<Vulkan_Swapchain> oldSwapchain;
-    std::vector<VkSemaphore>          imageAvailableSems;
-    std::vector<VkSemaphore>          renderFinishedSems;
-    std::vector<VkFence>              inFlightFences;
-    std::vector<VkFence>              imagesInFlight;
-    size_t                            currentFrame = 0;
+    std::vector<VkFence>              imagesInFlight; // fence of the frame that last rendered to the image
 };
 
 std::unique_ptr<Vulkan_Swapchain> CreateSwapchain(Vulkan_RenderDevice *rd, VkExtent2D windowExtent, std::shared_ptr<Vulkan_Swapchain> prev);
+// same images and render pass as a swapchain, but with one image per frame in flight and nothing to present
+std::unique_ptr<Vulkan_Swapchain> CreateOffscreenSwapchain(Vulkan_RenderDevice *rd, VkExtent2D extent);
 void                              DestroySwapchain(Vulkan_Swapchain *swapchain, Vulkan_RenderDevice *rd);
 
-VkResult SubmitCommandBuffers(Vulkan_Swapchain *swapchain, Vulkan_RenderDevice *rd, const VkCommandBuffer *buffers, u32 *imageIndex);
+VkResult SubmitCommandBuffers(Vulkan_Swapchain *swapchain, Vulkan_RenderDevice *rd, Vulkan_FrameContext &frame, u32 *imageIndex);
 
 }
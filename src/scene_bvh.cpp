@@ -0,0 +1,588 @@
+#include "pch.h"
+#include "scene_bvh.h"
+#include "profiler.h"
+
+namespace xjar {
+
+static constexpr u32 LOCATION_NONE = 0xffffffff;
+static constexpr u32 LOCATION_UNINDEXED = 0x80000000; // the rest is an index into m_unindexed
+static constexpr u32 INVALID_NODE = 0xffffffff;
+
+static constexpr u32 BIN_COUNT = 16;
+static constexpr u32 MIN_LEAF_SPLIT = 4;  // leaves at or below this size are never split
+static constexpr u32 MAX_LEAF_SIZE = 16;  // above it a split is forced even if the SAH prefers a leaf
+static constexpr f32 TRAVERSAL_COST = 1.0f;
+static constexpr f32 INTERSECTION_COST = 1.0f;
+
+// rebuild once the tree is this much worse than when it was built
+static constexpr f32 REBUILD_DEGRADATION = 1.5f;
+static constexpr u32 MIN_UNINDEXED_FOR_REBUILD = 64;
+
+// deeper nodes become leaves, which bounds the traversal stacks
+static constexpr u32 MAX_TREE_DEPTH = 48;
+static constexpr u32 QUERY_STACK_SIZE = MAX_TREE_DEPTH + 2;
+static constexpr u32 QUERY_INSIDE = 0x80000000; // the node is known to be fully inside
+
+static glm::vec3 Centroid(const AABB &box) {
+    return 0.5f * (box.min + box.max);
+}
+
+static bool Equal(const AABB &a, const AABB &b) {
+    return a.min == b.min && a.max == b.max;
+}
+
+static f64 NodeCost(const BVHNode &node) {
+    const f64 area = SurfaceArea(node.bounds);
+
+    return node.count > 0 ? area * node.count * INTERSECTION_COST : area * TRAVERSAL_COST;
+}
+
+// cost relative to the root area, so trees over differently sized scenes compare
+static f64 NormalizedCost(const BVHTree &tree) {
+    if (tree.nodes.empty())
+        return 0.0;
+
+    const f64 rootArea = SurfaceArea(tree.nodes[0].bounds);
+
+    return rootArea > 0.0 ? tree.cost / rootArea : 0.0;
+}
+
+static u32 BinIndex(f32 centroid, f32 min, f32 scale) {
+    return std::min(BIN_COUNT - 1, static_cast<u32>((centroid - min) * scale));
+}
+
+// binned SAH top down build, the two children of a node are allocated next to each other
+static void BuildTree(std::vector<BVHPrimitive> primitives, BVHTree &tree) {
+    XJAR_ZONE("SceneBVH::BuildTree");
+
+    tree = BVHTree {};
+    tree.primitives = std::move(primitives);
+
+    const u32 primitiveCount = static_cast<u32>(tree.primitives.size());
+    tree.primitiveLeaves.resize(primitiveCount);
+    if (primitiveCount == 0)
+        return;
+
+    auto rangeBounds = [&](u32 first, u32 count) {
+        AABB bounds = EmptyAABB();
+        for (u32 i = first; i < first + count; i++)
+            bounds = Union(bounds, tree.primitives[i].bounds);
+        return bounds;
+    };
+
+    tree.nodes.reserve(2 * primitiveCount);
+    tree.parents.reserve(2 * primitiveCount);
+    tree.nodes.push_back(BVHNode {.bounds = rangeBounds(0, primitiveCount), .first = 0, .count = primitiveCount});
+    tree.parents.push_back(INVALID_NODE);
+
+    struct Bin {
+        AABB bounds;
+        u32  count;
+    };
+
+    struct Task {
+        u32 node;
+        u32 depth;
+    };
+
+    std::vector<Task> stack {Task {.node = 0, .depth = 0}};
+    while (!stack.empty()) {
+        const Task    task = stack.back();
+        const u32     nodeIndex = task.node;
+        const BVHNode node = tree.nodes[nodeIndex];
+        stack.pop_back();
+
+        if (node.count <= MIN_LEAF_SPLIT || task.depth >= MAX_TREE_DEPTH)
+            continue;
+
+        BVHPrimitive *begin = tree.primitives.data() + node.first;
+        BVHPrimitive *end = begin + node.count;
+
+        AABB centroidBounds = EmptyAABB();
+        for (const BVHPrimitive *p = begin; p != end; p++) {
+            const glm::vec3 c = Centroid(p->bounds);
+            centroidBounds = Union(centroidBounds, AABB {.min = c, .max = c});
+        }
+
+        f32 bestCost = std::numeric_limits<f32>::max();
+        u32 bestAxis = 3;
+        u32 bestSplit = 0; // bins up to and including it go left
+
+        for (u32 axis = 0; axis < 3; axis++) {
+            const f32 extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+            if (extent <= 0.0f)
+                continue;
+
+            Bin bins[BIN_COUNT];
+            for (Bin &bin : bins)
+                bin = Bin {.bounds = EmptyAABB(), .count = 0};
+
+            const f32 scale = BIN_COUNT / extent;
+            for (const BVHPrimitive *p = begin; p != end; p++) {
+                Bin &bin = bins[BinIndex(Centroid(p->bounds)[axis], centroidBounds.min[axis], scale)];
+                bin.bounds = Union(bin.bounds, p->bounds);
+                bin.count++;
+            }
+
+            // right to left sweep first, then the left side is accumulated while evaluating the splits
+            f32  rightAreas[BIN_COUNT];
+            u32  rightCounts[BIN_COUNT];
+            AABB right = EmptyAABB();
+            u32  rightCount = 0;
+            for (u32 i = BIN_COUNT - 1; i > 0; i--) {
+                right = Union(right, bins[i].bounds);
+                rightCount += bins[i].count;
+                rightAreas[i - 1] = SurfaceArea(right);
+                rightCounts[i - 1] = rightCount;
+            }
+
+            AABB left = EmptyAABB();
+            u32  leftCount = 0;
+            for (u32 i = 0; i < BIN_COUNT - 1; i++) {
+                left = Union(left, bins[i].bounds);
+                leftCount += bins[i].count;
+                if (leftCount == 0 || rightCounts[i] == 0)
+                    continue;
+
+                const f32 cost = SurfaceArea(left) * leftCount + rightAreas[i] * rightCounts[i];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = i;
+                }
+            }
+        }
+
+        BVHPrimitive *middle = nullptr;
+        if (bestAxis < 3) {
+            const f32 nodeArea = std::max(SurfaceArea(node.bounds), 1e-12f);
+            const f32 splitCost = TRAVERSAL_COST + INTERSECTION_COST * bestCost / nodeArea;
+            const f32 leafCost = INTERSECTION_COST * node.count;
+            if (splitCost >= leafCost && node.count <= MAX_LEAF_SIZE)
+                continue;
+
+            const f32 min = centroidBounds.min[bestAxis];
+            const f32 scale = BIN_COUNT / (centroidBounds.max[bestAxis] - min);
+            middle = std::partition(begin, end, [&](const BVHPrimitive &p) {
+                return BinIndex(Centroid(p.bounds)[bestAxis], min, scale) <= bestSplit;
+            });
+        } else {
+            // every centroid is the same point, only the count can be split
+            if (node.count <= MAX_LEAF_SIZE)
+                continue;
+
+            middle = begin + node.count / 2;
+        }
+
+        const u32 leftCount = static_cast<u32>(middle - begin);
+        const u32 leftIndex = static_cast<u32>(tree.nodes.size());
+
+        tree.nodes.push_back(BVHNode {.bounds = rangeBounds(node.first, leftCount), .first = node.first, .count = leftCount});
+        tree.nodes.push_back(BVHNode {.bounds = rangeBounds(node.first + leftCount, node.count - leftCount),
+                                      .first = node.first + leftCount,
+                                      .count = node.count - leftCount});
+        tree.parents.push_back(nodeIndex);
+        tree.parents.push_back(nodeIndex);
+
+        tree.nodes[nodeIndex].first = leftIndex;
+        tree.nodes[nodeIndex].count = 0;
+
+        stack.push_back(Task {.node = leftIndex + 1, .depth = task.depth + 1});
+        stack.push_back(Task {.node = leftIndex, .depth = task.depth + 1});
+    }
+
+    for (u32 nodeIndex = 0; nodeIndex < tree.nodes.size(); nodeIndex++) {
+        const BVHNode &node = tree.nodes[nodeIndex];
+        for (u32 i = node.first; i < node.first + node.count; i++)
+            tree.primitiveLeaves[i] = nodeIndex;
+
+        tree.cost += NodeCost(node);
+    }
+}
+
+SceneBVH::~SceneBVH() {
+    if (m_rebuilding)
+        JobSystem::Instance().Wait(m_rebuildCounter);
+}
+
+void SceneBVH::Clear() {
+    if (m_rebuilding) {
+        JobSystem::Instance().Wait(m_rebuildCounter);
+        m_pendingTree.reset();
+        m_rebuilding = false;
+    }
+
+    m_tree = BVHTree {};
+    m_unindexed.clear();
+    m_locations.clear();
+    m_refitLeaves.clear();
+    m_refitStamps.clear();
+    m_touchedDuringRebuild.clear();
+    m_removedCount = 0;
+    m_builtCost = 0.0;
+}
+
+void SceneBVH::Build(const World &world) {
+    XJAR_ZONE("SceneBVH::Build");
+
+    Clear();
+
+    const std::span<const EntityHandle> entities = world.GetEntities();
+    const std::span<const Renderable>   renderables = world.GetRenderables();
+    const std::span<const AABB>         bounds = world.GetBounds();
+
+    std::vector<BVHPrimitive> primitives;
+    primitives.reserve(entities.size());
+    for (size_t i = 0; i < entities.size(); i++) {
+        if (renderables[i].model)
+            primitives.push_back(BVHPrimitive {.entity = entities[i], .bounds = bounds[i]});
+    }
+
+    BuildTree(std::move(primitives), m_tree);
+
+    m_unindexed.clear();
+    m_removedCount = 0;
+    m_builtCost = NormalizedCost(m_tree);
+    ResetLocations();
+}
+
+void SceneBVH::ResetLocations() {
+    std::fill(m_locations.begin(), m_locations.end(), LOCATION_NONE);
+
+    auto setLocation = [&](EntityHandle entity, u32 location) {
+        if (entity.index >= m_locations.size())
+            m_locations.resize(entity.index + 1, LOCATION_NONE);
+        m_locations[entity.index] = location;
+    };
+
+    for (u32 i = 0; i < m_tree.primitives.size(); i++)
+        setLocation(m_tree.primitives[i].entity, i);
+    for (u32 i = 0; i < m_unindexed.size(); i++)
+        setLocation(m_unindexed[i].entity, LOCATION_UNINDEXED | i);
+
+    m_refitLeaves.clear();
+    m_refitStamps.assign(m_tree.nodes.size(), 0);
+    m_refitStamp = 1;
+}
+
+void SceneBVH::Update(const World &world) {
+    XJAR_ZONE("SceneBVH::Update");
+
+    JobSystem &jobs = JobSystem::Instance();
+    if (m_rebuilding && jobs.IsDone(m_rebuildCounter))
+        AdoptRebuild(world);
+
+    // destroyed first, a slot reused in the same frame then shows up as a new entity
+    for (EntityHandle entity : world.GetDestroyedEntities()) {
+        RemovePrimitive(entity);
+        if (m_rebuilding)
+            m_touchedDuringRebuild.push_back(entity);
+    }
+
+    for (EntityHandle entity : world.GetChangedEntities()) {
+        ApplyEntity(world, entity);
+        if (m_rebuilding)
+            m_touchedDuringRebuild.push_back(entity);
+    }
+
+    RefitLeaves();
+
+    if (m_rebuilding)
+        return;
+
+    const u32 primitiveCount = static_cast<u32>(m_tree.primitives.size());
+    const u32 indexedCount = primitiveCount - m_removedCount;
+    const u32 unindexedCount = static_cast<u32>(m_unindexed.size());
+
+    if (GetDegradation() > REBUILD_DEGRADATION || unindexedCount > std::max(MIN_UNINDEXED_FOR_REBUILD, indexedCount / 8) ||
+        m_removedCount > primitiveCount / 4)
+        StartRebuild();
+}
+
+f32 SceneBVH::GetDegradation() const {
+    if (m_builtCost <= 0.0)
+        return 1.0f;
+
+    return static_cast<f32>(NormalizedCost(m_tree) / m_builtCost);
+}
+
+void SceneBVH::ApplyEntity(const World &world, EntityHandle entity) {
+    const Renderable *renderable = world.GetRenderable(entity);
+    if (!renderable || !renderable->model) {
+        RemovePrimitive(entity);
+        return;
+    }
+
+    const AABB &bounds = *world.GetWorldBounds(entity);
+
+    if (entity.index >= m_locations.size())
+        m_locations.resize(entity.index + 1, LOCATION_NONE);
+
+    const u32 location = m_locations[entity.index];
+    if (location == LOCATION_NONE) {
+        m_locations[entity.index] = LOCATION_UNINDEXED | static_cast<u32>(m_unindexed.size());
+        m_unindexed.push_back(BVHPrimitive {.entity = entity, .bounds = bounds});
+        return;
+    }
+
+    if (location & LOCATION_UNINDEXED) {
+        m_unindexed[location & ~LOCATION_UNINDEXED] = BVHPrimitive {.entity = entity, .bounds = bounds};
+        return;
+    }
+
+    m_tree.primitives[location] = BVHPrimitive {.entity = entity, .bounds = bounds};
+
+    const u32 leaf = m_tree.primitiveLeaves[location];
+    if (m_refitStamps[leaf] != m_refitStamp) {
+        m_refitStamps[leaf] = m_refitStamp;
+        m_refitLeaves.push_back(leaf);
+    }
+}
+
+void SceneBVH::RemovePrimitive(EntityHandle entity) {
+    if (entity.index >= m_locations.size())
+        return;
+
+    const u32 location = m_locations[entity.index];
+    if (location == LOCATION_NONE)
+        return;
+
+    if (location & LOCATION_UNINDEXED) {
+        const u32 index = location & ~LOCATION_UNINDEXED;
+        if (m_unindexed[index].entity != entity)
+            return;
+
+        const BVHPrimitive last = m_unindexed.back();
+        m_unindexed[index] = last;
+        m_locations[last.entity.index] = LOCATION_UNINDEXED | index;
+        m_unindexed.pop_back();
+        m_locations[entity.index] = LOCATION_NONE;
+        return;
+    }
+
+    BVHPrimitive &primitive = m_tree.primitives[location];
+    if (primitive.entity != entity)
+        return;
+
+    // the hole stays in its leaf until the next rebuild, empty bounds keep it out of the refit
+    primitive = BVHPrimitive {.entity = EntityHandle {}, .bounds = EmptyAABB()};
+    m_locations[entity.index] = LOCATION_NONE;
+    m_removedCount++;
+
+    const u32 leaf = m_tree.primitiveLeaves[location];
+    if (m_refitStamps[leaf] != m_refitStamp) {
+        m_refitStamps[leaf] = m_refitStamp;
+        m_refitLeaves.push_back(leaf);
+    }
+}
+
+// recomputes the marked leaves and walks up until a node's bounds stop changing, the SAH cost is kept up to date
+// on the way
+void SceneBVH::RefitLeaves() {
+    for (u32 leaf : m_refitLeaves) {
+        BVHNode &node = m_tree.nodes[leaf];
+
+        AABB bounds = EmptyAABB();
+        for (u32 i = node.first; i < node.first + node.count; i++)
+            bounds = Union(bounds, m_tree.primitives[i].bounds);
+
+        if (Equal(bounds, node.bounds))
+            continue;
+
+        m_tree.cost -= NodeCost(node);
+        node.bounds = bounds;
+        m_tree.cost += NodeCost(node);
+
+        for (u32 parent = m_tree.parents[leaf]; parent != INVALID_NODE; parent = m_tree.parents[parent]) {
+            BVHNode   &inner = m_tree.nodes[parent];
+            const AABB innerBounds = Union(m_tree.nodes[inner.first].bounds, m_tree.nodes[inner.first + 1].bounds);
+            if (Equal(innerBounds, inner.bounds))
+                break;
+
+            m_tree.cost -= NodeCost(inner);
+            inner.bounds = innerBounds;
+            m_tree.cost += NodeCost(inner);
+        }
+    }
+
+    m_refitLeaves.clear();
+    m_refitStamp++;
+}
+
+void SceneBVH::StartRebuild() {
+    std::vector<BVHPrimitive> primitives;
+    primitives.reserve(m_tree.primitives.size() - m_removedCount + m_unindexed.size());
+
+    for (const BVHPrimitive &primitive : m_tree.primitives) {
+        if (primitive.entity.index != INVALID_ENTITY_INDEX)
+            primitives.push_back(primitive);
+    }
+    primitives.insert(primitives.end(), m_unindexed.begin(), m_unindexed.end());
+
+    m_pendingTree = std::make_unique<BVHTree>();
+    m_touchedDuringRebuild.clear();
+    m_rebuilding = true;
+
+    JobSystem &jobs = JobSystem::Instance();
+    if (jobs.GetWorkerCount() <= 1) {
+        // nobody to hand it to, it is still adopted on the next update like a finished job
+        BuildTree(std::move(primitives), *m_pendingTree);
+        return;
+    }
+
+    BVHTree *tree = m_pendingTree.get();
+    jobs.Run([tree, primitives = std::move(primitives)]() mutable { BuildTree(std::move(primitives), *tree); },
+             &m_rebuildCounter);
+}
+
+// the new tree is a snapshot of when the rebuild started, what changed since then is applied on top of it
+void SceneBVH::AdoptRebuild(const World &world) {
+    XJAR_ZONE("SceneBVH::AdoptRebuild");
+
+    m_tree = std::move(*m_pendingTree);
+    m_pendingTree.reset();
+    m_rebuilding = false;
+
+    m_unindexed.clear();
+    m_removedCount = 0;
+    m_builtCost = NormalizedCost(m_tree);
+    ResetLocations();
+
+    for (EntityHandle entity : m_touchedDuringRebuild) {
+        if (world.IsAlive(entity))
+            ApplyEntity(world, entity);
+        else
+            RemovePrimitive(entity);
+    }
+    m_touchedDuringRebuild.clear();
+}
+
+template <typename Overlap>
+void SceneBVH::Query(Overlap overlap, std::vector<EntityHandle> &result) const {
+    for (const BVHPrimitive &primitive : m_unindexed) {
+        if (overlap(primitive.bounds) != Containment::Outside)
+            result.push_back(primitive.entity);
+    }
+
+    if (m_tree.nodes.empty())
+        return;
+
+    u32 stack[QUERY_STACK_SIZE];
+    u32 stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0) {
+        const u32      entry = stack[--stackSize];
+        const BVHNode &node = m_tree.nodes[entry & ~QUERY_INSIDE];
+
+        b32 inside = (entry & QUERY_INSIDE) != 0;
+        if (!inside) {
+            const Containment containment = overlap(node.bounds);
+            if (containment == Containment::Outside)
+                continue;
+            inside = containment == Containment::Inside;
+        }
+
+        if (node.count > 0) {
+            for (u32 i = node.first; i < node.first + node.count; i++) {
+                const BVHPrimitive &primitive = m_tree.primitives[i];
+                if (primitive.entity.index == INVALID_ENTITY_INDEX)
+                    continue;
+                if (inside || overlap(primitive.bounds) != Containment::Outside)
+                    result.push_back(primitive.entity);
+            }
+            continue;
+        }
+
+        const u32 flag = inside ? QUERY_INSIDE : 0;
+        stack[stackSize++] = (node.first + 1) | flag;
+        stack[stackSize++] = node.first | flag;
+    }
+}
+
+void SceneBVH::QueryFrustum(const Frustum &frustum, std::vector<EntityHandle> &result) const {
+    XJAR_ZONE("SceneBVH::QueryFrustum");
+
+    Query([&](const AABB &box) { return TestFrustumAABB(frustum, box); }, result);
+}
+
+void SceneBVH::QuerySphere(const Sphere &sphere, std::vector<EntityHandle> &result) const {
+    Query([&](const AABB &box) { return Overlaps(sphere, box) ? Containment::Intersects : Containment::Outside; }, result);
+}
+
+void SceneBVH::QueryAABB(const AABB &query, std::vector<EntityHandle> &result) const {
+    Query(
+        [&](const AABB &box) {
+            if (!Overlaps(query, box))
+                return Containment::Outside;
+            return Contains(query, box) ? Containment::Inside : Containment::Intersects;
+        },
+        result);
+}
+
+// nearer child first, whatever starts beyond the closest hit so far is skipped
+bool SceneBVH::Raycast(const Ray &ray, f32 maxDistance, RayHit &hit) const {
+    const glm::vec3 invDirection = 1.0f / ray.direction;
+
+    bool found = false;
+    f32  closest = maxDistance;
+    f32  distance;
+
+    auto test = [&](const BVHPrimitive &primitive) {
+        if (IntersectRayAABB(ray, invDirection, primitive.bounds, closest, distance)) {
+            closest = std::max(distance, 0.0f);
+            hit = RayHit {.entity = primitive.entity, .distance = closest};
+            found = true;
+        }
+    };
+
+    for (const BVHPrimitive &primitive : m_unindexed)
+        test(primitive);
+
+    if (m_tree.nodes.empty() || !IntersectRayAABB(ray, invDirection, m_tree.nodes[0].bounds, closest, distance))
+        return found;
+
+    struct Entry {
+        u32 node;
+        f32 distance;
+    };
+
+    Entry stack[QUERY_STACK_SIZE];
+    u32   stackSize = 0;
+    stack[stackSize++] = Entry {.node = 0, .distance = distance};
+
+    while (stackSize > 0) {
+        const Entry entry = stack[--stackSize];
+        if (entry.distance > closest)
+            continue;
+
+        const BVHNode &node = m_tree.nodes[entry.node];
+        if (node.count > 0) {
+            for (u32 i = node.first; i < node.first + node.count; i++) {
+                if (m_tree.primitives[i].entity.index != INVALID_ENTITY_INDEX)
+                    test(m_tree.primitives[i]);
+            }
+            continue;
+        }
+
+        f32        nearDistance, farDistance;
+        u32        nearNode = node.first;
+        u32        farNode = node.first + 1;
+        const bool nearHit = IntersectRayAABB(ray, invDirection, m_tree.nodes[nearNode].bounds, closest, nearDistance);
+        const bool farHit = IntersectRayAABB(ray, invDirection, m_tree.nodes[farNode].bounds, closest, farDistance);
+
+        if (nearHit && farHit && farDistance < nearDistance) {
+            std::swap(nearNode, farNode);
+            std::swap(nearDistance, farDistance);
+        }
+
+        if (farHit)
+            stack[stackSize++] = Entry {.node = farNode, .distance = farDistance};
+        if (nearHit)
+            stack[stackSize++] = Entry {.node = nearNode, .distance = nearDistance};
+    }
+
+    return found;
+}
+
+}
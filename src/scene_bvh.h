@@ -0,0 +1,102 @@
+#pragma once
+
+#include "types.h"
+#include "geometry.h"
+#include "world.h"
+#include "job_system.h"
+
+#include <memory>
+#include <vector>
+
+namespace xjar {
+
+struct BVHNode {
+    AABB bounds;
+    u32  first; // first primitive of a leaf, left child of an inner node, the right child follows it
+    u32  count; // primitives of a leaf, 0 for an inner node
+};
+
+struct BVHPrimitive {
+    EntityHandle entity; // invalid once removed, the slot stays in its leaf until the next rebuild
+    AABB         bounds;
+};
+
+struct BVHTree {
+    std::vector<BVHNode>      nodes; // children always come after their parent, nodes[0] is the root
+    std::vector<u32>          parents;
+    std::vector<BVHPrimitive> primitives;
+    std::vector<u32>          primitiveLeaves;
+    f64                       cost = 0.0; // SAH cost, not normalized by the root area
+};
+
+struct RayHit {
+    EntityHandle entity;
+    f32          distance;
+};
+
+// Bounding volume hierarchy over the world bounds of the World's renderable entities.
+// It is built with a binned SAH and follows the world incrementally: moved entities refit their leaves
+// and ancestors, new ones go to a small unindexed list, destroyed ones leave a hole in their leaf.
+// When refits have degraded the tree enough, a new one is built on the job system and swapped in.
+class SceneBVH {
+public:
+    SceneBVH() = default;
+    ~SceneBVH();
+
+    SceneBVH(const SceneBVH &) = delete;
+    SceneBVH &operator=(const SceneBVH &) = delete;
+
+    // synchronous full build
+    void Build(const World &world);
+    // applies the changes of the last World::UpdateTransforms
+    void Update(const World &world);
+    // waits for a rebuild in flight and drops the tree, has to happen before the job system shuts down
+    void Clear();
+
+    // entities whose bounds overlap, in no particular order
+    void QueryFrustum(const Frustum &frustum, std::vector<EntityHandle> &result) const;
+    void QuerySphere(const Sphere &sphere, std::vector<EntityHandle> &result) const;
+    void QueryAABB(const AABB &box, std::vector<EntityHandle> &result) const;
+    // closest entity bounds along the ray
+    bool Raycast(const Ray &ray, f32 maxDistance, RayHit &hit) const;
+
+    u32 GetNodeCount() const {
+        return static_cast<u32>(m_tree.nodes.size());
+    }
+
+    // SAH cost relative to the cost right after the build, 1 for a fresh tree
+    f32 GetDegradation() const;
+
+    b32 IsRebuilding() const {
+        return m_rebuilding;
+    }
+
+private:
+    void ApplyEntity(const World &world, EntityHandle entity);
+    void RemovePrimitive(EntityHandle entity);
+    void RefitLeaves();
+    void StartRebuild();
+    void AdoptRebuild(const World &world);
+    void ResetLocations();
+
+    template <typename Overlap>
+    void Query(Overlap overlap, std::vector<EntityHandle> &result) const;
+
+    BVHTree m_tree;
+    f64     m_builtCost = 0.0; // normalized, at the last build
+
+    std::vector<BVHPrimitive> m_unindexed; // added since the last build, tested one by one
+    std::vector<u32>          m_locations; // per entity slot, see LOCATION_*
+    std::vector<u32>          m_refitLeaves;
+    std::vector<u32>          m_refitStamps;
+    u32                       m_refitStamp = 0;
+    u32                       m_removedCount = 0;
+
+    // background rebuild, entities touched while it runs are applied again once it is adopted
+    std::unique_ptr<BVHTree>  m_pendingTree;
+    JobCounter                m_rebuildCounter;
+    b32                       m_rebuilding = false;
+    std::vector<EntityHandle> m_touchedDuringRebuild;
+};
+
+}
@@ -2,6 +2,8 @@
 #include "texture_manager.h"
 #include "renderer/resource_types.h"
 #include "renderer/render_system.h"
+#include "job_system.h"
+#include "profiler.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -47,29 +49,76 @@ static void CreateDefaultTexture() {
     g_defaultTexture.id = INVALID_TEXTURE;
 }
 
-std::optional<Texture> TextureManager::LoadTexture(const std::string &textureName) {
-    int      w, h, nr;
+std::optional<DecodedTexture> TextureManager::DecodeTexture(const std::string &textureName) {
+    XJAR_ZONE("TextureManager::DecodeTexture");
+
+    DecodedTexture decoded;
 
-    stbi_uc *pixels = stbi_load(textureName.c_str(), &w, &h, &nr, STBI_rgb_alpha);
+    decoded.pixels = stbi_load(textureName.c_str(), &decoded.width, &decoded.height, &decoded.nr, STBI_rgb_alpha);
 
-    if (!pixels) {
+    if (!decoded.pixels) {
         fprintf(stderr, "Failed to read file %s\n", textureName.c_str());
         return {};
     }
 
+    return decoded;
+}
+
+void TextureManager::FreeDecodedTexture(DecodedTexture &decoded) {
+    stbi_image_free(decoded.pixels);
+    decoded.pixels = nullptr;
+}
+
+Texture TextureManager::CreateTexture(const std::string &textureName, const DecodedTexture &decoded) {
     Texture texture {};
-    texture.nr = nr;
-    texture.width = static_cast<u32>(w);
-    texture.height = static_cast<u32>(h);
+    texture.nr = decoded.nr;
+    texture.width = static_cast<u32>(decoded.width);
+    texture.height = static_cast<u32>(decoded.height);
     texture.name = textureName;
 
-    RenderSystem::Instance().CreateTexture(pixels, &texture);
+    RenderSystem::Instance().CreateTexture(decoded.pixels, &texture);
 
-    stbi_image_free(pixels);
+    return texture;
+}
+
+std::optional<Texture> TextureManager::LoadTexture(const std::string &textureName) {
+    auto decoded = DecodeTexture(textureName);
+    if (!decoded.has_value()) {
+        return {};
+    }
+
+    Texture texture = CreateTexture(textureName, *decoded);
+
+    FreeDecodedTexture(*decoded);
 
     return texture;
 }
 
+void TextureManager::Preload(const std::vector<std::string> &names) {
+    XJAR_ZONE("TextureManager::Preload");
+
+    std::vector<std::string> pending;
+    for (const auto &name : names) {
+        if (!m_textures.contains(name) && !m_decoded.contains(name) &&
+            std::find(pending.begin(), pending.end(), name) == pending.end()) {
+            pending.push_back(name);
+        }
+    }
+
+    // stb_image keeps no shared state while decoding, the upload stays on this thread
+    std::vector<std::optional<DecodedTexture>> decoded(pending.size());
+    JobSystem::Instance().ParallelFor(static_cast<u32>(pending.size()), 1, [&](u32 first, u32 count) {
+        for (u32 i = first; i < first + count; i++)
+            decoded[i] = DecodeTexture(pending[i]);
+    });
+
+    for (size_t i = 0; i < pending.size(); i++) {
+        if (decoded[i].has_value()) {
+            m_decoded[pending[i]] = *decoded[i];
+        }
+    }
+}
+
 TextureManager &TextureManager::Instance() {
     static TextureManager manager;
 
@@ -89,6 +138,8 @@ const Texture &TextureManager::GetDefaultTexture() {
 }
 
 const Texture &TextureManager::Acquire(const std::string &name, b32 autorelease) {
+    XJAR_ZONE("TextureManager::Acquire");
+
     if (m_textures.contains(name)) {
         TextureRef &textureRef = m_textures[name];
         ++textureRef.refcount;
@@ -96,7 +147,17 @@ const Texture &TextureManager::Acquire(const std::string &name, b32 autorelease)
         return textureRef.texture;
     }
 
-    auto texture = TextureManager::LoadTexture(name);
+    std::optional<Texture> texture;
+    auto decoded = m_decoded.find(name);
+    if (decoded != m_decoded.end()) {
+        texture = CreateTexture(name, decoded->second);
+
+        FreeDecodedTexture(decoded->second);
+        m_decoded.erase(decoded);
+    } else {
+        texture = TextureManager::LoadTexture(name);
+    }
+
     if (texture.has_value()) {
         TextureRef textureRef {.texture = *texture, .refcount = 0, .autorelease = autorelease};
         m_textures[name] = textureRef;
@@ -126,10 +187,16 @@ void TextureManager::Release(const std::string &name) {
 }
 
 void TextureManager::Shutdown() {
+    for (auto &[key, decoded] : m_decoded) {
+        FreeDecodedTexture(decoded);
+    }
+    m_decoded.clear();
+
     auto &renderSys = RenderSystem::Instance();
     for (auto &[key, textureRef] : m_textures) {
         renderSys.DestroyTexture(&textureRef.texture);
     }
+    m_textures.clear();
 }
 
 }
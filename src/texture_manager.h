@@ -14,6 +14,14 @@ struct TextureRef {
     b32     autorelease;
 };
 
+// pixels decoded off the main thread, waiting for their upload in Acquire
+struct DecodedTexture {
+    u8 *pixels;
+    int width;
+    int height;
+    int nr;
+};
+
 class TextureManager {
 public:
     static TextureManager &Instance();
@@ -23,14 +31,22 @@ public:
     const Texture &GetDefaultTexture();
     const Texture &Acquire(const std::string &name, b32 autorelease = true);
     void           Release(const std::string &name);
+    // decodes the textures that are not loaded yet in parallel, Acquire uploads them
+    void           Preload(const std::vector<std::string> &names);
     static std::optional<Texture> LoadTexture(const std::string &textureName);
+    // decode only, the pixels are released with FreeDecodedTexture
+    static std::optional<DecodedTexture> DecodeTexture(const std::string &textureName);
+    static void                          FreeDecodedTexture(DecodedTexture &decoded);
     TextureManager(const TextureManager &) = delete;
     TextureManager &operator=(const TextureManager &) = delete;
 
 private:
     TextureManager() = default;
 
-    std::unordered_map<std::string, TextureRef> m_textures;
+    static Texture CreateTexture(const std::string &textureName, const DecodedTexture &decoded);
+
+    std::unordered_map<std::string, TextureRef>     m_textures;
+    std::unordered_map<std::string, DecodedTexture> m_decoded;
 };
 
 }
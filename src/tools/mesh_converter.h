@@ -2,18 +2,22 @@
 
 #include "renderer/renderer_types.h"
 #include "material_descr.h"
+#include "mesh_bvh.h"
+#include "profiler.h"
 
 namespace {
 std::vector<xjar::Mesh>          g_meshes;
 std::vector<xjar::MaterialDescr> g_materials;
 std::vector<std::string>         g_matFiles;
+std::vector<xjar::MeshBVH>       g_meshBVHs; // per mesh when g_buildBVH is set
 
-std::vector<u32> g_indexData;
+std::vector<u8>  g_indexData;
 std::vector<f32> g_vertexData;
-u32              g_indexOffset;
+std::vector<f32> g_positionData; // packed positions, appended after the attribute streams
 u32              g_vertexOffset;
 bool             g_exportTexcoords = false;
 bool             g_exportNormals = false;
+bool             g_buildBVH = false;
 u32              g_numElementsToStore = 3; // by default only vertex elements
 
 constexpr char cmdExportTexcoords[] = "-t";
@@ -24,11 +28,79 @@ constexpr char cmdExportNormals[] = "-n";
 void Clear() {
     g_indexData.clear();
     g_vertexData.clear();
+    g_positionData.clear();
     g_meshes.clear();
     g_materials.clear();
     g_matFiles.clear();
-    g_indexOffset = 0;
+    g_meshBVHs.clear();
     g_vertexOffset = 0;
+    // MeshConvert adds the optional streams again, repeated conversions must not accumulate them
+    g_numElementsToStore = 3;
+    g_exportTexcoords = false;
+    g_exportNormals = false;
+    g_buildBVH = false;
+}
+
+// the BVH section goes after the vertex data, readers that stop there still load the file
+void WriteMeshFile(const char *outputMeshFile, const xjar::Mesh *meshes, u32 meshNum) {
+    FILE         *outputMesh = fopen(outputMeshFile, "wb");
+    xjar::MeshHdr hdr = {
+        .magicValue = 0xdeadbeef,
+        .meshNum = meshNum,
+        .dataStartOffset = (u32)(sizeof(xjar::MeshHdr) + meshNum * sizeof(xjar::Mesh)),
+        .indexDataSize = (u32)g_indexData.size(),
+        .vertexDataSize = (u32)(g_vertexData.size() * sizeof(f32))};
+
+    fwrite(&hdr, 1, sizeof(hdr), outputMesh);
+    fwrite(meshes, hdr.meshNum, sizeof(xjar::Mesh), outputMesh);
+    fwrite(g_indexData.data(), 1, hdr.indexDataSize, outputMesh);
+    fwrite(g_vertexData.data(), 1, hdr.vertexDataSize, outputMesh);
+
+    if (g_buildBVH)
+        xjar::WriteMeshBVHs(outputMesh, g_meshBVHs);
+
+    fclose(outputMesh);
+}
+
+// indices are stored relative to the mesh, so u16 is enough for up to 65536 vertices
+inline xjar::IndexFormat ChooseIndexFormat(u32 vertexCount) {
+    return vertexCount <= 65536 ? xjar::INDEX_FORMAT_U16 : xjar::INDEX_FORMAT_U32;
+}
+
+inline void AlignIndexData(u32 alignment) {
+    while (g_indexData.size() % alignment != 0)
+        g_indexData.push_back(0);
+}
+
+// moves the position streams after the attribute streams and rebases their offsets
+void AppendPositionStream() {
+    const u64 positionStreamOffset = g_vertexData.size() * sizeof(f32);
+    for (xjar::Mesh &mesh : g_meshes)
+        mesh.streamOffset[xjar::POSITION_STREAM] += positionStreamOffset;
+
+    g_vertexData.insert(g_vertexData.end(), g_positionData.begin(), g_positionData.end());
+    g_positionData.clear();
+}
+
+// appends the indices in the given format and returns the byte offset they start at
+u32 PushIndices(const u32 *indices, u32 count, xjar::IndexFormat format) {
+    const u32 indexSize = format == xjar::INDEX_FORMAT_U16 ? sizeof(u16) : sizeof(u32);
+    AlignIndexData(indexSize);
+
+    const u32 offset = (u32)g_indexData.size();
+    g_indexData.resize(offset + count * indexSize);
+
+    u8 *dst = g_indexData.data() + offset;
+    for (u32 i = 0; i < count; i++) {
+        if (format == xjar::INDEX_FORMAT_U16) {
+            const u16 index = (u16)indices[i];
+            memcpy(dst + i * sizeof(u16), &index, sizeof(u16));
+        } else {
+            memcpy(dst + i * sizeof(u32), &indices[i], sizeof(u32));
+        }
+    }
+
+    return offset;
 }
 
 inline int AddUnique(std::vector<std::string> &files, const std::string &file) {
@@ -91,10 +163,13 @@ xjar::MaterialDescr ConvertAIMaterial(const aiMaterial *mat, const char *dir) {
 xjar::Mesh ConvertAIMesh(const aiMesh *m) {
     const bool hasTexCoords = m->HasTextureCoords(0);
 
-    const u32 numIndices = m->mNumFaces * 3;
-    const u32 numElements = g_numElementsToStore;
-    const u32 streamElementSize = static_cast<u32>(numElements * sizeof(f32));
-    const u32 meshSize = static_cast<u32>(m->mNumVertices * streamElementSize + numIndices * sizeof(u32));
+    const u32               numIndices = m->mNumFaces * 3;
+    const u32               numElements = g_numElementsToStore;
+    const u32               streamElementSize = static_cast<u32>(numElements * sizeof(f32));
+    const u32               positionSize = static_cast<u32>(3 * sizeof(f32));
+    const xjar::IndexFormat indexFormat = ChooseIndexFormat(m->mNumVertices);
+    const u32               indexSize = indexFormat == xjar::INDEX_FORMAT_U16 ? sizeof(u16) : sizeof(u32);
+    const u32               meshSize = static_cast<u32>(m->mNumVertices * (streamElementSize + positionSize) + numIndices * indexSize);
 
     for (size_t i = 0; i != m->mNumVertices; i++) {
         const aiVector3D &v = m->mVertices[i];
@@ -104,6 +179,10 @@ xjar::Mesh ConvertAIMesh(const aiMesh *m) {
         g_vertexData.push_back(v.y);
         g_vertexData.push_back(v.z);
 
+        g_positionData.push_back(v.x);
+        g_positionData.push_back(v.y);
+        g_positionData.push_back(v.z);
+
         if (g_exportTexcoords) {
             g_vertexData.push_back(t.x);
             g_vertexData.push_back(t.y);
@@ -116,31 +195,47 @@ xjar::Mesh ConvertAIMesh(const aiMesh *m) {
         }
     }
 
+    // indices stay local to the mesh, the vertex offset is applied at draw time
+    std::vector<u32> indices;
+    indices.reserve(numIndices);
+    for (size_t i = 0; i != m->mNumFaces; i++) {
+        const aiFace &face = m->mFaces[i];
+        indices.push_back(face.mIndices[0]);
+        indices.push_back(face.mIndices[1]);
+        indices.push_back(face.mIndices[2]);
+    }
+
+    const u32 indexByteOffset = PushIndices(indices.data(), numIndices, indexFormat);
+
+    if (g_buildBVH) {
+        std::vector<glm::vec3> positions(m->mNumVertices);
+        for (u32 i = 0; i < m->mNumVertices; i++)
+            positions[i] = glm::vec3(m->mVertices[i].x, m->mVertices[i].y, m->mVertices[i].z);
+
+        g_meshBVHs.push_back(xjar::BuildMeshBVH(positions, indices));
+    }
+
     const xjar::Mesh result = {
         .lodNum = 1,
-        .streamNum = 1,
+        .streamNum = 2,
         .materialID = 0,
         .meshSize = meshSize,
         .vertexCount = m->mNumVertices,
-        .indexOffset = g_indexOffset,
+        .indexOffset = indexByteOffset / indexSize,
         .vertexOffset = g_vertexOffset,
-        .lodOffset = {g_indexOffset * sizeof(u32), (g_indexOffset + numIndices) * sizeof(u32)},
-        .streamOffset = {g_vertexOffset * streamElementSize},
-        .streamElementSize = streamElementSize};
+        .lodOffset = {indexByteOffset, indexByteOffset + numIndices * indexSize},
+        .indexFormat = indexFormat,
+        .streamOffset = {g_vertexOffset * streamElementSize, g_vertexOffset * positionSize},
+        .streamElementSize = {streamElementSize, positionSize}};
 
-    for (size_t i = 0; i != m->mNumFaces; i++) {
-        const aiFace &face = m->mFaces[i];
-        g_indexData.push_back(face.mIndices[0] + g_vertexOffset);
-        g_indexData.push_back(face.mIndices[1] + g_vertexOffset);
-        g_indexData.push_back(face.mIndices[2] + g_vertexOffset);
-    }
-    g_indexOffset += numIndices;
     g_vertexOffset += m->mNumVertices;
 
     return result;
 }
 
 void LoadFile(const char *filename, const char *materialDir) {
+    XJAR_ZONE("MeshConverter::LoadFile");
+
     const u32 flags = aiProcess_JoinIdenticalVertices | aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_PreTransformVertices | aiProcess_RemoveRedundantMaterials | aiProcess_FindDegenerates | aiProcess_FindInvalidData | aiProcess_FindInstances | aiProcess_OptimizeMeshes;
 
     Assimp::Importer importer;
@@ -173,8 +268,11 @@ void SaveStringList(FILE *f, const std::vector<std::string> &lines) {
     }
 }
 
-void MeshPack(xjar::Vertex *vertices, int verticesNum, u32 *indices, int indicesNum, int facesNum, const char *outputMeshFile, const char *outputInstanceDataFile, const char *outputMaterialFile, const char *materialFile) {
+void MeshPack(xjar::Vertex *vertices, int verticesNum, u32 *indices, int indicesNum, int facesNum, const char *outputMeshFile, const char *outputInstanceDataFile, const char *outputMaterialFile, const char *materialFile, bool buildBVH = true) {
+    XJAR_ZONE("MeshConverter::MeshPack");
+
     Clear();
+    g_buildBVH = buildBVH;
 
     std::string fullpath = materialFile;
 
@@ -182,10 +280,13 @@ void MeshPack(xjar::Vertex *vertices, int verticesNum, u32 *indices, int indices
     material.albedoColor = gpuvec4(1.0f, 1.0f, 1.0f, 1.0f);
     material.diffuseMap = AddUnique(g_matFiles, fullpath);
 
-    const u32 numIndices = indicesNum;
-    const u32 numElements = g_numElementsToStore + 2 + 3;
-    const u32 streamElementSize = static_cast<u32>(numElements * sizeof(f32));
-    const u32 meshSize = static_cast<u32>(verticesNum * streamElementSize + numIndices * sizeof(u32));
+    const u32               numIndices = indicesNum;
+    const u32               numElements = g_numElementsToStore + 2 + 3;
+    const u32               streamElementSize = static_cast<u32>(numElements * sizeof(f32));
+    const u32               positionSize = static_cast<u32>(3 * sizeof(f32));
+    const xjar::IndexFormat indexFormat = ChooseIndexFormat((u32)verticesNum);
+    const u32               indexSize = indexFormat == xjar::INDEX_FORMAT_U16 ? sizeof(u16) : sizeof(u32);
+    const u32               meshSize = static_cast<u32>(verticesNum * (streamElementSize + positionSize) + numIndices * indexSize);
 
     for (size_t i = 0; i != verticesNum; i++) {
         xjar::Vertex *v = vertices + i;
@@ -199,37 +300,41 @@ void MeshPack(xjar::Vertex *vertices, int verticesNum, u32 *indices, int indices
         g_vertexData.push_back(v->norm.x);
         g_vertexData.push_back(v->norm.y);
         g_vertexData.push_back(v->norm.z);
+
+        g_positionData.push_back(v->pos.x);
+        g_positionData.push_back(v->pos.y);
+        g_positionData.push_back(v->pos.z);
     }
 
-    for (size_t i = 0; i != indicesNum; i++) {
-        u32 *index = indices + i;
-        g_indexData.push_back(*index);
+    PushIndices(indices, numIndices, indexFormat);
+    AlignIndexData(sizeof(u32));
+
+    if (g_buildBVH) {
+        std::vector<glm::vec3> positions(verticesNum);
+        for (int i = 0; i < verticesNum; i++)
+            positions[i] = vertices[i].pos;
+
+        g_meshBVHs.push_back(xjar::BuildMeshBVH(positions, std::span<const u32>(indices, numIndices)));
     }
-    const xjar::Mesh mesh = {
+
+    xjar::Mesh mesh = {
         .lodNum = 1,
-        .streamNum = 1,
+        .streamNum = 2,
         .materialID = 0,
         .meshSize = meshSize,
         .vertexCount = (u32)verticesNum,
         .indexOffset = 0,
         .vertexOffset = 0,
-        .lodOffset = {0, numIndices * sizeof(u32)},
-        .streamOffset = {0},
-        .streamElementSize = streamElementSize};
+        .lodOffset = {0, numIndices * indexSize},
+        .indexFormat = indexFormat,
+        .streamOffset = {0, 0},
+        .streamElementSize = {streamElementSize, positionSize}};
 
-    FILE         *outputMesh = fopen(outputMeshFile, "wb");
-    xjar::MeshHdr hdr = {
-        .magicValue = 0xdeadbeef,
-        .meshNum = 1,
-        .dataStartOffset = (u32)(sizeof(xjar::MeshHdr) + sizeof(xjar::Mesh)),
-        .indexDataSize = (u32)(g_indexData.size() * sizeof(u32)),
-        .vertexDataSize = (u32)(g_vertexData.size() * sizeof(f32))};
+    g_meshes.push_back(mesh);
+    AppendPositionStream();
+    mesh = g_meshes[0];
 
-    fwrite(&hdr, 1, sizeof(hdr), outputMesh);
-    fwrite(&mesh, hdr.meshNum, sizeof(xjar::Mesh), outputMesh);
-    fwrite(g_indexData.data(), 1, hdr.indexDataSize, outputMesh);
-    fwrite(g_vertexData.data(), 1, hdr.vertexDataSize, outputMesh);
-    fclose(outputMesh);
+    WriteMeshFile(outputMeshFile, &mesh, 1);
 
     FILE *outputInstanceData = fopen(outputInstanceDataFile, "wb");
 
@@ -259,8 +364,12 @@ void MeshConvert(const char *inputFile,
                  const char *outputMaterialFile,
                  const char *materialDir,
                  bool        exportTexcoords,
-                 bool        exportNormals) {
+                 bool        exportNormals,
+                 bool        buildBVH = true) {
+    XJAR_ZONE("MeshConverter::MeshConvert");
+
     Clear();
+    g_buildBVH = buildBVH;
 
     if (exportTexcoords) {
         g_numElementsToStore += 2;
@@ -272,20 +381,11 @@ void MeshConvert(const char *inputFile,
     }
 
     LoadFile(inputFile, materialDir);
+    AppendPositionStream();
+    // the index data is read back as u32 words when vertex pulling
+    AlignIndexData(sizeof(u32));
 
-    FILE         *outputMesh = fopen(outputMeshFile, "wb");
-    xjar::MeshHdr hdr = {
-        .magicValue = 0xdeadbeef,
-        .meshNum = (u32)g_meshes.size(),
-        .dataStartOffset = (u32)(sizeof(xjar::MeshHdr) + g_meshes.size() * sizeof(xjar::Mesh)),
-        .indexDataSize = (u32)(g_indexData.size() * sizeof(u32)),
-        .vertexDataSize = (u32)(g_vertexData.size() * sizeof(f32))};
-
-    fwrite(&hdr, 1, sizeof(hdr), outputMesh);
-    fwrite(g_meshes.data(), hdr.meshNum, sizeof(xjar::Mesh), outputMesh);
-    fwrite(g_indexData.data(), 1, hdr.indexDataSize, outputMesh);
-    fwrite(g_vertexData.data(), 1, hdr.vertexDataSize, outputMesh);
-    fclose(outputMesh);
+    WriteMeshFile(outputMeshFile, g_meshes.data(), (u32)g_meshes.size());
 
     FILE *outputInstanceData = fopen(outputInstanceDataFile, "wb");
 
@@ -10,6 +10,7 @@
 
 #define INVALID_TEXTURE 0xffffff
 
+using i8 = int8_t;
 using i16 = int16_t;
 using i32 = int32_t;
 using u8 = uint8_t;
@@ -9,6 +9,11 @@ Window &GetWindow() {
     return g_window;
 }
 
+void InitWindow(u32 width, u32 height, const char *title) {
+    SetWindowParams(width, height, title, nullptr, nullptr);
+    g_window.headless = true;
+}
+
 void SetWindowParams(u32 width, u32 height, const char *title, void *handle, void *nativeHandle) {
     g_window.width = width;
     g_window.height = height;
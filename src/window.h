@@ -15,10 +15,11 @@ struct Window {
     void *       nativeHandle; // used for SDL,GLFW wrappers
     b32          resized = false;
     b32          requestExit = false;
+    b32          headless = false; // no OS window, the renderer draws to offscreen images
 };
 
 Window &GetWindow();
-void    InitWindow(u32 width, u32 height, const char *title);
+void    InitWindow(u32 width, u32 height, const char *title); // headless, there is no window handle
 void    SetWindowParams(u32 width, u32 height, const char *title, void *handle, void *nativeHandle);
 
 }
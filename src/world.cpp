@@ -1,5 +1,7 @@
 #include "pch.h"
 #include "world.h"
+#include "math_simd.h"
+#include "profiler.h"
 
 namespace xjar {
 
@@ -9,24 +11,372 @@ World &World::Instance() {
     return world;
 }
 
-Entity *World::CreateEntity() {
-    Entity *result = nullptr;
-    for (int i = 0; i < MAX_ENTITY_COUNT; i++) {
-        Entity *ent = &entities[i];
-        if (!ent->valid) {
-            ent->valid = true;
+EntityHandle World::CreateEntity() {
+    u32 slot = m_freeSlot;
+    if (slot != INVALID_ENTITY_INDEX) {
+        m_freeSlot = m_slotDense[slot];
+    } else {
+        slot = static_cast<u32>(m_slotGeneration.size());
+        m_slotGeneration.push_back(0);
+        m_slotDense.push_back(0);
+    }
+
+    const EntityHandle entity {.index = slot, .generation = m_slotGeneration[slot]};
+
+    // a new entity is a root at the end, which keeps the order valid
+    m_slotDense[slot] = static_cast<u32>(m_entities.size());
+    m_entities.push_back(entity);
+    m_parents.push_back(EntityHandle {});
+    m_childCounts.push_back(0);
+    m_dirty.push_back(1);
+    m_localTransforms.push_back(glm::mat4(1.0f));
+    m_worldTransforms.push_back(glm::mat4(1.0f));
+    m_normalMatrices.push_back(glm::mat4(1.0f));
+    m_renderables.push_back(Renderable {.model = nullptr});
+    m_bounds.push_back(AABB {.min = glm::vec3(0.0f), .max = glm::vec3(0.0f)});
+    m_cullBounds.Push(m_bounds.back());
+
+    m_anyDirty = true;
+
+    return entity;
+}
+
+void World::MoveEntity(u32 from, u32 to) {
+    m_entities[to] = m_entities[from];
+    m_parents[to] = m_parents[from];
+    m_childCounts[to] = m_childCounts[from];
+    m_dirty[to] = m_dirty[from];
+    m_localTransforms[to] = m_localTransforms[from];
+    m_worldTransforms[to] = m_worldTransforms[from];
+    m_normalMatrices[to] = m_normalMatrices[from];
+    m_renderables[to] = m_renderables[from];
+    m_bounds[to] = m_bounds[from];
+    m_cullBounds.Move(from, to);
+
+    m_slotDense[m_entities[to].index] = to;
+}
+
+void World::PopEntity() {
+    m_entities.pop_back();
+    m_parents.pop_back();
+    m_childCounts.pop_back();
+    m_dirty.pop_back();
+    m_localTransforms.pop_back();
+    m_worldTransforms.pop_back();
+    m_normalMatrices.pop_back();
+    m_renderables.pop_back();
+    m_bounds.pop_back();
+    m_cullBounds.ForEachArray([](std::vector<f32> &values) { values.pop_back(); });
+}
+
+void World::DestroyEntity(EntityHandle entity) {
+    const u32 dense = GetDenseIndex(entity);
+    if (dense == INVALID_ENTITY_INDEX) {
+        fprintf(stderr, "Destroying a stale entity %u:%u\n", entity.index, entity.generation);
+        return;
+    }
 
-            result = ent;
-            return result;
+    // children are only searched for when there are some, they keep the world transform of the last update
+    if (m_childCounts[dense] > 0) {
+        for (size_t i = 0; i < m_entities.size(); i++) {
+            if (m_parents[i] == entity) {
+                m_localTransforms[i] = m_worldTransforms[i];
+                m_parents[i] = EntityHandle {};
+                m_dirty[i] = 1;
+            }
         }
+
+        m_anyDirty = true;
     }
 
-    assert(!"No free entity");
-    return nullptr;
+    const u32 parent = GetDenseIndex(m_parents[dense]);
+    if (parent != INVALID_ENTITY_INDEX)
+        m_childCounts[parent]--;
+
+    if (m_renderables[dense].isStatic)
+        m_staticVersion++;
+
+    const u32 last = static_cast<u32>(m_entities.size() - 1);
+    if (dense != last) {
+        MoveEntity(last, dense);
+
+        // the moved entity may now come before its parent or after its children
+        const u32 movedParent = GetDenseIndex(m_parents[dense]);
+        if (m_childCounts[dense] > 0 || (movedParent != INVALID_ENTITY_INDEX && movedParent > dense))
+            m_orderDirty = true;
+    }
+
+    PopEntity();
+    m_destroyedPending.push_back(entity);
+
+    m_slotGeneration[entity.index]++;
+    m_slotDense[entity.index] = m_freeSlot;
+    m_freeSlot = entity.index;
 }
 
-void World::DestroyEntity(Entity *ent) {
-    memset(ent, 0, sizeof(*ent));
+bool World::IsAlive(EntityHandle entity) const {
+    return GetDenseIndex(entity) != INVALID_ENTITY_INDEX;
+}
+
+u32 World::GetDenseIndex(EntityHandle entity) const {
+    if (entity.index >= m_slotGeneration.size() || m_slotGeneration[entity.index] != entity.generation)
+        return INVALID_ENTITY_INDEX;
+
+    return m_slotDense[entity.index];
+}
+
+void World::Reserve(u32 count) {
+    m_slotGeneration.reserve(count);
+    m_slotDense.reserve(count);
+    m_entities.reserve(count);
+    m_parents.reserve(count);
+    m_childCounts.reserve(count);
+    m_dirty.reserve(count);
+    m_localTransforms.reserve(count);
+    m_worldTransforms.reserve(count);
+    m_normalMatrices.reserve(count);
+    m_renderables.reserve(count);
+    m_bounds.reserve(count);
+    m_cullBounds.ForEachArray([=](std::vector<f32> &values) { values.reserve(count); });
+}
+
+void World::Clear() {
+    // every live slot gets a new generation, so no handle given out so far resolves again
+    for (const EntityHandle &entity : m_entities) {
+        m_destroyedPending.push_back(entity);
+        m_slotGeneration[entity.index]++;
+        m_slotDense[entity.index] = m_freeSlot;
+        m_freeSlot = entity.index;
+    }
+
+    m_entities.clear();
+    m_parents.clear();
+    m_childCounts.clear();
+    m_dirty.clear();
+    m_localTransforms.clear();
+    m_worldTransforms.clear();
+    m_normalMatrices.clear();
+    m_renderables.clear();
+    m_bounds.clear();
+    m_cullBounds.ForEachArray([](std::vector<f32> &values) { values.clear(); });
+
+    m_anyDirty = false;
+    m_orderDirty = false;
+    m_staticVersion++;
+}
+
+void World::SetLocalTransform(EntityHandle entity, const glm::mat4 &transform) {
+    const u32 dense = GetDenseIndex(entity);
+    if (dense == INVALID_ENTITY_INDEX)
+        return;
+
+    m_localTransforms[dense] = transform;
+    m_dirty[dense] = 1;
+    m_anyDirty = true;
+}
+
+void World::SetParent(EntityHandle entity, EntityHandle parent) {
+    const u32 dense = GetDenseIndex(entity);
+    if (dense == INVALID_ENTITY_INDEX)
+        return;
+
+    const u32 parentDense = GetDenseIndex(parent);
+    if (parent.index != INVALID_ENTITY_INDEX && parentDense == INVALID_ENTITY_INDEX) {
+        fprintf(stderr, "Parenting %u:%u to a stale entity\n", entity.index, entity.generation);
+        return;
+    }
+
+    for (u32 node = parentDense; node != INVALID_ENTITY_INDEX; node = GetDenseIndex(m_parents[node])) {
+        if (node == dense) {
+            fprintf(stderr, "Parenting %u:%u to its own descendant\n", entity.index, entity.generation);
+            return;
+        }
+    }
+
+    const u32 oldParent = GetDenseIndex(m_parents[dense]);
+    if (oldParent != INVALID_ENTITY_INDEX)
+        m_childCounts[oldParent]--;
+
+    if (parentDense != INVALID_ENTITY_INDEX) {
+        m_parents[dense] = parent;
+        m_childCounts[parentDense]++;
+
+        if (parentDense > dense)
+            m_orderDirty = true;
+    } else {
+        m_parents[dense] = EntityHandle {};
+    }
+
+    m_dirty[dense] = 1;
+    m_anyDirty = true;
+}
+
+void World::SetModel(EntityHandle entity, const Model *model) {
+    const u32 dense = GetDenseIndex(entity);
+    if (dense == INVALID_ENTITY_INDEX)
+        return;
+
+    m_renderables[dense].model = model;
+    m_dirty[dense] = 1;
+    m_anyDirty = true;
+}
+
+void World::SetStatic(EntityHandle entity, b32 isStatic) {
+    const u32 dense = GetDenseIndex(entity);
+    if (dense == INVALID_ENTITY_INDEX || m_renderables[dense].isStatic == isStatic)
+        return;
+
+    m_renderables[dense].isStatic = isStatic;
+    m_staticVersion++;
+}
+
+EntityHandle World::GetParent(EntityHandle entity) const {
+    const u32 dense = GetDenseIndex(entity);
+
+    return dense != INVALID_ENTITY_INDEX ? m_parents[dense] : EntityHandle {};
+}
+
+const glm::mat4 *World::GetLocalTransform(EntityHandle entity) const {
+    const u32 dense = GetDenseIndex(entity);
+
+    return dense != INVALID_ENTITY_INDEX ? &m_localTransforms[dense] : nullptr;
+}
+
+const glm::mat4 *World::GetTransform(EntityHandle entity) const {
+    const u32 dense = GetDenseIndex(entity);
+
+    return dense != INVALID_ENTITY_INDEX ? &m_worldTransforms[dense] : nullptr;
+}
+
+const AABB *World::GetWorldBounds(EntityHandle entity) const {
+    const u32 dense = GetDenseIndex(entity);
+
+    return dense != INVALID_ENTITY_INDEX ? &m_bounds[dense] : nullptr;
+}
+
+const Renderable *World::GetRenderable(EntityHandle entity) const {
+    const u32 dense = GetDenseIndex(entity);
+
+    return dense != INVALID_ENTITY_INDEX ? &m_renderables[dense] : nullptr;
+}
+
+// stable counting sort by depth, roots first, then every level in the previous order
+void World::SortHierarchy() {
+    XJAR_ZONE("World::SortHierarchy");
+
+    const u32 count = GetEntityCount();
+
+    std::vector<u32> depths(count, INVALID_ENTITY_INDEX);
+    std::vector<u32> chain;
+    u32              maxDepth = 0;
+
+    for (u32 i = 0; i < count; i++) {
+        // walk up to the first entity with a known depth, then number the chain back down
+        u32 node = i;
+        chain.clear();
+        while (depths[node] == INVALID_ENTITY_INDEX) {
+            const u32 parent = GetDenseIndex(m_parents[node]);
+            if (parent == INVALID_ENTITY_INDEX) {
+                depths[node] = 0;
+                break;
+            }
+
+            chain.push_back(node);
+            node = parent;
+        }
+
+        u32 depth = depths[node];
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+            depths[*it] = ++depth;
+
+        maxDepth = std::max(maxDepth, depth);
+    }
+
+    std::vector<u32> levelStart(maxDepth + 2, 0);
+    for (u32 depth : depths)
+        levelStart[depth + 1]++;
+    for (u32 level = 1; level < levelStart.size(); level++)
+        levelStart[level] += levelStart[level - 1];
+
+    std::vector<u32> order(count); // new position to old position
+    for (u32 i = 0; i < count; i++)
+        order[levelStart[depths[i]]++] = i;
+
+    auto permute = [&](auto &values) {
+        std::remove_reference_t<decltype(values)> sorted(count);
+        for (u32 i = 0; i < count; i++)
+            sorted[i] = values[order[i]];
+        values.swap(sorted);
+    };
+
+    permute(m_entities);
+    permute(m_parents);
+    permute(m_childCounts);
+    permute(m_dirty);
+    permute(m_localTransforms);
+    permute(m_worldTransforms);
+    permute(m_normalMatrices);
+    permute(m_renderables);
+    permute(m_bounds);
+    m_cullBounds.ForEachArray(permute);
+
+    for (u32 i = 0; i < count; i++)
+        m_slotDense[m_entities[i].index] = i;
+}
+
+u32 World::UpdateTransforms() {
+    XJAR_ZONE("World::UpdateTransforms");
+
+    m_changed.clear();
+    m_destroyed.swap(m_destroyedPending);
+    m_destroyedPending.clear();
+
+    if (m_orderDirty) {
+        SortHierarchy();
+        m_orderDirty = false;
+    }
+
+    if (!m_anyDirty)
+        return 0;
+
+    // parents come first, so a dirty flag reaches the whole subtree in one pass
+    const u32 count = GetEntityCount();
+    u32       updated = 0;
+
+    for (u32 i = 0; i < count; i++) {
+        const EntityHandle parentHandle = m_parents[i];
+        const u32          parent = parentHandle.index != INVALID_ENTITY_INDEX ? m_slotDense[parentHandle.index] : INVALID_ENTITY_INDEX;
+
+        if (parent != INVALID_ENTITY_INDEX)
+            m_dirty[i] |= m_dirty[parent];
+
+        if (!m_dirty[i])
+            continue;
+
+        if (parent != INVALID_ENTITY_INDEX) {
+            MulMat4(m_worldTransforms[parent], m_localTransforms[i], m_worldTransforms[i]);
+        } else {
+            m_worldTransforms[i] = m_localTransforms[i];
+        }
+
+        m_normalMatrices[i] = NormalMatrix(m_worldTransforms[i]);
+
+        if (const Model *model = m_renderables[i].model) {
+            m_bounds[i] = TransformBounds(model->bounds, m_worldTransforms[i]);
+            m_cullBounds.Set(i, m_bounds[i]);
+        }
+
+        if (m_renderables[i].isStatic)
+            m_staticVersion++;
+
+        m_changed.push_back(m_entities[i]);
+        updated++;
+    }
+
+    std::fill(m_dirty.begin(), m_dirty.end(), 0);
+    m_anyDirty = false;
+
+    return updated;
 }
 
 }
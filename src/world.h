@@ -2,36 +2,142 @@
 
 #include "types.h"
 #include "renderer/renderer_types.h"
+#include "frustum_culling.h"
 
-namespace xjar {
-
-enum class EntityType {
-    Hero = 0 << 1,
-};
+#include <span>
+#include <vector>
 
-struct Entity {
-    EntityType type;
-    b32        valid = false;
-    Model      model;
-};
+namespace xjar {
 
-static constexpr int MAX_ENTITY_COUNT = 1024;
+static constexpr u32 INVALID_ENTITY_INDEX = 0xffffffff;
 
-struct World {
-    Entity entities[MAX_ENTITY_COUNT];
+// a slot index and the generation of the slot when the entity was created, a destroyed entity's handle
+// stops resolving as soon as the slot is reused
+struct EntityHandle {
+    u32 index = INVALID_ENTITY_INDEX;
+    u32 generation = 0;
 
-    Entity *player;
+    bool operator==(const EntityHandle &other) const = default;
+};
 
+// Entities are slots with a generation, the components live in dense parallel arrays so systems walk
+// them linearly. Destroying an entity moves the last one into its place.
+// The dense order is also the transform order, a parent always comes before its children. Whatever
+// breaks that (reparenting, the move on destroy) only flags the order, UpdateTransforms sorts it again.
+class World {
+public:
     static World &Instance();
 
     World(const World &other) = delete;
     World &operator=(const World &other) = delete;
 
-    Entity *CreateEntity();
-    void    DestroyEntity(Entity *ent);
+    EntityHandle CreateEntity();
+    // the children keep their world transform and become roots
+    void         DestroyEntity(EntityHandle entity);
+    bool         IsAlive(EntityHandle entity) const;
+    // position in the dense arrays, INVALID_ENTITY_INDEX if the handle is stale. Valid until the next
+    // DestroyEntity or UpdateTransforms.
+    u32          GetDenseIndex(EntityHandle entity) const;
+    void         Reserve(u32 count);
+    void         Clear();
+
+    u32 GetEntityCount() const {
+        return static_cast<u32>(m_entities.size());
+    }
+
+    // the local transform is relative to the parent, an invalid parent makes the entity a root
+    void         SetLocalTransform(EntityHandle entity, const glm::mat4 &transform);
+    void         SetParent(EntityHandle entity, EntityHandle parent);
+    void         SetModel(EntityHandle entity, const Model *model);
+    // a static entity is not expected to move, what it renders may be cached, see GetStaticVersion
+    void         SetStatic(EntityHandle entity, b32 isStatic);
+    EntityHandle GetParent(EntityHandle entity) const;
+
+    // null if the handle is stale, the world transform is as of the last UpdateTransforms
+    const glm::mat4  *GetLocalTransform(EntityHandle entity) const;
+    const glm::mat4  *GetTransform(EntityHandle entity) const;
+    const AABB       *GetWorldBounds(EntityHandle entity) const;
+    const Renderable *GetRenderable(EntityHandle entity) const;
+
+    // recomputes the world and normal matrices and world bounds of the changed entities and their
+    // subtrees, returns how many were recomputed
+    u32 UpdateTransforms();
+
+    // what the last UpdateTransforms recomputed, new entities included, and what was destroyed before it
+    std::span<const EntityHandle> GetChangedEntities() const {
+        return m_changed;
+    }
+
+    std::span<const EntityHandle> GetDestroyedEntities() const {
+        return m_destroyed;
+    }
+
+    // dense component arrays, index i of each belongs to GetEntities()[i]
+    std::span<const EntityHandle> GetEntities() const {
+        return m_entities;
+    }
+
+    std::span<const glm::mat4> GetTransforms() const {
+        return m_worldTransforms;
+    }
+
+    std::span<const glm::mat4> GetNormalMatrices() const {
+        return m_normalMatrices;
+    }
+
+    std::span<const Renderable> GetRenderables() const {
+        return m_renderables;
+    }
+
+    std::span<const AABB> GetBounds() const {
+        return m_bounds;
+    }
+
+    // changes whenever a static entity is created, destroyed or updated, or an entity becomes (not) static
+    u32 GetStaticVersion() const {
+        return m_staticVersion;
+    }
+
+    // the world bounds again, laid out for CullFrustum
+    const CullBounds &GetCullBounds() const {
+        return m_cullBounds;
+    }
+
+    RenderList GetRenderList() const {
+        return RenderList {.renderables = m_renderables, .bounds = &m_cullBounds, .transforms = m_worldTransforms, .normalMatrices = m_normalMatrices, .staticVersion = m_staticVersion};
+    }
 
 private:
     World() = default;
+
+    void MoveEntity(u32 from, u32 to);
+    void PopEntity();
+    void SortHierarchy();
+
+    // per slot, a free slot links to the next free one through m_slotDense
+    std::vector<u32> m_slotGeneration;
+    std::vector<u32> m_slotDense;
+    u32              m_freeSlot = INVALID_ENTITY_INDEX;
+
+    // per live entity
+    std::vector<EntityHandle> m_entities;
+    std::vector<EntityHandle> m_parents;
+    std::vector<u32>          m_childCounts;
+    std::vector<u8>           m_dirty; // the local transform or model changed since the last update
+    std::vector<glm::mat4>    m_localTransforms;
+    std::vector<glm::mat4>    m_worldTransforms;
+    std::vector<glm::mat4>    m_normalMatrices;
+    std::vector<Renderable>   m_renderables;
+    std::vector<AABB>         m_bounds; // world space
+    CullBounds                m_cullBounds;
+
+    std::vector<EntityHandle> m_changed;
+    std::vector<EntityHandle> m_destroyed;
+    std::vector<EntityHandle> m_destroyedPending; // since the last UpdateTransforms
+
+    b32 m_anyDirty = false;
+    b32 m_orderDirty = false;
+    u32 m_staticVersion = 0;
 };
 
 }